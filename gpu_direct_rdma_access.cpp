@@ -49,12 +49,17 @@
 #include <getopt.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
 
 #include <rdma/rdma_cma.h>
 #include <infiniband/mlx5dv.h>
 
 #include "khash.h"
 #include "ibv_helper.hpp"
+#include "pci_topology.hpp"
 #include "gpu_direct_rdma_access.h"
 
 int debug = 0;
@@ -73,18 +78,26 @@ int debug_fast_path = 0;
 
 #define WR_ID_FLUSH_MARKER UINT64_MAX  
 
+#define CQ_EVENTS_ACK_BATCH 64  /* ibv_ack_cq_events() takes a mutex, ack in batches */
+
+#define DEFAULT_MAX_MSG_SZ  (1U << 30) /* if the port doesn't report it */
+
 #define mmin(a, b)      a < b ? a : b
+#define mmax(a, b)      ((a) > (b) ? (a) : (b))
 
 KHASH_TYPE(kh_ib_ah, struct ibv_ah_attr, struct ibv_ah*);
 
 enum wr_id_flags {
-	WR_ID_FLAGS_ACTIVE = 1 << 0
+	WR_ID_FLAGS_ACTIVE = 1 << 0,
+	WR_ID_FLAGS_STRIPE = 1 << 1, /* a chunk of a striped task, wr_id is the stripe index */
+	WR_ID_FLAGS_SIGNAL = 1 << 2  /* a zero length WR signaling the tasks before it, not reported */
 };
 
 struct wr_id_reported {
     uint64_t 	wr_id;
     uint16_t	num_wrs;
     uint16_t	flags; /* enum wr_id_flags */
+    uint16_t	status; /* of the CQE of this entry, if any */
 };
 
 #ifdef PRINT_LATENCY
@@ -96,6 +109,63 @@ struct wr_latency {
 };
 #endif /*PRINT_LATENCY*/
 
+#define DEFAULT_NUM_DCIS    1
+#define MAX_NUM_DCIS        64
+
+#define MAX_STRIPES             256 /* striped and streamed tasks in flight */
+#define MAX_STRIPE_WRS_PER_DCI  16  /* beyond that the chunks of a task grow */
+#define STREAM_PIECE_WRS        32  /* WRs of a streamed task per signaled piece */
+
+#define MAX_SEND_SGE_LIMIT      64  /* of the sge lists built on the stack, whatever the device supports */
+
+#define MAX_SIGNAL_PERIOD       (SEND_Q_DEPTH / 4)
+
+#define DEFAULT_MAX_INLINE_DATA 256 /* RDMA Writes up to it are copied into the WQE */
+#define NOTIFY_INLINE_SIZE      sizeof(uint64_t) /* RDMA_TASK_ATTR_NOTIFY value */
+
+/* CQE wr_id carries both the DCI index and the index in its app_wr_id table */
+#define DCI_WR_ID(dci_idx, wr_id_idx)   (((uint64_t)(dci_idx) << 32) | (uint32_t)(wr_id_idx))
+#define DCI_WR_ID_DCI(cq_wr_id)         ((int)((cq_wr_id) >> 32))
+#define DCI_WR_ID_IDX(cq_wr_id)         ((int)((cq_wr_id) & 0xffffffff))
+
+/*
+ * DC initiator (server side send queue) with its own wr_id DB and WR
+ * accounting. A device holds a pool of them, tasks are dispatched by
+ * destination hash, so the order of tasks to a specific client is kept.
+ */
+struct rdma_dci {
+    int                     index;
+    struct ibv_qp          *qp;
+    struct ibv_qp_ex       *qpex;
+    struct mlx5dv_qp_ex    *mqpex;
+
+    struct wr_id_reported   app_wr_id[SEND_Q_DEPTH];
+    int                     app_wr_id_idx;
+    int                     qp_available_wr;
+    /* Entries are reported in order, from the oldest one, up to the last CQE */
+    int                     app_wr_id_tail;
+    int                     app_wr_id_done; /* from app_wr_id_tail */
+
+    /* Selective signaling: WRs posted after the last signaled one, and where to signal them */
+    int                     unsignaled_wrs;
+    struct ibv_ah          *signal_ah;
+    uint32_t                signal_dctn;
+    uint32_t                signal_rkey;
+    uint64_t                signal_addr;
+
+    /* rdma_submit_tasks() state, valid while batch_tasks > 0 */
+    int                     batch_tasks;
+    int                     batch_first_wr_id_idx;
+    int                     batch_qp_available_wr;
+    int                     batch_unsignaled_wrs;
+
+    /* Task too long for the send queue, its pieces are posted as it drains */
+    struct rdma_stripe     *stream;
+#ifdef PRINT_LATENCY
+    struct wr_latency       latency[SEND_Q_DEPTH];
+#endif /*PRINT_LATENCY*/
+};
+
 struct rdma_device {
 
     struct rdma_event_channel *cm_channel;
@@ -109,10 +179,28 @@ struct rdma_device {
     struct ibv_cq      *cq;
 #endif
     struct ibv_srq     *srq; /* for DCT (client) only, for DCI (server) this is NULL */
-    struct ibv_qp      *qp;
-    struct ibv_qp_ex       *qpex;  /* DCI (server) only */
-    struct mlx5dv_qp_ex    *mqpex; /* DCI (server) only */
+    struct ibv_qp      *qp;  /* DCT (client) only */
+    struct rdma_dci    *dcis; /* DCI pool (server) only */
+    int                 num_dcis;
+    int                 max_send_sge; /* of the DCIs */
+    int                 max_inline_data; /* of the DCIs for the tasks, 0 - no inline RDMA Writes */
+    /* Tasks posted in pieces: striped over the DCI pool, or streamed (server) */
+    uint32_t            stripe_size;
+    struct rdma_stripe *stripes;
+    struct rdma_stripe *stripe_free;
+    int                 num_streams;
+    int                 signal_period; /* WRs of a DCI per CQE, 1 - every task (server) */
+    int                 completions_pending; /* some DCI has completed entries not reported yet */
+    /* Optional CQ completion events (server) */
+    struct ibv_comp_channel *comp_channel;
+    unsigned int        unacked_cq_events;
     
+    /* Locality of the NIC, from sysfs */
+    int                 numa_node; /* -1 - unknown */
+    cpu_set_t           local_cpus;
+    int                 num_local_cpus; /* 0 - unknown */
+    int                 comp_vector; /* of the CQ */
+
     /* Address handler (port info) relateed fields */
     int                 ib_port;
     int                 is_global;
@@ -120,17 +208,21 @@ struct rdma_device {
     union ibv_gid       gid;
     uint16_t            lid;
     enum ibv_mtu        mtu;
+    uint32_t            max_msg_sz; /* of a WR, larger tasks are split */
 
-    struct wr_id_reported       app_wr_id[SEND_Q_DEPTH];
-    int                 app_wr_id_idx;
-    int                 qp_available_wr;
     int                 rdma_buff_cnt;
+    /* Optional memory registration cache */
+    struct rdma_reg_cache *reg_cache;
+
+    /* Imported remote buffers (slab allocated) */
+    struct rdma_remote_buf_slab *remote_buf_slabs;
+    struct rdma_remote_buffer   *remote_buf_free;
+    int                 remote_buf_cnt;
 
     /* AH hash */
     khash_t(kh_ib_ah)   ah_hash;
 #ifdef PRINT_LATENCY
     uint64_t            hca_core_clock_kHz;
-    struct wr_latency   latency[SEND_Q_DEPTH];
     uint64_t    measure_index;
     uint64_t    wr_complete_latency_sum; /*from wr_start_ts*/
     uint64_t    completion_latency_sum; /*from wr_start_ts*/
@@ -151,16 +243,74 @@ struct rdma_buffer {
     /* MR Related fields */
     struct ibv_mr      *mr;
     uint32_t            rkey;
+    struct rdma_reg_region *region; /* owner of mr, if it came from the registration cache */
+    struct rdma_buffer *parent;     /* owner of mr, if this is a view */
+    int                 view_cnt;
     /* Linked rdma_device */
     struct rdma_device *rdma_dev;
 };
 
+/*
+ * A cached MR: a node of the registration cache interval tree, a treap ordered
+ * by start address and augmented with the maximal end address of the subtree.
+ * A registration is served by any region containing it. On a miss the regions
+ * overlapping or adjacent to it are replaced by one region of their union, so
+ * cached regions overlap only while one of them is in use.
+ */
+struct rdma_reg_region {
+    uintptr_t               start;
+    uintptr_t               end;        /* exclusive */
+    uintptr_t               max_end;    /* of the subtree */
+    unsigned int            prio;
+    struct rdma_reg_region *left;
+    struct rdma_reg_region *right;
+    /* LRU list of the unused cached regions, most recently used first */
+    struct rdma_reg_region *lru_prev;
+    struct rdma_reg_region *lru_next;
+    struct ibv_mr          *mr;
+    int                     refcnt;     /* rdma_buffers using the region */
+    int                     cached;     /* in the tree, can serve registrations */
+};
+
+struct rdma_reg_cache {
+    struct rdma_reg_region *root;
+    struct rdma_reg_region *lru_head;
+    struct rdma_reg_region *lru_tail;
+    size_t                  max_pinned_bytes;   /* 0 - unlimited */
+    size_t                  pinned_bytes;
+    int                     num_regions;
+    uint64_t                hits;
+    uint64_t                misses;
+    uint64_t                evictions;
+};
+
+#define REMOTE_BUF_SLAB_SIZE    1024
+
+struct rdma_remote_buffer {
+    uint64_t            addr;
+    uint64_t            size;
+    uint32_t            rkey;
+    uint32_t            dctn;
+    struct ibv_ah      *ah;
+    struct rdma_dci    *dci;
+    union {
+        struct rdma_device        *rdma_dev;  /* while imported */
+        struct rdma_remote_buffer *next_free; /* while on the device free list */
+    };
+};
+
+struct rdma_remote_buf_slab {
+    struct rdma_remote_buf_slab *next;
+    struct rdma_remote_buffer    entries[REMOTE_BUF_SLAB_SIZE];
+};
+
 struct rdma_exec_params {
 	struct rdma_device 	*device;
+	struct rdma_dci 	*dci;
 	uint64_t 		 wr_id;
 	unsigned long		 rem_buf_rkey;
 	unsigned long long 	 rem_buf_addr;
-	uint32_t 		 rem_buf_size;
+	unsigned long long 	 rem_buf_size;
 	struct ibv_ah 		*ah;
 	unsigned long 		 rem_dctn; /*QP number from DCT (client)*/
 	uint32_t 		 local_buf_mr_lkey;
@@ -168,6 +318,38 @@ struct rdma_exec_params {
 	struct iovec            *local_buf_iovec;
 	int                      local_buf_iovcnt;
 	uint32_t 		 flags; /*enum rdma_task_attr_flags*/
+	/* RDMA_TASK_ATTR_NOTIFY completion slot */
+	struct rdma_remote_buffer *notify_buf;
+	uint64_t                 notify_addr;
+	uint64_t                 notify_value;
+	/* Remote scatter list, from rem_buf_addr */
+	const struct rdma_remote_sge *rem_sgl;
+	int                      rem_sgl_cnt;
+	int                      num_wrs; /* of the data, 0 - not counted yet */
+};
+
+/* Position in the local buffer and the remote range of a task, between the WRs built from it */
+struct rdma_sg_cursor {
+	int                      iov_idx;
+	size_t                   iov_offset;
+	uint64_t                 rem_addr;
+	int                      rem_sge_idx;    /* with a remote scatter list */
+	uint64_t                 rem_sge_offset;
+};
+
+/*
+ * A task posted in several signaled pieces: striped over the DCIs, or streamed
+ * through a send queue too short for it. It's reported once its last piece
+ * completes.
+ */
+struct rdma_stripe {
+    uint64_t                    wr_id;
+    int                         remaining;  /* pieces in flight, +1 while a stream is posted */
+    enum rdma_completion_status status;     /* of the first failed piece */
+    struct rdma_stripe         *next_free;
+    /* The rest of a streamed task */
+    struct rdma_exec_params     params;
+    struct rdma_sg_cursor       cursor;
 };
 
 static inline
@@ -176,6 +358,28 @@ int is_server(struct rdma_device *device)
 	return device->srq == NULL;
 }
 
+/* Release all the stripes, their chunks are flushed or never posted */
+static void rdma_reset_stripes(struct rdma_device *device)
+{
+	int i;
+
+	device->stripe_free = NULL;
+	for (i = MAX_STRIPES - 1; i >= 0; i--) {
+		device->stripes[i].next_free = device->stripe_free;
+		device->stripe_free = &device->stripes[i];
+	}
+}
+
+static inline
+struct ibv_cq *rdma_dev_cq(struct rdma_device *device)
+{
+#ifdef PRINT_LATENCY
+	return ibv_cq_ex_to_cq(device->cq);
+#else /*PRINT_LATENCY*/
+	return device->cq;
+#endif /*PRINT_LATENCY*/
+}
+
 /* use both gid + lid data for key generarion (lid - ib based, gid - RoCE) */
 static inline
 khint32_t kh_ib_ah_hash_func(struct ibv_ah_attr attr)
@@ -194,6 +398,19 @@ int kh_ib_ah_hash_equal(struct ibv_ah_attr a, struct ibv_ah_attr b)
 KHASH_IMPL(kh_ib_ah, struct ibv_ah_attr, struct ibv_ah*, 1,
            kh_ib_ah_hash_func, kh_ib_ah_hash_equal)
 
+/* pick the DCI by destination (dctn + gid), all tasks of one client go to the same DCI */
+static inline
+struct rdma_dci *rdma_select_dci(struct rdma_device *rdma_dev, uint32_t rem_dctn, const union ibv_gid *rem_gid)
+{
+    if (rdma_dev->num_dcis == 1) {
+        return &rdma_dev->dcis[0];
+    }
+    khint32_t hash = kh_int64_hash_func(rem_gid->global.subnet_prefix ^
+                                        rem_gid->global.interface_id  ^
+                                        rem_dctn);
+    return &rdma_dev->dcis[hash % rdma_dev->num_dcis];
+}
+
 
 //============================================================================================
 static struct ibv_context *open_ib_device_by_addr(struct rdma_device *rdma_dev, struct sockaddr *addr)
@@ -297,6 +514,7 @@ static int rdma_set_lid_gid_from_port_info(struct rdma_device *rdma_dev)
 
     rdma_dev->mtu = portinfo.active_mtu;
     rdma_dev->lid = portinfo.lid;
+    rdma_dev->max_msg_sz = portinfo.max_msg_sz ? portinfo.max_msg_sz : DEFAULT_MAX_MSG_SZ;
     if ((portinfo.link_layer != IBV_LINK_LAYER_ETHERNET) && (!portinfo.lid)) {
         fprintf(stderr, "Couldn't get local LID\n");
         return 1;
@@ -335,6 +553,19 @@ static int rdma_set_lid_gid_from_port_info(struct rdma_device *rdma_dev)
     return 0;
 }
 
+/*
+ * NUMA node and local CPUs of the NIC, from sysfs. The application places its
+ * polling threads and buffers by them (see rdma_device_bind_thread()), so the
+ * CQEs, doorbells and DMA don't cross the socket interconnect.
+ */
+static void rdma_set_locality(struct rdma_device *rdma_dev)
+{
+    rdma_dev->numa_node = ibv_query_numa_node(rdma_dev->context);
+    rdma_dev->num_local_cpus = ibv_query_local_cpus(rdma_dev->context, &rdma_dev->local_cpus);
+    DEBUG_LOG ("%s: NUMA node %d, %d local CPUs, %d completion vectors\n", ibv_get_device_name(rdma_dev->context->device),
+               rdma_dev->numa_node, rdma_dev->num_local_cpus, rdma_dev->context->num_comp_vectors);
+}
+
 /****************************************************************************************
  * Modify target QP state to RTR (on the client side)
  * Return value: 0 - success, 1 - error
@@ -377,7 +608,7 @@ static int modify_target_qp_to_rtr(struct rdma_device *rdma_dev)
  * Modify source QP state to RTR and then to RTS (on the server side)
  * Return value: 0 - success, 1 - error
  ****************************************************************************************/
-static int modify_source_qp_to_rtr_and_rts(struct rdma_device *rdma_dev)
+static int modify_source_qp_to_rtr_and_rts(struct rdma_device *rdma_dev, struct rdma_dci *dci)
 {
     struct ibv_qp_attr      qp_attr;
     enum ibv_qp_attr_mask   attr_mask;
@@ -401,12 +632,12 @@ static int modify_source_qp_to_rtr_and_rts(struct rdma_device *rdma_dev)
                 (int)IBV_QP_PATH_MTU);
 
     DEBUG_LOG("ibv_modify_qp(qp = %p, qp_attr.qp_state = %d, attr_mask = 0x%x)\n",
-               rdma_dev->qp, qp_attr.qp_state, attr_mask);
-    if (ibv_modify_qp(rdma_dev->qp, &qp_attr, attr_mask)) {
+               dci->qp, qp_attr.qp_state, attr_mask);
+    if (ibv_modify_qp(dci->qp, &qp_attr, attr_mask)) {
         fprintf(stderr, "Failed to modify QP to RTR\n");
         return 1;
     }
-    DEBUG_LOG ("ibv_modify_qp to state %d completed: qp_num = 0x%x\n", qp_attr.qp_state, rdma_dev->qp->qp_num);
+    DEBUG_LOG ("ibv_modify_qp to state %d completed: qp_num = 0x%x\n", qp_attr.qp_state, dci->qp->qp_num);
 
     /* - - - - - - -  Modify QP to RTS  - - - - - - - */
     qp_attr.qp_state       = IBV_QPS_RTS;
@@ -423,12 +654,12 @@ static int modify_source_qp_to_rtr_and_rts(struct rdma_device *rdma_dev)
                 (int)IBV_QP_SQ_PSN           |
                 (int)IBV_QP_MAX_QP_RD_ATOMIC);
     DEBUG_LOG("ibv_modify_qp(qp = %p, qp_attr.qp_state = %d, attr_mask = 0x%x)\n",
-               rdma_dev->qp, qp_attr.qp_state, attr_mask);
-    if (ibv_modify_qp(rdma_dev->qp, &qp_attr, attr_mask)) {
+               dci->qp, qp_attr.qp_state, attr_mask);
+    if (ibv_modify_qp(dci->qp, &qp_attr, attr_mask)) {
         fprintf(stderr, "Failed to modify QP to RTS\n");
         return 1;
     }
-    DEBUG_LOG ("ibv_modify_qp to state %d completed: qp_num = 0x%x\n", qp_attr.qp_state, rdma_dev->qp->qp_num);
+    DEBUG_LOG ("ibv_modify_qp to state %d completed: qp_num = 0x%x\n", qp_attr.qp_state, dci->qp->qp_num);
     
     return 0;
 }
@@ -446,7 +677,7 @@ static int destroy_qp(struct ibv_qp *qp)
 	return ret;
 }
 
-static int modify_source_qp_rst2rts(struct rdma_device *rdma_dev) 
+static int modify_source_qp_rst2rts(struct rdma_device *rdma_dev, struct rdma_dci *dci) 
 {
     int ret_val;
     /* - - - - - - - - - -  Modify QP to INIT  - - - - - - - - - - - - - */
@@ -461,21 +692,21 @@ static int modify_source_qp_rst2rts(struct rdma_device *rdma_dev)
                                       (int)IBV_QP_PORT       |
                                       (int)0 /*IBV_QP_ACCESS_FLAGS*/); /*we must zero this bit for DCI QP*/
     DEBUG_LOG("ibv_modify_qp(qp = %p, qp_attr.qp_state = %d, attr_mask = 0x%x)\n",
-               rdma_dev->qp, qp_attr.qp_state, attr_mask);
-    ret_val = ibv_modify_qp(rdma_dev->qp, &qp_attr, attr_mask);
+               dci->qp, qp_attr.qp_state, attr_mask);
+    ret_val = ibv_modify_qp(dci->qp, &qp_attr, attr_mask);
     if (ret_val) {
         fprintf(stderr, "Failed to modify QP to INIT, error %d\n", ret_val);
         return 1;
     }
-    DEBUG_LOG("ibv_modify_qp to state %d completed: qp_num = 0x%x\n", qp_attr.qp_state, rdma_dev->qp->qp_num);
+    DEBUG_LOG("ibv_modify_qp to state %d completed: qp_num = 0x%x\n", qp_attr.qp_state, dci->qp->qp_num);
     
     /* - - - - - - - - - - - - -  Modify QP to RTS  - - - - - - - - - - - - */
-    ret_val = modify_source_qp_to_rtr_and_rts(rdma_dev);
+    ret_val = modify_source_qp_to_rtr_and_rts(rdma_dev, dci);
     if (ret_val) {
         return 1;
     }
 
-    rdma_dev->qpex->wr_flags = IBV_SEND_SIGNALED;
+    dci->qpex->wr_flags = IBV_SEND_SIGNALED;
 
     return 0;
 }
@@ -506,6 +737,7 @@ struct rdma_device *rdma_open_device_client(struct sockaddr *addr)
     if (ret_val) {
         goto clean_device;
     }
+    rdma_set_locality(rdma_dev);
 
     /****************************************************************************************************/
     
@@ -669,11 +901,136 @@ clean_rdma_dev:
     return NULL;
 }
 
+/****************************************************************************************
+ * Create a DCI on the device PD and CQ and move it to RTS
+ * Return value: 0 - success, 1 - error
+ ****************************************************************************************/
+static int create_dci(struct rdma_device *rdma_dev, struct rdma_dci *dci)
+{
+    struct ibv_qp_init_attr_ex attr_ex;
+    struct mlx5dv_qp_init_attr attr_dv;
+    int                        ret_val;
+
+    memset(&attr_ex, 0, sizeof(attr_ex));
+    memset(&attr_dv, 0, sizeof(attr_dv));
+
+    attr_ex.qp_type = IBV_QPT_DRIVER;
+#ifdef PRINT_LATENCY
+    attr_ex.send_cq = ibv_cq_ex_to_cq(rdma_dev->cq);
+    attr_ex.recv_cq = ibv_cq_ex_to_cq(rdma_dev->cq);
+#else /*PRINT_LATENCY*/
+    attr_ex.send_cq = rdma_dev->cq;
+    attr_ex.recv_cq = rdma_dev->cq;
+#endif /*PRINT_LATENCY*/
+
+    attr_ex.comp_mask |= IBV_QP_INIT_ATTR_PD;
+    attr_ex.pd = rdma_dev->pd;
+
+    /* create DCI */
+    attr_dv.comp_mask |= MLX5DV_QP_INIT_ATTR_MASK_DC;
+    attr_dv.dc_init_attr.dc_type = MLX5DV_DCTYPE_DCI;
+    
+    attr_ex.cap.max_send_wr  = SEND_Q_DEPTH;
+    attr_ex.cap.max_send_sge = rdma_dev->max_send_sge;
+    attr_ex.cap.max_inline_data = mmax(rdma_dev->max_inline_data, (int)NOTIFY_INLINE_SIZE);
+    dci->qp_available_wr = SEND_Q_DEPTH;
+
+    attr_ex.comp_mask |= IBV_QP_INIT_ATTR_SEND_OPS_FLAGS;
+    attr_ex.send_ops_flags = IBV_QP_EX_WITH_RDMA_WRITE | IBV_QP_EX_WITH_RDMA_READ;
+
+    attr_dv.comp_mask |= MLX5DV_QP_INIT_ATTR_MASK_QP_CREATE_FLAGS;
+    attr_dv.create_flags |= MLX5DV_QP_CREATE_DISABLE_SCATTER_TO_CQE; /*driver doesnt support scatter2cqe data-path on DCI yet*/
+    
+    DEBUG_LOG ("mlx5dv_create_qp(%p)\n", rdma_dev->context);
+    dci->qp = mlx5dv_create_qp(rdma_dev->context, &attr_ex, &attr_dv);
+    while (!dci->qp && (attr_ex.cap.max_inline_data > NOTIFY_INLINE_SIZE || attr_ex.cap.max_send_sge > 1)) {
+        /* The DC address takes room in the WQE, it may hold less inline data or fewer sges than the device reports */
+        if (attr_ex.cap.max_inline_data > NOTIFY_INLINE_SIZE) {
+            attr_ex.cap.max_inline_data = mmax(attr_ex.cap.max_inline_data / 2, (uint32_t)NOTIFY_INLINE_SIZE);
+        } else {
+            attr_ex.cap.max_send_sge /= 2;
+        }
+        DEBUG_LOG ("mlx5dv_create_qp(%p) retry with max_inline_data %u, max_send_sge %u\n", rdma_dev->context,
+                   attr_ex.cap.max_inline_data, attr_ex.cap.max_send_sge);
+        dci->qp = mlx5dv_create_qp(rdma_dev->context, &attr_ex, &attr_dv);
+    }
+    if (!dci->qp)  {
+        fprintf(stderr, "Couldn't create QP\n");
+        return 1;
+    }
+    if ((int)attr_ex.cap.max_send_sge < rdma_dev->max_send_sge) {
+        rdma_dev->max_send_sge = attr_ex.cap.max_send_sge;
+    }
+    if ((int)attr_ex.cap.max_inline_data < rdma_dev->max_inline_data) {
+        rdma_dev->max_inline_data = attr_ex.cap.max_inline_data;
+    }
+    DEBUG_LOG ("mlx5dv_create_qp %p completed: qp_num = 0x%x\n", dci->qp, dci->qp->qp_num);
+    dci->qpex = ibv_qp_to_qp_ex(dci->qp);
+    if (!dci->qpex)  {
+        fprintf(stderr, "Couldn't create QPEX\n");
+        goto clean_dci;
+    }
+    dci->mqpex = mlx5dv_qp_ex_from_ibv_qp_ex(dci->qpex);
+    if (!dci->mqpex)  {
+        fprintf(stderr, "Couldn't create MQPEX\n");
+        goto clean_dci;
+    }
+    ret_val = modify_source_qp_rst2rts(rdma_dev, dci);
+    if (ret_val) {
+        goto clean_dci;
+    }
+
+    return 0;
+
+clean_dci:
+    destroy_qp(dci->qp);
+    dci->qp = NULL;
+    return 1;
+}
+
+struct rdma_device *rdma_open_device_client_near(const char *gpu_bdf)
+{
+    try {
+        gdr::PciTopology topology;
+
+        for (const auto& [nic, path] : topology.nearest_nics(gpu_bdf)) {
+            for (const std::string& netdev : nic->netdevs) {
+                struct sockaddr_storage addr;
+
+                if (!gdr::PciTopology::netdev_addr(netdev, addr)) {
+                    continue;
+                }
+                DEBUG_LOG("GPU %s: nearest RDMA device with an address is %s (%s), path %s, %d hops, %.1f Gb/s%s\n",
+                          gpu_bdf, nic->name.c_str(), netdev.c_str(), gdr::PciTopology::path_name(path.type), path.hops,
+                          path.bandwidth_gbps, path.degraded ? ", degraded link" : "");
+                return rdma_open_device_client((struct sockaddr *)&addr);
+            }
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return NULL;
+    }
+    fprintf(stderr, "No RDMA device with an ip address found for GPU %s\n", gpu_bdf);
+    return NULL;
+}
+
 //============================================================================================
 struct rdma_device *rdma_open_device_server(struct sockaddr *addr)
+{
+    return rdma_open_device_server_ex(addr, NULL);
+}
+
+struct rdma_device *rdma_open_device_server_ex(struct sockaddr *addr, const struct rdma_device_attr *attr)
 {
     struct rdma_device *rdma_dev;
+    struct ibv_device_attr_ex device_attr_ex = {};
     int                 ret_val;
+    int                 num_dcis = (attr && attr->num_dcis > 0) ? attr->num_dcis : DEFAULT_NUM_DCIS;
+
+    if (num_dcis > MAX_NUM_DCIS) {
+        fprintf(stderr, "Number of DCIs %d is greater than max %d\n", num_dcis, MAX_NUM_DCIS);
+        return NULL;
+    }
 
     rdma_dev = (struct rdma_device *)calloc(1, sizeof *rdma_dev);
     if (!rdma_dev) {
@@ -695,6 +1052,7 @@ struct rdma_device *rdma_open_device_server(struct sockaddr *addr)
     if (ret_val) {
         goto clean_device;
     }
+    rdma_set_locality(rdma_dev);
 
     /****************************************************************************************************/
 
@@ -706,103 +1064,119 @@ struct rdma_device *rdma_open_device_server(struct sockaddr *addr)
     }
     DEBUG_LOG("created pd %p\n", rdma_dev->pd);
 
-    /* We don't create completion events channel (ibv_create_comp_channel), we prefer working in polling mode */
+    /* Completion events channel is created on request only, by default we work in polling mode */
+    if (attr && attr->comp_channel) {
+        DEBUG_LOG ("ibv_create_comp_channel(%p)\n", rdma_dev->context);
+        rdma_dev->comp_channel = ibv_create_comp_channel(rdma_dev->context);
+        if (!rdma_dev->comp_channel) {
+            fprintf(stderr, "Couldn't create completion channel\n");
+            goto clean_pd;
+        }
+        /* The fd is polled by the application, events are read without blocking */
+        int flags = fcntl(rdma_dev->comp_channel->fd, F_GETFL);
+        if (flags < 0 || fcntl(rdma_dev->comp_channel->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            fprintf(stderr, "Couldn't set completion channel fd to non-blocking mode\n");
+            goto clean_comp_channel;
+        }
+    }
     
     /* **********************************  Create CQ  ********************************** */
+    /* The workers of an application take different vectors, spreading the CQ interrupts over the cores */
+    if (attr && attr->comp_vector > 0 && rdma_dev->context->num_comp_vectors > 0) {
+        rdma_dev->comp_vector = attr->comp_vector % rdma_dev->context->num_comp_vectors;
+    }
 #ifdef PRINT_LATENCY
 	struct ibv_cq_init_attr_ex cq_attr_ex;
 	
     memset(&cq_attr_ex, 0, sizeof(cq_attr_ex));
-	cq_attr_ex.cqe = CQ_DEPTH;
+	cq_attr_ex.cqe = CQ_DEPTH * num_dcis;
 	cq_attr_ex.cq_context = rdma_dev;
-	cq_attr_ex.channel = NULL;
-	cq_attr_ex.comp_vector = 0;
+	cq_attr_ex.channel = rdma_dev->comp_channel;
+	cq_attr_ex.comp_vector = rdma_dev->comp_vector;
 	cq_attr_ex.wc_flags = IBV_WC_EX_WITH_COMPLETION_TIMESTAMP;
 
     DEBUG_LOG ("ibv_create_cq_ex(rdma_dev->context = %p, &cq_attr_ex)\n", rdma_dev->context);
 	rdma_dev->cq = ibv_create_cq_ex(rdma_dev->context, &cq_attr_ex);
 #else /*PRINT_LATENCY*/
-    DEBUG_LOG ("ibv_create_cq(%p, %d, NULL, NULL, 0)\n", rdma_dev->context, CQ_DEPTH);
-    rdma_dev->cq = ibv_create_cq(rdma_dev->context, CQ_DEPTH, NULL, NULL /*comp. events channel*/, 0);
+    /* All the DCIs share one CQ */
+    DEBUG_LOG ("ibv_create_cq(%p, %d, NULL, %p, %d)\n", rdma_dev->context, CQ_DEPTH * num_dcis, rdma_dev->comp_channel,
+               rdma_dev->comp_vector);
+    rdma_dev->cq = ibv_create_cq(rdma_dev->context, CQ_DEPTH * num_dcis, NULL, rdma_dev->comp_channel, rdma_dev->comp_vector);
 #endif /*PRINT_LATENCY*/
     if (!rdma_dev->cq) {
         fprintf(stderr, "Couldn't create CQ\n");
-        goto clean_pd;
+        goto clean_comp_channel;
     }
     DEBUG_LOG("created cq %p\n", rdma_dev->cq);
 
-    /* We don't create SRQ for DCI (server) side */
-
-    /* **********************************  Create QP  ********************************** */
-    struct ibv_qp_init_attr_ex attr_ex;
-    struct mlx5dv_qp_init_attr attr_dv;
-
-    memset(&attr_ex, 0, sizeof(attr_ex));
-    memset(&attr_dv, 0, sizeof(attr_dv));
-
-    attr_ex.qp_type = IBV_QPT_DRIVER;
-#ifdef PRINT_LATENCY
-    attr_ex.send_cq = ibv_cq_ex_to_cq(rdma_dev->cq);
-    attr_ex.recv_cq = ibv_cq_ex_to_cq(rdma_dev->cq);
-#else /*PRINT_LATENCY*/
-    attr_ex.send_cq = rdma_dev->cq;
-    attr_ex.recv_cq = rdma_dev->cq;
-#endif /*PRINT_LATENCY*/
-
-    attr_ex.comp_mask |= IBV_QP_INIT_ATTR_PD;
-    attr_ex.pd = rdma_dev->pd;
+    if (attr && (attr->cq_moderation_count || attr->cq_moderation_period)) {
+        struct ibv_modify_cq_attr cq_mod_attr;
 
-    /* create DCI */
-    attr_dv.comp_mask |= MLX5DV_QP_INIT_ATTR_MASK_DC;
-    attr_dv.dc_init_attr.dc_type = MLX5DV_DCTYPE_DCI;
-    
-    attr_ex.cap.max_send_wr  = SEND_Q_DEPTH;
-    attr_ex.cap.max_send_sge = MAX_SEND_SGE;
-    rdma_dev->qp_available_wr = SEND_Q_DEPTH;
+        memset(&cq_mod_attr, 0, sizeof cq_mod_attr);
+        cq_mod_attr.attr_mask = IBV_CQ_ATTR_MODERATE;
+        cq_mod_attr.moderate.cq_count  = attr->cq_moderation_count;
+        cq_mod_attr.moderate.cq_period = attr->cq_moderation_period;
+        DEBUG_LOG ("ibv_modify_cq(%p, count %u, period %u usec)\n", rdma_dev->cq,
+                   attr->cq_moderation_count, attr->cq_moderation_period);
+        ret_val = ibv_modify_cq(rdma_dev_cq(rdma_dev), &cq_mod_attr);
+        if (ret_val) {
+            /* Moderation only affects the events rate, keep going without it */
+            fprintf(stderr, "WARN: CQ moderation is not supported by the device (error %d)\n", ret_val);
+        }
+    }
 
-    attr_ex.comp_mask |= IBV_QP_INIT_ATTR_SEND_OPS_FLAGS;
-    attr_ex.send_ops_flags = IBV_QP_EX_WITH_RDMA_WRITE | IBV_QP_EX_WITH_RDMA_READ;
+    /* We don't create SRQ for DCI (server) side */
 
-    attr_dv.comp_mask |= MLX5DV_QP_INIT_ATTR_MASK_QP_CREATE_FLAGS;
-    attr_dv.create_flags |= MLX5DV_QP_CREATE_DISABLE_SCATTER_TO_CQE; /*driver doesnt support scatter2cqe data-path on DCI yet*/
-    
-    DEBUG_LOG ("mlx5dv_create_qp(%p)\n", rdma_dev->context);
-    rdma_dev->qp = mlx5dv_create_qp(rdma_dev->context, &attr_ex, &attr_dv);
-    DEBUG_LOG ("mlx5dv_create_qp %p completed: qp_num = 0x%x\n", rdma_dev->qp, rdma_dev->qp->qp_num);
+    /* A WR of the DCIs gathers up to the SGE limit of the device */
+    ret_val = ibv_query_device_ex(rdma_dev->context, /*struct ibv_query_device_ex_input*/NULL, &device_attr_ex);
+    if (ret_val) {
+        fprintf(stderr, "ibv_query_device_ex failed\n");
+        goto clean_cq;
+    }
+    rdma_dev->max_send_sge = device_attr_ex.orig_attr.max_sge < MAX_SEND_SGE_LIMIT ? device_attr_ex.orig_attr.max_sge
+                                                                                   : MAX_SEND_SGE_LIMIT;
+    /* Small RDMA Writes go inline, as far as the DCIs take it */
+    rdma_dev->max_inline_data = DEFAULT_MAX_INLINE_DATA;
+    if (attr && attr->max_inline_data) {
+        rdma_dev->max_inline_data = attr->max_inline_data < 0 ? 0 : attr->max_inline_data;
+    }
 
-    if (!rdma_dev->qp)  {
-        fprintf(stderr, "Couldn't create QP\n");
+    /* **********************************  Create DCI pool  ********************************** */
+    rdma_dev->dcis = (struct rdma_dci *)calloc(num_dcis, sizeof *rdma_dev->dcis);
+    if (!rdma_dev->dcis) {
+        fprintf(stderr, "DCI pool memory allocation failed\n");
         goto clean_cq;
     }
-    rdma_dev->qpex = ibv_qp_to_qp_ex(rdma_dev->qp);
-    if (!rdma_dev->qpex)  {
-        fprintf(stderr, "Couldn't create QPEX\n");
-        goto clean_qp;
+    for (rdma_dev->num_dcis = 0; rdma_dev->num_dcis < num_dcis; rdma_dev->num_dcis++) {
+        ret_val = create_dci(rdma_dev, &rdma_dev->dcis[rdma_dev->num_dcis]);
+        if (ret_val) {
+            goto clean_qp;
+        }
+        rdma_dev->dcis[rdma_dev->num_dcis].index = rdma_dev->num_dcis;
     }
-    rdma_dev->mqpex = mlx5dv_qp_ex_from_ibv_qp_ex(rdma_dev->qpex);
-    if (!rdma_dev->mqpex)  {
-        fprintf(stderr, "Couldn't create MQPEX\n");
+    DEBUG_LOG("created %d DCIs, %d sges per WR, RDMA Writes up to %d bytes inline\n",
+              rdma_dev->num_dcis, rdma_dev->max_send_sge, rdma_dev->max_inline_data);
+
+    rdma_dev->stripes = (struct rdma_stripe *)calloc(MAX_STRIPES, sizeof *rdma_dev->stripes);
+    if (!rdma_dev->stripes) {
+        fprintf(stderr, "Stripes memory allocation failed\n");
         goto clean_qp;
     }
-    ret_val = modify_source_qp_rst2rts(rdma_dev);
-    if (ret_val) {
-        goto clean_qp;
+    rdma_reset_stripes(rdma_dev);
+    if (attr && attr->stripe_size && num_dcis > 1) {
+        rdma_dev->stripe_size = attr->stripe_size;
+        DEBUG_LOG("striping tasks over %d DCIs in chunks of %u bytes\n", num_dcis, rdma_dev->stripe_size);
+    }
+    rdma_dev->signal_period = 1;
+    if (attr && attr->signal_period > 1) {
+        rdma_dev->signal_period = mmin(attr->signal_period, MAX_SIGNAL_PERIOD);
+        DEBUG_LOG("a CQE every %d WRs of a DCI\n", rdma_dev->signal_period);
     }
 
     DEBUG_LOG("init AH cache\n");
     kh_init_inplace(kh_ib_ah, &rdma_dev->ah_hash);
     
 #ifdef PRINT_LATENCY
-    struct ibv_device_attr_ex           device_attr_ex = {};
-    //struct ibv_query_device_ex_input    query_device_ex_input = {
-    //    .comp_masc = ...
-    //}
-    
-    ret_val = ibv_query_device_ex(rdma_dev->context, /*struct ibv_query_device_ex_input*/NULL, &device_attr_ex);
-    if (ret_val) {
-        fprintf(stderr, "ibv_query_device_ex failed\n");
-        goto clean_qp;
-    }
     if (!device_attr_ex.hca_core_clock) {
         fprintf(stderr, "hca_core_clock = 0\n");
         goto clean_qp;
@@ -819,15 +1193,20 @@ struct rdma_device *rdma_open_device_server(struct sockaddr *addr)
     return rdma_dev;
 
 clean_qp:
-    destroy_qp(rdma_dev->qp);
+    free(rdma_dev->stripes);
+    while (rdma_dev->num_dcis > 0) {
+        destroy_qp(rdma_dev->dcis[--rdma_dev->num_dcis].qp);
+    }
+    free(rdma_dev->dcis);
 
 clean_cq:
     if (rdma_dev->cq) {
-#ifdef PRINT_LATENCY
-        ibv_destroy_cq(ibv_cq_ex_to_cq(rdma_dev->cq));
-#else /*PRINT_LATENCY*/
-        ibv_destroy_cq(rdma_dev->cq);
-#endif /*PRINT_LATENCY*/
+        ibv_destroy_cq(rdma_dev_cq(rdma_dev));
+    }
+
+clean_comp_channel:
+    if (rdma_dev->comp_channel) {
+        ibv_destroy_comp_channel(rdma_dev->comp_channel);
     }
 
 clean_pd:
@@ -845,110 +1224,336 @@ clean_rdma_dev:
 }
 
 //===========================================================================================
+static inline
+int rdma_task_iovcnt(const struct rdma_exec_params *exec_params)
+{
+	return exec_params->local_buf_iovcnt ? exec_params->local_buf_iovcnt : 1;
+}
+
+static inline
+void rdma_sg_cursor_init(struct rdma_sg_cursor *cursor, const struct rdma_exec_params *exec_params)
+{
+	cursor->iov_idx    = 0;
+	cursor->iov_offset = 0;
+	cursor->rem_addr   = exec_params->rem_buf_addr;
+	cursor->rem_sge_idx    = 0;
+	cursor->rem_sge_offset = 0;
+}
+
+static inline
+int rdma_sg_cursor_done(const struct rdma_sg_cursor *cursor, const struct rdma_exec_params *exec_params)
+{
+	return cursor->iov_idx >= rdma_task_iovcnt(exec_params);
+}
+
+/* An RDMA Write WR of length bytes is sent inline */
+static inline
+int rdma_wr_is_inline(const struct rdma_exec_params *exec_params, uint64_t length)
+{
+	return !(exec_params->flags & RDMA_TASK_ATTR_RDMA_READ) && length <= (uint64_t)exec_params->device->max_inline_data;
+}
+
+/*
+ * Walk the local buffer of a task (its gather list, or local_buf_addr for
+ * rem_buf_size bytes) from cursor in up to max_wrs WRs, of up to max_send_sge
+ * sges and max_msg_sz bytes, an sge which doesn't fit is split over the
+ * following WRs. With a remote scatter list, a WR doesn't cross the end of a
+ * remote segment. With post, the WRs are built on the DCI, only the last one
+ * with last_flags. An RDMA Write WR of up to max_inline_data bytes carries its
+ * data inline, so the NIC doesn't read the local buffer.
+ * returns: the number of WRs, cursor is moved past them
+ */
 static
-int rdma_exec_task(struct rdma_exec_params *exec_params) 
+int rdma_task_build_wrs(struct rdma_exec_params *exec_params, struct rdma_sg_cursor *cursor,
+                        int max_wrs, int post, int last_flags)
 {
-	int ret_val;
-	int required_wr = (exec_params->local_buf_iovcnt) ? (exec_params->local_buf_iovcnt + MAX_SEND_SGE - 1) / MAX_SEND_SGE : 1;
-	if (required_wr > exec_params->device->qp_available_wr) {
-		fprintf(stderr, "Required WR number %d is greater than available in QP WRs %d\n", 
-				required_wr, exec_params->device->qp_available_wr);
-		return 1;
-	}
+	struct iovec   local_buf = { exec_params->local_buf_addr, (size_t)exec_params->rem_buf_size };
+	struct iovec  *iov = exec_params->local_buf_iovcnt ? exec_params->local_buf_iovec : &local_buf;
+	int            iovcnt = rdma_task_iovcnt(exec_params);
+	int            max_sge = exec_params->device->max_send_sge;
+	uint64_t       max_msg_sz = exec_params->device->max_msg_sz;
+	int            num_wrs = 0;
 	void (*ibv_wr_rdma_rw_post)(struct ibv_qp_ex *qp, uint32_t rkey, uint64_t remote_addr) = (exec_params->flags & RDMA_TASK_ATTR_RDMA_READ) 
 		? ibv_wr_rdma_read // client wants to send data to the server
 		: ibv_wr_rdma_write; // client wants to receive data from the server
 
-	/* RDMA Read/Write for DCI connect, this will create cqe->ts_start */
-	DEBUG_LOG_FAST_PATH("RDMA Read/Write: ibv_wr_start: qpex = %p\n", exec_params->device->qpex);
-	ibv_wr_start(exec_params->device->qpex);
-#ifdef PRINT_LATENCY
-	struct ibv_values_ex ts_values = {
-		.comp_mask = IBV_VALUES_MASK_RAW_CLOCK,
-		.raw_clock = {} /*struct timespec*/
-	};
-
-	ret_val = ibv_query_rt_values_ex(exec_params->device->context, &ts_values);
-	if (ret_val) {
-		fprintf(stderr, "ibv_query_rt_values_ex failed after ibv_wr_start call\n");
-		return 1;
-	}
-#endif /*PRINT_LATENCY*/
+	while (cursor->iov_idx < iovcnt && num_wrs < max_wrs) {
+		struct ibv_sge sg_list[MAX_SEND_SGE_LIMIT];
+		int            num_sge = 0;
+		uint64_t       wr_length = 0;
+		uint64_t       max_length = max_msg_sz;
 
-	// The following code should be atomic operation
-	int wr_id_idx = exec_params->device->app_wr_id_idx++;
-	if (exec_params->device->app_wr_id_idx >= SEND_Q_DEPTH) {
-		exec_params->device->app_wr_id_idx = 0;
-	}
-	// end of atomic operation
+		if (exec_params->rem_sgl_cnt) {
+			const struct rdma_remote_sge *rem_sge = &exec_params->rem_sgl[cursor->rem_sge_idx];
 
-#ifdef PRINT_LATENCY
-	exec_params->device->latency[wr_id_idx].wr_start_ts = ts_values.raw_clock.tv_nsec; /*the value in hca clocks*/
-#endif /*PRINT_LATENCY*/
+			cursor->rem_addr = exec_params->rem_buf_addr + rem_sge->offset + cursor->rem_sge_offset;
+			if (max_length > rem_sge->length - cursor->rem_sge_offset) {
+				max_length = rem_sge->length - cursor->rem_sge_offset;
+			}
+		}
+		while (cursor->iov_idx < iovcnt && num_sge < max_sge && wr_length < max_length) {
+			uint64_t length = iov[cursor->iov_idx].iov_len - cursor->iov_offset;
 
-	// update internal wr_id DB
-	exec_params->device->qp_available_wr -= required_wr;
-	exec_params->device->app_wr_id[wr_id_idx].num_wrs = required_wr;
-	exec_params->device->app_wr_id[wr_id_idx].wr_id = exec_params->wr_id;
-	exec_params->device->app_wr_id[wr_id_idx].flags = WR_ID_FLAGS_ACTIVE;
-
-	exec_params->device->qpex->wr_id = (uint64_t)wr_id_idx;
-
-	if (exec_params->local_buf_iovcnt) {
-		int i, start_i = 0;
-		struct ibv_sge sg_list[MAX_SEND_SGE];
-	       	uint64_t curr_rem_addr = (uint64_t)exec_params->rem_buf_addr;
-		int num_sges_to_send = exec_params->local_buf_iovcnt;
-
-		while (num_sges_to_send > 0) {
-			int curr_iovcnt = mmin(MAX_SEND_SGE, num_sges_to_send);
-			exec_params->device->qpex->wr_flags = num_sges_to_send > MAX_SEND_SGE ? 0 : IBV_SEND_SIGNALED;
+			if (length > max_length - wr_length) {
+				length = max_length - wr_length;
+			}
+			sg_list[num_sge].addr   = (uintptr_t)iov[cursor->iov_idx].iov_base + cursor->iov_offset;
+			sg_list[num_sge].length = (uint32_t)length;
+			sg_list[num_sge].lkey   = exec_params->local_buf_mr_lkey;
+			num_sge++;
+			wr_length          += length;
+			cursor->iov_offset += length;
+			if (cursor->iov_offset == iov[cursor->iov_idx].iov_len) {
+				cursor->iov_idx++;
+				cursor->iov_offset = 0;
+			}
+		}
+		num_wrs++;
+		if (post) {
+			exec_params->dci->qpex->wr_flags = (cursor->iov_idx < iovcnt && num_wrs < max_wrs) ? 0 : last_flags;
 
 			DEBUG_LOG_FAST_PATH("RDMA Read/Write: ibv_wr_rdma_%s: wr_id=0x%llx, qpex=%p, rkey=0x%lx, remote_buf=0x%llx\n",
 					exec_params->flags & RDMA_TASK_ATTR_RDMA_READ ? "read" : "write",
-					(long long unsigned int)exec_params->wr_id, exec_params->device->qpex, exec_params->rem_buf_rkey, (long long unsigned int)curr_rem_addr);
-			ibv_wr_rdma_rw_post(exec_params->device->qpex, exec_params->rem_buf_rkey, curr_rem_addr);
-		
-			for (i = 0; i < curr_iovcnt; i++) {
-				sg_list[i].addr   = (uint64_t)exec_params->local_buf_iovec[start_i + i].iov_base;
-				sg_list[i].length = (uint32_t)exec_params->local_buf_iovec[start_i + i].iov_len;
-				sg_list[i].lkey   = exec_params->local_buf_mr_lkey;
-				curr_rem_addr += sg_list[i].length;
+					(long long unsigned int)exec_params->wr_id, exec_params->dci->qpex, exec_params->rem_buf_rkey, (long long unsigned int)cursor->rem_addr);
+			ibv_wr_rdma_rw_post(exec_params->dci->qpex, exec_params->rem_buf_rkey, cursor->rem_addr);
+
+			if (rdma_wr_is_inline(exec_params, wr_length)) {
+				struct ibv_data_buf buf_list[MAX_SEND_SGE_LIMIT];
+
+				for (int i = 0; i < num_sge; i++) {
+					buf_list[i].addr   = (void *)(uintptr_t)sg_list[i].addr;
+					buf_list[i].length = sg_list[i].length;
+				}
+				DEBUG_LOG_FAST_PATH("RDMA Write: ibv_wr_set_inline_data_list(qpex=%p, num_buf=%d), length=%llu\n",
+					exec_params->dci->qpex, num_sge, (unsigned long long)wr_length);
+				ibv_wr_set_inline_data_list(exec_params->dci->qpex, (size_t)num_sge, buf_list);
+			} else {
+				DEBUG_LOG_FAST_PATH("RDMA Read/Write: ibv_wr_set_sge_list(qpex=%p, num_sge=%d, sg_list=%p), length=%llu\n",
+					exec_params->dci->qpex, num_sge, (void*)sg_list, (unsigned long long)wr_length);
+				ibv_wr_set_sge_list(exec_params->dci->qpex, (size_t)num_sge, sg_list);
 			}
-		
-			DEBUG_LOG_FAST_PATH("RDMA Read/Write: ibv_wr_set_sge_list(qpex=%p, num_sge=%lu, sg_list=%p), start_i=%d, num_sges_to_send=%d, sg[0].length=%u\n",
-				exec_params->device->qpex, (size_t)curr_iovcnt, (void*)sg_list, start_i, num_sges_to_send, sg_list[0].length);
-			ibv_wr_set_sge_list(exec_params->device->qpex, (size_t)curr_iovcnt, sg_list);
-			num_sges_to_send -= curr_iovcnt;
-			start_i += curr_iovcnt;
-
 
 			DEBUG_LOG_FAST_PATH("RDMA Read/Write: mlx5dv_wr_set_dc_addr: mqpex=%p, ah=%p, rem_dctn=0x%06lx\n",
-				exec_params->device->mqpex, exec_params->ah, exec_params->rem_dctn);
-			mlx5dv_wr_set_dc_addr(exec_params->device->mqpex, exec_params->ah, exec_params->rem_dctn, DC_KEY);
+				exec_params->dci->mqpex, exec_params->ah, exec_params->rem_dctn);
+			mlx5dv_wr_set_dc_addr(exec_params->dci->mqpex, exec_params->ah, exec_params->rem_dctn, DC_KEY);
 		}
-	} else {
-		exec_params->device->qpex->wr_flags = IBV_SEND_SIGNALED;
+		cursor->rem_addr += wr_length;
+		if (exec_params->rem_sgl_cnt) {
+			cursor->rem_sge_offset += wr_length;
+			if (cursor->rem_sge_offset == exec_params->rem_sgl[cursor->rem_sge_idx].length) {
+				cursor->rem_sge_idx++;
+				cursor->rem_sge_offset = 0;
+				if (cursor->rem_sge_idx == exec_params->rem_sgl_cnt) {
+					/* only empty local sges may be left */
+					cursor->iov_idx = iovcnt;
+				}
+			}
+		}
+	}
+	return num_wrs;
+}
+
+/* returns: the number of data WRs of the task, counted once */
+static
+int rdma_task_num_wrs(struct rdma_exec_params *exec_params)
+{
+	struct rdma_sg_cursor cursor;
+
+	if (!exec_params->num_wrs) {
+		if (exec_params->local_buf_iovcnt <= exec_params->device->max_send_sge &&
+		    exec_params->rem_sgl_cnt <= 1 && exec_params->rem_buf_size <= exec_params->device->max_msg_sz) {
+			exec_params->num_wrs = 1;
+		} else {
+			rdma_sg_cursor_init(&cursor, exec_params);
+			exec_params->num_wrs = rdma_task_build_wrs(exec_params, &cursor, INT_MAX, 0, 0);
+		}
+	}
+	return exec_params->num_wrs;
+}
+
+static
+int rdma_notify_buf_check(const struct rdma_exec_params *exec_params)
+{
+	if (!exec_params->notify_buf || exec_params->notify_buf->dci != exec_params->dci) {
+		fprintf(stderr, "Notify buffer %p doesn't belong to the task destination (DCT 0x%06lx)\n",
+				exec_params->notify_buf, exec_params->rem_dctn);
+		return 1;
+	}
+	return 0;
+}
+
+static
+void rdma_notify_post(struct rdma_exec_params *exec_params, int signaled)
+{
+	/* The fence keeps the notify write behind a preceding RDMA Read as well */
+	exec_params->dci->qpex->wr_flags = signaled | IBV_SEND_FENCE | IBV_SEND_INLINE;
+
+	DEBUG_LOG_FAST_PATH("RDMA Notify: ibv_wr_rdma_write: qpex=%p, rkey=0x%x, remote_buf=0x%llx, value=0x%llx\n",
+			exec_params->dci->qpex, exec_params->notify_buf->rkey,
+			(unsigned long long)exec_params->notify_addr, (unsigned long long)exec_params->notify_value);
+	ibv_wr_rdma_write(exec_params->dci->qpex, exec_params->notify_buf->rkey, exec_params->notify_addr);
+	ibv_wr_set_inline_data(exec_params->dci->qpex, &exec_params->notify_value, sizeof(exec_params->notify_value));
+	mlx5dv_wr_set_dc_addr(exec_params->dci->mqpex, exec_params->notify_buf->ah, exec_params->notify_buf->dctn, DC_KEY);
+}
+
+/*
+ * Selective signaling: whether the last WR of a task of num_wrs WRs is
+ * signaled. It is with force, every signal_period WRs of the DCI, when no CQE
+ * is expected on the DCI (an idle DCI then needs no signal WR), and when the
+ * send queue is short of WRs. To be called before the WRs are taken.
+ * returns: IBV_SEND_SIGNALED or 0
+ */
+static inline
+int rdma_dci_signal(const struct rdma_device *device, struct rdma_dci *dci, int num_wrs, int force)
+{
+	if (force || device->signal_period <= 1 ||
+	    dci->unsignaled_wrs + num_wrs >= device->signal_period ||
+	    dci->qp_available_wr + dci->unsignaled_wrs == SEND_Q_DEPTH ||
+	    dci->qp_available_wr - num_wrs <= device->signal_period) {
+		dci->unsignaled_wrs = 0;
+		return IBV_SEND_SIGNALED;
+	}
+	dci->unsignaled_wrs += num_wrs;
+	return 0;
+}
+
+/*
+ * Post a signaled zero length RDMA Write behind the unsignaled WRs of the DCI,
+ * to the destination of the last of them, so their tasks get reported.
+ * Between ibv_wr_start() and ibv_wr_complete() which are issued by the caller.
+ * returns: the internal wr_id index of the WR, or -1 if the QP is out of WRs
+ */
+static
+int rdma_dci_signal_post(struct rdma_dci *dci)
+{
+	int wr_id_idx;
+
+	if (!dci->qp_available_wr) {
+		return -1;
+	}
+	wr_id_idx = dci->app_wr_id_idx++;
+	if (dci->app_wr_id_idx >= SEND_Q_DEPTH) {
+		dci->app_wr_id_idx = 0;
+	}
+	dci->qp_available_wr--;
+	dci->app_wr_id[wr_id_idx].num_wrs = 1;
+	dci->app_wr_id[wr_id_idx].wr_id = 0;
+	dci->app_wr_id[wr_id_idx].flags = WR_ID_FLAGS_ACTIVE | WR_ID_FLAGS_SIGNAL;
+	dci->unsignaled_wrs = 0;
+
+	DEBUG_LOG_FAST_PATH("RDMA Signal: DCI %d, wr_id_idx %d, dctn 0x%06x\n", dci->index, wr_id_idx, dci->signal_dctn);
+	dci->qpex->wr_id = DCI_WR_ID(dci->index, wr_id_idx);
+	dci->qpex->wr_flags = IBV_SEND_SIGNALED;
+	ibv_wr_rdma_write(dci->qpex, dci->signal_rkey, dci->signal_addr);
+	ibv_wr_set_sge_list(dci->qpex, 0, NULL);
+	mlx5dv_wr_set_dc_addr(dci->mqpex, dci->signal_ah, dci->signal_dctn, DC_KEY);
+	return wr_id_idx;
+}
+
+/*
+ * Build the WRs of a single task on the DCI, between ibv_wr_start() and
+ * ibv_wr_complete() which are issued by the caller. The last WR is signaled
+ * with force_signal, otherwise as the signal_period of the device goes.
+ * returns: the internal wr_id index of the task, -EAGAIN if the QP is out of
+ * WRs or busy streaming a task, or -EINVAL on a wrong notify buffer
+ */
+static
+int rdma_exec_task_post(struct rdma_exec_params *exec_params, int force_signal)
+{
+	struct rdma_sg_cursor cursor;
+	struct rdma_dci *dci = exec_params->dci;
+	int required_wr;
+	int signaled;
+	/* the data WRs are unsignaled when a notify WR follows them */
+	int data_signaled;
+
+	if (exec_params->dci->stream) {
+		/* The tasks to the Client wait behind the task streamed on its DCI */
+		DEBUG_LOG_FAST_PATH("DCI %d is busy streaming a task\n", exec_params->dci->index);
+		return -EAGAIN;
+	}
+	required_wr = rdma_task_num_wrs(exec_params);
+	if (exec_params->flags & RDMA_TASK_ATTR_NOTIFY) {
+		if (rdma_notify_buf_check(exec_params)) {
+			return -EINVAL;
+		}
+		required_wr++;
+	}
+	if (required_wr > exec_params->dci->qp_available_wr) {
+		DEBUG_LOG_FAST_PATH("Required WR number %d is greater than available in QP WRs %d\n",
+				required_wr, exec_params->dci->qp_available_wr);
+		return -EAGAIN;
+	}
+	signaled = rdma_dci_signal(exec_params->device, dci, required_wr, force_signal);
+	data_signaled = (exec_params->flags & RDMA_TASK_ATTR_NOTIFY) ? 0 : signaled;
+	if (!signaled) {
+		dci->signal_ah    = exec_params->ah;
+		dci->signal_dctn  = exec_params->rem_dctn;
+		dci->signal_rkey  = exec_params->rem_buf_rkey;
+		dci->signal_addr  = exec_params->rem_buf_addr;
+	}
+
+	// The following code should be atomic operation
+	int wr_id_idx = exec_params->dci->app_wr_id_idx++;
+	if (exec_params->dci->app_wr_id_idx >= SEND_Q_DEPTH) {
+		exec_params->dci->app_wr_id_idx = 0;
+	}
+	// end of atomic operation
+
+	// update internal wr_id DB
+	exec_params->dci->qp_available_wr -= required_wr;
+	exec_params->dci->app_wr_id[wr_id_idx].num_wrs = required_wr;
+	exec_params->dci->app_wr_id[wr_id_idx].wr_id = exec_params->wr_id;
+	exec_params->dci->app_wr_id[wr_id_idx].flags = WR_ID_FLAGS_ACTIVE;
+
+	exec_params->dci->qpex->wr_id = DCI_WR_ID(exec_params->dci->index, wr_id_idx);
+
+	rdma_sg_cursor_init(&cursor, exec_params);
+	rdma_task_build_wrs(exec_params, &cursor, INT_MAX, 1, data_signaled);
+
+	if (exec_params->flags & RDMA_TASK_ATTR_NOTIFY) {
+		rdma_notify_post(exec_params, signaled);
+	}
+
+	return wr_id_idx;
+}
+
+static
+int rdma_exec_task(struct rdma_exec_params *exec_params, int force_signal)
+{
+	int ret_val;
+	int wr_id_idx;
 
-		DEBUG_LOG_FAST_PATH("RDMA Read/Write: ibv_wr_rdma_%s: wr_id=0x%llx, qpex=%p, rkey=0x%lx, remote_buf=0x%llx\n",
-				exec_params->flags & RDMA_TASK_ATTR_RDMA_READ ? "read" : "write",
-				(long long unsigned int)exec_params->wr_id, exec_params->device->qpex, exec_params->rem_buf_rkey, (unsigned long long)exec_params->rem_buf_addr);
+	/* RDMA Read/Write for DCI connect, this will create cqe->ts_start */
+	DEBUG_LOG_FAST_PATH("RDMA Read/Write: ibv_wr_start: qpex = %p\n", exec_params->dci->qpex);
+	ibv_wr_start(exec_params->dci->qpex);
+#ifdef PRINT_LATENCY
+	struct ibv_values_ex ts_values = {
+		.comp_mask = IBV_VALUES_MASK_RAW_CLOCK,
+		.raw_clock = {} /*struct timespec*/
+	};
 
-		ibv_wr_rdma_rw_post(exec_params->device->qpex, exec_params->rem_buf_rkey, exec_params->rem_buf_addr);
-		
-		DEBUG_LOG_FAST_PATH("RDMA Read/Write: ibv_wr_set_sge: qpex=%p, lkey=0x%x, local_buf=0x%llx, size=%u\n",
-				exec_params->device->qpex, exec_params->local_buf_mr_lkey,
-				(unsigned long long)exec_params->local_buf_addr, exec_params->rem_buf_size);
-		ibv_wr_set_sge(exec_params->device->qpex, exec_params->local_buf_mr_lkey, (uintptr_t)exec_params->local_buf_addr, exec_params->rem_buf_size);
+	ret_val = ibv_query_rt_values_ex(exec_params->device->context, &ts_values);
+	if (ret_val) {
+		fprintf(stderr, "ibv_query_rt_values_ex failed after ibv_wr_start call\n");
+		ibv_wr_abort(exec_params->dci->qpex);
+		return 1;
+	}
+#endif /*PRINT_LATENCY*/
 
-		DEBUG_LOG_FAST_PATH("RDMA Read/Write: mlx5dv_wr_set_dc_addr: mqpex=%p, ah=%p, rem_dctn=0x%06lx\n",
-				exec_params->device->mqpex, exec_params->ah, exec_params->rem_dctn);
-		mlx5dv_wr_set_dc_addr(exec_params->device->mqpex, exec_params->ah, exec_params->rem_dctn, DC_KEY);
+	wr_id_idx = rdma_exec_task_post(exec_params, force_signal);
+	if (wr_id_idx < 0) {
+		ibv_wr_abort(exec_params->dci->qpex);
+		return -wr_id_idx;
 	}
 
+#ifdef PRINT_LATENCY
+	exec_params->dci->latency[wr_id_idx].wr_start_ts = ts_values.raw_clock.tv_nsec; /*the value in hca clocks*/
+#endif /*PRINT_LATENCY*/
+
 	/* ring DB */
-	DEBUG_LOG_FAST_PATH("ibv_wr_complete: qpex=%p, required_wr=%d\n", exec_params->device->qpex, required_wr);
-	ret_val = ibv_wr_complete(exec_params->device->qpex);
+	DEBUG_LOG_FAST_PATH("ibv_wr_complete: qpex=%p, wr_id_idx=%d\n", exec_params->dci->qpex, wr_id_idx);
+	ret_val = ibv_wr_complete(exec_params->dci->qpex);
 	if (ret_val) {
 		DEBUG_LOG_FAST_PATH("FAILURE: ibv_wr_complete (error=%d\n", ret_val);
 		return ret_val;
@@ -959,18 +1564,266 @@ int rdma_exec_task(struct rdma_exec_params *exec_params)
 		fprintf(stderr, "ibv_query_rt_values_ex failed after ibv_wr_start call\n");
 		return 1;
 	}
-	exec_params->device->latency[wr_id_idx].wr_complete_ts = ts_values.raw_clock.tv_nsec; /*the value in hca clocks*/
+	exec_params->dci->latency[wr_id_idx].wr_complete_ts = ts_values.raw_clock.tv_nsec; /*the value in hca clocks*/
 #endif /*PRINT_LATENCY*/
 	return ret_val;
 }
-//===========================================================================================
 
-int rdma_reset_device(struct rdma_device *device)
+/* The bytes a contiguous task moves: as an unstriped task, up to the end of the shorter side */
+static inline
+uint64_t rdma_task_contig_size(const struct rdma_exec_params *exec_params)
 {
-	if (!is_server(device)) {
-		fprintf(stderr, "Method \"rdma_reset_device()\" could be executed only by server side!\n");
-		return EOPNOTSUPP;
+	if (exec_params->local_buf_iovcnt && exec_params->local_buf_iovec[0].iov_len < exec_params->rem_buf_size) {
+		return exec_params->local_buf_iovec[0].iov_len;
+	}
+	return exec_params->rem_buf_size;
+}
+
+static inline
+int rdma_task_is_striped(const struct rdma_exec_params *exec_params)
+{
+	const struct rdma_device *device = exec_params->device;
+
+	return (exec_params->flags & RDMA_TASK_ATTR_STRIPE) &&
+	       !(exec_params->flags & RDMA_TASK_ATTR_NOTIFY) && !exec_params->rem_sgl_cnt &&
+	       exec_params->local_buf_iovcnt <= 1 && device->stripe_size && device->stripe_free &&
+	       rdma_task_contig_size(exec_params) > device->stripe_size;
+}
+
+/*
+ * Post a large task in chunks of about stripe_size, round robin over the DCIs
+ * starting at the DCI of its destination. Each chunk is a signaled WR of its own,
+ * rdma_poll_completions() reports the task when the last one completes.
+ * Either all the chunks are posted or none.
+ * returns: 0 on success, EAGAIN if the DCIs are out of WRs or one is busy
+ * streaming a task, or EIO if no doorbell could be rung
+ */
+static
+int rdma_exec_task_striped(struct rdma_exec_params *exec_params)
+{
+	struct rdma_device *device = exec_params->device;
+	struct rdma_stripe *stripe = device->stripe_free;
+	int       num_dcis = device->num_dcis;
+	int       first = exec_params->dci->index;
+	uint64_t  size = rdma_task_contig_size(exec_params);
+	uint64_t  num_chunks = (size + device->stripe_size - 1) / device->stripe_size;
+	uint64_t  chunk_size, offset;
+	uintptr_t local_addr = exec_params->local_buf_iovcnt ? (uintptr_t)exec_params->local_buf_iovec[0].iov_base
+	                                                     : (uintptr_t)exec_params->local_buf_addr;
+	int       i, k, ret_val;
+	void (*ibv_wr_rdma_rw_post)(struct ibv_qp_ex *qp, uint32_t rkey, uint64_t remote_addr) = (exec_params->flags & RDMA_TASK_ATTR_RDMA_READ)
+		? ibv_wr_rdma_read
+		: ibv_wr_rdma_write;
+
+	if (num_chunks > (uint64_t)num_dcis * MAX_STRIPE_WRS_PER_DCI) {
+		/* a chunk is still a single WR, of up to max_msg_sz */
+		num_chunks = (uint64_t)num_dcis * MAX_STRIPE_WRS_PER_DCI;
+		if (num_chunks < (size + device->max_msg_sz - 1) / device->max_msg_sz) {
+			num_chunks = (size + device->max_msg_sz - 1) / device->max_msg_sz;
+		}
+	}
+	chunk_size = (size + num_chunks - 1) / num_chunks;
+	num_chunks = (size + chunk_size - 1) / chunk_size;
+
+	/* Check all the DCIs before starting any of them, a failure leaves them untouched */
+	for (k = 0; k < num_dcis && k < (int)num_chunks; k++) {
+		struct rdma_dci *dci = &device->dcis[(first + k) % num_dcis];
+		int dci_chunks = num_chunks / num_dcis + (k < (int)(num_chunks % num_dcis));
+
+		if (dci->stream) {
+			DEBUG_LOG_FAST_PATH("DCI %d is busy streaming a task\n", dci->index);
+			return EAGAIN;
+		}
+		if (dci_chunks > dci->qp_available_wr) {
+			DEBUG_LOG_FAST_PATH("Required WR number %d is greater than available in QP WRs %d (DCI %d)\n",
+					dci_chunks, dci->qp_available_wr, dci->index);
+			return EAGAIN;
+		}
+	}
+	for (k = 0; k < num_dcis && k < (int)num_chunks; k++) {
+		struct rdma_dci *dci = &device->dcis[(first + k) % num_dcis];
+		int dci_chunks = num_chunks / num_dcis + (k < (int)(num_chunks % num_dcis));
+
+		dci->batch_tasks = dci_chunks;
+		dci->batch_first_wr_id_idx = dci->app_wr_id_idx;
+		dci->batch_qp_available_wr = dci->qp_available_wr;
+		dci->batch_unsignaled_wrs = dci->unsignaled_wrs;
+		dci->unsignaled_wrs = 0; /* the chunks are signaled */
+		ibv_wr_start(dci->qpex);
+	}
+
+	device->stripe_free = stripe->next_free;
+	stripe->wr_id = exec_params->wr_id;
+	stripe->remaining = (int)num_chunks;
+	stripe->status = RDMA_STATUS_SUCCESS;
+
+	for (i = 0, offset = 0; i < (int)num_chunks; i++, offset += chunk_size) {
+		struct rdma_dci *dci = &device->dcis[(first + i) % num_dcis];
+		uint32_t length = (uint32_t)(mmin(chunk_size, size - offset));
+		int wr_id_idx = dci->app_wr_id_idx++;
+
+		if (dci->app_wr_id_idx >= SEND_Q_DEPTH) {
+			dci->app_wr_id_idx = 0;
+		}
+		dci->qp_available_wr--;
+		dci->app_wr_id[wr_id_idx].num_wrs = 1;
+		dci->app_wr_id[wr_id_idx].wr_id = (uint64_t)(stripe - device->stripes);
+		dci->app_wr_id[wr_id_idx].flags = WR_ID_FLAGS_ACTIVE | WR_ID_FLAGS_STRIPE;
+
+		dci->qpex->wr_id = DCI_WR_ID(dci->index, wr_id_idx);
+		dci->qpex->wr_flags = IBV_SEND_SIGNALED;
+		DEBUG_LOG_FAST_PATH("RDMA Read/Write stripe %d: DCI %d, wr_id=0x%llx, remote_buf=0x%llx, size=%u\n",
+				i, dci->index, (long long unsigned int)exec_params->wr_id,
+				(long long unsigned int)(exec_params->rem_buf_addr + offset), length);
+		ibv_wr_rdma_rw_post(dci->qpex, exec_params->rem_buf_rkey, exec_params->rem_buf_addr + offset);
+		ibv_wr_set_sge(dci->qpex, exec_params->local_buf_mr_lkey, local_addr + offset, length);
+		mlx5dv_wr_set_dc_addr(dci->mqpex, exec_params->ah, exec_params->rem_dctn, DC_KEY);
+	}
+
+	/* ring DBs, the chunks of a DCI which failed won't complete, roll them back */
+	for (k = 0; k < num_dcis && k < (int)num_chunks; k++) {
+		struct rdma_dci *dci = &device->dcis[(first + k) % num_dcis];
+
+		ret_val = ibv_wr_complete(dci->qpex);
+		if (ret_val) {
+			DEBUG_LOG_FAST_PATH("FAILURE: ibv_wr_complete of DCI %d (error=%d)\n", dci->index, ret_val);
+			for (i = 0; i < dci->batch_tasks; i++) {
+				dci->app_wr_id[(dci->batch_first_wr_id_idx + i) % SEND_Q_DEPTH].flags = 0;
+			}
+			dci->app_wr_id_idx = dci->batch_first_wr_id_idx;
+			dci->qp_available_wr = dci->batch_qp_available_wr;
+			dci->unsignaled_wrs = dci->batch_unsignaled_wrs;
+			stripe->remaining -= dci->batch_tasks;
+			stripe->status = RDMA_STATUS_ERR_LAST;
+		}
+		dci->batch_tasks = 0;
+	}
+	if (!stripe->remaining) {
+		stripe->next_free = device->stripe_free;
+		device->stripe_free = stripe;
+		return EIO;
+	}
+	return 0;
+}
+
+/*
+ * Post the next pieces of the task streamed on the DCI, as far as its send
+ * queue has room. A piece ends with a signaled WR, the notify WR goes with the
+ * last one. If the doorbell fails nothing is posted, it's retried on the next
+ * completions.
+ */
+static
+void rdma_stream_post(struct rdma_device *device, struct rdma_dci *dci)
+{
+	struct rdma_stripe      *stream = dci->stream;
+	struct rdma_exec_params *exec_params = &stream->params;
+	struct rdma_sg_cursor    start = stream->cursor;
+	int notify = (exec_params->flags & RDMA_TASK_ATTR_NOTIFY) != 0;
+	int first_wr_id_idx = dci->app_wr_id_idx;
+	int available_wr = dci->qp_available_wr;
+	int unsignaled_wrs = dci->unsignaled_wrs;
+	int i, pieces = 0;
+
+	ibv_wr_start(dci->qpex);
+	while (!rdma_sg_cursor_done(&stream->cursor, exec_params)) {
+		int max_wrs = dci->qp_available_wr - notify;
+		int last = 0, num_wrs, wr_id_idx;
+
+		if (max_wrs > STREAM_PIECE_WRS) {
+			max_wrs = STREAM_PIECE_WRS;
+		}
+		if (max_wrs <= 0) {
+			break;
+		}
+		if (notify) {
+			struct rdma_sg_cursor probe = stream->cursor;
+
+			rdma_task_build_wrs(exec_params, &probe, max_wrs, 0, 0);
+			last = rdma_sg_cursor_done(&probe, exec_params);
+		}
+
+		wr_id_idx = dci->app_wr_id_idx++;
+		if (dci->app_wr_id_idx >= SEND_Q_DEPTH) {
+			dci->app_wr_id_idx = 0;
+		}
+		dci->qpex->wr_id = DCI_WR_ID(dci->index, wr_id_idx);
+		num_wrs = rdma_task_build_wrs(exec_params, &stream->cursor, max_wrs, 1, last ? 0 : IBV_SEND_SIGNALED);
+		if (last) {
+			rdma_notify_post(exec_params, IBV_SEND_SIGNALED);
+			num_wrs++;
+		}
+		dci->qp_available_wr -= num_wrs;
+		dci->app_wr_id[wr_id_idx].num_wrs = num_wrs;
+		dci->app_wr_id[wr_id_idx].wr_id = (uint64_t)(stream - device->stripes);
+		dci->app_wr_id[wr_id_idx].flags = WR_ID_FLAGS_ACTIVE | WR_ID_FLAGS_STRIPE;
+		stream->remaining++;
+		pieces++;
+		dci->unsignaled_wrs = 0; /* a piece ends signaled */
+	}
+	if (!pieces) {
+		ibv_wr_abort(dci->qpex);
+		return;
+	}
+
+	DEBUG_LOG_FAST_PATH("ibv_wr_complete: qpex=%p, %d pieces of streamed wr_id 0x%llx\n",
+			dci->qpex, pieces, (long long unsigned int)stream->wr_id);
+	if (ibv_wr_complete(dci->qpex)) {
+		DEBUG_LOG_FAST_PATH("FAILURE: ibv_wr_complete of DCI %d stream\n", dci->index);
+		for (i = 0; i < pieces; i++) {
+			dci->app_wr_id[(first_wr_id_idx + i) % SEND_Q_DEPTH].flags = 0;
+		}
+		dci->app_wr_id_idx = first_wr_id_idx;
+		dci->qp_available_wr = available_wr;
+		dci->unsignaled_wrs = unsignaled_wrs;
+		stream->remaining -= pieces;
+		stream->cursor = start;
+		return;
+	}
+	if (rdma_sg_cursor_done(&stream->cursor, exec_params)) {
+		/* All posted, the pieces in flight hold the task now */
+		dci->stream = NULL;
+		device->num_streams--;
+		stream->remaining--;
+	}
+}
+
+/*
+ * Stream a task which needs more WRs than the send queue of its DCI holds,
+ * see rdma_stream_post()
+ * returns: 0 on success, EAGAIN if the DCI is already streaming or out of
+ * stripes, or EINVAL on a wrong notify buffer
+ */
+static
+int rdma_exec_task_stream(struct rdma_exec_params *exec_params)
+{
+	struct rdma_device *device = exec_params->device;
+	struct rdma_dci    *dci = exec_params->dci;
+	struct rdma_stripe *stream = device->stripe_free;
+
+	if (dci->stream || !stream) {
+		return EAGAIN;
 	}
+	if ((exec_params->flags & RDMA_TASK_ATTR_NOTIFY) && rdma_notify_buf_check(exec_params)) {
+		return EINVAL;
+	}
+	DEBUG_LOG_FAST_PATH("Streaming wr_id 0x%llx, %d WRs, on DCI %d\n",
+			(long long unsigned int)exec_params->wr_id, exec_params->num_wrs, dci->index);
+	device->stripe_free = stream->next_free;
+	stream->wr_id = exec_params->wr_id;
+	stream->remaining = 1; /* until the last piece is posted */
+	stream->status = RDMA_STATUS_SUCCESS;
+	stream->params = *exec_params;
+	rdma_sg_cursor_init(&stream->cursor, exec_params);
+	dci->stream = stream;
+	device->num_streams++;
+
+	rdma_stream_post(device, dci);
+	return 0;
+}
+//===========================================================================================
+
+static int rdma_reset_dci(struct rdma_device *device, struct rdma_dci *dci)
+{
 	struct ibv_qp_attr      qp_attr;
 	enum ibv_qp_attr_mask   attr_mask;
 	memset(&qp_attr, 0, sizeof qp_attr);
@@ -979,12 +1832,18 @@ int rdma_reset_device(struct rdma_device *device)
 	qp_attr.qp_state = IBV_QPS_ERR;
 	attr_mask = IBV_QP_STATE;
 	DEBUG_LOG("ibv_modify_qp(qp = %p, qp_attr.qp_state = %d, attr_mask = 0x%x)\n",
-                      device->qp, qp_attr.qp_state, attr_mask);
-	if (ibv_modify_qp(device->qp, &qp_attr, attr_mask)) {
+                      dci->qp, qp_attr.qp_state, attr_mask);
+	if (ibv_modify_qp(dci->qp, &qp_attr, attr_mask)) {
 		fprintf(stderr, "Failed to modify QP to ERR\n");
 		return 1;
 	}
 	
+	/* The rest of a streamed task is dropped with the flushed pieces */
+	if (dci->stream) {
+		dci->stream = NULL;
+		device->num_streams--;
+	}
+
 	/* - - - - - - - FLUSH WORK COMPLETIONS - - - - - - - */
 	struct rdma_exec_params exec_params;
 	memset(&exec_params, 0, sizeof exec_params);
@@ -997,9 +1856,10 @@ int rdma_reset_device(struct rdma_device *device)
 	if (exec_params.ah) {
 		exec_params.wr_id = WR_ID_FLUSH_MARKER;
 		exec_params.device = device;
+		exec_params.dci = dci;
 
-		DEBUG_LOG_FAST_PATH("Posting FLUSH MARKER on queue\n");
-		rdma_exec_task(&exec_params);
+		DEBUG_LOG_FAST_PATH("Posting FLUSH MARKER on DCI %d queue\n", dci->index);
+		rdma_exec_task(&exec_params, 1);
 
 		DEBUG_LOG_FAST_PATH("Flushing Work Completions\n");
 		struct rdma_completion_event rdma_comp_ev[COMP_ARRAY_SIZE];
@@ -1014,84 +1874,538 @@ int rdma_reset_device(struct rdma_device *device)
 		DEBUG_LOG_FAST_PATH("Finished Work Completions flushing\n");
 	}
 
-	/* - - - - - - - RESET RDMA_DEVICE MEMBERS - - - - - - - */
-	memset(device->app_wr_id, 0, sizeof(device->app_wr_id));
-	device->app_wr_id_idx = 0;
-	device->qp_available_wr = SEND_Q_DEPTH;
+	/* - - - - - - - RESET DCI MEMBERS - - - - - - - */
+	memset(dci->app_wr_id, 0, sizeof(dci->app_wr_id));
+	dci->app_wr_id_idx = 0;
+	dci->qp_available_wr = SEND_Q_DEPTH;
+	dci->app_wr_id_tail = 0;
+	dci->app_wr_id_done = 0;
+	dci->unsignaled_wrs = 0;
 	/* - - - - - - - Modify QP to RESET - - - - - - - */
 	qp_attr.qp_state = IBV_QPS_RESET;
 	attr_mask = IBV_QP_STATE;
 	DEBUG_LOG("ibv_modify_qp(qp = %p, qp_attr.qp_state = %d, attr_mask = 0x%x)\n",
-                    device->qp, qp_attr.qp_state, attr_mask);
-	if (ibv_modify_qp(device->qp, &qp_attr, attr_mask)) {
+                    dci->qp, qp_attr.qp_state, attr_mask);
+	if (ibv_modify_qp(dci->qp, &qp_attr, attr_mask)) {
 		fprintf(stderr, "Failed to modify QP to RESET\n");
 		return 1;
 	}
-	DEBUG_LOG ("ibv_modify_qp to state %d completed, qp_num=%u.\n", qp_attr.qp_state, device->qp->qp_num);
+	DEBUG_LOG ("ibv_modify_qp to state %d completed, qp_num=%u.\n", qp_attr.qp_state, dci->qp->qp_num);
 
 	/* - - - - - - - Modify QP to RTS (RESET->INIT->RTR->RTS) - - - - - - - */
-	return modify_source_qp_rst2rts(device);
+	return modify_source_qp_rst2rts(device, dci);
+}
+
+int rdma_device_get_caps(struct rdma_device *device, struct rdma_device_caps *caps)
+{
+	struct ibv_device_attr device_attr;
+	int ret_val;
+
+	ret_val = ibv_query_device(device->context, &device_attr);
+	if (ret_val) {
+		fprintf(stderr, "ibv_query_device failed, error %d\n", ret_val);
+		return ret_val;
+	}
+	memset(caps, 0, sizeof *caps);
+	caps->max_mr_size = device_attr.max_mr_size;
+	caps->max_msg_size = device->max_msg_sz;
+	caps->max_send_sge = device->max_send_sge ? device->max_send_sge : device_attr.max_sge;
+	caps->max_inline_data = device->max_inline_data;
+	caps->numa_node = device->numa_node;
+	caps->num_local_cpus = device->num_local_cpus;
+	caps->num_comp_vectors = device->context->num_comp_vectors;
+	caps->comp_vector = device->comp_vector;
+	return 0;
+}
+
+int rdma_device_bind_thread(struct rdma_device *device, int cpu_index)
+{
+	cpu_set_t cpus;
+	int cpu, n;
+
+	if (!device->num_local_cpus) {
+		return ENOENT;
+	}
+	if (cpu_index < 0) {
+		cpus = device->local_cpus;
+	} else {
+		/* The (cpu_index % num_local_cpus)-th CPU of the local set */
+		n = cpu_index % device->num_local_cpus;
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &device->local_cpus) && !n--) {
+				break;
+			}
+		}
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+	}
+	if (sched_setaffinity(0, sizeof cpus, &cpus)) {
+		return errno;
+	}
+	DEBUG_LOG("bound thread to %d CPU(s) local to the device, NUMA node %d\n", CPU_COUNT(&cpus), device->numa_node);
+	return 0;
+}
+
+int rdma_reset_device(struct rdma_device *device)
+{
+	int i, ret_val;
+
+	if (!is_server(device)) {
+		fprintf(stderr, "Method \"rdma_reset_device()\" could be executed only by server side!\n");
+		return EOPNOTSUPP;
+	}
+	for (i = 0; i < device->num_dcis; i++) {
+		ret_val = rdma_reset_dci(device, &device->dcis[i]);
+		if (ret_val) {
+			return ret_val;
+		}
+	}
+	if (device->stripes) {
+		rdma_reset_stripes(device);
+	}
+	return 0;
 }
 
 //============================================================================================
-void rdma_close_device(struct rdma_device *rdma_dev)
+/* Memory registration cache */
+
+static enum ibv_access_flags rdma_buffer_access_flags(void)
 {
-    int ret_val;
-    struct ibv_ah *ah;
+    return (enum ibv_access_flags)(
+        (int)IBV_ACCESS_LOCAL_WRITE |
+        (int)IBV_ACCESS_REMOTE_READ |
+        (int)IBV_ACCESS_REMOTE_WRITE);
+}
 
-    if (rdma_dev->rdma_buff_cnt > 0) {
-        fprintf(stderr, "The number of attached RDMA buffers is not zero (%d). Can't close device.\n",
-                rdma_dev->rdma_buff_cnt);
-        return;
+static void reg_region_update(struct rdma_reg_region *region)
+{
+    region->max_end = region->end;
+    if (region->left && region->left->max_end > region->max_end) {
+        region->max_end = region->left->max_end;
     }
-#ifdef PRINT_LATENCY
-    if (rdma_dev->measure_index) {
-        DEBUG_LOG("PRINT_LATENCY: %6lu wr-s, wr_sent latency: min %8lu, max %8lu, avg %8lu (nSec)\n",
-                  rdma_dev->measure_index,
-                  rdma_dev->min_wr_complete_latency * 1000000 / rdma_dev->hca_core_clock_kHz,
-                  rdma_dev->max_wr_complete_latency * 1000000 / rdma_dev->hca_core_clock_kHz,
-                  rdma_dev->wr_complete_latency_sum / rdma_dev->measure_index * 1000000 / rdma_dev->hca_core_clock_kHz);
+    if (region->right && region->right->max_end > region->max_end) {
+        region->max_end = region->right->max_end;
+    }
+}
 
-        DEBUG_LOG("PRINT_LATENCY:   completion latency        : min %8lu, max %8lu, avg %8lu (nSec)\n",
-                  rdma_dev->min_completion_latency * 1000000 / rdma_dev->hca_core_clock_kHz,
-                  rdma_dev->max_completion_latency * 1000000 / rdma_dev->hca_core_clock_kHz,
-                  rdma_dev->completion_latency_sum / rdma_dev->measure_index * 1000000 / rdma_dev->hca_core_clock_kHz);
+static int reg_region_less(const struct rdma_reg_region *a, const struct rdma_reg_region *b)
+{
+    return a->start < b->start || (a->start == b->start && a < b);
+}
 
-        DEBUG_LOG("PRINT_LATENCY:   read_comp latency         : min %8lu, max %8lu, avg %8lu (nSec)\n",
-                  rdma_dev->min_read_comp_latency * 1000000 / rdma_dev->hca_core_clock_kHz,
-                  rdma_dev->max_read_comp_latency * 1000000 / rdma_dev->hca_core_clock_kHz,
-                  rdma_dev->read_comp_latency_sum / rdma_dev->measure_index * 1000000 / rdma_dev->hca_core_clock_kHz);
+/* Split the tree into the regions ordered before key and the rest (key included) */
+static void reg_tree_split(struct rdma_reg_region *root, struct rdma_reg_region *key,
+                           struct rdma_reg_region **left, struct rdma_reg_region **right)
+{
+    if (!root) {
+        *left = *right = NULL;
+    } else if (reg_region_less(root, key)) {
+        reg_tree_split(root->right, key, &root->right, right);
+        *left = root;
+        reg_region_update(root);
+    } else {
+        reg_tree_split(root->left, key, left, &root->left);
+        *right = root;
+        reg_region_update(root);
+    }
+}
 
-        fflush(stdout);
+/* Merge two trees, all the regions of left are ordered before the regions of right */
+static struct rdma_reg_region *reg_tree_merge(struct rdma_reg_region *left, struct rdma_reg_region *right)
+{
+    if (!left || !right) {
+        return left ? left : right;
     }
-#endif /*PRINT_LATENCY*/
-    ret_val = destroy_qp(rdma_dev->qp);
-    if (ret_val) {
-        return;
+    if (left->prio > right->prio) {
+        left->right = reg_tree_merge(left->right, right);
+        reg_region_update(left);
+        return left;
     }
+    right->left = reg_tree_merge(left, right->left);
+    reg_region_update(right);
+    return right;
+}
 
-    if (rdma_dev->srq) {
-        DEBUG_LOG("ibv_destroy_srq(%p)\n", rdma_dev->srq);
-        ret_val = ibv_destroy_srq(rdma_dev->srq);
-        if (ret_val) {
-            fprintf(stderr, "Couldn't destroy SRQ\n");
-            return;
-        }
+static void reg_tree_insert(struct rdma_reg_cache *cache, struct rdma_reg_region *region)
+{
+    struct rdma_reg_region *left, *right;
+
+    region->left = region->right = NULL;
+    region->prio = (unsigned int)rand();
+    reg_region_update(region);
+    reg_tree_split(cache->root, region, &left, &right);
+    cache->root = reg_tree_merge(reg_tree_merge(left, region), right);
+}
+
+static struct rdma_reg_region *reg_tree_remove(struct rdma_reg_region *root, struct rdma_reg_region *region)
+{
+    if (root == region) {
+        return reg_tree_merge(root->left, root->right);
     }
-    
-    DEBUG_LOG("ibv_destroy_cq(%p)\n", rdma_dev->cq);
-#ifdef PRINT_LATENCY
-    ibv_destroy_cq(ibv_cq_ex_to_cq(rdma_dev->cq));
-#else /*PRINT_LATENCY*/
-    ibv_destroy_cq(rdma_dev->cq);
-#endif /*PRINT_LATENCY*/
-    if (ret_val) {
-        fprintf(stderr, "Couldn't destroy CQ, error %d\n", ret_val);
-        return;
+    if (reg_region_less(region, root)) {
+        root->left = reg_tree_remove(root->left, region);
+    } else {
+        root->right = reg_tree_remove(root->right, region);
     }
+    reg_region_update(root);
+    return root;
+}
 
-    DEBUG_LOG("destroy ibv_ah's\n");
-    kh_foreach_value(&rdma_dev->ah_hash, ah, ibv_destroy_ah(ah));
+/* Find a region containing [start, end) */
+static struct rdma_reg_region *reg_tree_find_containing(struct rdma_reg_region *root, uintptr_t start, uintptr_t end)
+{
+    struct rdma_reg_region *found;
+
+    if (!root || root->max_end < end) {
+        return NULL;
+    }
+    found = reg_tree_find_containing(root->left, start, end);
+    if (found) {
+        return found;
+    }
+    if (root->start > start) {
+        return NULL; /* the right subtree starts even later */
+    }
+    if (root->end >= end) {
+        return root;
+    }
+    return reg_tree_find_containing(root->right, start, end);
+}
+
+/* Find a region overlapping [start, end) */
+static struct rdma_reg_region *reg_tree_find_overlapping(struct rdma_reg_region *root, uintptr_t start, uintptr_t end)
+{
+    struct rdma_reg_region *found;
+
+    if (!root || root->max_end <= start) {
+        return NULL;
+    }
+    found = reg_tree_find_overlapping(root->left, start, end);
+    if (found) {
+        return found;
+    }
+    if (root->start >= end) {
+        return NULL;
+    }
+    if (root->end > start) {
+        return root;
+    }
+    return reg_tree_find_overlapping(root->right, start, end);
+}
+
+static void reg_lru_remove(struct rdma_reg_cache *cache, struct rdma_reg_region *region)
+{
+    if (region->lru_prev) {
+        region->lru_prev->lru_next = region->lru_next;
+    } else {
+        cache->lru_head = region->lru_next;
+    }
+    if (region->lru_next) {
+        region->lru_next->lru_prev = region->lru_prev;
+    } else {
+        cache->lru_tail = region->lru_prev;
+    }
+    region->lru_prev = region->lru_next = NULL;
+}
+
+static void reg_lru_push(struct rdma_reg_cache *cache, struct rdma_reg_region *region)
+{
+    region->lru_prev = NULL;
+    region->lru_next = cache->lru_head;
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = region;
+    } else {
+        cache->lru_tail = region;
+    }
+    cache->lru_head = region;
+}
+
+static void reg_region_destroy(struct rdma_reg_cache *cache, struct rdma_reg_region *region)
+{
+    int ret_val;
+
+    DEBUG_LOG("ibv_dereg_mr(%p) of cached region [0x%lx, 0x%lx)\n",
+              region->mr, (unsigned long)region->start, (unsigned long)region->end);
+    ret_val = ibv_dereg_mr(region->mr);
+    if (ret_val) {
+        fprintf(stderr, "Couldn't deregister cached MR, error %d\n", ret_val);
+    }
+    cache->pinned_bytes -= region->end - region->start;
+    cache->num_regions--;
+    free(region);
+}
+
+/* Stop serving registrations from the region, it's destroyed now or by its last user */
+static void reg_region_uncache(struct rdma_reg_cache *cache, struct rdma_reg_region *region)
+{
+    cache->root = reg_tree_remove(cache->root, region);
+    region->cached = 0;
+    if (!region->refcnt) {
+        reg_lru_remove(cache, region);
+        reg_region_destroy(cache, region);
+    }
+}
+
+/* Put the regions taken out by reg_cache_get() back in the cache */
+static void reg_cache_restore(struct rdma_reg_cache *cache, struct rdma_reg_region *covered)
+{
+    struct rdma_reg_region *region;
+
+    while ((region = covered)) {
+        covered = region->left;
+        reg_tree_insert(cache, region);
+        if (!region->refcnt) {
+            reg_lru_push(cache, region);
+        }
+    }
+}
+
+static struct rdma_reg_region *reg_cache_get(struct rdma_device *rdma_dev, void *addr, size_t length)
+{
+    struct rdma_reg_cache *cache = rdma_dev->reg_cache;
+    struct rdma_reg_region *region, *covered = NULL;
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end = start + length;
+    size_t    idle_bytes = 0;
+
+    region = reg_tree_find_containing(cache->root, start, end);
+    if (region) {
+        if (!region->refcnt) {
+            reg_lru_remove(cache, region);
+        }
+        region->refcnt++;
+        cache->hits++;
+        DEBUG_LOG("registration cache hit: buf %p, size = %lu, region [0x%lx, 0x%lx)\n",
+                  addr, length, (unsigned long)region->start, (unsigned long)region->end);
+        return region;
+    }
+    cache->misses++;
+
+    /*
+     * The regions overlapping or adjacent to the range are taken out of the cache
+     * (linked by their left pointer), the new region covers their union. Their idle
+     * MRs are deregistered once it is registered, the ones in use by their last user.
+     */
+    while ((region = reg_tree_find_overlapping(cache->root, start ? start - 1 : 0, end + 1))) {
+        cache->root = reg_tree_remove(cache->root, region);
+        if (!region->refcnt) {
+            reg_lru_remove(cache, region);
+            idle_bytes += region->end - region->start;
+        }
+        start = mmin(start, region->start);
+        end = mmax(end, region->end);
+        region->left = covered;
+        covered = region;
+    }
+    length = end - start;
+
+    while (cache->max_pinned_bytes && cache->pinned_bytes - idle_bytes + length > cache->max_pinned_bytes && cache->lru_tail) {
+        cache->evictions++;
+        reg_region_uncache(cache, cache->lru_tail);
+    }
+    if (cache->max_pinned_bytes && cache->pinned_bytes - idle_bytes + length > cache->max_pinned_bytes) {
+        fprintf(stderr, "Registration of %lu bytes exceeds the registration cache limit (%lu of %lu bytes pinned in use)\n",
+                length, cache->pinned_bytes, cache->max_pinned_bytes);
+        reg_cache_restore(cache, covered);
+        return NULL;
+    }
+
+    region = (struct rdma_reg_region *)calloc(1, sizeof *region);
+    if (!region) {
+        fprintf(stderr, "rdma_reg_region memory allocation failed\n");
+        reg_cache_restore(cache, covered);
+        return NULL;
+    }
+    DEBUG_LOG("ibv_reg_mr(pd %p, buf %p, size = %lu) for the registration cache\n",
+              rdma_dev->pd, (void *)start, length);
+    region->mr = ibv_reg_mr(rdma_dev->pd, (void *)start, length, rdma_buffer_access_flags());
+    if (!region->mr) {
+        fprintf(stderr, "Couldn't register MR\n");
+        free(region);
+        reg_cache_restore(cache, covered);
+        return NULL;
+    }
+    region->start = start;
+    region->end = end;
+    region->refcnt = 1;
+    region->cached = 1;
+    reg_tree_insert(cache, region);
+    cache->pinned_bytes += length;
+    cache->num_regions++;
+
+    while (covered) {
+        struct rdma_reg_region *next = covered->left;
+
+        DEBUG_LOG("cached region [0x%lx, 0x%lx) merged into [0x%lx, 0x%lx)\n",
+                  (unsigned long)covered->start, (unsigned long)covered->end, (unsigned long)start, (unsigned long)end);
+        covered->cached = 0;
+        if (!covered->refcnt) {
+            reg_region_destroy(cache, covered);
+        }
+        covered = next;
+    }
+    return region;
+}
+
+static void reg_cache_put(struct rdma_reg_cache *cache, struct rdma_reg_region *region)
+{
+    if (--region->refcnt) {
+        return;
+    }
+    if (region->cached) {
+        reg_lru_push(cache, region);
+    } else {
+        reg_region_destroy(cache, region);
+    }
+}
+
+static void reg_cache_destroy(struct rdma_reg_cache *cache)
+{
+    /* Called without rdma_buffers, all the cached regions are unused */
+    while (cache->lru_tail) {
+        reg_region_uncache(cache, cache->lru_tail);
+    }
+    free(cache);
+}
+
+int rdma_reg_cache_enable(struct rdma_device *rdma_dev, size_t max_pinned_bytes)
+{
+    if (rdma_dev->reg_cache) {
+        rdma_dev->reg_cache->max_pinned_bytes = max_pinned_bytes;
+        return 0;
+    }
+    rdma_dev->reg_cache = (struct rdma_reg_cache *)calloc(1, sizeof *rdma_dev->reg_cache);
+    if (!rdma_dev->reg_cache) {
+        fprintf(stderr, "rdma_reg_cache memory allocation failed\n");
+        return ENOMEM;
+    }
+    rdma_dev->reg_cache->max_pinned_bytes = max_pinned_bytes;
+    return 0;
+}
+
+void rdma_reg_cache_invalidate(struct rdma_device *rdma_dev, void *addr, size_t length)
+{
+    struct rdma_reg_cache *cache = rdma_dev->reg_cache;
+    struct rdma_reg_region *region;
+    uintptr_t start = (uintptr_t)addr;
+
+    if (!cache) {
+        return;
+    }
+    while ((region = reg_tree_find_overlapping(cache->root, start, start + length))) {
+        reg_region_uncache(cache, region);
+    }
+}
+
+int rdma_reg_cache_get_stats(struct rdma_device *rdma_dev, struct rdma_reg_cache_stats *stats)
+{
+    struct rdma_reg_cache *cache = rdma_dev->reg_cache;
+
+    if (!cache) {
+        return ENOENT;
+    }
+    stats->hits         = cache->hits;
+    stats->misses       = cache->misses;
+    stats->evictions    = cache->evictions;
+    stats->pinned_bytes = cache->pinned_bytes;
+    stats->num_regions  = cache->num_regions;
+    return 0;
+}
+
+//============================================================================================
+void rdma_close_device(struct rdma_device *rdma_dev)
+{
+    int ret_val;
+    struct ibv_ah *ah;
+
+    if (rdma_dev->rdma_buff_cnt > 0) {
+        fprintf(stderr, "The number of attached RDMA buffers is not zero (%d). Can't close device.\n",
+                rdma_dev->rdma_buff_cnt);
+        return;
+    }
+    if (rdma_dev->reg_cache) {
+        reg_cache_destroy(rdma_dev->reg_cache);
+        rdma_dev->reg_cache = NULL;
+    }
+#ifdef PRINT_LATENCY
+    if (rdma_dev->measure_index) {
+        DEBUG_LOG("PRINT_LATENCY: %6lu wr-s, wr_sent latency: min %8lu, max %8lu, avg %8lu (nSec)\n",
+                  rdma_dev->measure_index,
+                  rdma_dev->min_wr_complete_latency * 1000000 / rdma_dev->hca_core_clock_kHz,
+                  rdma_dev->max_wr_complete_latency * 1000000 / rdma_dev->hca_core_clock_kHz,
+                  rdma_dev->wr_complete_latency_sum / rdma_dev->measure_index * 1000000 / rdma_dev->hca_core_clock_kHz);
+
+        DEBUG_LOG("PRINT_LATENCY:   completion latency        : min %8lu, max %8lu, avg %8lu (nSec)\n",
+                  rdma_dev->min_completion_latency * 1000000 / rdma_dev->hca_core_clock_kHz,
+                  rdma_dev->max_completion_latency * 1000000 / rdma_dev->hca_core_clock_kHz,
+                  rdma_dev->completion_latency_sum / rdma_dev->measure_index * 1000000 / rdma_dev->hca_core_clock_kHz);
+
+        DEBUG_LOG("PRINT_LATENCY:   read_comp latency         : min %8lu, max %8lu, avg %8lu (nSec)\n",
+                  rdma_dev->min_read_comp_latency * 1000000 / rdma_dev->hca_core_clock_kHz,
+                  rdma_dev->max_read_comp_latency * 1000000 / rdma_dev->hca_core_clock_kHz,
+                  rdma_dev->read_comp_latency_sum / rdma_dev->measure_index * 1000000 / rdma_dev->hca_core_clock_kHz);
+
+        fflush(stdout);
+    }
+#endif /*PRINT_LATENCY*/
+    if (is_server(rdma_dev)) {
+        int i;
+
+        for (i = 0; i < rdma_dev->num_dcis; i++) {
+            ret_val = destroy_qp(rdma_dev->dcis[i].qp);
+            if (ret_val) {
+                return;
+            }
+        }
+        free(rdma_dev->dcis);
+        free(rdma_dev->stripes);
+    } else {
+        ret_val = destroy_qp(rdma_dev->qp);
+        if (ret_val) {
+            return;
+        }
+    }
+
+    if (rdma_dev->srq) {
+        DEBUG_LOG("ibv_destroy_srq(%p)\n", rdma_dev->srq);
+        ret_val = ibv_destroy_srq(rdma_dev->srq);
+        if (ret_val) {
+            fprintf(stderr, "Couldn't destroy SRQ\n");
+            return;
+        }
+    }
+    
+    if (rdma_dev->unacked_cq_events) {
+        ibv_ack_cq_events(rdma_dev_cq(rdma_dev), rdma_dev->unacked_cq_events);
+        rdma_dev->unacked_cq_events = 0;
+    }
+    DEBUG_LOG("ibv_destroy_cq(%p)\n", rdma_dev->cq);
+    ret_val = ibv_destroy_cq(rdma_dev_cq(rdma_dev));
+    if (ret_val) {
+        fprintf(stderr, "Couldn't destroy CQ, error %d\n", ret_val);
+        return;
+    }
+
+    if (rdma_dev->comp_channel) {
+        DEBUG_LOG("ibv_destroy_comp_channel(%p)\n", rdma_dev->comp_channel);
+        ret_val = ibv_destroy_comp_channel(rdma_dev->comp_channel);
+        if (ret_val) {
+            fprintf(stderr, "Couldn't destroy completion channel, error %d\n", ret_val);
+            return;
+        }
+    }
+
+    if (rdma_dev->remote_buf_cnt > 0) {
+        DEBUG_LOG("releasing %d imported remote buffers\n", rdma_dev->remote_buf_cnt);
+    }
+    while (rdma_dev->remote_buf_slabs) {
+        struct rdma_remote_buf_slab *slab = rdma_dev->remote_buf_slabs;
+        rdma_dev->remote_buf_slabs = slab->next;
+        free(slab);
+    }
+
+    DEBUG_LOG("destroy ibv_ah's\n");
+    kh_foreach_value(&rdma_dev->ah_hash, ah, ibv_destroy_ah(ah));
 
     DEBUG_LOG("ibv_dealloc_pd(%p)\n", rdma_dev->pd);
     ret_val = ibv_dealloc_pd(rdma_dev->pd);
@@ -1103,279 +2417,949 @@ void rdma_close_device(struct rdma_device *rdma_dev)
     DEBUG_LOG("destroy AH cache\n");
     kh_destroy_inplace(kh_ib_ah, &rdma_dev->ah_hash);
 
-    close_ib_device(rdma_dev);
+    close_ib_device(rdma_dev);
+
+    free(rdma_dev);
+
+    return;
+}
+
+//============================================================================================
+/* A read-only buffer is registered with no access flags (local read only) and not cached */
+static struct rdma_buffer *buffer_reg(struct rdma_device *rdma_dev, void *addr, size_t length, int readonly)
+{
+    struct rdma_buffer *rdma_buff;
+    rdma_buff = (struct rdma_buffer *)calloc(1, sizeof *rdma_buff);
+    if (!rdma_buff) {
+        fprintf(stderr, "rdma_buff memory allocation failed\n");
+        return NULL;
+    }
+
+    if (rdma_dev->reg_cache && !readonly) {
+        rdma_buff->region = reg_cache_get(rdma_dev, addr, length);
+        if (!rdma_buff->region) {
+            goto clean_rdma_buff;
+        }
+        rdma_buff->mr = rdma_buff->region->mr;
+    } else {
+        enum ibv_access_flags access_flags = readonly ? (enum ibv_access_flags)0 : rdma_buffer_access_flags();
+        /*In the case of local buffer we can use IBV_ACCESS_LOCAL_WRITE only flag*/
+        DEBUG_LOG("ibv_reg_mr(pd %p, buf %p, size = %lu, access_flags = 0x%08x\n",
+                   rdma_dev->pd, addr, length, access_flags);
+        rdma_buff->mr = ibv_reg_mr(rdma_dev->pd, addr, length, access_flags);
+        if (!rdma_buff->mr) {
+            fprintf(stderr, "Couldn't register GPU MR\n");
+            goto clean_rdma_buff;
+        }
+        DEBUG_LOG("ibv_reg_mr completed: buf %p, size = %lu, rkey = 0x%08x\n",
+                   addr, length, rdma_buff->mr->rkey);
+    }
+
+    rdma_buff->buf_addr = addr;
+    rdma_buff->buf_size = length;
+    rdma_buff->rkey     = rdma_buff->mr->rkey; /*not used for local buffer case*/
+    rdma_buff->rdma_dev = rdma_dev;
+    rdma_dev->rdma_buff_cnt++;
+
+    return rdma_buff;
+
+clean_rdma_buff:
+    /* We don't decrement device rdma_buff_cnt because we still did not increment it,
+    we just free the allocated for rdma_buff memory. */
+    free(rdma_buff);
+    
+    return NULL;
+}
+
+struct rdma_buffer *rdma_buffer_reg(struct rdma_device *rdma_dev, void *addr, size_t length)
+{
+    return buffer_reg(rdma_dev, addr, length, 0);
+}
+
+struct rdma_buffer *rdma_buffer_reg_readonly(struct rdma_device *rdma_dev, void *addr, size_t length)
+{
+    return buffer_reg(rdma_dev, addr, length, 1);
+}
+
+//============================================================================================
+struct rdma_buffer *rdma_buffer_view(struct rdma_buffer *parent, size_t offset, size_t length)
+{
+    struct rdma_buffer *rdma_buff;
+
+    if (offset > parent->buf_size || length > parent->buf_size - offset) {
+        fprintf(stderr, "View [%lu, %lu) is out of the buffer of size %lu\n",
+                offset, offset + length, parent->buf_size);
+        return NULL;
+    }
+    rdma_buff = (struct rdma_buffer *)calloc(1, sizeof *rdma_buff);
+    if (!rdma_buff) {
+        fprintf(stderr, "rdma_buff memory allocation failed\n");
+        return NULL;
+    }
+    rdma_buff->buf_addr = (uint8_t *)parent->buf_addr + offset;
+    rdma_buff->buf_size = length;
+    rdma_buff->mr       = parent->mr;
+    rdma_buff->rkey     = parent->rkey;
+    rdma_buff->parent   = parent;
+    rdma_buff->rdma_dev = parent->rdma_dev;
+    parent->view_cnt++;
+    rdma_buff->rdma_dev->rdma_buff_cnt++;
+
+    return rdma_buff;
+}
+
+//============================================================================================
+void rdma_buffer_dereg(struct rdma_buffer *rdma_buff)
+{
+    int ret_val;
+
+    if (rdma_buff->view_cnt) {
+        fprintf(stderr, "The buffer has %d views. Can't deregister it.\n", rdma_buff->view_cnt);
+        return;
+    }
+    if (rdma_buff->parent) {
+        rdma_buff->parent->view_cnt--;
+    } else if (rdma_buff->region) {
+        reg_cache_put(rdma_buff->rdma_dev->reg_cache, rdma_buff->region);
+    } else if (rdma_buff->mr) {
+        DEBUG_LOG("ibv_dereg_mr(%p)\n", rdma_buff->mr);
+        ret_val = ibv_dereg_mr(rdma_buff->mr);
+        if (ret_val) {
+            fprintf(stderr, "Couldn't deregister MR, error %d\n", ret_val);
+            return;
+        }
+    }
+    rdma_buff->rdma_dev->rdma_buff_cnt--;
+    DEBUG_LOG("The buffer detached from rdma_device (%p). Number of attached to device buffers is %d.\n",
+              rdma_buff->rdma_dev, rdma_buff->rdma_dev->rdma_buff_cnt);
+
+    free(rdma_buff);
+}
+
+//============================================================================================
+static void wire_gid_to_gid(const char *wgid, union ibv_gid *gid)
+{
+    char tmp[9];
+    uint32_t v32;
+    uint32_t *raw = (uint32_t *)gid->raw;
+    int i;
+
+    for (tmp[8] = 0, i = 0; i < 4; ++i) {
+        memcpy(tmp, wgid + i * 8, 8);
+        sscanf(tmp, "%x", &v32);
+        raw[i] = ntohl(v32);
+    }
+}
+
+static void gid_to_wire_gid(const union ibv_gid *gid, char wgid[])
+{
+    int i;
+    uint32_t *raw = (uint32_t *)gid->raw;
+
+    for (i = 0; i < 4; ++i)
+        sprintf(&wgid[i * 8], "%08x", htonl(raw[i]));
+}
+
+//===============================================================================================
+/*                                       addr             size             rkey     lid  dctn   g gid   */
+#define BUFF_DESC_STRING_LENGTH (sizeof "0102030405060708:0102030405060708:01020304:0102:010203:1:0102030405060708090a0b0c0d0e0f10")
+#define BUFF_DESC_STRING_GID_OFFSET (sizeof "0102030405060708:0102030405060708:01020304:0102:010203:1")
+
+int rdma_buffer_get_desc_str(struct rdma_buffer *rdma_buff, char *desc_str, size_t desc_length)
+{
+    if (desc_length < BUFF_DESC_STRING_LENGTH) {
+        fprintf(stderr, "desc string size (%lu) is less than required (%lu) for sending rdma_buffer attributes\n",
+                desc_length, BUFF_DESC_STRING_LENGTH);
+        return 0;
+    }
+    /*       addr             size             rkey     lid  dctn   g 
+            "0102030405060708:0102030405060708:01020304:0102:010203:1:" */
+    sprintf(desc_str, "%016llx:%016llx:%08x:%04x:%06x:%d:",
+            (unsigned long long)rdma_buff->buf_addr,
+            (unsigned long long)rdma_buff->buf_size,
+            rdma_buff->rkey,
+            rdma_buff->rdma_dev->lid,
+            rdma_buff->rdma_dev->qp->qp_num /* dctn */,
+            rdma_buff->rdma_dev->is_global & 0x1);
+    
+    gid_to_wire_gid(&rdma_buff->rdma_dev->gid, desc_str + BUFF_DESC_STRING_GID_OFFSET);
+    
+    return strlen(desc_str) + 1; /*including the terminating null character*/
+}
+
+//===============================================================================================
+int rdma_buffer_desc_encode(struct rdma_buffer *rdma_buff, void *desc, size_t desc_length)
+{
+    struct rdma_buffer_desc wire_desc;
+
+    if (desc_length < sizeof wire_desc) {
+        fprintf(stderr, "desc size (%lu) is less than required (%lu) for sending rdma_buffer attributes\n",
+                desc_length, sizeof wire_desc);
+        return 0;
+    }
+
+    memset(&wire_desc, 0, sizeof wire_desc);
+    wire_desc.magic     = htole16(RDMA_BUFFER_DESC_MAGIC);
+    wire_desc.version   = RDMA_BUFFER_DESC_VERSION;
+    wire_desc.is_global = rdma_buff->rdma_dev->is_global & 0x1;
+    wire_desc.lid       = htole16(rdma_buff->rdma_dev->lid);
+    wire_desc.addr      = htole64((uint64_t)rdma_buff->buf_addr);
+    wire_desc.size      = htole64((uint64_t)rdma_buff->buf_size);
+    wire_desc.rkey      = htole32(rdma_buff->rkey);
+    wire_desc.dctn      = htole32(rdma_buff->rdma_dev->qp->qp_num);
+    /* GID is kept in network order as in union ibv_gid */
+    memcpy(wire_desc.gid, rdma_buff->rdma_dev->gid.raw, sizeof wire_desc.gid);
+
+    memcpy(desc, &wire_desc, sizeof wire_desc);
+
+    return sizeof wire_desc;
+}
+
+//===============================================================================================
+int rdma_buffer_desc_decode(const void *wire_desc, size_t wire_length, struct rdma_buffer_desc *desc)
+{
+    if (wire_length < sizeof *desc) {
+        FDEBUG_LOG_FAST_PATH(stderr, "wire desc size (%lu) is less than expected (%lu)\n",
+                             wire_length, sizeof *desc);
+        return EINVAL;
+    }
+    memcpy(desc, wire_desc, sizeof *desc);
+
+    desc->magic = le16toh(desc->magic);
+    if (desc->magic != RDMA_BUFFER_DESC_MAGIC || desc->version != RDMA_BUFFER_DESC_VERSION) {
+        FDEBUG_LOG_FAST_PATH(stderr, "wrong wire desc magic 0x%04x or version %u\n",
+                             desc->magic, desc->version);
+        return EINVAL;
+    }
+    desc->lid  = le16toh(desc->lid);
+    desc->addr = le64toh(desc->addr);
+    desc->size = le64toh(desc->size);
+    desc->rkey = le32toh(desc->rkey);
+    desc->dctn = le32toh(desc->dctn);
+
+    return 0;
+}
+
+static int rdma_create_ah_cached(struct rdma_device *rdma_dev,
+                 struct ibv_ah_attr *ah_attr,
+                 struct ibv_ah **p_ah)
+{
+    int ret = -1;
+    khiter_t iter;
+
+    /* looking for existing AH with same attributes */
+    iter = kh_get(kh_ib_ah, &rdma_dev->ah_hash, *ah_attr);
+    if (iter == kh_end(&rdma_dev->ah_hash)) {
+
+        /* new AH */
+        DEBUG_LOG("ibv_create_ah(dlid=%d port=%d is_global=%d, tc=%d)\n",
+            ah_attr->dlid, ah_attr->port_num, ah_attr->is_global, (ah_attr->grh.traffic_class >> 5));
+        *p_ah = ibv_create_ah(rdma_dev->pd, ah_attr);
+
+        if (*p_ah == NULL) {
+            perror("ibv_create_ah");
+            goto out;
+        }
+
+        /* store AH in hash */
+        iter = kh_put(kh_ib_ah, &rdma_dev->ah_hash, *ah_attr, &ret);
+
+        /* failed to store - rollback */
+        if (iter == kh_end(&rdma_dev->ah_hash)) {
+            perror("rdma_create_ah_cached failed storing");
+            ibv_destroy_ah(*p_ah);
+            goto out;
+        }
+
+        kh_value(&rdma_dev->ah_hash, iter) = *p_ah;
+        ret = 0;
+    } else {
+        /* found existing AH */
+        *p_ah = kh_value(&rdma_dev->ah_hash, iter);
+        ret = 0;
+    }
+
+out:
+    return ret;
+}
+
+//============================================================================================
+static int buff_size_validation(struct rdma_task_attr *attr, uint64_t rem_buf_size)
+{
+    size_t  total_len = 0;
+    int     i;
+    /* The data of an inline RDMA Write doesn't have to be registered */
+    int     is_inline = !(attr->flags & RDMA_TASK_ATTR_RDMA_READ) &&
+                        rem_buf_size <= (uint64_t)attr->local_buf_rdma->rdma_dev->max_inline_data;
+
+    for (i = 0; i < attr->local_buf_iovcnt; i++) {
+        if (!is_inline &&
+            (((uint8_t*)attr->local_buf_iovec[i].iov_base < (uint8_t*)attr->local_buf_rdma->buf_addr) ||
+             ((uint8_t*)attr->local_buf_iovec[i].iov_base + attr->local_buf_iovec[i].iov_len >
+              (uint8_t*)attr->local_buf_rdma->buf_addr + attr->local_buf_rdma->buf_size))) {
+
+            fprintf(stderr, "sge buffer %d (%p, %p) exceeds the local buffer bounary (%p, %p)\n", i,
+                    attr->local_buf_iovec[i].iov_base, (uint8_t*)attr->local_buf_iovec[i].iov_base + attr->local_buf_iovec[i].iov_len,
+                    attr->local_buf_rdma->buf_addr, (uint8_t*)attr->local_buf_rdma->buf_addr + attr->local_buf_rdma->buf_size);
+            return 1;
+        }
+        total_len += attr->local_buf_iovec[i].iov_len;
+        if (total_len > rem_buf_size) {
+            fprintf(stderr, "The sum of sge buffers lengths (%lu) exceeded the remote buffer size %lu on iteration %d\n",
+                    total_len, rem_buf_size, i);
+            return 1;
+        }
+    }
+    if ((attr->local_buf_iovcnt) && (total_len != rem_buf_size)) {
+        fprintf(stderr, "WARN: The sum of sge buffers lengths (%lu) differs from the remote buffer size %lu\n",
+                total_len, rem_buf_size);
+    }
+    return 0;
+}
+
+/*
+ * Without a gather list the task moves rem_buf_size bytes from the start of
+ * the local buffer, they must be in it: a view of a slab shares the MR of the
+ * slab, a longer task would reach the buffers next to it.
+ * returns: 0 on success, or EINVAL
+ */
+static int rdma_check_local_range(struct rdma_task_attr *attr, uint64_t rem_buf_size)
+{
+	if (!attr->local_buf_iovcnt && rem_buf_size > attr->local_buf_rdma->buf_size) {
+		fprintf(stderr, "The requested size %lu is greater than the local buffer size %lu\n",
+			rem_buf_size, attr->local_buf_rdma->buf_size);
+		return EINVAL;
+	}
+	return 0;
+}
+
+//============================================================================================
+static int rdma_resolve_ah(struct rdma_device *rdma_dev, uint16_t rem_lid, int is_global,
+                           const union ibv_gid *rem_gid, struct ibv_ah **p_ah)
+{
+    /* Check if address handler corresponding to the given key is present in the hash table,
+       if yes - return it and if it is not, create ah and add it to the hash table */
+    struct ibv_ah_attr  ah_attr;
+
+    memset(&ah_attr, 0, sizeof ah_attr);
+    ah_attr.is_global   = is_global;
+    ah_attr.dlid        = rem_lid;
+    ah_attr.port_num    = rdma_dev->ib_port;
+    
+    if (ah_attr.is_global) {
+        ah_attr.grh.hop_limit = 1;
+        ah_attr.grh.dgid = *rem_gid;
+        ah_attr.grh.sgid_index = rdma_dev->gidx;
+        ah_attr.grh.traffic_class = TC_PRIO << 5; // <<3 for dscp2prio, <<2 for ECN bits
+    }
+
+    return rdma_create_ah_cached(rdma_dev, &ah_attr, p_ah);
+}
+
+static inline
+void rdma_exec_params_set_local(struct rdma_exec_params *exec_params, struct rdma_task_attr *attr)
+{
+	exec_params->wr_id = attr->wr_id;
+	exec_params->device = attr->local_buf_rdma->rdma_dev;
+	exec_params->flags = attr->flags;
+	exec_params->local_buf_mr_lkey = (uint32_t)attr->local_buf_rdma->mr->lkey;
+	exec_params->local_buf_addr = attr->local_buf_rdma->buf_addr;
+	exec_params->local_buf_iovec = attr->local_buf_iovec;
+	exec_params->local_buf_iovcnt = attr->local_buf_iovcnt;
+	if (attr->flags & RDMA_TASK_ATTR_NOTIFY) {
+		exec_params->notify_buf = attr->notify_buf;
+		exec_params->notify_addr = attr->notify_buf ? attr->notify_buf->addr + attr->notify_offset : 0;
+		exec_params->notify_value = attr->notify_value;
+	}
+}
+
+/*
+ * Check the remote scatter list of the task against its remote range, the
+ * task then moves the sum of the segment lengths.
+ * returns: 0 on success, or EINVAL
+ */
+static int rdma_exec_params_set_rem_sgl(struct rdma_task_attr *attr, struct rdma_exec_params *exec_params)
+{
+	uint64_t total_len = 0;
+	int      i;
+
+	for (i = 0; i < attr->remote_sgl_cnt; i++) {
+		const struct rdma_remote_sge *rem_sge = &attr->remote_sgl[i];
+
+		if (!rem_sge->length || rem_sge->offset > exec_params->rem_buf_size ||
+		    rem_sge->length > exec_params->rem_buf_size - rem_sge->offset) {
+			fprintf(stderr, "Remote segment %d (offset %llu, length %llu) is out of the remote range of %llu bytes\n",
+				i, (unsigned long long)rem_sge->offset, (unsigned long long)rem_sge->length, exec_params->rem_buf_size);
+			return EINVAL;
+		}
+		total_len += rem_sge->length;
+	}
+	if (attr->local_buf_iovcnt) {
+		uint64_t local_len = 0;
+
+		for (i = 0; i < attr->local_buf_iovcnt; i++) {
+			local_len += attr->local_buf_iovec[i].iov_len;
+		}
+		if (local_len != total_len) {
+			fprintf(stderr, "The sum of sge buffers lengths (%llu) differs from the remote segments total %llu\n",
+				(unsigned long long)local_len, (unsigned long long)total_len);
+			return EINVAL;
+		}
+	}
+	exec_params->rem_sgl      = attr->remote_sgl;
+	exec_params->rem_sgl_cnt  = attr->remote_sgl_cnt;
+	exec_params->rem_buf_size = total_len;
+	return 0;
+}
+
+/* exec_params remote buffer addr and size are expected to be already adjusted to the requested offset */
+static int rdma_submit_exec_params(struct rdma_task_attr *attr, struct rdma_exec_params *exec_params)
+{
+	int ret_val;
+
+	if (attr->remote_sgl_cnt) {
+		ret_val = rdma_exec_params_set_rem_sgl(attr, exec_params);
+		if (ret_val) {
+			return ret_val;
+		}
+	}
+	ret_val = rdma_check_local_range(attr, exec_params->rem_buf_size);
+	if (ret_val) {
+		return ret_val;
+	}
+
+	/*
+	 * Pass attr->local_buf_iovec - local_buf_iovcnt elements and check that
+	 * the sum of local_buf_iovec[i].iov_len doesn't exceed rem_buf_size
+	 */
+	if (debug_fast_path) {
+		/* We do these validation code in debug mode only, because if something
+		 * is wrong in the fast path, the HW will give completion error */
+		ret_val = buff_size_validation(attr, exec_params->rem_buf_size);
+		if (ret_val) {
+			return ret_val;
+		}
+	}
+
+	if (rdma_task_is_striped(exec_params)) {
+		return rdma_exec_task_striped(exec_params);
+	}
+	if (rdma_task_num_wrs(exec_params) + 1 > SEND_Q_DEPTH) {
+		return rdma_exec_task_stream(exec_params);
+	}
+	return rdma_exec_task(exec_params, 0);
+}
+
+/*
+ * Check the remote range of a task, from offset and of length bytes (0 - up
+ * to the end), against the size of the remote buffer.
+ * returns: 0 on success, or EINVAL
+ */
+static int rdma_check_rem_range(uint64_t buf_size, size_t offset, size_t length)
+{
+	if (offset > buf_size || length > buf_size - offset) {
+		fprintf(stderr, "Remote range (offset %llu, length %llu) is out of the remote buffer of %llu bytes\n",
+			(unsigned long long)offset, (unsigned long long)length, (unsigned long long)buf_size);
+		return EINVAL;
+	}
+	return 0;
+}
+
+//============================================================================================
+static int rdma_exec_params_from_desc_str(struct rdma_task_attr *attr, struct rdma_exec_params *exec_params)
+{
+	uint16_t                rem_lid = 0;
+	int                     is_global = 0;
+    	union ibv_gid           rem_gid;
+
+	/*
+	 * Parse desc string, extracting remote buffer address, size, rkey, lid, dctn, and if global is true, also gid
+	 */
+	DEBUG_LOG_FAST_PATH("Starting to parse desc string: \"%s\"\n", attr->remote_buf_desc_str);
+	/*   addr             size             rkey     lid  dctn   g gid
+	 *  "0102030405060708:0102030405060708:01020304:0102:010203:1:0102030405060708090a0b0c0d0e0f10"*/
+	sscanf(attr->remote_buf_desc_str, "%llx:%llx:%lx:%hx:%lx:%d",
+			&exec_params->rem_buf_addr, &exec_params->rem_buf_size,
+		       	&exec_params->rem_buf_rkey, &rem_lid,
+			&exec_params->rem_dctn, &is_global);
+	memset(&rem_gid, 0, sizeof(rem_gid));
+	if (is_global) {
+		wire_gid_to_gid(attr->remote_buf_desc_str + BUFF_DESC_STRING_GID_OFFSET, &rem_gid);
+	}
+	DEBUG_LOG_FAST_PATH("rem_buf_addr=0x%llx, rem_buf_size=%llu, rem_buf_offset=%lu, rem_buf_rkey=0x%lx, rem_lid=0x%hx, rem_dctn=0x%lx, is_global=%d\n",
+			exec_params->rem_buf_addr, exec_params->rem_buf_size, attr->remote_buf_offset, exec_params->rem_buf_rkey, rem_lid, exec_params->rem_dctn, is_global);
+       	DEBUG_LOG_FAST_PATH("Rem GID: %02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x\n",
+                        rem_gid.raw[0],  rem_gid.raw[1],  rem_gid.raw[2],  rem_gid.raw[3],
+                        rem_gid.raw[4],  rem_gid.raw[5],  rem_gid.raw[6],  rem_gid.raw[7], 
+                        rem_gid.raw[8],  rem_gid.raw[9],  rem_gid.raw[10], rem_gid.raw[11],
+                        rem_gid.raw[12], rem_gid.raw[13], rem_gid.raw[14], rem_gid.raw[15] );
+	DEBUG_LOG_FAST_PATH("rdma_task_attr_flags=%08x\n", exec_params->flags);
+
+	if (rdma_check_rem_range(exec_params->rem_buf_size, attr->remote_buf_offset, 0)) {
+		return EINVAL;
+	}
+	/* upadte the remote buffer addr and size acording to the requested start offset */
+	exec_params->rem_buf_addr += attr->remote_buf_offset;
+	exec_params->rem_buf_size -= attr->remote_buf_offset;
+
+	exec_params->dci = rdma_select_dci(exec_params->device, exec_params->rem_dctn, &rem_gid);
+	if (rdma_resolve_ah(exec_params->device, rem_lid, is_global, &rem_gid, &exec_params->ah)) {
+		return 1;
+	}
+	return 0;
+}
+
+/* Fill exec_params from attr, from the imported remote buffer if given, or from the desc string */
+static int rdma_exec_params_from_attr(struct rdma_task_attr *attr, struct rdma_exec_params *exec_params)
+{
+	rdma_exec_params_set_local(exec_params, attr);
+	if (!attr->remote_buf) {
+		return rdma_exec_params_from_desc_str(attr, exec_params);
+	}
+	if (rdma_check_rem_range(attr->remote_buf->size, attr->remote_buf_offset, attr->remote_buf_length)) {
+		return EINVAL;
+	}
+	exec_params->rem_buf_addr = attr->remote_buf->addr + attr->remote_buf_offset;
+	exec_params->rem_buf_size = attr->remote_buf_length ? attr->remote_buf_length
+	                                                     : attr->remote_buf->size - attr->remote_buf_offset;
+	exec_params->rem_buf_rkey = attr->remote_buf->rkey;
+	exec_params->rem_dctn     = attr->remote_buf->dctn;
+	exec_params->ah           = attr->remote_buf->ah;
+	exec_params->dci          = attr->remote_buf->dci;
+	return 0;
+}
+
+//============================================================================================
+int rdma_submit_task(struct rdma_task_attr *attr)
+{
+	struct rdma_exec_params exec_params = {};
+	int                     ret_val;
+
+	ret_val = rdma_exec_params_from_attr(attr, &exec_params);
+	if (ret_val) {
+		return ret_val;
+	}
+	return rdma_submit_exec_params(attr, &exec_params);
+}
+
+/*
+ * Ring the doorbells of the DCIs started by rdma_submit_tasks(), each ends
+ * its batch signaled. If ibv_wr_complete() fails on a DCI, none of its batch
+ * WRs were posted and its wr_id DB is rolled back.
+ * results[first..last) of the tasks of these doorbells hold the index of
+ * their DCI, they are set to 0, or to EIO for the tasks of a failed DCI.
+ * returns: the number of tasks dropped with the failed DCIs
+ */
+static int rdma_submit_tasks_complete(struct rdma_device *rdma_dev, int *results, int first, int last)
+{
+	struct rdma_dci *dci;
+	int              k, t, entries, wr_id_idx, ret_val;
+	int              dropped = 0;
+	uint64_t         failed_dcis = 0; /* MAX_NUM_DCIS bits */
+
+	for (k = 0; k < rdma_dev->num_dcis; k++) {
+		dci = &rdma_dev->dcis[k];
+		if (!dci->batch_tasks) {
+			continue;
+		}
+		entries = dci->batch_tasks;
+		if (dci->unsignaled_wrs && rdma_dci_signal_post(dci) >= 0) {
+			/* The batch ends signaled on every DCI */
+			entries++;
+		}
+		DEBUG_LOG_FAST_PATH("ibv_wr_complete: DCI %d, qpex=%p, tasks %d\n", dci->index, dci->qpex, dci->batch_tasks);
+		ret_val = ibv_wr_complete(dci->qpex);
+		if (ret_val) {
+			/* None of this DCI batch WRs were posted - roll back its wr_id DB */
+			fprintf(stderr, "FAILURE: ibv_wr_complete on DCI %d for a batch of %d tasks (error=%d)\n",
+				dci->index, dci->batch_tasks, ret_val);
+			for (t = 0, wr_id_idx = dci->batch_first_wr_id_idx; t < entries; t++) {
+				dci->app_wr_id[wr_id_idx].flags = 0;
+				if (++wr_id_idx >= SEND_Q_DEPTH) {
+					wr_id_idx = 0;
+				}
+			}
+			dci->app_wr_id_idx = dci->batch_first_wr_id_idx;
+			dci->qp_available_wr = dci->batch_qp_available_wr;
+			dci->unsignaled_wrs = dci->batch_unsignaled_wrs;
+			dropped += dci->batch_tasks;
+			failed_dcis |= 1ULL << dci->index;
+		}
+		dci->batch_tasks = 0;
+	}
+	if (results) {
+		for (t = first; t < last; t++) {
+			results[t] = (failed_dcis >> results[t]) & 1 ? EIO : 0;
+		}
+	}
+	return dropped;
+}
+
+//============================================================================================
+int rdma_submit_tasks(struct rdma_task_attr *attrs, int num_tasks, int *results)
+{
+	struct rdma_exec_params exec_params;
+	struct rdma_device     *rdma_dev;
+	struct rdma_dci        *dci;
+	int                     i, t, wr_id_idx;
+	int                     ret_val = 0;
+	int                     first = 0; /* of the tasks waiting for the doorbells */
+	int                     dropped = 0;
+
+	if (num_tasks <= 0) {
+		return 0;
+	}
+	rdma_dev = attrs[0].local_buf_rdma->rdma_dev;
 
-    free(rdma_dev);
+	/*
+	 * The tasks of each DCI are posted between one ibv_wr_start()/ibv_wr_complete() pair,
+	 * a DCI is started on its first task, so a batch costs one doorbell per used DCI
+	 */
+	for (i = 0; i < num_tasks; i++) {
+		memset(&exec_params, 0, sizeof exec_params);
+		if (attrs[i].local_buf_rdma->rdma_dev != rdma_dev) {
+			fprintf(stderr, "Task %d of the batch belongs to a different rdma_device\n", i);
+			ret_val = EINVAL;
+			break;
+		}
+		ret_val = rdma_exec_params_from_attr(&attrs[i], &exec_params);
+		if (!ret_val && attrs[i].remote_sgl_cnt) {
+			ret_val = rdma_exec_params_set_rem_sgl(&attrs[i], &exec_params);
+		}
+		if (!ret_val) {
+			ret_val = rdma_check_local_range(&attrs[i], exec_params.rem_buf_size);
+		}
+		if (!ret_val && debug_fast_path && buff_size_validation(&attrs[i], exec_params.rem_buf_size)) {
+			ret_val = EINVAL;
+		}
+		if (ret_val) {
+			break;
+		}
+		if (rdma_task_is_striped(&exec_params) || rdma_task_num_wrs(&exec_params) + 1 > SEND_Q_DEPTH) {
+			/*
+			 * Striped and streamed tasks post on their own DCIs, after the
+			 * doorbells of the tasks before them, the batch goes on after them
+			 */
+			dropped += rdma_submit_tasks_complete(rdma_dev, results, first, i);
+			ret_val = rdma_task_is_striped(&exec_params) ? rdma_exec_task_striped(&exec_params)
+			                                             : rdma_exec_task_stream(&exec_params);
+			first = i + 1;
+			if (ret_val) {
+				break;
+			}
+			if (results) {
+				results[i] = 0;
+			}
+			continue;
+		}
+		dci = exec_params.dci;
+		if (!dci->batch_tasks) {
+			DEBUG_LOG_FAST_PATH("RDMA Read/Write batch: ibv_wr_start: DCI %d, qpex = %p\n", dci->index, dci->qpex);
+			ibv_wr_start(dci->qpex);
+			dci->batch_first_wr_id_idx = dci->app_wr_id_idx;
+			dci->batch_qp_available_wr = dci->qp_available_wr;
+			dci->batch_unsignaled_wrs = dci->unsignaled_wrs;
+		}
+		wr_id_idx = rdma_exec_task_post(&exec_params, i == num_tasks - 1);
+		if (wr_id_idx < 0) {
+			if (!dci->batch_tasks) {
+				ibv_wr_abort(dci->qpex);
+			}
+			ret_val = -wr_id_idx;
+			break;
+		}
+		dci->batch_tasks++;
+		if (results) {
+			results[i] = dci->index; /* until its doorbell is rung */
+		}
+	}
 
-    return;
+	/* ring DBs */
+	dropped += rdma_submit_tasks_complete(rdma_dev, results, first, i);
+	if (results && i < num_tasks) {
+		results[i] = ret_val;
+		for (t = i + 1; t < num_tasks; t++) {
+			results[t] = ECANCELED;
+		}
+	}
+	return i - dropped;
 }
 
 //============================================================================================
-struct rdma_buffer *rdma_buffer_reg(struct rdma_device *rdma_dev, void *addr, size_t length)
+int rdma_submit_task_desc(struct rdma_task_attr *attr, const struct rdma_buffer_desc *desc)
 {
-    struct rdma_buffer *rdma_buff;
-    rdma_buff = (struct rdma_buffer *)calloc(1, sizeof *rdma_buff);
-    if (!rdma_buff) {
-        fprintf(stderr, "rdma_buff memory allocation failed\n");
-        return NULL;
-    }
+	struct rdma_exec_params exec_params = {};
+	union ibv_gid           rem_gid;
 
-    enum ibv_access_flags access_flags = (enum ibv_access_flags)(
-        (int)IBV_ACCESS_LOCAL_WRITE |
-        (int)IBV_ACCESS_REMOTE_READ |
-        (int)IBV_ACCESS_REMOTE_WRITE);
-    /*In the case of local buffer we can use IBV_ACCESS_LOCAL_WRITE only flag*/
-    DEBUG_LOG("ibv_reg_mr(pd %p, buf %p, size = %lu, access_flags = 0x%08x\n",
-               rdma_dev->pd, addr, length, access_flags);
-    rdma_buff->mr = ibv_reg_mr(rdma_dev->pd, addr, length, access_flags);
-    if (!rdma_buff->mr) {
-        fprintf(stderr, "Couldn't register GPU MR\n");
-        goto clean_rdma_buff;
-    }
-    DEBUG_LOG("ibv_reg_mr completed: buf %p, size = %lu, rkey = 0x%08x\n",
-               addr, length, rdma_buff->mr->rkey);
+	rdma_exec_params_set_local(&exec_params, attr);
 
-    rdma_buff->buf_addr = addr;
-    rdma_buff->buf_size = length;
-    rdma_buff->rkey     = rdma_buff->mr->rkey; /*not used for local buffer case*/
-    rdma_buff->rdma_dev = rdma_dev;
-    rdma_dev->rdma_buff_cnt++;
+	exec_params.rem_buf_addr = desc->addr;
+	exec_params.rem_buf_size = desc->size;
+	exec_params.rem_buf_rkey = desc->rkey;
+	exec_params.rem_dctn = desc->dctn;
+	memcpy(rem_gid.raw, desc->gid, sizeof(rem_gid.raw));
+	DEBUG_LOG_FAST_PATH("rem_buf_addr=0x%llx, rem_buf_size=%llu, rem_buf_offset=%lu, rem_buf_rkey=0x%lx, rem_lid=0x%hx, rem_dctn=0x%lx, is_global=%d\n",
+			exec_params.rem_buf_addr, exec_params.rem_buf_size, attr->remote_buf_offset, exec_params.rem_buf_rkey, desc->lid, exec_params.rem_dctn, desc->is_global);
 
-    return rdma_buff;
+	if (rdma_check_rem_range(exec_params.rem_buf_size, attr->remote_buf_offset, 0)) {
+		return EINVAL;
+	}
+	exec_params.rem_buf_addr += attr->remote_buf_offset;
+	exec_params.rem_buf_size -= attr->remote_buf_offset;
 
-clean_rdma_buff:
-    /* We don't decrement device rdma_buff_cnt because we still did not increment it,
-    we just free the allocated for rdma_buff memory. */
-    free(rdma_buff);
-    
-    return NULL;
+	exec_params.dci = rdma_select_dci(exec_params.device, desc->dctn, &rem_gid);
+	if (rdma_resolve_ah(exec_params.device, desc->lid, desc->is_global, &rem_gid, &exec_params.ah)) {
+		return 1;
+	}
+	return rdma_submit_exec_params(attr, &exec_params);
 }
 
 //============================================================================================
-void rdma_buffer_dereg(struct rdma_buffer *rdma_buff)
+/*
+ * Imported remote buffers are allocated from per-device slabs of
+ * REMOTE_BUF_SLAB_SIZE entries, so tens of thousands of handles cost one
+ * allocation per slab and no per-handle malloc. The AH is owned by the
+ * device AH cache and is shared between handles of the same client.
+ */
+struct rdma_remote_buffer *rdma_remote_buffer_import(struct rdma_device *rdma_dev, const struct rdma_buffer_desc *desc)
 {
-    int ret_val;
+    struct rdma_remote_buffer *rbuf;
+    union ibv_gid              rem_gid;
+    struct ibv_ah             *ah;
 
-    DEBUG_LOG("ibv_dereg_mr(%p)\n", rdma_buff->mr);
-    if (rdma_buff->mr) {
-        ret_val = ibv_dereg_mr(rdma_buff->mr);
-        if (ret_val) {
-            fprintf(stderr, "Couldn't deregister MR, error %d\n", ret_val);
-            return;
-        }
+    memcpy(rem_gid.raw, desc->gid, sizeof(rem_gid.raw));
+    if (rdma_resolve_ah(rdma_dev, desc->lid, desc->is_global, &rem_gid, &ah)) {
+        return NULL;
     }
-    rdma_buff->rdma_dev->rdma_buff_cnt--;
-    DEBUG_LOG("The buffer detached from rdma_device (%p). Number of attached to device buffers is %d.\n",
-              rdma_buff->rdma_dev, rdma_buff->rdma_dev->rdma_buff_cnt);
 
-    free(rdma_buff);
+    if (!rdma_dev->remote_buf_free) {
+        struct rdma_remote_buf_slab *slab;
+        int i;
+
+        slab = (struct rdma_remote_buf_slab *)calloc(1, sizeof *slab);
+        if (!slab) {
+            fprintf(stderr, "rdma_remote_buffer slab memory allocation failed\n");
+            return NULL;
+        }
+        for (i = 0; i < REMOTE_BUF_SLAB_SIZE - 1; i++) {
+            slab->entries[i].next_free = &slab->entries[i + 1];
+        }
+        slab->entries[REMOTE_BUF_SLAB_SIZE - 1].next_free = NULL;
+        slab->next = rdma_dev->remote_buf_slabs;
+        rdma_dev->remote_buf_slabs = slab;
+        rdma_dev->remote_buf_free = &slab->entries[0];
+        DEBUG_LOG("allocated rdma_remote_buffer slab %p (%d entries)\n", slab, REMOTE_BUF_SLAB_SIZE);
+    }
+    rbuf = rdma_dev->remote_buf_free;
+    rdma_dev->remote_buf_free = rbuf->next_free;
+
+    rbuf->addr     = desc->addr;
+    rbuf->size     = desc->size;
+    rbuf->rkey     = desc->rkey;
+    rbuf->dctn     = desc->dctn;
+    rbuf->ah       = ah;
+    rbuf->dci      = rdma_select_dci(rdma_dev, desc->dctn, &rem_gid);
+    rbuf->rdma_dev = rdma_dev;
+    rdma_dev->remote_buf_cnt++;
+
+    DEBUG_LOG("imported remote buffer %p: addr 0x%llx, size %llu, rkey 0x%08x, dctn 0x%06x, ah %p\n",
+              rbuf, (unsigned long long)rbuf->addr, (unsigned long long)rbuf->size, rbuf->rkey, rbuf->dctn, ah);
+    return rbuf;
 }
 
 //============================================================================================
-static void wire_gid_to_gid(const char *wgid, union ibv_gid *gid)
+void rdma_remote_buffer_release(struct rdma_remote_buffer *rbuf)
 {
-    char tmp[9];
-    uint32_t v32;
-    uint32_t *raw = (uint32_t *)gid->raw;
-    int i;
+    struct rdma_device *rdma_dev = rbuf->rdma_dev;
 
-    for (tmp[8] = 0, i = 0; i < 4; ++i) {
-        memcpy(tmp, wgid + i * 8, 8);
-        sscanf(tmp, "%x", &v32);
-        raw[i] = ntohl(v32);
-    }
+    rbuf->rdma_dev  = NULL;
+    rbuf->next_free = rdma_dev->remote_buf_free;
+    rdma_dev->remote_buf_free = rbuf;
+    rdma_dev->remote_buf_cnt--;
 }
 
-static void gid_to_wire_gid(const union ibv_gid *gid, char wgid[])
+//============================================================================================
+int rdma_submit_task_handle(struct rdma_task_attr *attr, struct rdma_remote_buffer *rbuf,
+                            size_t offset, size_t length)
 {
-    int i;
-    uint32_t *raw = (uint32_t *)gid->raw;
+	struct rdma_exec_params exec_params = {};
 
-    for (i = 0; i < 4; ++i)
-        sprintf(&wgid[i * 8], "%08x", htonl(raw[i]));
+	if (rdma_check_rem_range(rbuf->size, offset, length)) {
+		return EINVAL;
+	}
+	rdma_exec_params_set_local(&exec_params, attr);
+
+	exec_params.rem_buf_addr = rbuf->addr + offset;
+	exec_params.rem_buf_size = length ? length : rbuf->size - offset;
+	exec_params.rem_buf_rkey = rbuf->rkey;
+	exec_params.rem_dctn     = rbuf->dctn;
+	exec_params.ah           = rbuf->ah;
+	exec_params.dci          = rbuf->dci;
+	DEBUG_LOG_FAST_PATH("remote buffer %p: rem_buf_addr=0x%llx, rem_buf_size=%llu, rem_dctn=0x%lx\n",
+			rbuf, exec_params.rem_buf_addr, exec_params.rem_buf_size, exec_params.rem_dctn);
+
+	return rdma_submit_exec_params(attr, &exec_params);
 }
 
-//===============================================================================================
-/*                                       addr             size     rkey     lid  dctn   g gid   */
-#define BUFF_DESC_STRING_LENGTH (sizeof "0102030405060708:01020304:01020304:0102:010203:1:0102030405060708090a0b0c0d0e0f10")
-
-int rdma_buffer_get_desc_str(struct rdma_buffer *rdma_buff, char *desc_str, size_t desc_length)
+//============================================================================================
+int rdma_get_completion_fd(struct rdma_device *rdma_dev)
 {
-    if (desc_length < BUFF_DESC_STRING_LENGTH) {
-        fprintf(stderr, "desc string size (%lu) is less than required (%lu) for sending rdma_buffer attributes\n",
-                desc_length, BUFF_DESC_STRING_LENGTH);
-        return 0;
-    }
-    /*       addr             size     rkey     lid  dctn   g 
-            "0102030405060708:01020304:01020304:0102:010203:1:" */
-    sprintf(desc_str, "%016llx:%08lx:%08x:%04x:%06x:%d:",
-            (unsigned long long)rdma_buff->buf_addr,
-            (unsigned long)rdma_buff->buf_size,
-            rdma_buff->rkey,
-            rdma_buff->rdma_dev->lid,
-            rdma_buff->rdma_dev->qp->qp_num /* dctn */,
-            rdma_buff->rdma_dev->is_global & 0x1);
-    
-    gid_to_wire_gid(&rdma_buff->rdma_dev->gid, desc_str + sizeof "0102030405060708:01020304:01020304:0102:010203:1");
-    
-    return strlen(desc_str) + 1; /*including the terminating null character*/
+    return rdma_dev->comp_channel ? rdma_dev->comp_channel->fd : -1;
 }
 
-static int rdma_create_ah_cached(struct rdma_device *rdma_dev,
-                 struct ibv_ah_attr *ah_attr,
-                 struct ibv_ah **p_ah)
+int rdma_arm_completions(struct rdma_device *rdma_dev)
 {
-    int ret = -1;
-    khiter_t iter;
-
-    /* looking for existing AH with same attributes */
-    iter = kh_get(kh_ib_ah, &rdma_dev->ah_hash, *ah_attr);
-    if (iter == kh_end(&rdma_dev->ah_hash)) {
-
-        /* new AH */
-        DEBUG_LOG("ibv_create_ah(dlid=%d port=%d is_global=%d, tc=%d)\n",
-            ah_attr->dlid, ah_attr->port_num, ah_attr->is_global, (ah_attr->grh.traffic_class >> 5));
-        *p_ah = ibv_create_ah(rdma_dev->pd, ah_attr);
-
-        if (*p_ah == NULL) {
-            perror("ibv_create_ah");
-            goto out;
-        }
+    int ret_val;
 
-        /* store AH in hash */
-        iter = kh_put(kh_ib_ah, &rdma_dev->ah_hash, *ah_attr, &ret);
+    if (!rdma_dev->comp_channel) {
+        return EOPNOTSUPP;
+    }
+    ret_val = ibv_req_notify_cq(rdma_dev_cq(rdma_dev), 0 /*any completion*/);
+    if (ret_val) {
+        fprintf(stderr, "FAILURE: ibv_req_notify_cq failed (error=%d)\n", ret_val);
+    }
+    return ret_val;
+}
 
-        /* failed to store - rollback */
-        if (iter == kh_end(&rdma_dev->ah_hash)) {
-            perror("rdma_create_ah_cached failed storing");
-            ibv_destroy_ah(*p_ah);
-            goto out;
+int rdma_get_completion_event(struct rdma_device *rdma_dev)
+{
+    struct ibv_cq *ev_cq;
+    void          *ev_ctx;
+    int            got_event = 0;
+
+    if (!rdma_dev->comp_channel) {
+        return EOPNOTSUPP;
+    }
+    /* Drain all the pending events, the CQ is re-armed by the caller */
+    while (!ibv_get_cq_event(rdma_dev->comp_channel, &ev_cq, &ev_ctx)) {
+        got_event = 1;
+        if (++rdma_dev->unacked_cq_events >= CQ_EVENTS_ACK_BATCH) {
+            ibv_ack_cq_events(ev_cq, rdma_dev->unacked_cq_events);
+            rdma_dev->unacked_cq_events = 0;
         }
-
-        kh_value(&rdma_dev->ah_hash, iter) = *p_ah;
-        ret = 0;
-    } else {
-        /* found existing AH */
-        *p_ah = kh_value(&rdma_dev->ah_hash, iter);
-        ret = 0;
     }
-
-out:
-    return ret;
+    return got_event ? 0 : EAGAIN;
 }
 
-//============================================================================================
-static int buff_size_validation(struct rdma_task_attr *attr, unsigned long rem_buf_size)
+/*
+ * Release the WRs of a completed task WR and fill event with its wr_id and status.
+ * A chunk of a striped task reports the task only when it's the last to complete.
+ * returns: 1 if event was filled, 0 otherwise
+ */
+static int rdma_complete_wr(struct rdma_device *rdma_dev, struct rdma_dci *dci, int cq_wr_id,
+                            enum rdma_completion_status status, struct rdma_completion_event *event)
 {
-    size_t  total_len = 0;
-    int     i;
+    struct wr_id_reported *reported = &dci->app_wr_id[cq_wr_id];
 
-    for (i = 0; i < attr->local_buf_iovcnt; i++) {
-        if (((uint8_t*)attr->local_buf_iovec[i].iov_base < (uint8_t*)attr->local_buf_rdma->buf_addr) ||
-            ((uint8_t*)attr->local_buf_iovec[i].iov_base + attr->local_buf_iovec[i].iov_len >
-             (uint8_t*)attr->local_buf_rdma->buf_addr + attr->local_buf_rdma->buf_size)) {
+    if (!(reported->flags & WR_ID_FLAGS_ACTIVE)) {
+        return 0;
+    }
+    dci->qp_available_wr += reported->num_wrs;
+    if (reported->flags & WR_ID_FLAGS_SIGNAL) {
+        reported->flags = 0;
+        return 0;
+    }
+    if (reported->flags & WR_ID_FLAGS_STRIPE) {
+        struct rdma_stripe *stripe = &rdma_dev->stripes[reported->wr_id];
 
-            fprintf(stderr, "sge buffer %d (%p, %p) exceeds the local buffer bounary (%p, %p)\n", i,
-                    attr->local_buf_iovec[i].iov_base, (uint8_t*)attr->local_buf_iovec[i].iov_base + attr->local_buf_iovec[i].iov_len,
-                    attr->local_buf_rdma->buf_addr, (uint8_t*)attr->local_buf_rdma->buf_addr + attr->local_buf_rdma->buf_size);
-            return 1;
+        reported->flags = 0;
+        if (status != RDMA_STATUS_SUCCESS && stripe->status == RDMA_STATUS_SUCCESS) {
+            stripe->status = status;
         }
-        total_len += attr->local_buf_iovec[i].iov_len;
-        if (total_len > rem_buf_size) {
-            fprintf(stderr, "The sum of sge buffers lengths (%lu) exceeded the remote buffer size %lu on iteration %d\n",
-                    total_len, rem_buf_size, i);
-            return 1;
+        if (--stripe->remaining) {
+            return 0;
         }
+        event->wr_id  = stripe->wr_id;
+        event->status = stripe->status;
+        stripe->next_free = rdma_dev->stripe_free;
+        rdma_dev->stripe_free = stripe;
+        return 1;
     }
-    if ((attr->local_buf_iovcnt) && (total_len != rem_buf_size)) {
-        fprintf(stderr, "WARN: The sum of sge buffers lengths (%lu) differs from the remote buffer size %lu\n",
-                total_len, rem_buf_size);
+    reported->flags = 0;
+    event->wr_id  = reported->wr_id;
+    event->status = status;
+    return 1;
+}
+
+/*
+ * A CQE of the DCI: its entry, and the unsignaled ones before it, are
+ * completed, they're reported by rdma_report_completions()
+ */
+static inline void rdma_cqe_done(struct rdma_device *rdma_dev, struct rdma_dci *dci, int cq_wr_id,
+                                 enum rdma_completion_status status)
+{
+    int done;
+
+    if (!(dci->app_wr_id[cq_wr_id].flags & WR_ID_FLAGS_ACTIVE)) {
+        return;
     }
-    if ((!attr->local_buf_iovcnt) && (rem_buf_size > attr->local_buf_rdma->buf_size)) {
-        fprintf(stderr, "WARN: When not using sge list, the requested buffer size %lu is greater than allocated local size %lu\n",
-                rem_buf_size, attr->local_buf_rdma->buf_size);
+    dci->app_wr_id[cq_wr_id].status = status;
+    done = (cq_wr_id - dci->app_wr_id_tail + SEND_Q_DEPTH) % SEND_Q_DEPTH + 1;
+    if (done > dci->app_wr_id_done) {
+        dci->app_wr_id_done = done;
     }
-    return 0;
+    rdma_dev->completions_pending = 1;
 }
 
-//============================================================================================
-int rdma_submit_task(struct rdma_task_attr *attr)
+/*
+ * Report the completed entries of the DCIs in their order, as many as fit in
+ * num_entries events, the rest on the next call
+ * returns: the number of filled events
+ */
+static int rdma_report_completions(struct rdma_device *rdma_dev, struct rdma_completion_event *event,
+                                   int num_entries)
 {
-	struct rdma_exec_params exec_params = {};
-	uint16_t                rem_lid = 0;
-	int                     is_global = 0;
-    	union ibv_gid           rem_gid;
-    	int                     ret_val;
-
-	exec_params.wr_id = attr->wr_id;
-	exec_params.device = attr->local_buf_rdma->rdma_dev;
-	exec_params.flags = attr->flags;
-	exec_params.local_buf_mr_lkey = (uint32_t)attr->local_buf_rdma->mr->lkey;
-	exec_params.local_buf_addr = attr->local_buf_rdma->buf_addr;
-	exec_params.local_buf_iovec = attr->local_buf_iovec;
-	exec_params.local_buf_iovcnt = attr->local_buf_iovcnt;
-	/*
-	 * Parse desc string, extracting remote buffer address, size, rkey, lid, dctn, and if global is true, also gid
-	 */
-	DEBUG_LOG_FAST_PATH("Starting to parse desc string: \"%s\"\n", attr->remote_buf_desc_str);
-	/*   addr             size     rkey     lid  dctn   g gid                                              
-	 *  "0102030405060708:01020304:01020304:0102:010203:1:0102030405060708090a0b0c0d0e0f10"*/
-	sscanf(attr->remote_buf_desc_str, "%llx:%x:%lx:%hx:%lx:%d",
-			&exec_params.rem_buf_addr, &exec_params.rem_buf_size,
-		       	&exec_params.rem_buf_rkey, &rem_lid,
-			&exec_params.rem_dctn, &is_global);
-	memset(&rem_gid, 0, sizeof(rem_gid));
-	if (is_global) {
-		wire_gid_to_gid(attr->remote_buf_desc_str + sizeof "0102030405060708:01020304:01020304:0102:010203:1", &rem_gid);
-	}
-	DEBUG_LOG_FAST_PATH("rem_buf_addr=0x%llx, rem_buf_size=%u, rem_buf_offset=%lu, rem_buf_rkey=0x%lx, rem_lid=0x%hx, rem_dctn=0x%lx, is_global=%d\n",
-			exec_params.rem_buf_addr, exec_params.rem_buf_size, attr->remote_buf_offset, exec_params.rem_buf_rkey, rem_lid, exec_params.rem_dctn, is_global);
-       	DEBUG_LOG_FAST_PATH("Rem GID: %02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x\n",
-                        rem_gid.raw[0],  rem_gid.raw[1],  rem_gid.raw[2],  rem_gid.raw[3],
-                        rem_gid.raw[4],  rem_gid.raw[5],  rem_gid.raw[6],  rem_gid.raw[7], 
-                        rem_gid.raw[8],  rem_gid.raw[9],  rem_gid.raw[10], rem_gid.raw[11],
-                        rem_gid.raw[12], rem_gid.raw[13], rem_gid.raw[14], rem_gid.raw[15] );
-	DEBUG_LOG_FAST_PATH("rdma_task_attr_flags=%08x\n", exec_params.flags);
+    int reported_entries = 0;
 
-	/* upadte the remote buffer addr and size acording to the requested start offset */
-	exec_params.rem_buf_addr += attr->remote_buf_offset;
-	exec_params.rem_buf_size -= attr->remote_buf_offset;
+    rdma_dev->completions_pending = 0;
+    for (int i = 0; i < rdma_dev->num_dcis; i++) {
+        struct rdma_dci *dci = &rdma_dev->dcis[i];
 
-	/*
-	 * Pass attr->local_buf_iovec - local_buf_iovcnt elements and check that
-	 * the sum of local_buf_iovec[i].iov_len doesn't exceed rem_buf_size
-	 */
-	if (debug_fast_path) {
-		/* We do these validation code in debug mode only, because if something
-		 * is wrong in the fast path, the HW will give completion error */
-		ret_val = buff_size_validation(attr, exec_params.rem_buf_size);
-		if (ret_val) {
-			return ret_val;
-		}
-	}
-    
-    /* Check if address handler corresponding to the given key is present in the hash table,
-       if yes - return it and if it is not, create ah and add it to the hash table */
-    struct ibv_ah_attr  ah_attr;
+        while (dci->app_wr_id_done) {
+            int wr_id_idx = dci->app_wr_id_tail;
+            enum rdma_completion_status status = (enum rdma_completion_status)dci->app_wr_id[wr_id_idx].status;
 
-    memset(&ah_attr, 0, sizeof ah_attr);
-    ah_attr.is_global   = is_global;
-    ah_attr.dlid        = rem_lid;
-    ah_attr.port_num    = exec_params.device->ib_port;
-    
-    if (ah_attr.is_global) {
-        ah_attr.grh.hop_limit = 1;
-        ah_attr.grh.dgid = rem_gid;
-        ah_attr.grh.sgid_index = exec_params.device->gidx;
-        ah_attr.grh.traffic_class = TC_PRIO << 5; // <<3 for dscp2prio, <<2 for ECN bits
+            if (reported_entries == num_entries) {
+                rdma_dev->completions_pending = 1;
+                return reported_entries;
+            }
+            dci->app_wr_id[wr_id_idx].status = RDMA_STATUS_SUCCESS;
+            dci->app_wr_id_tail = (wr_id_idx + 1) % SEND_Q_DEPTH;
+            dci->app_wr_id_done--;
+            reported_entries += rdma_complete_wr(rdma_dev, dci, wr_id_idx, status, &event[reported_entries]);
+        }
     }
+    return reported_entries;
+}
 
-    if (rdma_create_ah_cached(exec_params.device, &ah_attr, &exec_params.ah)) {
-        return 1;
-    }
-    ret_val = rdma_exec_task(&exec_params);
+/*
+ * Selective signaling: signal the tasks left unsignaled on a DCI without any
+ * CQE to come, called when the CQ is empty
+ */
+static void rdma_signal_idle_dcis(struct rdma_device *rdma_dev)
+{
+    for (int i = 0; i < rdma_dev->num_dcis; i++) {
+        struct rdma_dci *dci = &rdma_dev->dcis[i];
+        int unsignaled_wrs = dci->unsignaled_wrs;
+        int wr_id_idx;
 
-    return ret_val;
+        if (!unsignaled_wrs || dci->qp_available_wr + unsignaled_wrs != SEND_Q_DEPTH) {
+            continue;
+        }
+        ibv_wr_start(dci->qpex);
+        wr_id_idx = rdma_dci_signal_post(dci);
+        if (wr_id_idx < 0) {
+            ibv_wr_abort(dci->qpex);
+            continue;
+        }
+        if (ibv_wr_complete(dci->qpex)) {
+            DEBUG_LOG_FAST_PATH("FAILURE: ibv_wr_complete of DCI %d signal\n", dci->index);
+            dci->app_wr_id[wr_id_idx].flags = 0;
+            dci->app_wr_id_idx = wr_id_idx;
+            dci->qp_available_wr++;
+            dci->unsignaled_wrs = unsignaled_wrs;
+        }
+    }
 }
 
 //============================================================================================
@@ -1384,12 +3368,21 @@ int rdma_poll_completions(struct rdma_device            *rdma_dev,
                           uint32_t                      num_entries)
 {
     int    reported_entries = 0;
+    int    polled = 0;
 
     if (num_entries > COMP_ARRAY_SIZE) {
         num_entries = COMP_ARRAY_SIZE; /* We don't returne more than 16 entries,
                         If user needs more, he can call rdma_poll_completions again */
     }
 
+    /* Completed entries which didn't fit in the events of the previous call */
+    if (rdma_dev->completions_pending) {
+        reported_entries = rdma_report_completions(rdma_dev, event, num_entries);
+        if (reported_entries == (int)num_entries) {
+            return reported_entries;
+        }
+    }
+
     /* Polling completion queue */
     //DEBUG_LOG_FAST_PATH("Polling completion queue: ibv_poll_cq\n");
 #ifdef PRINT_LATENCY
@@ -1404,20 +3397,16 @@ int rdma_poll_completions(struct rdma_device            *rdma_dev,
     }
     
     while (ret_val != ENOENT) {
-        uint64_t cq_wr_id = rdma_dev->cq->wr_id;
-        DEBUG_LOG_FAST_PATH("virtual wr_id %llu, original wr_id 0x%llx, num_wrs=%d\n",
-                            (long long unsigned int)cq_wr_id,
-                            (long long unsigned int)rdma_dev->app_wr_id[cq_wr_id].wr_id,
-                            rdma_dev->app_wr_id[cq_wr_id].num_wrs);
-        if (rdma_dev->app_wr_id[cq_wr_id].flags & WR_ID_FLAGS_ACTIVE) {
-		rdma_dev->app_wr_id[wc[i].wr_id].flags = 0;
-		rdma_dev->qp_available_wr += rdma_dev->app_wr_id[cq_wr_id].num_wrs;
-        	event[reported_entries].wr_id  = rdma_dev->app_wr_id[cq_wr_id].wr_id;
-        	event[reported_entries].status = rdma_dev->cq->status;
-        	reported_entries++;
-	}
+        struct rdma_dci *dci = &rdma_dev->dcis[DCI_WR_ID_DCI(rdma_dev->cq->wr_id)];
+        int cq_wr_id = DCI_WR_ID_IDX(rdma_dev->cq->wr_id);
+        DEBUG_LOG_FAST_PATH("DCI %d virtual wr_id %d, original wr_id 0x%llx, num_wrs=%d\n",
+                            dci->index, cq_wr_id,
+                            (long long unsigned int)dci->app_wr_id[cq_wr_id].wr_id,
+                            dci->app_wr_id[cq_wr_id].num_wrs);
+        rdma_cqe_done(rdma_dev, dci, cq_wr_id, (enum rdma_completion_status)rdma_dev->cq->status);
+        polled++;
         
-        rdma_dev->latency[cq_wr_id].completion_ts = ibv_wc_read_completion_ts(rdma_dev->cq);
+        dci->latency[cq_wr_id].completion_ts = ibv_wc_read_completion_ts(rdma_dev->cq);
         
         struct ibv_values_ex ts_values = {
             .comp_mask = IBV_VALUES_MASK_RAW_CLOCK,
@@ -1429,11 +3418,11 @@ int rdma_poll_completions(struct rdma_device            *rdma_dev,
             fprintf(stderr, "ibv_query_rt_values_ex failed after ibv_wr_start call\n");
             ts_values.raw_clock.tv_nsec = 0;
         }
-        rdma_dev->latency[cq_wr_id].read_comp_ts = ts_values.raw_clock.tv_nsec;
+        dci->latency[cq_wr_id].read_comp_ts = ts_values.raw_clock.tv_nsec;
 
-        uint64_t    wr_complete_latency = rdma_dev->latency[cq_wr_id].wr_complete_ts - rdma_dev->latency[cq_wr_id].wr_start_ts;
-        uint64_t    completion_latency  = rdma_dev->latency[cq_wr_id].completion_ts  - rdma_dev->latency[cq_wr_id].wr_start_ts;
-        uint64_t    read_comp_latency   = rdma_dev->latency[cq_wr_id].read_comp_ts   - rdma_dev->latency[cq_wr_id].completion_ts;
+        uint64_t    wr_complete_latency = dci->latency[cq_wr_id].wr_complete_ts - dci->latency[cq_wr_id].wr_start_ts;
+        uint64_t    completion_latency  = dci->latency[cq_wr_id].completion_ts  - dci->latency[cq_wr_id].wr_start_ts;
+        uint64_t    read_comp_latency   = dci->latency[cq_wr_id].read_comp_ts   - dci->latency[cq_wr_id].completion_ts;
         
         rdma_dev->measure_index++;
         rdma_dev->wr_complete_latency_sum += wr_complete_latency;
@@ -1484,25 +3473,38 @@ int rdma_poll_completions(struct rdma_device            *rdma_dev,
     struct ibv_wc wc[COMP_ARRAY_SIZE];
     int    i, wcn;
     
-    wcn = ibv_poll_cq(rdma_dev->cq, num_entries, wc);
+    wcn = ibv_poll_cq(rdma_dev->cq, num_entries - reported_entries, wc);
     if (wcn < 0) {
         fprintf(stderr, "poll CQ failed %d\n", wcn);
-        return 0;
+        return reported_entries;
     }
     
     for (i = 0; i < wcn; ++i) {
-        DEBUG_LOG_FAST_PATH("cqe idx %d: virtual wr_id %llu, original wr_id 0x%llx, num_wrs=%d\n",
-                            i, (long long unsigned int)wc[i].wr_id,
-                            (long long unsigned int)rdma_dev->app_wr_id[wc[i].wr_id].wr_id,
-                            rdma_dev->app_wr_id[wc[i].wr_id].num_wrs);
-        if (rdma_dev->app_wr_id[wc[i].wr_id].flags & WR_ID_FLAGS_ACTIVE) {
-		rdma_dev->app_wr_id[wc[i].wr_id].flags = 0;
-		rdma_dev->qp_available_wr += rdma_dev->app_wr_id[wc[i].wr_id].num_wrs;
-		event[reported_entries].wr_id  = rdma_dev->app_wr_id[wc[i].wr_id].wr_id;
-  		event[reported_entries].status = (enum rdma_completion_status)(wc[i].status);
-		reported_entries++;
-	}
-    }
+        struct rdma_dci *dci = &rdma_dev->dcis[DCI_WR_ID_DCI(wc[i].wr_id)];
+        int cq_wr_id = DCI_WR_ID_IDX(wc[i].wr_id);
+        DEBUG_LOG_FAST_PATH("cqe idx %d: DCI %d virtual wr_id %d, original wr_id 0x%llx, num_wrs=%d\n",
+                            i, dci->index, cq_wr_id,
+                            (long long unsigned int)dci->app_wr_id[cq_wr_id].wr_id,
+                            dci->app_wr_id[cq_wr_id].num_wrs);
+        rdma_cqe_done(rdma_dev, dci, cq_wr_id, (enum rdma_completion_status)(wc[i].status));
+    }
+    polled = wcn;
 #endif /*PRINT_LATENCY*/
+
+    if (polled) {
+        reported_entries += rdma_report_completions(rdma_dev, &event[reported_entries],
+                                                    num_entries - reported_entries);
+    } else if (rdma_dev->signal_period > 1 && !reported_entries) {
+        rdma_signal_idle_dcis(rdma_dev);
+    }
+
+    /* The completions made room for the streamed tasks */
+    if (rdma_dev->num_streams) {
+        for (int i = 0; i < rdma_dev->num_dcis; i++) {
+            if (rdma_dev->dcis[i].stream && rdma_dev->dcis[i].qp_available_wr > 0) {
+                rdma_stream_post(rdma_dev, &rdma_dev->dcis[i]);
+            }
+        }
+    }
     return reported_entries;
 }
@@ -42,8 +42,6 @@
 extern "C" {
 #endif
 
-#define MAX_SEND_SGE    10
-
 /*
  * rdma_device object holds the RDMA resources of the local RDMA device,
  * of a Targte or a Source
@@ -56,14 +54,63 @@ struct rdma_device;
  */
 struct rdma_buffer;
 
+/*
+ * rdma_remote_buffer is an imported (already parsed and resolved)
+ * description of a remote rdma_buffer, used by the Server
+ */
+struct rdma_remote_buffer;
+
 struct rdma_open_dev_attr {
     const char      *ib_devname;
     int             ib_port;
     int             gidx;
 };
 
+/*
+ * Optional attributes for rdma_open_device_server_ex(),
+ * a zero field means the default value
+ */
+struct rdma_device_attr {
+    int             num_dcis;   /* size of the DCI pool, default 1 */
+    int             comp_channel; /* create a completion events channel for the CQ */
+    uint16_t        cq_moderation_count;  /* CQ event moderation, if supported by the device */
+    uint16_t        cq_moderation_period; /* in usec */
+    uint32_t        stripe_size; /* chunk size of RDMA_TASK_ATTR_STRIPE tasks, 0 - no striping */
+    uint16_t        signal_period; /* request a CQE about every signal_period WRs of a DCI
+                                      (see rdma_poll_completions()), 0 - for every task */
+    int             max_inline_data; /* RDMA Writes up to it are sent inline, as far as the
+                                        DCIs take it, default 256, -1 - none */
+    int             comp_vector; /* completion vector of the CQ, modulo the vectors of the device,
+                                    e.g. the worker index, default 0 */
+};
+
+/*
+ * Limits of the device, the buffers and tasks have to fit in
+ */
+struct rdma_device_caps {
+    uint64_t        max_mr_size;    /* bytes of one registration */
+    uint32_t        max_msg_size;   /* bytes of one WR, larger tasks are split in several WRs */
+    uint32_t        max_send_sge;   /* sges of one WR, longer gather lists are chained over several WRs */
+    uint32_t        max_inline_data; /* bytes of an RDMA Write sent inline (server) */
+    int             numa_node;      /* of the NIC, -1 - unknown */
+    int             num_local_cpus; /* CPUs local to the NIC, 0 - unknown */
+    int             num_comp_vectors;
+    int             comp_vector;    /* of the CQ (server) */
+};
+
 enum rdma_task_attr_flags {
         RDMA_TASK_ATTR_RDMA_READ = 1 << 0,
+        /* After the data, write notify_value (8 bytes) at notify_offset of notify_buf */
+        RDMA_TASK_ATTR_NOTIFY    = 1 << 1,
+        /* May be striped over the DCIs, the task is then no longer ordered
+         * with the other tasks to its destination (see rdma_submit_task()) */
+        RDMA_TASK_ATTR_STRIPE    = 1 << 2,
+};
+
+/* A segment of the remote buffer, at offset from the start of the task range */
+struct rdma_remote_sge {
+        uint64_t                 offset;
+        uint64_t                 length;
 };
 
 struct rdma_task_attr {
@@ -75,6 +122,19 @@ struct rdma_task_attr {
         int                      local_buf_iovcnt;
         uint32_t                 flags; /* Use enum rdma_task_attr_flags */
         uint64_t                 wr_id;
+        /* Optional imported remote buffer, used instead of remote_buf_desc_str,
+         * with remote_buf_length bytes (0 - up to the end of the remote buffer) */
+        struct rdma_remote_buffer *remote_buf;
+        size_t                   remote_buf_length;
+        /* Completion slot for RDMA_TASK_ATTR_NOTIFY, must belong to the same Client
+         * (DCT) as the remote buffer of the task */
+        struct rdma_remote_buffer *notify_buf;
+        size_t                   notify_offset;
+        uint64_t                 notify_value;
+        /* Optional remote scatter list, the data goes to (comes from) these
+         * segments in order instead of the contiguous remote range */
+        const struct rdma_remote_sge *remote_sgl;
+        int                      remote_sgl_cnt;
 };
 /*
  * Open a RDMA device and allocated requiered resources.
@@ -88,8 +148,43 @@ struct rdma_task_attr {
  * returns: a pointer to a rdma_device object or NULL on error
  */
 struct rdma_device *rdma_open_device_client(struct sockaddr *addr);
+
+/*
+ * Client: open the RDMA device nearest on PCIe to the GPU of gpu_bdf
+ * (e.g. "b7:00.0"), by the ip address of its net device. The NICs are
+ * ranked by gdr::PciTopology (pci_topology.hpp), the nearest one with an
+ * address is opened.
+ *
+ * returns: a pointer to a rdma_device object or NULL on error
+ */
+struct rdma_device *rdma_open_device_client_near(const char *gpu_bdf);
 struct rdma_device *rdma_open_device_server(struct sockaddr *addr);
 
+/*
+ * Same as rdma_open_device_server() with optional attributes (attr may be NULL).
+ * With num_dcis > 1 the Server creates a pool of DCIs sharing one CQ, and
+ * each task is dispatched to a DCI by hashing its destination (DCT number
+ * and GID): tasks to one Client keep their order, while different Clients
+ * proceed in parallel on different send queues.
+ */
+struct rdma_device *rdma_open_device_server_ex(struct sockaddr *addr, const struct rdma_device_attr *attr);
+
+/*
+ * Query the limits of the device
+ *
+ * returns: 0 on success, or the value of errno on failure
+ */
+int rdma_device_get_caps(struct rdma_device *device, struct rdma_device_caps *caps);
+
+/*
+ * Bind the calling thread to the CPUs local to the NIC (its NUMA node): to the
+ * cpu_index-th of them (modulo their number), e.g. a polling thread per core,
+ * or to all of them with cpu_index < 0.
+ *
+ * returns: 0 on success, ENOENT if the CPUs of the NIC are unknown, or the value of errno
+ */
+int rdma_device_bind_thread(struct rdma_device *device, int cpu_index);
+
 /*
  * Reset device from failed state back to an operations state 
  */
@@ -106,6 +201,62 @@ void rdma_close_device(struct rdma_device *device);
 struct rdma_buffer *rdma_buffer_reg(struct rdma_device *device, void *addr, size_t length);
 void rdma_buffer_dereg(struct rdma_buffer *buffer);
 
+/*
+ * Register a buffer which is only the source of RDMA writes (local read
+ * access), so it may be a read-only mapping, e.g. of a file: its pages are
+ * pinned without write faults and RDMA goes from the page cache. Bypasses
+ * the registration cache; released with rdma_buffer_dereg().
+ */
+struct rdma_buffer *rdma_buffer_reg_readonly(struct rdma_device *device, void *addr, size_t length);
+
+/*
+ * Sub-view of a registered buffer: an rdma_buffer of [offset, offset + length)
+ * of parent which shares its MR, so it costs no registration. Views are
+ * released with rdma_buffer_dereg(), before their parent.
+ */
+struct rdma_buffer *rdma_buffer_view(struct rdma_buffer *parent, size_t offset, size_t length);
+
+/*
+ * Memory registration cache of a device
+ *
+ * Once enabled, rdma_buffer_reg() reuses a cached MR which covers the whole
+ * requested range instead of calling ibv_reg_mr(), and rdma_buffer_dereg()
+ * keeps the MR cached (reference counted) for the next registrations.
+ * Otherwise the range is registered together with the cached MRs overlapping
+ * or adjacent to it, as one MR which replaces them: buffers carved out of one
+ * allocation end up served by one MR. The replaced MRs still in use are
+ * deregistered by their last rdma_buffer_dereg().
+ * Unused MRs are evicted in LRU order to keep the pinned bytes within
+ * max_pinned_bytes (0 - unlimited); a registration which doesn't fit even
+ * after evicting all of them fails.
+ *
+ * A cached MR pins the pages it was registered with: memory which is freed
+ * (or remapped) while it may still be cached must be invalidated with
+ * rdma_reg_cache_invalidate() before it is reused.
+ *
+ * returns: 0 on success, or an errno value
+ */
+int rdma_reg_cache_enable(struct rdma_device *device, size_t max_pinned_bytes);
+
+/*
+ * Drop the cached MRs overlapping [addr, addr + length). MRs still in use
+ * are no longer reused, and are deregistered by their last rdma_buffer_dereg().
+ */
+void rdma_reg_cache_invalidate(struct rdma_device *device, void *addr, size_t length);
+
+struct rdma_reg_cache_stats {
+    uint64_t        hits;           /* registrations served by a cached MR */
+    uint64_t        misses;         /* registrations which called ibv_reg_mr() */
+    uint64_t        evictions;
+    size_t          pinned_bytes;   /* bytes registered by the cache MRs */
+    int             num_regions;    /* cached MRs */
+};
+
+/*
+ * returns: 0 on success, or ENOENT if the device has no registration cache
+ */
+int rdma_reg_cache_get_stats(struct rdma_device *device, struct rdma_reg_cache_stats *stats);
+
 /*
  * Get a rdma_buffer address description string representations
  *
@@ -119,6 +270,44 @@ void rdma_buffer_dereg(struct rdma_buffer *buffer);
  */
 int rdma_buffer_get_desc_str(struct rdma_buffer *rdma_buff, char *desc_str, size_t desc_length);
 
+/*
+ * Binary rdma_buffer description, a fixed layout alternative to the
+ * description string above. On the wire all multi-byte fields are
+ * little-endian; after rdma_buffer_desc_decode() they are in host order.
+ */
+#define RDMA_BUFFER_DESC_MAGIC      0x4744 /* "GD" */
+#define RDMA_BUFFER_DESC_VERSION    1
+
+struct rdma_buffer_desc {
+        uint16_t                 magic;
+        uint8_t                  version;
+        uint8_t                  is_global;
+        uint16_t                 lid;
+        uint16_t                 reserved;
+        uint64_t                 addr;
+        uint64_t                 size;
+        uint32_t                 rkey;
+        uint32_t                 dctn;
+        uint8_t                  gid[16];
+} __attribute__((packed));
+
+/*
+ * Encode the rdma_buffer description into its wire format.
+ *
+ * desc is output, desc_length is input size in bytes of desc
+ *
+ * returns: the number of bytes written into desc, or 0 on error
+ */
+int rdma_buffer_desc_encode(struct rdma_buffer *rdma_buff, void *desc, size_t desc_length);
+
+/*
+ * Decode and validate (magic, version and length) a wire description
+ * received from the Client into host order rdma_buffer_desc.
+ *
+ * returns: 0 on success, or EINVAL on malformed description
+ */
+int rdma_buffer_desc_decode(const void *wire_desc, size_t wire_length, struct rdma_buffer_desc *desc);
+
 /*
  * Issue a RDMA WRITE operation from a local buffer to a remote buffer, 
  * or a RDMA READ operation from remote buffer to a local buffer,
@@ -129,14 +318,114 @@ int rdma_buffer_get_desc_str(struct rdma_buffer *rdma_buff, char *desc_str, size
  * the rdma info.
  * We don't pass struct rdma_device as parameter, because we can get it using
  * rdma_task_attr struct field local_buf_rdma
+ * Without a gather list, the task moves the size of the remote range from the
+ * start of local_buf_rdma, which must hold it.
  *
  * On completion of the RDMA operation, the status and wr_id will be reported
  * from rdma_poll_completions()
  *
- * returns: 0 on success, or the value of errno on failure
+ * Sizes are 64-bit, a task larger than the max_msg_size of the device (see
+ * rdma_device_get_caps()), or an sge larger than it, is split in several WRs
+ * and still reported once. The gather list may be of any length, a WR takes
+ * up to max_send_sge of it. A task which needs more WRs than a send queue
+ * holds is streamed: posted in pieces as the completions free the send queue,
+ * so local_buf_iovec has to stay valid until the task is reported, and the
+ * following tasks to the same Client fail as on a full send queue until all
+ * of it is posted.
+ *
+ * An RDMA Write WR of up to max_inline_data bytes (see rdma_device_get_caps())
+ * carries its data in the WQE: the NIC doesn't read the local buffer, which
+ * may then be unregistered memory (local_buf_rdma still gives the device) and
+ * may be reused as soon as the call returns.
+ *
+ * With RDMA_TASK_ATTR_NOTIFY, a fenced 8-byte RDMA Write of notify_value to
+ * notify_buf is posted after the data, so once the Client sees the value in its
+ * completion slot the data operation is complete, without a message from the Server.
+ *
+ * With remote_sgl, the local data is scattered over remote_sgl_cnt segments
+ * of the remote range (from remote_buf_offset), each a WR at least, the task
+ * moves the sum of their lengths, which must equal the local gather list total
+ * if there is one. The segments must be non empty and inside the remote range.
+ * The scatter list has to stay valid until the task is reported if the task
+ * is streamed.
+ *
+ * With RDMA_TASK_ATTR_STRIPE, a task larger than the stripe_size of the device,
+ * with a contiguous local buffer and remote range, and without
+ * RDMA_TASK_ATTR_NOTIFY, is split in chunks of about stripe_size posted round
+ * robin over the DCIs, so one large transfer isn't limited to a single send
+ * queue. As unstriped, it moves the length of the shorter of the local buffer
+ * and the remote range. It's reported once by rdma_poll_completions(), when
+ * all of its chunks completed, with the status of the first failed chunk if
+ * any. The chunks may land after later tasks to the same Client, which are
+ * posted on its DCI only.
+ *
+ * returns: 0 on success, EAGAIN if the send queue is full (the DCI of the
+ * task is out of WRs or busy streaming a task, the DCIs of a striped task are
+ * out of WRs): the task may be submitted again after completions are polled,
+ * EINVAL if the remote range (remote_buf_offset and remote_buf_length) is out
+ * of the remote buffer or, without a gather list, larger than the local buffer,
+ * or the value of errno on other failures
  */
 int rdma_submit_task(struct rdma_task_attr *attr);
 
+/*
+ * Same as rdma_submit_task(), but the remote buffer is described by a
+ * decoded rdma_buffer_desc, and attr->remote_buf_desc_str is ignored.
+ * No string parsing is done on this path.
+ *
+ * returns: 0 on success, EAGAIN if the send queue is full, or the value of
+ * errno on failure (see rdma_submit_task())
+ */
+int rdma_submit_task_desc(struct rdma_task_attr *attr, const struct rdma_buffer_desc *desc);
+
+/*
+ * Import a remote buffer description once, resolving its address handler,
+ * so repeated tasks to the same Client buffer skip descriptor parsing and
+ * the AH lookup. Handles are allocated from compact per-device slabs.
+ * The handle is valid until released or until the device is closed.
+ *
+ * returns: a pointer to a rdma_remote_buffer object or NULL on error
+ */
+struct rdma_remote_buffer *rdma_remote_buffer_import(struct rdma_device *device, const struct rdma_buffer_desc *desc);
+void rdma_remote_buffer_release(struct rdma_remote_buffer *rbuf);
+
+/*
+ * Same as rdma_submit_task(), but the remote range is given by an imported
+ * handle, starting at offset and of length bytes (0 - up to the end of the
+ * remote buffer). attr->remote_buf_desc_str and remote_buf_offset are ignored.
+ *
+ * returns: 0 on success, EAGAIN if the send queue is full, EINVAL if the
+ * range is out of the remote buffer, or the value of errno on failure
+ * (see rdma_submit_task())
+ */
+int rdma_submit_task_handle(struct rdma_task_attr *attr, struct rdma_remote_buffer *rbuf,
+                            size_t offset, size_t length);
+
+/*
+ * Post num_tasks tasks, possibly to different Clients, with a single
+ * doorbell (one ibv_wr_start()/ibv_wr_complete() pair) per used DCI on the
+ * device of attrs[0].local_buf_rdma. Each task is reported by its own
+ * wr_id from rdma_poll_completions().
+ *
+ * Tasks are posted in order; on a failure to prepare or post task i, the
+ * tasks before it are still posted and tasks i..num_tasks-1 are not.
+ * A striped task, or a task streamed for needing more WRs than the send queue
+ * holds, is posted as by rdma_submit_task(): the doorbells of the tasks before
+ * it are rung first, and the tasks after it start new doorbells.
+ * If ringing the doorbell of a DCI fails, the tasks of that DCI are dropped,
+ * not counted in the return value and never reported: the posted tasks are
+ * not always a prefix of attrs, results tells which ones were.
+ * The last WR of the batch on each DCI is signaled, whatever the signal_period.
+ *
+ * results (NULL - not needed) gets the result of each task: 0 if it was
+ * posted, the error of task i as rdma_submit_task() returns it (EAGAIN if the
+ * send queue is full), EIO for a task dropped with the doorbell of its DCI,
+ * and ECANCELED for the tasks after task i, which weren't tried.
+ *
+ * returns: the number of posted tasks (num_tasks on full success)
+ */
+int rdma_submit_tasks(struct rdma_task_attr *attrs, int num_tasks, int *results);
+
 enum rdma_completion_status {
 	RDMA_STATUS_SUCCESS,
 	RDMA_STATUS_ERR_LAST,
@@ -147,10 +436,35 @@ struct rdma_completion_event {
 	enum rdma_completion_status status;
 };
 
+/*
+ * Completion events, for a server device opened with rdma_device_attr.comp_channel,
+ * to sleep instead of busy polling when no completions are expected soon.
+ *
+ * rdma_get_completion_fd() returns a non-blocking fd which becomes readable on a
+ * completion event (to be used with poll/epoll), or -1 without a channel.
+ * rdma_arm_completions() requests an event for the next completion, it's one-shot.
+ * Completions which arrived before arming don't raise an event, so poll the CQ
+ * once more after arming and before going to sleep.
+ * rdma_get_completion_event() consumes the pending events of the fd.
+ *
+ * returns: 0 on success, EAGAIN if there is no pending event,
+ *          or EOPNOTSUPP for a device without a completion channel
+ */
+int rdma_get_completion_fd(struct rdma_device *device);
+int rdma_arm_completions(struct rdma_device *device);
+int rdma_get_completion_event(struct rdma_device *device);
+
 /*
  * Return rdma operations which have completed.
  * the event will hold the requets id (wr_id) and the status of the operation.
  *
+ * With a signal_period, only some of the WRs of a DCI generate a CQE: one
+ * every signal_period WRs, the last task of a rdma_submit_tasks() batch on
+ * each DCI, and a task posted while no CQE is expected on its DCI. A CQE
+ * reports the tasks posted before it on the DCI as well, in their order.
+ * The tasks left behind the last CQE of an idle DCI are signaled by a zero
+ * length RDMA Write, posted when a call finds the CQ empty.
+ *
  * returns: number of reported events in the event array (<= num_entries)
  */
 int rdma_poll_completions(struct rdma_device *device,
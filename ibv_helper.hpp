@@ -7,6 +7,7 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -108,3 +109,36 @@ int ibv_find_sgid_type(struct ibv_context *context, uint8_t port_num,
 }
 
 
+/* NUMA node of the PCI function of the device, -1 if unknown (e.g. a single node system) */
+static int ibv_query_numa_node(struct ibv_context* context) {
+    try {
+        return std::stoi(ibv_read_sysfs_file(context->device->ibdev_path, "device/numa_node"));
+    } catch (const std::exception&) {
+        return -1;
+    }
+}
+
+/*
+ * CPUs local to the device, from its sysfs "device/local_cpulist",
+ * e.g. "0-15,32-47". Returns the number of CPUs, 0 if unknown.
+ */
+static int ibv_query_local_cpus(struct ibv_context* context, cpu_set_t* cpus) {
+    CPU_ZERO(cpus);
+    try {
+        std::istringstream list(ibv_read_sysfs_file(context->device->ibdev_path, "device/local_cpulist"));
+        std::string range;
+
+        while (std::getline(list, range, ',')) {
+            size_t dash = range.find('-');
+            int first = std::stoi(range);
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+
+            for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+                CPU_SET(cpu, cpus);
+            }
+        }
+    } catch (const std::exception&) {
+        CPU_ZERO(cpus);
+    }
+    return CPU_COUNT(cpus);
+}
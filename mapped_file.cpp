@@ -0,0 +1,105 @@
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ  22
+#endif
+
+namespace gdr {
+
+MappedFile::MappedFile(rdma_device* device, const std::string& path, size_t max_segment, unsigned populate_threads)
+    : addr_(nullptr), size_(0), populate_seconds_(0), reg_seconds_(0) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    struct stat st = {};
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "MappedFile: can't open " + path);
+    }
+    if (fstat(fd, &st) || !st.st_size) {
+        int err = st.st_size ? errno : EINVAL;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "MappedFile: can't map " + path);
+    }
+    size_ = st.st_size;
+    addr_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr_ == MAP_FAILED) {
+        addr_ = nullptr;
+        throw std::system_error(errno, std::generic_category(), "MappedFile: mmap of " + path + " failed");
+    }
+    madvise(addr_, size_, MADV_WILLNEED);
+
+    auto populate_start = std::chrono::steady_clock::now();
+    populate(std::max(populate_threads, 1U));
+    std::chrono::duration<double> populate_time = std::chrono::steady_clock::now() - populate_start;
+    populate_seconds_ = populate_time.count();
+
+    /* The segments start page aligned, the last one ends with the file */
+    segment_size_ = std::max(max_segment & ~(page_size - 1), page_size);
+    auto reg_start = std::chrono::steady_clock::now();
+    for (uint64_t offset = 0; offset < size_; offset += segment_size_) {
+        Segment seg = { offset, static_cast<size_t>(std::min<uint64_t>(segment_size_, size_ - offset)), nullptr };
+
+        seg.rdma_buff = rdma_buffer_reg_readonly(device, addr(offset), seg.length);
+        if (!seg.rdma_buff) {
+            unmap();
+            throw std::system_error(EFAULT, std::generic_category(), "MappedFile: registration of " + path + " failed");
+        }
+        segments_.push_back(seg);
+    }
+    std::chrono::duration<double> reg_time = std::chrono::steady_clock::now() - reg_start;
+    reg_seconds_ = reg_time.count();
+}
+
+MappedFile::~MappedFile() {
+    unmap();
+}
+
+void MappedFile::unmap() {
+    for (Segment& seg : segments_) {
+        rdma_buffer_dereg(seg.rdma_buff);
+    }
+    segments_.clear();
+    munmap(addr_, size_);
+}
+
+/*
+ * Fault the pages of the file in, each thread a slice of the mapping, so the
+ * registration only pins them and the first requests don't wait for the disk
+ */
+void MappedFile::populate(unsigned threads) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t slice = ((size_ / threads) + page_size - 1) & ~(page_size - 1);
+    std::vector<std::thread> workers;
+
+    slice = std::max(slice, page_size);
+    for (uint64_t offset = 0; offset < size_; offset += slice) {
+        workers.emplace_back([this, offset, slice, page_size] {
+            uint8_t* start = static_cast<uint8_t*>(addr(offset));
+            size_t length = std::min<uint64_t>(slice, size_ - offset);
+
+            if (madvise(start, length, MADV_POPULATE_READ)) {
+                /* Before Linux 5.14, touch the pages */
+                volatile uint8_t sink;
+                for (size_t i = 0; i < length; i += page_size) {
+                    sink = start[i];
+                }
+                (void)sink;
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+} // namespace gdr
@@ -0,0 +1,63 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+
+#include "gpu_direct_rdma_access.h"
+
+namespace gdr {
+
+/*
+ * A file mapped read-only and registered with the RDMA device, so RDMA writes
+ * go straight from the page cache: no read and no copy into a staging buffer.
+ * The mapping is populated by several threads in parallel before it's
+ * registered, in segments of at most max_segment bytes (e.g. the MR size limit
+ * of the device), each its own MR. A range of the file is written by one task
+ * per segment it spans.
+ *
+ * The file is expected not to change while it's mapped, its size is taken once.
+ */
+class MappedFile {
+public:
+    struct Segment {
+        uint64_t        offset;     /* in the file */
+        size_t          length;
+        rdma_buffer*    rdma_buff;
+    };
+
+    /* Throws std::system_error if the file can't be mapped or registered */
+    MappedFile(rdma_device* device, const std::string& path, size_t max_segment, unsigned populate_threads);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    uint64_t size() const { return size_; }
+    void* addr(uint64_t offset) const { return static_cast<uint8_t*>(addr_) + offset; }
+
+    /* The segment holding offset, which must be below size() */
+    const Segment& segment(uint64_t offset) const {
+        assert(offset < size_);
+        return segments_[offset / segment_size_];
+    }
+    const std::vector<Segment>& segments() const { return segments_; }
+
+    double populate_seconds() const { return populate_seconds_; }
+    double reg_seconds() const { return reg_seconds_; }
+
+private:
+    void populate(unsigned threads);
+    void unmap();
+
+    void* addr_;
+    uint64_t size_;
+    size_t segment_size_;
+    std::vector<Segment> segments_;
+    double populate_seconds_;
+    double reg_seconds_;
+};
+
+} // namespace gdr
@@ -0,0 +1,169 @@
+#include "mem_provider.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mman.h>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND           2
+#endif
+#ifndef MPOL_MF_STRICT
+#define MPOL_MF_STRICT      (1 << 0)
+#endif
+#ifndef MFD_HUGE_2MB
+#define MFD_HUGE_2MB        (21U << 26)
+#endif
+
+namespace gdr {
+
+namespace {
+
+constexpr size_t PAGE_4K = 4096;
+constexpr size_t PAGE_2M = 2UL << 20;
+constexpr size_t PAGE_1G = 1UL << 30;
+constexpr int MAX_NUMA_NODE = 1023;
+
+/*
+ * Anonymous or memfd backed mmap() of one page size, optionally bound to a
+ * NUMA node. The node policy is set before the first touch of the pages,
+ * which happens when the memory is registered (pinned).
+ */
+class MmapProvider : public MemProvider {
+public:
+    MmapProvider(size_t page_size, bool shared, int node)
+        : page_size_(page_size), shared_(shared), node_(node) {}
+
+    MemRegion alloc(size_t size) override {
+        MemRegion region = { nullptr, (size + page_size_ - 1) & ~(page_size_ - 1), -1 };
+        int flags = shared_ ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS;
+
+        if (!size) {
+            throw std::invalid_argument("MemProvider: zero size allocation");
+        }
+        if (page_size_ != PAGE_4K && !shared_) {
+            flags |= MAP_HUGETLB | (page_size_ == PAGE_2M ? MAP_HUGE_2MB : MAP_HUGE_1GB);
+        }
+        if (shared_) {
+            region.fd = memfd_create("gdr-buffer", MFD_CLOEXEC | (page_size_ != PAGE_4K ? MFD_HUGETLB | MFD_HUGE_2MB : 0));
+            if (region.fd < 0) {
+                throw std::system_error(errno, std::generic_category(), "MemProvider " + name() + ": memfd_create failed");
+            }
+            if (ftruncate(region.fd, region.size)) {
+                int err = errno;
+                close(region.fd);
+                throw std::system_error(err, std::generic_category(), "MemProvider " + name() + ": ftruncate failed");
+            }
+        }
+
+        region.addr = mmap(nullptr, region.size, PROT_READ | PROT_WRITE, flags, region.fd, 0);
+        if (region.addr == MAP_FAILED) {
+            int err = errno;
+            if (region.fd >= 0) {
+                close(region.fd);
+            }
+            throw std::system_error(err, std::generic_category(), "MemProvider " + name() +
+                                    ": mmap failed" + (page_size_ != PAGE_4K ? " (are enough hugepages reserved?)" : ""));
+        }
+
+        if (node_ >= 0) {
+            unsigned long nodemask[MAX_NUMA_NODE / (8 * sizeof(unsigned long)) + 1] = {};
+
+            nodemask[node_ / (8 * sizeof(unsigned long))] = 1UL << (node_ % (8 * sizeof(unsigned long)));
+            if (syscall(SYS_mbind, region.addr, region.size, MPOL_BIND, nodemask, MAX_NUMA_NODE + 1, MPOL_MF_STRICT)) {
+                int err = errno;
+                this->free(region);
+                throw std::system_error(err, std::generic_category(), "MemProvider " + name() + ": mbind failed");
+            }
+        }
+        return region;
+    }
+
+    void free(const MemRegion& region) override {
+        munmap(region.addr, region.size);
+        if (region.fd >= 0) {
+            close(region.fd);
+        }
+    }
+
+    std::string name() const override {
+        std::string kind = shared_ ? "shm" : "host";
+
+        if (page_size_ == PAGE_2M) {
+            kind = shared_ ? "shm-huge2m" : "huge2m";
+        } else if (page_size_ == PAGE_1G) {
+            kind = "huge1g";
+        }
+        return node_ >= 0 ? kind + "@" + std::to_string(node_) : kind;
+    }
+
+    size_t page_size() const override { return page_size_; }
+
+private:
+    size_t page_size_;
+    bool shared_;
+    int node_;
+};
+
+std::unique_ptr<MemProvider>& default_provider_slot() {
+    static std::unique_ptr<MemProvider> provider;
+    return provider;
+}
+
+} // namespace
+
+std::unique_ptr<MemProvider> MemProvider::create(const std::string& spec) {
+    std::string kind = spec;
+    std::string node_str;
+    int node = -1;
+
+    size_t sep = spec.find('@');
+    if (spec.compare(0, 5, "numa:") == 0) {
+        kind = "host";
+        node_str = spec.substr(5);
+    } else if (sep != std::string::npos) {
+        kind = spec.substr(0, sep);
+        node_str = spec.substr(sep + 1);
+    }
+    if (kind != spec) {
+        char* end;
+        node = std::strtol(node_str.c_str(), &end, 10);
+        if (node_str.empty() || *end || node < 0 || node > MAX_NUMA_NODE) {
+            throw std::invalid_argument("Invalid NUMA node in memory provider \"" + spec + "\"");
+        }
+    }
+
+    if (kind == "host") {
+        return std::unique_ptr<MemProvider>(new MmapProvider(PAGE_4K, false, node));
+    }
+    if (kind == "huge2m") {
+        return std::unique_ptr<MemProvider>(new MmapProvider(PAGE_2M, false, node));
+    }
+    if (kind == "huge1g") {
+        return std::unique_ptr<MemProvider>(new MmapProvider(PAGE_1G, false, node));
+    }
+    if (kind == "shm") {
+        return std::unique_ptr<MemProvider>(new MmapProvider(PAGE_4K, true, node));
+    }
+    if (kind == "shm-huge2m") {
+        return std::unique_ptr<MemProvider>(new MmapProvider(PAGE_2M, true, node));
+    }
+    throw std::invalid_argument("Unknown memory provider \"" + spec + "\"");
+}
+
+MemProvider& default_mem_provider() {
+    std::unique_ptr<MemProvider>& provider = default_provider_slot();
+
+    if (!provider) {
+        provider = MemProvider::create("host");
+    }
+    return *provider;
+}
+
+void set_default_mem_provider(std::unique_ptr<MemProvider> provider) {
+    default_provider_slot() = std::move(provider);
+}
+
+} // namespace gdr
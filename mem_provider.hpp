@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include <system_error>
+
+namespace gdr {
+
+/* Memory allocated by a provider */
+struct MemRegion {
+    void*   addr;
+    size_t  size;   /* rounded up to the page size of the provider */
+    int     fd;     /* memfd of a shared memory region, another process may map it, else -1 */
+};
+
+/*
+ * Source of the memory registered for RDMA. Larger pages need fewer MTT
+ * entries (and IOTLB entries with an IOMMU), which makes the registration of
+ * large buffers faster and the accesses of the HCA to them cheaper.
+ */
+class MemProvider {
+public:
+    virtual ~MemProvider() {}
+
+    /* Throws std::system_error if the memory can't be allocated */
+    virtual MemRegion alloc(size_t size) = 0;
+    virtual void free(const MemRegion& region) = 0;
+    virtual std::string name() const = 0;
+    /* The allocations are rounded up to it */
+    virtual size_t page_size() const = 0;
+
+    /*
+     * Create a provider from its description:
+     *   host        anonymous memory of 4 KB pages (default)
+     *   huge2m      explicit 2 MB hugepages (MAP_HUGETLB, from the hugetlbfs pool)
+     *   huge1g      explicit 1 GB hugepages
+     *   shm         memfd shared memory, "shm-huge2m" with 2 MB hugepages
+     *   numa:<node> host memory bound to the NUMA node
+     * Any of them may be bound to a NUMA node with an "@<node>" suffix, e.g. "huge2m@1".
+     * Throws std::invalid_argument for an unknown description.
+     */
+    static std::unique_ptr<MemProvider> create(const std::string& spec);
+};
+
+/*
+ * The process-wide provider, selected once at startup (e.g. from the command
+ * line) before any memory is allocated; host pages if none was set.
+ */
+MemProvider& default_mem_provider();
+void set_default_mem_provider(std::unique_ptr<MemProvider> provider);
+
+} // namespace gdr
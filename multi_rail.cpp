@@ -0,0 +1,360 @@
+#include "multi_rail.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace gdr {
+
+namespace {
+
+/* The rail is broken (port down, link or remote NIC lost), not the task */
+bool is_transport_error(rdma_completion_status status) {
+    switch (static_cast<int>(status)) {
+    case IBV_WC_RETRY_EXC_ERR:
+    case IBV_WC_RNR_RETRY_EXC_ERR:
+    case IBV_WC_RESP_TIMEOUT_ERR:
+    case IBV_WC_WR_FLUSH_ERR:
+    case IBV_WC_FATAL_ERR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+} // namespace
+
+MultiRail::Buffer::~Buffer() {
+    for (rdma_buffer* rdma_buff : rails_) {
+        rdma_buffer_dereg(rdma_buff);
+    }
+}
+
+MultiRail::RemoteBuffer::~RemoteBuffer() {
+    for (rdma_remote_buffer* rbuf : rails_) {
+        rdma_remote_buffer_release(rbuf);
+    }
+}
+
+MultiRail::MultiRail(const std::vector<sockaddr_storage>& addrs, Side side, const rdma_device_attr* attr)
+    : min_chunk_(DEFAULT_MIN_CHUNK), next_rail_(0), in_flight_(0), completed_(0) {
+    if (addrs.empty() || addrs.size() > MAX_RAILS) {
+        throw std::invalid_argument("MultiRail: 1 to " + std::to_string(MAX_RAILS) + " rails are supported");
+    }
+    rails_.reserve(addrs.size());
+    for (const sockaddr_storage& addr : addrs) {
+        sockaddr* sa = reinterpret_cast<sockaddr*>(const_cast<sockaddr_storage*>(&addr));
+        Rail rail = { nullptr, nullptr, true };
+
+        rail.device = side == Side::SERVER ? rdma_open_device_server_ex(sa, attr) : rdma_open_device_client(sa);
+        if (!rail.device) {
+            close();
+            throw std::system_error(ENODEV, std::generic_category(),
+                                    "MultiRail: can't open rail " + std::to_string(rails_.size()));
+        }
+        if (side == Side::SERVER) {
+            try {
+                rail.async.reset(new AsyncDevice(rail.device));
+            } catch (...) {
+                rdma_close_device(rail.device);
+                close();
+                throw;
+            }
+        }
+        rails_.push_back(std::move(rail));
+    }
+}
+
+MultiRail::~MultiRail() {
+    close();
+}
+
+void MultiRail::close() {
+    for (Rail& rail : rails_) {
+        rail.async.reset();
+        rdma_close_device(rail.device);
+    }
+    rails_.clear();
+}
+
+size_t MultiRail::rails_up() const {
+    return std::count_if(rails_.begin(), rails_.end(), [](const Rail& rail) { return rail.up; });
+}
+
+std::unique_ptr<MultiRail::Buffer> MultiRail::reg(void* addr, size_t length) {
+    std::unique_ptr<Buffer> buffer(new Buffer(addr, length));
+
+    for (size_t i = 0; i < rails_.size(); i++) {
+        rdma_buffer* rdma_buff = rdma_buffer_reg(rails_[i].device, addr, length);
+        if (!rdma_buff) {
+            throw std::system_error(EFAULT, std::generic_category(),
+                                    "MultiRail: registration on rail " + std::to_string(i) + " failed");
+        }
+        buffer->rails_.push_back(rdma_buff);
+    }
+    return buffer;
+}
+
+std::vector<uint8_t> MultiRail::encode_desc(const Buffer& buffer) const {
+    std::vector<uint8_t> desc(1 + buffer.rails_.size() * sizeof(rdma_buffer_desc));
+
+    desc[0] = static_cast<uint8_t>(buffer.rails_.size());
+    for (size_t i = 0; i < buffer.rails_.size(); i++) {
+        if (!rdma_buffer_desc_encode(buffer.rails_[i], &desc[1 + i * sizeof(rdma_buffer_desc)], sizeof(rdma_buffer_desc))) {
+            throw std::system_error(EINVAL, std::generic_category(),
+                                    "MultiRail: can't describe the buffer on rail " + std::to_string(i));
+        }
+    }
+    return desc;
+}
+
+std::unique_ptr<MultiRail::RemoteBuffer> MultiRail::import(const void* desc, size_t length) {
+    const uint8_t* wire = static_cast<const uint8_t*>(desc);
+    std::unique_ptr<RemoteBuffer> remote(new RemoteBuffer());
+
+    if (!length || !wire[0] || length != 1 + wire[0] * sizeof(rdma_buffer_desc)) {
+        throw std::invalid_argument("MultiRail: malformed multi-rail buffer description");
+    }
+    size_t num_rails = std::min<size_t>(wire[0], rails_.size());
+    for (size_t i = 0; i < num_rails; i++) {
+        rdma_buffer_desc rail_desc;
+
+        if (rdma_buffer_desc_decode(&wire[1 + i * sizeof(rdma_buffer_desc)], sizeof(rdma_buffer_desc), &rail_desc)) {
+            throw std::invalid_argument("MultiRail: malformed description of rail " + std::to_string(i));
+        }
+        if (i && rail_desc.size != remote->size_) {
+            throw std::invalid_argument("MultiRail: the rails describe buffers of different sizes");
+        }
+        rdma_remote_buffer* rbuf = rdma_remote_buffer_import(rails_[i].device, &rail_desc);
+        if (!rbuf) {
+            throw std::system_error(EINVAL, std::generic_category(),
+                                    "MultiRail: import on rail " + std::to_string(i) + " failed");
+        }
+        remote->rails_.push_back(rbuf);
+        remote->size_ = rail_desc.size;
+    }
+    return remote;
+}
+
+bool MultiRail::rail_usable(const Transfer& transfer, size_t rail) const {
+    return rails_[rail].up && transfer.remote->rail(rail);
+}
+
+void MultiRail::submit(Buffer& local, size_t local_offset, RemoteBuffer& remote, size_t remote_offset,
+                       size_t length, uint32_t flags, CompletionCallback cb, void* ctx, uint64_t user_data) {
+    size_t usable[MAX_RAILS];
+    size_t num_usable = 0;
+
+    if (!length || local_offset > local.length_ || length > local.length_ - local_offset ||
+        remote_offset > remote.size_ || length > remote.size_ - remote_offset) {
+        throw std::invalid_argument("MultiRail: the transfer is out of the buffers");
+    }
+    for (size_t i = 0; i < rails_.size(); i++) {
+        size_t rail = (next_rail_ + i) % rails_.size();
+
+        if (rails_[rail].up && remote.rail(rail)) {
+            usable[num_usable++] = rail;
+        }
+    }
+    if (!num_usable) {
+        throw std::system_error(ENETDOWN, std::generic_category(), "MultiRail: no rail is up to the remote buffer");
+    }
+    next_rail_ = (usable[0] + 1) % rails_.size();
+
+    uint32_t transfer_idx;
+    if (free_transfers_.empty()) {
+        transfer_idx = static_cast<uint32_t>(transfers_.size());
+        transfers_.emplace_back();
+    } else {
+        transfer_idx = free_transfers_.back();
+        free_transfers_.pop_back();
+    }
+    Transfer& transfer = transfers_[transfer_idx];
+    size_t num_chunks = std::max<size_t>(1, std::min(num_usable, length / min_chunk_));
+    uint64_t chunk_size = (length + num_chunks - 1) / num_chunks;
+
+    chunk_size = (chunk_size + 4095) & ~4095ULL; /* page aligned, the last chunk gets the rest */
+    num_chunks = (length + chunk_size - 1) / chunk_size;
+    transfer.local = &local;
+    transfer.local_offset = local_offset;
+    transfer.remote = &remote;
+    transfer.remote_offset = remote_offset;
+    transfer.flags = flags & RDMA_TASK_ATTR_RDMA_READ;
+    transfer.remaining = static_cast<uint32_t>(num_chunks);
+    transfer.status = RDMA_STATUS_SUCCESS;
+    transfer.cb = cb;
+    transfer.ctx = ctx;
+    transfer.user_data = user_data;
+    in_flight_++;
+
+    for (uint32_t k = 0; k < num_chunks; k++) {
+        Chunk& chunk = transfer.chunks[k];
+
+        chunk.offset = k * chunk_size;
+        chunk.length = std::min<uint64_t>(chunk_size, length - chunk.offset);
+        chunk.rail = static_cast<uint32_t>(usable[k]);
+        chunk.attempts = 0;
+        try {
+            post_chunk(transfer_idx, k, usable[k]);
+        } catch (const std::system_error& e) {
+            if (e.code().value() == EAGAIN) {
+                /* Send queue full, the chunk waits for the next poll() */
+                retries_.push_back(static_cast<uint64_t>(transfer_idx) * MAX_RAILS + k);
+                continue;
+            }
+            fprintf(stderr, "FAILURE: chunk %u on rail %zu: %s\n", k, usable[k], e.what());
+            transfer.status = RDMA_STATUS_ERR_LAST;
+            if (!--transfer.remaining) {
+                /* No chunk was posted, the transfer fails here rather than from poll() */
+                free_transfers_.push_back(transfer_idx);
+                in_flight_--;
+                throw;
+            }
+        }
+    }
+}
+
+void MultiRail::post_chunk(uint32_t transfer_idx, uint32_t chunk_idx, size_t rail) {
+    Transfer& transfer = transfers_[transfer_idx];
+    Chunk& chunk = transfer.chunks[chunk_idx];
+    rdma_task_attr attr;
+
+    memset(&attr, 0, sizeof attr);
+    chunk.iov.iov_base = static_cast<uint8_t*>(transfer.local->addr_) + transfer.local_offset + chunk.offset;
+    chunk.iov.iov_len = chunk.length;
+    attr.local_buf_rdma = transfer.local->rails_[rail];
+    attr.local_buf_iovec = &chunk.iov;
+    attr.local_buf_iovcnt = 1;
+    attr.flags = transfer.flags;
+    rails_[rail].async->submit_callback(attr, transfer.remote->rails_[rail], transfer.remote_offset + chunk.offset,
+                                        chunk.length, on_chunk, this, static_cast<uint64_t>(transfer_idx) * MAX_RAILS + chunk_idx);
+    chunk.rail = static_cast<uint32_t>(rail);
+    chunk.attempts++;
+}
+
+void MultiRail::on_chunk(void* ctx, uint64_t chunk_id, rdma_completion_status status) {
+    static_cast<MultiRail*>(ctx)->chunk_done(chunk_id, status);
+}
+
+void MultiRail::chunk_done(uint64_t chunk_id, rdma_completion_status status) {
+    uint32_t transfer_idx = static_cast<uint32_t>(chunk_id / MAX_RAILS);
+    Transfer& transfer = transfers_[transfer_idx];
+    Chunk& chunk = transfer.chunks[chunk_id % MAX_RAILS];
+
+    if (status != RDMA_STATUS_SUCCESS) {
+        Rail& rail = rails_[chunk.rail];
+        /* Once the rail is down, the following errors of its chunks are flushes */
+        bool retry = !rail.up || is_transport_error(status);
+
+        if (rail.up) {
+            /* The DCI is in error state either way, until the rail is recovered */
+            fprintf(stderr, "WARN: rail %u is down (completion status %d)\n", chunk.rail, static_cast<int>(status));
+            rail.up = false;
+        }
+        if (retry && chunk.attempts < rails_.size()) {
+            retries_.push_back(chunk_id);
+            return;
+        }
+        if (transfer.status == RDMA_STATUS_SUCCESS) {
+            transfer.status = status;
+        }
+    }
+    finish_chunk(transfer_idx);
+}
+
+void MultiRail::finish_chunk(uint32_t transfer_idx) {
+    Transfer& transfer = transfers_[transfer_idx];
+
+    if (--transfer.remaining) {
+        return;
+    }
+
+    /* Free the transfer before the callback, which may submit the next one */
+    CompletionCallback cb = transfer.cb;
+    void* ctx = transfer.ctx;
+    uint64_t user_data = transfer.user_data;
+    rdma_completion_status status = transfer.status;
+
+    free_transfers_.push_back(transfer_idx);
+    in_flight_--;
+    completed_++;
+    if (cb) {
+        cb(ctx, user_data, status);
+    }
+}
+
+void MultiRail::post_retries() {
+    size_t count = retries_.size();
+
+    while (count--) {
+        uint64_t chunk_id = retries_.front();
+        uint32_t transfer_idx = static_cast<uint32_t>(chunk_id / MAX_RAILS);
+        Transfer& transfer = transfers_[transfer_idx];
+        Chunk& chunk = transfer.chunks[chunk_id % MAX_RAILS];
+        size_t rail = rails_.size();
+
+        retries_.pop_front();
+        /* The next rail after the one it failed on */
+        for (size_t i = 1; i <= rails_.size(); i++) {
+            size_t candidate = (chunk.rail + i) % rails_.size();
+
+            if (rail_usable(transfer, candidate)) {
+                rail = candidate;
+                break;
+            }
+        }
+        if (rail == rails_.size()) {
+            if (transfer.status == RDMA_STATUS_SUCCESS) {
+                transfer.status = RDMA_STATUS_ERR_LAST;
+            }
+            finish_chunk(transfer_idx);
+            continue;
+        }
+        try {
+            post_chunk(transfer_idx, static_cast<uint32_t>(chunk_id % MAX_RAILS), rail);
+        } catch (const std::system_error& e) {
+            if (e.code().value() == EAGAIN) {
+                retries_.push_back(chunk_id);
+                continue;
+            }
+            fprintf(stderr, "FAILURE: chunk %u on rail %zu: %s\n", static_cast<uint32_t>(chunk_id % MAX_RAILS), rail, e.what());
+            if (transfer.status == RDMA_STATUS_SUCCESS) {
+                transfer.status = RDMA_STATUS_ERR_LAST;
+            }
+            finish_chunk(transfer_idx);
+        }
+    }
+}
+
+int MultiRail::poll() {
+    completed_ = 0;
+    for (Rail& rail : rails_) {
+        if (rail.async && rail.async->in_flight()) {
+            rail.async->poll();
+        }
+    }
+    if (!retries_.empty()) {
+        post_retries();
+    }
+    return completed_;
+}
+
+bool MultiRail::recover_rail(size_t rail) {
+    Rail& r = rails_.at(rail);
+
+    r.up = false;
+    if (rdma_reset_device(r.device)) {
+        fprintf(stderr, "FAILURE: reset of rail %zu failed\n", rail);
+        return false;
+    }
+    /* The reset flushed the tasks without reporting them, their chunks go to the retries */
+    if (r.async) {
+        r.async->fail_pending();
+    }
+    r.up = true;
+    post_retries();
+    return true;
+}
+
+} // namespace gdr
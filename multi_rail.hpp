@@ -0,0 +1,188 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "gpu_direct_rdma_access.h"
+#include "rdma_async.hpp"
+
+namespace gdr {
+
+/*
+ * One logical device over several RDMA devices (rails), e.g. the ConnectX
+ * ports of a DGX-class node, each opened by the ip address of its net device.
+ *
+ * A buffer is registered on every rail, and its description carries the keys
+ * and the address (DCT number, LID/GID) of each rail. The Server imports a
+ * description on each of its rails, rail i of the Server talking to rail i of
+ * the Client, and stripes a transfer over the rails which are up. A chunk which
+ * fails on a transport error takes its rail down and is posted again on a
+ * surviving rail. The transfer is reported once, when all of its chunks are done.
+ *
+ * Buffers and imported buffers have to be released before their MultiRail.
+ * Not thread safe, one MultiRail per thread.
+ */
+class MultiRail {
+public:
+    static constexpr size_t MAX_RAILS = 16;
+    static constexpr size_t DEFAULT_MIN_CHUNK = 1 << 20;
+
+    enum class Side { CLIENT, SERVER };
+
+    /* A local buffer registered on every rail */
+    class Buffer {
+    public:
+        ~Buffer();
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        void* addr() const { return addr_; }
+        size_t length() const { return length_; }
+        rdma_buffer* rail(size_t rail) const { return rails_[rail]; }
+
+    private:
+        friend class MultiRail;
+        Buffer(void* addr, size_t length) : addr_(addr), length_(length) {}
+
+        void* addr_;
+        size_t length_;
+        std::vector<rdma_buffer*> rails_;
+    };
+
+    /* A Client buffer imported on the rails both sides have */
+    class RemoteBuffer {
+    public:
+        ~RemoteBuffer();
+        RemoteBuffer(const RemoteBuffer&) = delete;
+        RemoteBuffer& operator=(const RemoteBuffer&) = delete;
+
+        uint64_t size() const { return size_; }
+        rdma_remote_buffer* rail(size_t rail) const { return rail < rails_.size() ? rails_[rail] : nullptr; }
+
+    private:
+        friend class MultiRail;
+        RemoteBuffer() : size_(0) {}
+
+        uint64_t size_;
+        std::vector<rdma_remote_buffer*> rails_;
+    };
+
+    /*
+     * Open a rail per address (up to MAX_RAILS), with attr for the Server
+     * rails (may be nullptr). Throws std::system_error if a rail can't be opened.
+     */
+    MultiRail(const std::vector<sockaddr_storage>& addrs, Side side, const rdma_device_attr* attr = nullptr);
+    ~MultiRail();
+    MultiRail(const MultiRail&) = delete;
+    MultiRail& operator=(const MultiRail&) = delete;
+
+    size_t num_rails() const { return rails_.size(); }
+    size_t rails_up() const;
+    bool rail_up(size_t rail) const { return rails_.at(rail).up; }
+    rdma_device* rail_device(size_t rail) const { return rails_.at(rail).device; }
+    uint32_t in_flight() const { return in_flight_; }
+
+    /* Smallest chunk a transfer is striped in, a smaller transfer takes one rail */
+    void set_min_chunk(size_t min_chunk) { min_chunk_ = min_chunk ? min_chunk : 1; }
+
+    /* Register [addr, addr + length) on every rail, throws std::system_error on failure */
+    std::unique_ptr<Buffer> reg(void* addr, size_t length);
+
+    /*
+     * Wire description of a buffer: a byte with the number of rails, then the
+     * rdma_buffer_desc of each rail (see rdma_buffer_desc_encode())
+     */
+    std::vector<uint8_t> encode_desc(const Buffer& buffer) const;
+
+    /*
+     * Server: import a Client buffer description on the first
+     * min(num_rails(), described rails) rails.
+     * Throws std::invalid_argument on a malformed description, std::system_error on failure.
+     */
+    std::unique_ptr<RemoteBuffer> import(const void* desc, size_t length);
+
+    /*
+     * Server: RDMA Write length bytes of local from local_offset to remote at
+     * remote_offset, or RDMA Read them with RDMA_TASK_ATTR_RDMA_READ in flags.
+     * The transfer is split in up to one chunk per rail which is up, of at
+     * least the min chunk, a smaller transfer goes on the next rail round robin.
+     * cb is called once from poll(), with the first error of the chunks if any.
+     * A chunk whose send queue is full is posted again from poll(), a chunk
+     * which can't be posted for another reason fails the transfer.
+     * Throws std::invalid_argument if the ranges are out of the buffers,
+     * std::system_error if no rail can reach the remote buffer or no chunk
+     * could be posted (cb is not called then).
+     */
+    void submit(Buffer& local, size_t local_offset, RemoteBuffer& remote, size_t remote_offset,
+                size_t length, uint32_t flags, CompletionCallback cb, void* ctx, uint64_t user_data);
+
+    /*
+     * Poll the completions of all the rails, and post the chunks which wait
+     * for another rail.
+     *
+     * returns: the number of completed transfers
+     */
+    int poll();
+
+    /*
+     * Reset a rail which is down (rdma_reset_device()) and take it up again,
+     * its chunks in flight are posted again first, on this or another rail.
+     *
+     * returns: false if the reset failed, the rail stays down
+     */
+    bool recover_rail(size_t rail);
+
+private:
+    struct Rail {
+        rdma_device*                    device;
+        std::unique_ptr<AsyncDevice>    async;  /* Server only */
+        bool                            up;
+    };
+
+    struct Chunk {
+        uint64_t        offset;     /* in the transfer */
+        uint64_t        length;
+        struct iovec    iov;        /* valid while posted */
+        uint32_t        rail;
+        uint32_t        attempts;
+    };
+
+    struct Transfer {
+        Buffer*                 local;
+        size_t                  local_offset;
+        RemoteBuffer*           remote;
+        size_t                  remote_offset;
+        uint32_t                flags;
+        uint32_t                remaining;
+        rdma_completion_status  status;
+        CompletionCallback      cb;
+        void*                   ctx;
+        uint64_t                user_data;
+        Chunk                   chunks[MAX_RAILS];
+    };
+
+    static void on_chunk(void* ctx, uint64_t chunk_id, rdma_completion_status status);
+    void chunk_done(uint64_t chunk_id, rdma_completion_status status);
+    void finish_chunk(uint32_t transfer_idx);
+    bool rail_usable(const Transfer& transfer, size_t rail) const;
+    void post_chunk(uint32_t transfer_idx, uint32_t chunk_idx, size_t rail);
+    void post_retries();
+    void close();
+
+    std::vector<Rail> rails_;
+    std::deque<Transfer> transfers_;    /* stable addresses, the chunk iovs are posted */
+    std::vector<uint32_t> free_transfers_;
+    std::deque<uint64_t> retries_;      /* chunks waiting for a rail */
+    size_t min_chunk_;
+    size_t next_rail_;
+    uint32_t in_flight_;
+    int completed_;
+};
+
+} // namespace gdr
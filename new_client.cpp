@@ -3,17 +3,22 @@
 #include <cstring>
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include <stdexcept>
 #include <sstream>
 #include <chrono>
 #include <ctime>
 #include <getopt.h>
+#include <endian.h>
+#include <poll.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 
 #include "utils.hpp"
 #include "gpu_direct_rdma_access.h"
+#include "mem_provider.hpp"
+#include "pci_topology.hpp"
 
 extern int debug;
 extern int debug_fast_path;
@@ -29,22 +34,32 @@ struct user_params {
     int             	port;
     unsigned long   	size;
     int             	iters;
+    int             	window;
+    int             	notify;
+    long            	reg_cache_mb;   /* -1 - no registration cache */
+    std::string     	file;           /* requests RDMA write this server file range, instead of task flags */
+    uint64_t        	file_offset;
+    int             	scatter;
     int             	use_cuda;
     std::string     	bdf;
+    int             	topology;       /* print the GPU to NIC paths and exit */
     std::string     	servername;
     sockaddr        	hostaddr;
 };
 
-enum class payload_t { RDMA_BUF_DESC, TASK_ATTRS };
+enum class payload_t { RDMA_BUF_DESC, TASK_ATTRS, RDMA_BUF_DESC_BIN, REQUEST_ID, ACK, NOTIFY_DESC, FILE_REQ, REMOTE_SGL };
+
+constexpr size_t PACKAGE_HDR_SIZE = sizeof(uint8_t) + sizeof(uint16_t); /* type + size */
+constexpr size_t MAX_FILE_PATH_SIZE = 256 - 2 * sizeof(uint64_t); /* server package limit, after the file range */
+constexpr int MAX_SCATTER_SEGMENTS = (256 - sizeof(uint32_t)) / (2 * sizeof(uint64_t)); /* likewise, after the task flags */
 
 struct payload_attr {
     payload_t data_t;
     std::string payload_str;
 };
 
-int pack_payload_data(std::vector<uint8_t>& package, const payload_attr& attr) {
-    uint8_t data_t = static_cast<uint8_t>(attr.data_t);
-    uint16_t payload_size = attr.payload_str.length() + 1;
+int pack_payload_data(std::vector<uint8_t>& package, payload_t type, const void* payload, uint16_t payload_size) {
+    uint8_t data_t = static_cast<uint8_t>(type);
 
     size_t pos = 0;
     package.resize(sizeof(data_t) + sizeof(payload_size) + payload_size);
@@ -55,11 +70,15 @@ int pack_payload_data(std::vector<uint8_t>& package, const payload_attr& attr) {
     std::memcpy(package.data() + pos, &payload_size, sizeof(payload_size));
     pos += sizeof(payload_size);
 
-    std::memcpy(package.data() + pos, attr.payload_str.c_str(), payload_size);
+    std::memcpy(package.data() + pos, payload, payload_size);
 
     return package.size();
 }
 
+int pack_payload_data(std::vector<uint8_t>& package, const payload_attr& attr) {
+    return pack_payload_data(package, attr.data_t, attr.payload_str.c_str(), attr.payload_str.length() + 1);
+}
+
 constexpr size_t RDMA_TASK_ATTR_DESC_STRING_LENGTH = sizeof("12345678");
 
 std::string rdma_task_attr_flags_get_desc_str(uint32_t flags) {
@@ -80,12 +99,26 @@ void usage(const std::string& argv0) {
     std::cout << "Usage:\n" << "  " << argv0 
               << " <host>     connect to server at <host>\n\nOptions:\n"
               << "  -t, --task_flags=<flags>  rdma task attrs bitmask: bit 0 - rdma operation type: 0 - \"WRITE\"(default), 1 - \"READ\"\n"
-              << "  -a, --addr=<ipaddr>       ip address of the local host net device <ipaddr v4> (mandatory)\n"
+              << "  -a, --addr=<ipaddr>       ip address of the local host net device <ipaddr v4> (mandatory,\n"
+              << "                            unless -u selects the NIC nearest to the GPU)\n"
               << "  -p, --port=<port>         listen on/connect to port <port> (default 18515)\n"
               << "  -s, --size=<size>         size of message to exchange (default 4096)\n"
               << "  -n, --iters=<iters>       number of exchanges (default 1000)\n"
+              << "  -w, --window=<num>        number of requests kept in flight (default 1)\n"
+              << "  -N, --notify              completion by a sequence number the server RDMA-writes\n"
+              << "                            into a local slot, instead of TCP acks\n"
+              << "  -C, --reg-cache=<MB>      reuse memory registrations through a cache pinning up to <MB>\n"
+              << "                            (0 - unlimited), the buffers are registered inside one region\n"
+              << "  -H, --mem=<provider>      memory of the buffers: host (default), huge2m, huge1g, shm, shm-huge2m,\n"
+              << "                            numa:<node>, or any of them bound to a NUMA node as <provider>@<node>\n"
+              << "  -f, --file=<path>         the server RDMA writes <size> bytes of the file <path> (relative to its\n"
+              << "                            file root) into the buffer, instead of the task flags\n"
+              << "  -o, --file-offset=<bytes> offset of the range in the file (default 0)\n"
+              << "  -g, --scatter=<count>     the server task covers <count> segments spread over the buffer, each\n"
+              << "                            half of its 1/<count> share, in one RDMA task (default 0 - whole buffer)\n"
               << "  -u, --use-cuda=<BDF>      use CUDA package (work with GPU memory),\n"
               << "                            BDF corresponding to CUDA device, for example, \"3e:02.0\"\n"
+              << "  -T, --topology            print the PCIe paths of the GPUs to the RDMA NICs and exit\n"
               << "  -D, --debug-mask=<mask>   debug bitmask: bit 0 - debug print enable,\n"
               << "                                           bit 1 - fast path debug print enable\n";
 }
@@ -96,6 +129,8 @@ int parse_command_line(int argc, char* argv[], user_params& params) {
     params.port = 18515;
     params.size = 4096;
     params.iters = 1000;
+    params.window = 1;
+    params.reg_cache_mb = -1;
     params.task = 0;
 
     struct option long_options[] = {
@@ -104,13 +139,21 @@ int parse_command_line(int argc, char* argv[], user_params& params) {
         { "port", required_argument, nullptr, 'p' },
         { "size", required_argument, nullptr, 's' },
         { "iters", required_argument, nullptr, 'n' },
+        { "window", required_argument, nullptr, 'w' },
+        { "notify", no_argument, nullptr, 'N' },
+        { "reg-cache", required_argument, nullptr, 'C' },
+        { "mem", required_argument, nullptr, 'H' },
+        { "file", required_argument, nullptr, 'f' },
+        { "file-offset", required_argument, nullptr, 'o' },
+        { "scatter", required_argument, nullptr, 'g' },
         { "use-cuda", required_argument, nullptr, 'u' },
+        { "topology", no_argument, nullptr, 'T' },
         { "debug-mask", required_argument, nullptr, 'D' },
         { nullptr, 0, nullptr, 0 }
     };
 
     int c;
-    while ((c = getopt_long(argc, argv, "t:a:p:s:n:u:D:", long_options, nullptr)) != -1) {
+    while ((c = getopt_long(argc, argv, "t:a:p:s:n:w:NC:H:f:o:g:u:TD:", long_options, nullptr)) != -1) {
         switch (c) {
             case 't':
                 params.task = static_cast<uint32_t>(std::strtol(optarg, nullptr, 0)) & 1u; // bit 0
@@ -131,10 +174,53 @@ int parse_command_line(int argc, char* argv[], user_params& params) {
             case 'n':
                 params.iters = static_cast<int>(std::strtol(optarg, nullptr, 0));
                 break;
+            case 'w':
+                params.window = static_cast<int>(std::strtol(optarg, nullptr, 0));
+                if (params.window < 1) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'N':
+                params.notify = 1;
+                break;
+            case 'C':
+                params.reg_cache_mb = std::strtol(optarg, nullptr, 0);
+                if (params.reg_cache_mb < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'H':
+                try {
+                    gdr::set_default_mem_provider(gdr::MemProvider::create(optarg));
+                } catch (const std::invalid_argument& e) {
+                    std::cerr << "FAILURE: " << e.what() << "\n";
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'f':
+                params.file = optarg;
+                break;
+            case 'o':
+                params.file_offset = std::strtoull(optarg, nullptr, 0);
+                break;
+            case 'g':
+                params.scatter = static_cast<int>(std::strtol(optarg, nullptr, 0));
+                if (params.scatter < 0 || params.scatter > MAX_SCATTER_SEGMENTS) {
+                    std::cerr << "FAILURE: the scatter count is limited to " << MAX_SCATTER_SEGMENTS << ".\n";
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
             case 'u':
                 params.use_cuda = 1;
                 params.bdf = optarg;
                 break;
+            case 'T':
+                params.topology = 1;
+                break;
             case 'D':
                 debug = static_cast<int>(std::strtol(optarg, nullptr, 0)) & 1; // bit 0
                 debug_fast_path = static_cast<int>(std::strtol(optarg, nullptr, 0)) >> 1 & 1; // bit 1
@@ -145,6 +231,34 @@ int parse_command_line(int argc, char* argv[], user_params& params) {
         }
     }
 
+    if (params.file.size() >= MAX_FILE_PATH_SIZE) {
+        std::cerr << "FAILURE: file path is longer than " << MAX_FILE_PATH_SIZE - 1 << " characters.\n";
+        return 1;
+    }
+    if (!params.file.empty() && (params.task & RDMA_TASK_ATTR_RDMA_READ)) {
+        std::cerr << "FAILURE: the server only RDMA writes the file ranges.\n";
+        usage(argv[0]);
+        return 1;
+    }
+    if (!params.file.empty() && params.scatter) {
+        std::cerr << "FAILURE: the file ranges are written whole, not scattered.\n";
+        usage(argv[0]);
+        return 1;
+    }
+    if (params.scatter && params.size / params.scatter < 2) {
+        std::cerr << "FAILURE: size " << params.size << " is too small for " << params.scatter << " segments.\n";
+        return 1;
+    }
+
+    if (params.topology) {
+        return 0;
+    }
+    if (!params.hostaddr.sa_family && params.bdf.empty()) {
+        std::cerr << "FAILURE: the local address (-a) or the GPU (-u) is missing in the command line.\n";
+        usage(argv[0]);
+        return 1;
+    }
+
     if (optind < argc) {
         params.servername = argv[optind];
     } else {
@@ -161,99 +275,243 @@ int parse_command_line(int argc, char* argv[], user_params& params) {
 class RDMAClient {
 public:
     RDMAClient(const user_params& params)
-        : params_(params), rdma_dev_(nullptr), rdma_buff_(nullptr) {
+        : params_(params), rdma_dev_(nullptr), notify_rdma_buff_(nullptr) {
         std::srand(static_cast<unsigned int>(std::time(nullptr)) ^ getpid());
 
         std::cout << "Connecting to remote server \"" << params_.servername << ":" << params_.port << "\"\n";
         socket_ = new Socket(params_.servername, params_.port);
 
         std::cout << "Opening RDMA device\n";
-        rdma_dev_ = rdma_open_device_client(&params_.hostaddr);
+        // Without an address, the NIC nearest on PCIe to the GPU
+        rdma_dev_ = params_.hostaddr.sa_family ? rdma_open_device_client(&params_.hostaddr)
+                                               : rdma_open_device_client_near(params_.bdf.c_str());
         if (!rdma_dev_) {
             throw std::runtime_error("Failed to open RDMA device.");
         }
+
+        if (params_.reg_cache_mb >= 0 &&
+            rdma_reg_cache_enable(rdma_dev_, static_cast<size_t>(params_.reg_cache_mb) << 20)) {
+            throw std::runtime_error("Failed to enable the registration cache.");
+        }
+
+        if (params_.notify) {
+            notify_rdma_buff_ = rdma_buffer_reg(rdma_dev_, &notify_slot_, sizeof(notify_slot_));
+            if (!notify_rdma_buff_) {
+                throw std::runtime_error("Failed to register RDMA notify slot.");
+            }
+        }
     }
 
     ~RDMAClient() {
-        if (rdma_buff_) {
-            rdma_buffer_dereg(rdma_buff_);
+        if (notify_rdma_buff_) {
+            rdma_buffer_dereg(notify_rdma_buff_);
+        }
+        for (rdma_buffer* rdma_buff : rdma_buffs_) {
+            rdma_buffer_dereg(rdma_buff);
         }
         if (rdma_dev_) {
             rdma_close_device(rdma_dev_);
         }
+        delete socket_;
     }
 
+    /*
+     * Register a buffer the server will read or write, and prepare its request
+     * packages (binary buffer description, and task flags, the remote segments
+     * or the file range).
+     *
+     * returns: the index of the buffer, requests cycle over the registered buffers
+     */
     template <typename DType>
     int register_data(DType* data_ptr, size_t num_elements) {
-        rdma_buff_ = rdma_buffer_reg(rdma_dev_, data_ptr, num_elements * sizeof(DType));
-        if (!rdma_buff_) {
+        rdma_buffer* rdma_buff = rdma_buffer_reg(rdma_dev_, data_ptr, num_elements * sizeof(DType));
+        if (!rdma_buff) {
             throw std::runtime_error("Failed to register RDMA buffer.");
         }
-        char desc_str[256], task_opt_str[16];
+        rdma_buffs_.push_back(rdma_buff);
+        uint8_t wire_desc[sizeof(rdma_buffer_desc)];
 
-        int ret_desc_str_size = rdma_buffer_get_desc_str(rdma_buff_, desc_str, sizeof(desc_str));
+        int ret_desc_size = rdma_buffer_desc_encode(rdma_buff, wire_desc, sizeof(wire_desc));
         std::string ret_task_opt_str = rdma_task_attr_flags_get_desc_str(params_.task);
         int ret_task_opt_str_size = ret_task_opt_str.length() + 1;
      
-        if (!ret_desc_str_size || !ret_task_opt_str_size) {
-            throw std::runtime_error("Failed to get rdma_buffer_desc_str or rdma_task_attr_flags_desc_str");
+        if (!ret_desc_size || !ret_task_opt_str_size) {
+            throw std::runtime_error("Failed to get rdma_buffer_desc or rdma_task_attr_flags_desc_str");
         }
 
         /* Package memory allocation */
         std::vector<uint8_t> desc_package, task_package;
 
-        /* Packing RDMA buff desc str */
-        struct payload_attr pl_attr = { .data_t = payload_t::RDMA_BUF_DESC, .payload_str = desc_str };
-        int buff_package_size = pack_payload_data(desc_package, pl_attr);
+        /* Packing RDMA buff binary desc */
+        int buff_package_size = pack_payload_data(desc_package, payload_t::RDMA_BUF_DESC_BIN, wire_desc, ret_desc_size);
         if (!buff_package_size) {
             throw std::runtime_error("Failed to init data package");
         }
         
-        /* Packing RDMA task attrs desc str */
-        pl_attr.data_t = payload_t::TASK_ATTRS;
-        pl_attr.payload_str = task_opt_str;
-        buff_package_size += pack_payload_data(task_package, pl_attr);
+        if (!params_.file.empty()) {
+            /* Packing the file range: offset, length (the buffer is filled) and path */
+            uint64_t range[2] = { htole64(params_.file_offset), htole64(num_elements * sizeof(DType)) };
+            std::vector<uint8_t> file_req(reinterpret_cast<uint8_t*>(range), reinterpret_cast<uint8_t*>(range) + sizeof(range));
+
+            file_req.insert(file_req.end(), params_.file.begin(), params_.file.end());
+            file_req.push_back('\0');
+            buff_package_size += pack_payload_data(task_package, payload_t::FILE_REQ, file_req.data(), file_req.size());
+        } else if (params_.scatter) {
+            /* Packing the task flags and the (offset, length) of each segment, the first half of each share */
+            uint64_t share = num_elements * sizeof(DType) / params_.scatter;
+            uint32_t flags = htole32(params_.task);
+            std::vector<uint8_t> sgl(reinterpret_cast<uint8_t*>(&flags), reinterpret_cast<uint8_t*>(&flags) + sizeof(flags));
+
+            for (int i = 0; i < params_.scatter; i++) {
+                uint64_t sge[2] = { htole64(i * share), htole64(share / 2) };
+                sgl.insert(sgl.end(), reinterpret_cast<uint8_t*>(sge), reinterpret_cast<uint8_t*>(sge) + sizeof(sge));
+            }
+            buff_package_size += pack_payload_data(task_package, payload_t::REMOTE_SGL, sgl.data(), sgl.size());
+        } else {
+            /* Packing RDMA task attrs desc str */
+            struct payload_attr pl_attr = { .data_t = payload_t::TASK_ATTRS, .payload_str = ret_task_opt_str };
+            buff_package_size += pack_payload_data(task_package, pl_attr);
+        }
         if (!buff_package_size) {
             throw std::runtime_error("Failed to init task package\n");
         }
 
         desc_package.insert(desc_package.end(), task_package.begin(), task_package.end());
-        write(socket_->descriptor(), desc_package.data(), buff_package_size);
-        return int(data_ptr);
+        buff_packages_.push_back(std::move(desc_package));
+        return buff_packages_.size() - 1;
     }
 
+    /*
+     * Issue "iters" requests keeping up to "window" of them in flight,
+     * each request carries an id and its ack is matched by the id, in any order.
+     */
     void run(){
+        if (buff_packages_.empty()) {
+            throw std::runtime_error("No registered buffers to request.");
+        }
+        std::unordered_map<uint32_t, std::chrono::high_resolution_clock::time_point> in_flight;
+        std::vector<uint8_t> request;
+        double latency_sum = 0;
+        int sent = 0, acked = 0;
+
+        if (params_.notify) {
+            // Completion slot description goes ahead of the first request, selecting the RDMA notify mode
+            uint8_t wire_desc[sizeof(rdma_buffer_desc)];
+            int ret_desc_size = rdma_buffer_desc_encode(notify_rdma_buff_, wire_desc, sizeof(wire_desc));
+            if (!ret_desc_size) {
+                throw std::runtime_error("Failed to get notify slot rdma_buffer_desc");
+            }
+            pack_payload_data(request, payload_t::NOTIFY_DESC, wire_desc, ret_desc_size);
+            write_all(request.data(), request.size());
+        }
+
         auto start = std::chrono::high_resolution_clock::now();
-        for (int cnt = 0; cnt < params_.iters; ++cnt) {
-            char ackmsg[sizeof ACK_MSG];
-            int  ret_size;
-            int One = 1, Two = 2;
-            
-            // Sending RDMA data (address and rkey) by socket as a triger to start RDMA read/write operation
-            ret_size = write(socket_->descriptor(), cnt % 2 == 0 ? &One : &Two, sizeof(int));
-            if (ret_size != sizeof(int)) {
-                fprintf(stderr, "FAILURE: Couldn't send RDMA data for iteration, write data size %d (errno=%d '%m')\n", ret_size, errno);
-                throw std::runtime_error("ret_size != buff_package_size");
+        while (acked < params_.iters) {
+            // Sending requests (id, RDMA buffer description and task flags) by socket as a triger to start RDMA read/write operation
+            while (sent < params_.iters && static_cast<int>(in_flight.size()) < params_.window) {
+                uint32_t req_id = static_cast<uint32_t>(sent);
+                const std::vector<uint8_t>& buff_package = buff_packages_[sent % buff_packages_.size()];
+
+                pack_payload_data(request, payload_t::REQUEST_ID, &req_id, sizeof(req_id));
+                request.insert(request.end(), buff_package.begin(), buff_package.end());
+                write_all(request.data(), request.size());
+                in_flight[req_id] = std::chrono::high_resolution_clock::now();
+                sent++;
             }
-            
-            // Wating for confirmation message from the socket that rdma_read/write from the server has beed completed
-            ret_size = recv(socket_->descriptor(), ackmsg, sizeof ackmsg, MSG_WAITALL);
-            if (ret_size != sizeof ackmsg) {
-                fprintf(stderr, "FAILURE: Couldn't read \"%s\" message, recv data size %d (errno=%d '%m')\n", ACK_MSG, ret_size, errno);
+
+            if (params_.notify) {
+                // The slot holds the number of completed requests, they complete in order
+                uint32_t completed = wait_notify(acked);
+                for (; static_cast<uint32_t>(acked) < completed; acked++) {
+                    auto it = in_flight.find(acked);
+                    if (it == in_flight.end()) {
+                        throw std::runtime_error("Notify slot is ahead of the sent requests");
+                    }
+                    std::chrono::duration<double, std::micro> latency = std::chrono::high_resolution_clock::now() - it->second;
+                    latency_sum += latency.count();
+                    in_flight.erase(it);
+                }
+                DEBUG_LOG_FAST_PATH << "Notified completion of " << completed << " requests\n";
+                continue;
             }
 
+            // Wating for an ack from the socket that one of the rdma_read/write-s from the server has beed completed
+            uint8_t ack[PACKAGE_HDR_SIZE + sizeof(uint32_t)];
+            int ret_size = recv(socket_->descriptor(), ack, sizeof ack, MSG_WAITALL);
+            if (ret_size != sizeof ack || ack[0] != static_cast<uint8_t>(payload_t::ACK)) {
+                fprintf(stderr, "FAILURE: Couldn't read ack message, recv data size %d (errno=%d '%m')\n", ret_size, errno);
+                throw std::runtime_error("ret_size != ack size");
+            }
+            uint32_t req_id;
+            std::memcpy(&req_id, ack + PACKAGE_HDR_SIZE, sizeof(req_id));
+            auto it = in_flight.find(req_id);
+            if (it == in_flight.end()) {
+                throw std::runtime_error("Received ack for unknown request id " + std::to_string(req_id));
+            }
+            std::chrono::duration<double, std::micro> latency = std::chrono::high_resolution_clock::now() - it->second;
+            latency_sum += latency.count();
+            in_flight.erase(it);
+            acked++;
+
             // Printing received data for debug purpose
-            DEBUG_LOG_FAST_PATH << "Received ack N " << cnt << ": \"" << ackmsg << "\"\n";
+            DEBUG_LOG_FAST_PATH << "Received ack for request " << req_id << "\n";
+        }
+        print_run_time(start, params_.size, params_.iters);
+        std::cout << "window " << params_.window << ", completion by " << (params_.notify ? "rdma notify" : "tcp ack")
+                  << ": avg request latency " << latency_sum / params_.iters << " usec\n";
+
+        rdma_reg_cache_stats stats;
+        if (!rdma_reg_cache_get_stats(rdma_dev_, &stats)) {
+            std::cout << "registration cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+                      << stats.evictions << " evictions, " << stats.num_regions << " MRs pinning "
+                      << stats.pinned_bytes << " bytes\n";
         }
-       print_run_time(start, params_.size, params_.iters);
     }
 
 private:
+    /*
+     * Spin on the notify slot until it passes "completed", checking the socket
+     * now and then, since a failed session is reported only by the server closing it.
+     */
+    uint32_t wait_notify(int completed) {
+        for (unsigned long spins = 1; ; spins++) {
+            uint64_t value = le64toh(__atomic_load_n(&notify_slot_, __ATOMIC_ACQUIRE));
+            if (value > static_cast<uint64_t>(completed)) {
+                return static_cast<uint32_t>(value);
+            }
+            if (!(spins % NOTIFY_SOCKET_CHECK_SPINS)) {
+                struct pollfd pfd = { .fd = socket_->descriptor(), .events = POLLIN };
+                if (poll(&pfd, 1, 0) > 0) {
+                    throw std::runtime_error("Server closed the session while waiting for notify");
+                }
+            }
+        }
+    }
+
+    static constexpr unsigned long NOTIFY_SOCKET_CHECK_SPINS = 1 << 16;
+
+    void write_all(const uint8_t* data, size_t size) {
+        while (size) {
+            ssize_t ret_size = write(socket_->descriptor(), data, size);
+            if (ret_size < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "FAILURE: Couldn't send RDMA data for iteration (errno=%d '%m')\n", errno);
+                throw std::runtime_error("write failed");
+            }
+            data += ret_size;
+            size -= ret_size;
+        }
+    }
+
     Socket* socket_;
     user_params params_;
     rdma_device* rdma_dev_;
-    rdma_buffer* rdma_buff_;
-    std::vector<int> task_ids;
+    std::vector<rdma_buffer*> rdma_buffs_;
+    std::vector<std::vector<uint8_t>> buff_packages_;
+    alignas(64) uint64_t notify_slot_ = 0;
+    rdma_buffer* notify_rdma_buff_;
 };
 
 int main(int argc, char *argv[]) {
@@ -263,14 +521,24 @@ int main(int argc, char *argv[]) {
         if (ret_val) {
             return 1;
         }
+        if (params.topology) {
+            std::cout << gdr::PciTopology().report();
+            return 0;
+        }
 
-        char* data = new char[params.size];
-        char* data2 = new char[params.size];
-        
-        RDMAClient client(params);
-        client.register_data(data, params.size);
-        client.register_data(data2, params.size);
-        client.run();
+        // Both buffers in one allocation, the registration cache merges their adjacent MRs into one
+        gdr::MemRegion mem = gdr::default_mem_provider().alloc(2 * params.size);
+        char* data = static_cast<char*>(mem.addr);
+        char* data2 = data + params.size;
+        std::cout << "Buffers of " << gdr::default_mem_provider().name() << " memory\n";
+
+        {
+            RDMAClient client(params);
+            client.register_data(data, params.size);
+            client.register_data(data2, params.size);
+            client.run();
+        }
+        gdr::default_mem_provider().free(mem);
         return 0;
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
@@ -0,0 +1,273 @@
+#include "pci_topology.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+
+namespace gdr {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+/* Content of a sysfs attribute without the newline, "" if it can't be read */
+std::string read_attr(const std::string& path) {
+    std::ifstream file(path);
+    std::string value;
+
+    std::getline(file, value);
+    return value;
+}
+
+/* "0000:b7:00.0" */
+bool is_bdf(const std::string& name) {
+    unsigned domain, bus, dev, func;
+    int len = 0;
+
+    return name.size() == 12 && sscanf(name.c_str(), "%4x:%2x:%2x.%1x%n", &domain, &bus, &dev, &func, &len) == 4 && len == 12;
+}
+
+/* Data rate of one lane: 8b/10b encoding up to 5 GT/s (gen 1/2), 128b/130b above */
+double lane_gbps(double speed_gts) {
+    return speed_gts <= 5.0 ? speed_gts * 0.8 : speed_gts * 128 / 130;
+}
+
+} // namespace
+
+PciTopology::PciTopology(const std::string& sysfs_root) : root_(sysfs_root) {
+    std::error_code ec;
+    fs::directory_iterator devices(root_ + "/bus/pci/devices", ec);
+
+    if (ec) {
+        throw std::system_error(ec.value(), std::generic_category(), "PciTopology: can't read " + root_ + "/bus/pci/devices");
+    }
+    for (const fs::directory_entry& entry : devices) {
+        std::string bdf = entry.path().filename().string();
+
+        if (is_bdf(bdf)) {
+            read_device(bdf);
+        }
+    }
+    std::sort(gpus_.begin(), gpus_.end());
+    read_nics();
+}
+
+void PciTopology::read_device(const std::string& bdf) {
+    std::string dir = root_ + "/bus/pci/devices/" + bdf;
+    std::string numa_node = read_attr(dir + "/numa_node");
+    Device dev;
+    std::error_code ec;
+
+    dev.bdf = bdf;
+    dev.class_code = static_cast<uint32_t>(std::strtoul(read_attr(dir + "/class").c_str(), nullptr, 16));
+    dev.vendor = static_cast<uint16_t>(std::strtoul(read_attr(dir + "/vendor").c_str(), nullptr, 16));
+    dev.numa_node = numa_node.empty() ? -1 : std::atoi(numa_node.c_str());
+    /* "8.0 GT/s PCIe", "Unknown" if the link is down */
+    dev.link.speed_gts = std::strtod(read_attr(dir + "/current_link_speed").c_str(), nullptr);
+    dev.link.width = std::atoi(read_attr(dir + "/current_link_width").c_str());
+    dev.link.max_speed_gts = std::strtod(read_attr(dir + "/max_link_speed").c_str(), nullptr);
+    dev.link.max_width = std::atoi(read_attr(dir + "/max_link_width").c_str());
+
+    /* The link resolves to the place of the device in the tree, e.g.
+     * devices/pci0000:b0/0000:b0:02.0/0000:b1:00.0/0000:b2:04.0/0000:b7:00.0 */
+    fs::path real = fs::canonical(dir, ec);
+    if (!ec) {
+        for (const fs::path& part : real) {
+            std::string name = part.string();
+
+            if (is_bdf(name)) {
+                if (name != bdf) {
+                    dev.bridges.push_back(name);
+                }
+            } else if (name.compare(0, 3, "pci") == 0) {
+                dev.host_bridge = name;
+            }
+        }
+    }
+    if ((dev.class_code >> 16) == 0x03) {
+        gpus_.push_back(bdf);
+    }
+    devices_[bdf] = std::move(dev);
+}
+
+void PciTopology::read_nics() {
+    std::error_code ec;
+    fs::directory_iterator ib_devices(root_ + "/class/infiniband", ec);
+
+    if (ec) {
+        return; /* no RDMA devices */
+    }
+    for (const fs::directory_entry& entry : ib_devices) {
+        Nic nic;
+
+        nic.name = entry.path().filename().string();
+        nic.bdf = fs::canonical(entry.path() / "device", ec).filename().string();
+        if (ec || !is_bdf(nic.bdf)) {
+            continue;
+        }
+        fs::directory_iterator netdevs(entry.path() / "device" / "net", ec);
+        if (!ec) {
+            for (const fs::directory_entry& netdev : netdevs) {
+                nic.netdevs.push_back(netdev.path().filename().string());
+            }
+            std::sort(nic.netdevs.begin(), nic.netdevs.end());
+        }
+        nics_.push_back(std::move(nic));
+    }
+    std::sort(nics_.begin(), nics_.end(), [](const Nic& a, const Nic& b) { return a.name < b.name; });
+}
+
+std::string PciTopology::normalize_bdf(const std::string& bdf) {
+    std::string full = std::count(bdf.begin(), bdf.end(), ':') == 1 ? "0000:" + bdf : bdf;
+
+    std::transform(full.begin(), full.end(), full.begin(), [](unsigned char c) { return std::tolower(c); });
+    return full;
+}
+
+const char* PciTopology::path_name(PathType type) {
+    switch (type) {
+    case PathType::SWITCH:      return "SWITCH";
+    case PathType::HOST_BRIDGE: return "HOST_BRIDGE";
+    case PathType::NODE:        return "NODE";
+    default:                    return "SYSTEM";
+    }
+}
+
+const PciTopology::Device* PciTopology::device(const std::string& bdf) const {
+    auto it = devices_.find(normalize_bdf(bdf));
+    return it == devices_.end() ? nullptr : &it->second;
+}
+
+PciTopology::Path PciTopology::path(const std::string& bdf_a, const std::string& bdf_b) const {
+    const Device* dev_a = device(bdf_a);
+    const Device* dev_b = device(bdf_b);
+
+    if (!dev_a || !dev_b) {
+        throw std::invalid_argument("PciTopology: no PCI device " + (dev_a ? bdf_b : bdf_a));
+    }
+    std::vector<std::string> chain_a = dev_a->bridges;
+    std::vector<std::string> chain_b = dev_b->bridges;
+    size_t common = 0;
+
+    chain_a.push_back(dev_a->bdf);
+    chain_b.push_back(dev_b->bdf);
+    if (dev_a->host_bridge == dev_b->host_bridge) {
+        while (common < chain_a.size() && common < chain_b.size() && chain_a[common] == chain_b[common]) {
+            common++;
+        }
+    }
+
+    Path path = {};
+    if (dev_a->host_bridge == dev_b->host_bridge) {
+        /* A common bridge below the root port is a switch (its upstream port) */
+        path.type = common >= 2 ? PathType::SWITCH : PathType::HOST_BRIDGE;
+    } else {
+        /* An unknown node (-1, no NUMA or no firmware info) may as well be another socket */
+        path.type = dev_a->numa_node >= 0 && dev_a->numa_node == dev_b->numa_node ? PathType::NODE : PathType::SYSTEM;
+    }
+
+    /* Each device below the common bridge brings the link to its upstream port */
+    std::vector<std::string> links(chain_a.begin() + common, chain_a.end());
+    links.insert(links.end(), chain_b.begin() + common, chain_b.end());
+    for (const std::string& bdf : links) {
+        const Device* dev = device(bdf);
+
+        path.hops++;
+        if (!dev || !dev->link.speed_gts || !dev->link.width) {
+            continue;
+        }
+        double gbps = lane_gbps(dev->link.speed_gts) * dev->link.width;
+        if (!path.bandwidth_gbps || gbps < path.bandwidth_gbps) {
+            path.bandwidth_gbps = gbps;
+            path.bottleneck = bdf;
+        }
+        if (dev->link.max_speed_gts > dev->link.speed_gts || dev->link.max_width > dev->link.width) {
+            path.degraded = true;
+        }
+    }
+    return path;
+}
+
+std::vector<std::pair<const PciTopology::Nic*, PciTopology::Path>> PciTopology::nearest_nics(const std::string& gpu_bdf) const {
+    std::vector<std::pair<const Nic*, Path>> nics;
+
+    if (!device(gpu_bdf)) {
+        throw std::invalid_argument("PciTopology: no PCI device " + gpu_bdf);
+    }
+    for (const Nic& nic : nics_) {
+        if (device(nic.bdf)) {
+            nics.emplace_back(&nic, path(gpu_bdf, nic.bdf));
+        }
+    }
+    std::stable_sort(nics.begin(), nics.end(), [](const std::pair<const Nic*, Path>& a, const std::pair<const Nic*, Path>& b) {
+        if (a.second.type != b.second.type) {
+            return a.second.type < b.second.type;
+        }
+        if (a.second.hops != b.second.hops) {
+            return a.second.hops < b.second.hops;
+        }
+        return a.second.bandwidth_gbps > b.second.bandwidth_gbps;
+    });
+    return nics;
+}
+
+std::string PciTopology::report() const {
+    std::ostringstream out;
+    char line[256];
+
+    if (gpus_.empty()) {
+        out << "No GPU found under " << root_ << "/bus/pci/devices\n";
+    }
+    for (const std::string& gpu : gpus_) {
+        out << "GPU " << gpu << " (NUMA node " << devices_.at(gpu).numa_node << ")\n";
+        for (const auto& [nic, path] : nearest_nics(gpu)) {
+            std::string netdevs;
+
+            for (const std::string& netdev : nic->netdevs) {
+                netdevs += (netdevs.empty() ? "" : ",") + netdev;
+            }
+            snprintf(line, sizeof line, "  %-10s %s %-16s %-11s %2d hops  %7.1f Gb/s (%s)%s\n", nic->name.c_str(),
+                     nic->bdf.c_str(), netdevs.empty() ? "-" : netdevs.c_str(), path_name(path.type), path.hops,
+                     path.bandwidth_gbps, path.bottleneck.empty() ? "unknown" : path.bottleneck.c_str(),
+                     path.degraded ? "  degraded link" : "");
+            out << line;
+        }
+    }
+    return out.str();
+}
+
+bool PciTopology::netdev_addr(const std::string& netdev, sockaddr_storage& addr) {
+    struct ifaddrs* ifaddrs;
+    bool found = false;
+
+    if (getifaddrs(&ifaddrs)) {
+        return false;
+    }
+    for (int family : { AF_INET, AF_INET6 }) {
+        for (struct ifaddrs* ifa = ifaddrs; ifa && !found; ifa = ifa->ifa_next) {
+            if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != family || netdev != ifa->ifa_name) {
+                continue;
+            }
+            if (family == AF_INET6 && IN6_IS_ADDR_LINKLOCAL(&reinterpret_cast<sockaddr_in6*>(ifa->ifa_addr)->sin6_addr)) {
+                continue;
+            }
+            memset(&addr, 0, sizeof addr);
+            memcpy(&addr, ifa->ifa_addr, family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6));
+            found = true;
+        }
+        if (found) {
+            break;
+        }
+    }
+    freeifaddrs(ifaddrs);
+    return found;
+}
+
+} // namespace gdr
@@ -0,0 +1,106 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+#include <sys/socket.h>
+
+namespace gdr {
+
+/*
+ * PCIe topology of the GPUs and the RDMA NICs, read from sysfs: the PCI
+ * devices of <root>/bus/pci/devices, placed in the tree by the path their
+ * links resolve to, and the RDMA devices of <root>/class/infiniband.
+ *
+ * The path between a GPU and a NIC goes up to their closest common bridge:
+ * under one PCIe switch peer to peer traffic doesn't touch the CPU, through
+ * the root complex or across sockets it costs bandwidth. The slowest link of
+ * the path (speed times width) bounds the transfers, a link trained below its
+ * max speed or width is reported as degraded.
+ *
+ * The root is "/sys", or a fake tree of the same layout for tests.
+ */
+class PciTopology {
+public:
+    /* How far the path between two devices goes, the closest first */
+    enum class PathType {
+        SWITCH,         /* under a common PCIe switch, below the root ports */
+        HOST_BRIDGE,    /* through a root port or the host bridge of both */
+        NODE,           /* across host bridges of one known NUMA node */
+        SYSTEM          /* across NUMA nodes (the socket interconnect), or a node is unknown */
+    };
+
+    struct Link {
+        double      speed_gts;      /* GT/s per lane, 0 - unknown */
+        int         width;          /* lanes, 0 - unknown */
+        double      max_speed_gts;
+        int         max_width;
+    };
+
+    struct Device {
+        std::string                 bdf;        /* domain:bus:device.function, e.g. "0000:b7:00.0" */
+        uint32_t                    class_code;
+        uint16_t                    vendor;
+        int                         numa_node;  /* -1 - unknown */
+        Link                        link;       /* to its upstream port */
+        std::string                 host_bridge; /* e.g. "pci0000:b0" */
+        std::vector<std::string>    bridges;    /* from the root port down to its parent */
+    };
+
+    struct Nic {
+        std::string                 name;       /* RDMA device, e.g. "mlx5_12" */
+        std::string                 bdf;
+        std::vector<std::string>    netdevs;    /* its net devices, e.g. "ens12f0" */
+    };
+
+    struct Path {
+        PathType    type;
+        int         hops;           /* PCIe links on the path */
+        double      bandwidth_gbps; /* data rate of the slowest link, 0 - unknown */
+        std::string bottleneck;     /* BDF of the device on the slowest link */
+        bool        degraded;       /* a link runs below its max speed or width */
+    };
+
+    /* Throws std::system_error if <root>/bus/pci/devices can't be read */
+    explicit PciTopology(const std::string& sysfs_root = "/sys");
+
+    /* BDFs of the GPUs (display class devices) */
+    const std::vector<std::string>& gpus() const { return gpus_; }
+    const std::vector<Nic>& nics() const { return nics_; }
+
+    /* The device of a BDF, the domain may be omitted ("b7:00.0"); nullptr if there is none */
+    const Device* device(const std::string& bdf) const;
+
+    /* Throws std::invalid_argument if a BDF is not in the tree */
+    Path path(const std::string& bdf_a, const std::string& bdf_b) const;
+
+    /*
+     * The NICs ordered by their path from the GPU: path type, hops, then
+     * bandwidth. Throws std::invalid_argument if the GPU is not in the tree.
+     */
+    std::vector<std::pair<const Nic*, Path>> nearest_nics(const std::string& gpu_bdf) const;
+
+    /* The path of every GPU to every NIC, the nearest first, with the bottlenecks */
+    std::string report() const;
+
+    /* "b7:00.0" -> "0000:b7:00.0", lower case */
+    static std::string normalize_bdf(const std::string& bdf);
+    static const char* path_name(PathType type);
+
+    /* The IPv4 (else IPv6) address of a net device, false if it has none */
+    static bool netdev_addr(const std::string& netdev, sockaddr_storage& addr);
+
+private:
+    void read_device(const std::string& bdf);
+    void read_nics();
+
+    std::string root_;
+    std::map<std::string, Device> devices_;
+    std::vector<std::string> gpus_;
+    std::vector<Nic> nics_;
+};
+
+} // namespace gdr
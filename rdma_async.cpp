@@ -0,0 +1,191 @@
+#include "rdma_async.hpp"
+
+#include <algorithm>
+#include <cerrno>
+
+namespace gdr {
+
+TaskFuture::TaskFuture(TaskFuture&& other) noexcept
+    : dev_(other.dev_), slot_(other.slot_), gen_(other.gen_) {
+    other.dev_ = nullptr;
+}
+
+TaskFuture& TaskFuture::operator=(TaskFuture&& other) noexcept {
+    if (this != &other) {
+        release();
+        dev_ = other.dev_;
+        slot_ = other.slot_;
+        gen_ = other.gen_;
+        other.dev_ = nullptr;
+    }
+    return *this;
+}
+
+TaskFuture::~TaskFuture() {
+    release();
+}
+
+void TaskFuture::release() {
+    if (!dev_) {
+        return;
+    }
+    AsyncDevice::Slot& s = dev_->slots_[slot_];
+    if (s.state == AsyncDevice::SlotState::DONE) {
+        dev_->free_slot(slot_);
+    } else {
+        s.detached = true;
+    }
+    dev_ = nullptr;
+}
+
+bool TaskFuture::ready() const {
+    if (!dev_) {
+        throw std::logic_error("TaskFuture::ready() on an empty future");
+    }
+    return dev_->slots_[slot_].state == AsyncDevice::SlotState::DONE;
+}
+
+rdma_completion_status TaskFuture::get() {
+    if (!dev_) {
+        throw std::logic_error("TaskFuture::get() on an empty future");
+    }
+    while (!ready()) {
+        dev_->poll();
+    }
+    rdma_completion_status status = dev_->slots_[slot_].status;
+    release();
+    return status;
+}
+
+AsyncDevice::AsyncDevice(rdma_device* device, uint32_t capacity)
+    : device_(device), slots_(capacity), in_flight_(0) {
+    if (!device_ || !capacity) {
+        throw std::invalid_argument("AsyncDevice requires a device and a non zero capacity");
+    }
+    free_slots_.reserve(capacity);
+    for (uint32_t i = capacity; i > 0; i--) {
+        slots_[i - 1] = Slot{ 0, SlotState::FREE, false, RDMA_STATUS_SUCCESS, nullptr, nullptr, 0 };
+        free_slots_.push_back(i - 1);
+    }
+}
+
+uint32_t AsyncDevice::alloc_slot(CompletionCallback cb, void* ctx, uint64_t user_data) {
+    if (free_slots_.empty()) {
+        throw std::system_error(EAGAIN, std::generic_category(), "AsyncDevice: all completion slots are in use");
+    }
+    uint32_t slot = free_slots_.back();
+    free_slots_.pop_back();
+
+    Slot& s = slots_[slot];
+    s.gen++;
+    s.state = SlotState::PENDING;
+    s.detached = false;
+    s.status = RDMA_STATUS_SUCCESS;
+    s.cb = cb;
+    s.ctx = ctx;
+    s.user_data = user_data;
+    return slot;
+}
+
+void AsyncDevice::free_slot(uint32_t slot) {
+    slots_[slot].state = SlotState::FREE;
+    free_slots_.push_back(slot);
+}
+
+void AsyncDevice::post(rdma_task_attr& attr, rdma_remote_buffer* rbuf, size_t offset, size_t length, uint32_t slot) {
+    attr.wr_id = make_wr_id(slot, slots_[slot].gen);
+
+    int ret_val = rbuf ? rdma_submit_task_handle(&attr, rbuf, offset, length) : rdma_submit_task(&attr);
+    if (ret_val) {
+        free_slot(slot);
+        throw std::system_error(ret_val, std::generic_category(), "AsyncDevice: failed to submit RDMA task");
+    }
+    in_flight_++;
+}
+
+TaskFuture AsyncDevice::submit(rdma_task_attr& attr) {
+    return submit(attr, static_cast<rdma_remote_buffer*>(nullptr), 0, 0);
+}
+
+TaskFuture AsyncDevice::submit(rdma_task_attr& attr, rdma_remote_buffer* rbuf, size_t offset, size_t length) {
+    uint32_t slot = alloc_slot(nullptr, nullptr, 0);
+    post(attr, rbuf, offset, length, slot);
+    return TaskFuture(this, slot, slots_[slot].gen);
+}
+
+void AsyncDevice::submit_callback(rdma_task_attr& attr, CompletionCallback cb, void* ctx, uint64_t user_data) {
+    submit_callback(attr, nullptr, 0, 0, cb, ctx, user_data);
+}
+
+void AsyncDevice::submit_callback(rdma_task_attr& attr, rdma_remote_buffer* rbuf, size_t offset, size_t length,
+                                  CompletionCallback cb, void* ctx, uint64_t user_data) {
+    uint32_t slot = alloc_slot(cb, ctx, user_data);
+    slots_[slot].detached = true; /* nobody holds a future of a callback task */
+    post(attr, rbuf, offset, length, slot);
+}
+
+int AsyncDevice::submit_callbacks(rdma_task_attr* attrs, int num_tasks, CompletionCallback cb, void* const* ctxs,
+                                  int* results) {
+    int num_slots = std::min(num_tasks, static_cast<int>(free_slots_.size()));
+
+    for (int i = 0; i < num_slots; i++) {
+        uint32_t slot = alloc_slot(cb, ctxs[i], 0);
+
+        slots_[slot].detached = true;
+        attrs[i].wr_id = make_wr_id(slot, slots_[slot].gen);
+    }
+    int posted = num_slots ? rdma_submit_tasks(attrs, num_slots, results) : 0;
+    for (int i = 0; i < num_slots; i++) {
+        if (results[i]) {
+            free_slot(static_cast<uint32_t>(attrs[i].wr_id));
+        }
+    }
+    for (int i = num_slots; i < num_tasks; i++) {
+        results[i] = EAGAIN;
+    }
+    in_flight_ += posted;
+    return posted;
+}
+
+void AsyncDevice::complete(uint32_t slot, rdma_completion_status status) {
+    Slot& s = slots_[slot];
+
+    in_flight_--;
+    s.status = status;
+    s.state = SlotState::DONE;
+    if (s.cb) {
+        s.cb(s.ctx, s.user_data, status);
+    }
+    if (s.detached) {
+        free_slot(slot);
+    }
+}
+
+int AsyncDevice::poll() {
+    rdma_completion_event events[POLL_BATCH];
+    int reported = rdma_poll_completions(device_, events, POLL_BATCH);
+    int dispatched = 0;
+
+    for (int i = 0; i < reported; i++) {
+        uint32_t slot = static_cast<uint32_t>(events[i].wr_id);
+        uint32_t gen = static_cast<uint32_t>(events[i].wr_id >> 32);
+
+        if (slot >= slots_.size() || slots_[slot].state != SlotState::PENDING || slots_[slot].gen != gen) {
+            /* Not submitted through this dispatcher, or already failed by fail_pending() */
+            continue;
+        }
+        complete(slot, events[i].status);
+        dispatched++;
+    }
+    return dispatched;
+}
+
+void AsyncDevice::fail_pending() {
+    for (uint32_t slot = 0; slot < slots_.size(); slot++) {
+        if (slots_[slot].state == SlotState::PENDING) {
+            complete(slot, RDMA_STATUS_ERR_LAST);
+        }
+    }
+}
+
+} // namespace gdr
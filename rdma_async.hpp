@@ -0,0 +1,135 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+
+#include "gpu_direct_rdma_access.h"
+
+namespace gdr {
+
+class AsyncDevice;
+
+/*
+ * Completion callback, invoked from AsyncDevice::poll() with the context and
+ * user_data given at submission. A plain function pointer, so registering it
+ * doesn't allocate.
+ */
+using CompletionCallback = void (*)(void* ctx, uint64_t user_data, rdma_completion_status status);
+
+/*
+ * Handle to the completion of one submitted task. Move-only; a future dropped
+ * before its task completes is detached and its slot is recycled on completion.
+ */
+class TaskFuture {
+public:
+    TaskFuture() : dev_(nullptr), slot_(0), gen_(0) {}
+    TaskFuture(TaskFuture&& other) noexcept;
+    TaskFuture& operator=(TaskFuture&& other) noexcept;
+    ~TaskFuture();
+    TaskFuture(const TaskFuture&) = delete;
+    TaskFuture& operator=(const TaskFuture&) = delete;
+
+    bool valid() const { return dev_ != nullptr; }
+    bool ready() const;
+
+    /* Drive the device completions until this task completes and return its status */
+    rdma_completion_status get();
+
+private:
+    friend class AsyncDevice;
+    TaskFuture(AsyncDevice* dev, uint32_t slot, uint32_t gen) : dev_(dev), slot_(slot), gen_(gen) {}
+    void release();
+
+    AsyncDevice* dev_;
+    uint32_t slot_;
+    uint32_t gen_;
+};
+
+/*
+ * Completion dispatcher of a (server) rdma_device. All tasks of the device have
+ * to be submitted through it, since it owns the wr_id of every task: the wr_id
+ * carries the index and generation of a preallocated completion slot, so
+ * correlating a completion costs an array lookup and no allocation.
+ *
+ * Not thread safe, use one AsyncDevice per device per thread.
+ */
+class AsyncDevice {
+public:
+    static constexpr uint32_t DEFAULT_CAPACITY = 1024;
+
+    explicit AsyncDevice(rdma_device* device, uint32_t capacity = DEFAULT_CAPACITY);
+    AsyncDevice(const AsyncDevice&) = delete;
+    AsyncDevice& operator=(const AsyncDevice&) = delete;
+
+    rdma_device* device() const { return device_; }
+    uint32_t in_flight() const { return in_flight_; }
+    bool full() const { return free_slots_.empty(); }
+
+    /*
+     * Submit a task, with the remote buffer of attr (rdma_submit_task()) or an
+     * imported handle (rdma_submit_task_handle()). attr.wr_id is overwritten.
+     * Completion is reported through the returned future, or by the callback.
+     * Throws std::system_error if the task can't be posted, of EAGAIN if the
+     * send queue or all slots are full: it may be submitted after completions.
+     */
+    TaskFuture submit(rdma_task_attr& attr);
+    TaskFuture submit(rdma_task_attr& attr, rdma_remote_buffer* rbuf, size_t offset, size_t length);
+    void submit_callback(rdma_task_attr& attr, CompletionCallback cb, void* ctx, uint64_t user_data);
+    void submit_callback(rdma_task_attr& attr, rdma_remote_buffer* rbuf, size_t offset, size_t length,
+                         CompletionCallback cb, void* ctx, uint64_t user_data);
+
+    /*
+     * Submit num_tasks tasks with a doorbell per used DCI (rdma_submit_tasks()),
+     * task i reported by cb with ctxs[i] and user_data 0. attrs[i].wr_id is
+     * overwritten. results[i] is 0 for a posted task, else its error as
+     * rdma_submit_tasks() gives it, EAGAIN for the tasks without a free slot.
+     *
+     * returns: the number of posted tasks
+     */
+    int submit_callbacks(rdma_task_attr* attrs, int num_tasks, CompletionCallback cb, void* const* ctxs, int* results);
+
+    /*
+     * Poll one batch of completions, resolving their futures and invoking their callbacks.
+     *
+     * returns: the number of dispatched completions
+     */
+    int poll();
+
+    /*
+     * Complete every task in flight with RDMA_STATUS_ERR_LAST, to be used after
+     * rdma_reset_device() which flushes the posted tasks without reporting them.
+     */
+    void fail_pending();
+
+private:
+    friend class TaskFuture;
+
+    enum class SlotState : uint8_t { FREE, PENDING, DONE };
+
+    struct Slot {
+        uint32_t                gen;
+        SlotState               state;
+        bool                    detached;   /* future dropped, recycle on completion */
+        rdma_completion_status  status;
+        CompletionCallback      cb;
+        void*                   ctx;
+        uint64_t                user_data;
+    };
+
+    static constexpr int POLL_BATCH = 16;
+
+    uint32_t alloc_slot(CompletionCallback cb, void* ctx, uint64_t user_data);
+    void free_slot(uint32_t slot);
+    void post(rdma_task_attr& attr, rdma_remote_buffer* rbuf, size_t offset, size_t length, uint32_t slot);
+    void complete(uint32_t slot, rdma_completion_status status);
+
+    static uint64_t make_wr_id(uint32_t slot, uint32_t gen) { return (static_cast<uint64_t>(gen) << 32) | slot; }
+
+    rdma_device* device_;
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> free_slots_;
+    uint32_t in_flight_;
+};
+
+} // namespace gdr
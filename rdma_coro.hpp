@@ -0,0 +1,373 @@
+#pragma once
+/*
+ * C++20 coroutine executor for RDMA transfers.
+ *
+ * A request handler is written as straight-line code:
+ *
+ *     gdr::Task handle_client(gdr::Executor<gdr::VerbsDevice>& exec, int fd, rdma_remote_buffer* rbuf) {
+ *         for (;;) {
+ *             co_await exec.readable(fd);
+ *             ... recv the request ...
+ *             rdma_completion_status status = co_await exec.write(rbuf, offset, local, len);
+ *             ... send the ack ...
+ *         }
+ *     }
+ *
+ * and many of them are spawned on one single-threaded executor, which polls the
+ * device completions and the awaited fds and resumes each handler when its
+ * transfer completes, so one thread keeps hundreds of requests in flight.
+ *
+ * The executor is templated on the device: VerbsDevice posts the transfers
+ * through gdr::AsyncDevice, SoftDevice is a software stand-in which copies
+ * memory, so handlers can be run end to end without RDMA hardware.
+ */
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_set>
+#include <utility>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "rdma_async.hpp"
+
+namespace gdr {
+
+class ExecutorBase;
+
+/*
+ * Fire-and-forget coroutine, started by Executor::spawn(). An exception escaping
+ * it is stored by the executor and rethrown from Executor::run(), the other
+ * tasks are left suspended and run() may be called again to continue them.
+ */
+class Task {
+public:
+    struct promise_type {
+        ExecutorBase* exec = nullptr;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void();
+        void unhandled_exception();
+    };
+
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (handle_) {
+            handle_.destroy(); /* never spawned */
+        }
+    }
+
+private:
+    friend class ExecutorBase;
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/* Device independent part of the executor: the ready queue, the fd readiness and the task accounting */
+class ExecutorBase {
+public:
+    ExecutorBase() : epoll_fd_(epoll_create1(0)), fd_waiters_(0) {
+        if (epoll_fd_ < 0) {
+            throw std::system_error(errno, std::generic_category(), "epoll_create1 failed");
+        }
+    }
+    /* Destroys the unfinished tasks, none of them may have a transfer in flight */
+    ~ExecutorBase() {
+        for (void* frame : tasks_) {
+            std::coroutine_handle<>::from_address(frame).destroy();
+        }
+        close(epoll_fd_);
+    }
+    ExecutorBase(const ExecutorBase&) = delete;
+    ExecutorBase& operator=(const ExecutorBase&) = delete;
+
+    void spawn(Task task) {
+        std::coroutine_handle<Task::promise_type> handle = std::exchange(task.handle_, nullptr);
+        handle.promise().exec = this;
+        tasks_.insert(handle.address());
+        ready_.push_back(handle);
+    }
+
+    int live_tasks() const { return tasks_.size(); }
+
+    /* Awaitable suspending the coroutine until fd is readable (EPOLLIN) or writable (EPOLLOUT) */
+    class FdAwaitable {
+    public:
+        FdAwaitable(ExecutorBase* exec, int fd, uint32_t events) : exec_(exec), fd_(fd), events_(events) {}
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            struct epoll_event ev;
+
+            handle_ = handle;
+            ev.events = events_ | EPOLLONESHOT;
+            ev.data.ptr = this;
+            if (epoll_ctl(exec_->epoll_fd_, EPOLL_CTL_MOD, fd_, &ev) &&
+                (errno != ENOENT || epoll_ctl(exec_->epoll_fd_, EPOLL_CTL_ADD, fd_, &ev))) {
+                throw std::system_error(errno, std::generic_category(), "epoll_ctl failed");
+            }
+            exec_->fd_waiters_++;
+        }
+        /* returns: the received epoll events (EPOLLHUP/EPOLLERR are reported too) */
+        uint32_t await_resume() const noexcept { return revents_; }
+
+    private:
+        friend class ExecutorBase;
+        ExecutorBase* exec_;
+        int fd_;
+        uint32_t events_;
+        uint32_t revents_ = 0;
+        std::coroutine_handle<> handle_;
+    };
+
+    FdAwaitable readable(int fd) { return FdAwaitable(this, fd, EPOLLIN); }
+    FdAwaitable writable(int fd) { return FdAwaitable(this, fd, EPOLLOUT); }
+
+    /* An fd must be forgotten before it's closed, if it was ever awaited */
+    void forget_fd(int fd) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+protected:
+    friend struct Task::promise_type;
+
+    void task_done(void* frame) {
+        tasks_.erase(frame);
+    }
+    void task_failed(void* frame, std::exception_ptr error) {
+        tasks_.erase(frame);
+        if (!error_) {
+            error_ = error;
+        }
+    }
+
+    /* Resume everything which is ready, the resumed coroutines may queue more */
+    bool resume_ready() {
+        bool resumed = !ready_.empty();
+
+        while (!ready_.empty()) {
+            std::coroutine_handle<> handle = ready_.front();
+            ready_.pop_front();
+            handle.resume();
+        }
+        return resumed;
+    }
+
+    /* returns: the number of fd waiters made ready */
+    int poll_fds(int timeout_ms) {
+        struct epoll_event events[EPOLL_BATCH];
+
+        if (!fd_waiters_) {
+            return 0;
+        }
+        int n = epoll_wait(epoll_fd_, events, EPOLL_BATCH, timeout_ms);
+        for (int i = 0; i < n; i++) {
+            FdAwaitable* waiter = static_cast<FdAwaitable*>(events[i].data.ptr);
+            waiter->revents_ = events[i].events;
+            fd_waiters_--;
+            ready_.push_back(waiter->handle_);
+        }
+        return n > 0 ? n : 0;
+    }
+
+    void rethrow_error() {
+        if (error_) {
+            std::rethrow_exception(std::exchange(error_, nullptr));
+        }
+    }
+
+    static constexpr int EPOLL_BATCH = 64;
+
+    std::deque<std::coroutine_handle<>> ready_;
+    std::unordered_set<void*> tasks_;   /* frames of the spawned, unfinished tasks */
+    int epoll_fd_;
+    int fd_waiters_;
+    std::exception_ptr error_;
+};
+
+inline void Task::promise_type::return_void() {
+    exec->task_done(std::coroutine_handle<promise_type>::from_promise(*this).address());
+}
+
+inline void Task::promise_type::unhandled_exception() {
+    exec->task_failed(std::coroutine_handle<promise_type>::from_promise(*this).address(), std::current_exception());
+}
+
+/*
+ * Device of the executor, posting the transfers through gdr::AsyncDevice.
+ * Local addresses have to be inside the registered local buffer.
+ */
+class VerbsDevice {
+public:
+    using remote_type = rdma_remote_buffer*;
+
+    VerbsDevice(AsyncDevice& async, rdma_buffer* local_buf) : async_(async), local_buf_(local_buf) {}
+
+    void submit(remote_type remote, size_t remote_offset, void* local, size_t length, bool read,
+                CompletionCallback cb, void* ctx) {
+        struct iovec iov = { local, length };
+        rdma_task_attr attr;
+
+        std::memset(&attr, 0, sizeof attr);
+        attr.local_buf_rdma = local_buf_;
+        attr.local_buf_iovec = &iov;
+        attr.local_buf_iovcnt = 1;
+        attr.flags = read ? RDMA_TASK_ATTR_RDMA_READ : 0;
+        async_.submit_callback(attr, remote, remote_offset, length, cb, ctx, 0);
+    }
+    int poll() { return async_.poll(); }
+    uint32_t in_flight() const { return async_.in_flight(); }
+
+private:
+    AsyncDevice& async_;
+    rdma_buffer* local_buf_;
+};
+
+/*
+ * Software stand-in for the verbs layer: the "remote" buffer is local memory,
+ * a transfer is a memcpy done on the next poll(), so completions are deferred
+ * the same way as on the hardware. fail_next() makes the next transfers
+ * complete with an error.
+ */
+class SoftDevice {
+public:
+    using remote_type = void*;
+
+    void submit(remote_type remote, size_t remote_offset, void* local, size_t length, bool read,
+                CompletionCallback cb, void* ctx) {
+        queue_.push_back(Transfer{ static_cast<uint8_t*>(remote) + remote_offset, local, length, read, cb, ctx });
+    }
+    int poll() {
+        int completed = 0;
+
+        /* only the transfers posted before this poll, a callback may post more */
+        for (size_t n = queue_.size(); n > 0; n--, completed++) {
+            Transfer t = queue_.front();
+            queue_.pop_front();
+
+            rdma_completion_status status = RDMA_STATUS_SUCCESS;
+            if (fail_count_ > 0) {
+                fail_count_--;
+                status = RDMA_STATUS_ERR_LAST;
+            } else if (t.read) {
+                std::memcpy(t.local, t.remote, t.length);
+            } else {
+                std::memcpy(t.remote, t.local, t.length);
+            }
+            t.cb(t.ctx, 0, status);
+        }
+        return completed;
+    }
+    uint32_t in_flight() const { return queue_.size(); }
+    void fail_next(int count = 1) { fail_count_ += count; }
+
+private:
+    struct Transfer {
+        uint8_t* remote;
+        void* local;
+        size_t length;
+        bool read;
+        CompletionCallback cb;
+        void* ctx;
+    };
+
+    std::deque<Transfer> queue_;
+    int fail_count_ = 0;
+};
+
+/*
+ * Single-threaded executor: resumes the ready coroutines, polls the device
+ * completions and the awaited fds. It busy polls while transfers are in flight
+ * and blocks on the fds otherwise.
+ */
+template <typename Device>
+class Executor : public ExecutorBase {
+public:
+    using remote_type = typename Device::remote_type;
+
+    explicit Executor(Device& device) : device_(device) {}
+
+    /* Awaitable RDMA transfer, resumes with the completion status */
+    class TransferAwaitable {
+    public:
+        TransferAwaitable(Executor* exec, remote_type remote, size_t remote_offset, void* local, size_t length, bool read)
+            : exec_(exec), remote_(remote), remote_offset_(remote_offset), local_(local), length_(length), read_(read) {}
+
+        bool await_ready() const noexcept { return false; }
+        /* A failure to post is thrown into the awaiting coroutine */
+        void await_suspend(std::coroutine_handle<> handle) {
+            handle_ = handle;
+            exec_->device_.submit(remote_, remote_offset_, local_, length_, read_, &TransferAwaitable::on_completion, this);
+        }
+        rdma_completion_status await_resume() const noexcept { return status_; }
+
+    private:
+        static void on_completion(void* ctx, uint64_t, rdma_completion_status status) {
+            TransferAwaitable* self = static_cast<TransferAwaitable*>(ctx);
+            self->status_ = status;
+            /* resumed from the executor loop, not from inside the device poll */
+            self->exec_->ready_.push_back(self->handle_);
+        }
+
+        Executor* exec_;
+        remote_type remote_;
+        size_t remote_offset_;
+        void* local_;
+        size_t length_;
+        bool read_;
+        rdma_completion_status status_ = RDMA_STATUS_SUCCESS;
+        std::coroutine_handle<> handle_;
+    };
+
+    /* RDMA Write of length bytes from local to remote + remote_offset */
+    TransferAwaitable write(remote_type remote, size_t remote_offset, void* local, size_t length) {
+        return TransferAwaitable(this, remote, remote_offset, local, length, false);
+    }
+    /* RDMA Read of length bytes from remote + remote_offset to local */
+    TransferAwaitable read(remote_type remote, size_t remote_offset, void* local, size_t length) {
+        return TransferAwaitable(this, remote, remote_offset, local, length, true);
+    }
+
+    /*
+     * One pass of the loop.
+     *
+     * returns: false when there is nothing left to do
+     */
+    bool run_once() {
+        bool progress = resume_ready();
+
+        if (device_.in_flight()) {
+            progress |= device_.poll() > 0;
+            progress |= poll_fds(0) > 0;
+        } else if (ready_.empty()) {
+            progress |= poll_fds(-1) > 0;
+        }
+        return progress || !ready_.empty() || device_.in_flight() || fd_waiters_;
+    }
+
+    /* Run until all the spawned tasks finish, rethrows the first exception which escaped a task */
+    void run() {
+        while (!tasks_.empty() && run_once()) {
+            rethrow_error();
+        }
+        rethrow_error();
+        if (!tasks_.empty()) {
+            throw std::logic_error("Executor: tasks are suspended with nothing to wake them up");
+        }
+    }
+
+private:
+    Device& device_;
+};
+
+} // namespace gdr
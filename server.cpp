@@ -46,14 +46,45 @@
 #include <getopt.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "utils.hpp"
+#include "rdma_async.hpp"
+#include "staging_pool.hpp"
+#include "uring.hpp"
+#include "mapped_file.hpp"
 #include "gpu_direct_rdma_access.h"
 
-#define MAX_SGES 512
 #define ACK_MSG "rdma_task completed"
 #define PACKAGE_TYPES 2
 
+enum payload_type {
+    PAYLOAD_RDMA_BUF_DESC     = 0,
+    PAYLOAD_TASK_ATTRS        = 1,
+    PAYLOAD_RDMA_BUF_DESC_BIN = 2,
+    PAYLOAD_REQUEST_ID        = 3, /* optional first package of a request, uint32_t id */
+    PAYLOAD_ACK               = 4, /* server -> client ack of a request with an id, uint32_t id */
+    PAYLOAD_NOTIFY_DESC       = 5, /* binary desc of the client completion slot, before the first request */
+    PAYLOAD_FILE_REQ          = 6, /* instead of PAYLOAD_TASK_ATTRS: RDMA write a file range, see FILE_REQ_HDR_SIZE */
+    PAYLOAD_REMOTE_SGL        = 7, /* instead of PAYLOAD_TASK_ATTRS: the task on segments of the buffer, see REMOTE_SGL_HDR_SIZE */
+};
+
 extern int debug;
 extern int debug_fast_path;
 
@@ -71,9 +102,192 @@ struct user_params {
     unsigned long       size;
     int                 iters;
     int                 num_sges;
+    int                 num_dcis;
+    int                 num_workers;
+    int                 poll_spin_usec;  /* -1 - busy poll only */
+    int                 poll_yield_usec;
+    int                 cq_mod_count;
+    int                 cq_mod_period;
+    unsigned long       stripe_size;     /* 0 - a task goes on the DCI of its client only */
+    int                 signal_period;   /* WRs of a DCI per CQE, 0 - every task */
+    int                 max_inline_data; /* 0 - the library default, -1 - no inline writes */
+    unsigned long       pool_mb;         /* staging pool of each worker */
+    const char         *mem_spec;        /* memory provider of the staging pools, NULL - host */
+    int                 numa_local;      /* workers and their staging pools on the NUMA node of the NIC */
+    const char         *file_root;       /* files served by PAYLOAD_FILE_REQ, NULL - not served */
+    unsigned long       file_chunk;      /* bytes of a file read, pipelined with the RDMA writes */
+    long                file_mmap_mb;    /* MR size of the registered file mappings (0 - device limit),
+                                          * -1 - the files are read with io_uring */
     struct sockaddr     hostaddr;
 };
 
+#define DESC_STR_SIZE       sizeof "0102030405060708:0102030405060708:01020304:0102:010203:1:0102030405060708090a0b0c0d0e0f10"
+#define PACKAGE_HDR_SIZE    (sizeof(uint8_t) + sizeof(uint16_t)) /* type + size */
+#define MAX_PACKAGE_SIZE    256
+#define RX_BUF_SIZE         4096
+#define MAX_EPOLL_EVENTS    64
+#define MAX_INFLIGHT_TASKS  256 /* per worker, bounded by the DCI send queues */
+#define SUBMIT_BATCH        16  /* pending requests posted with one doorbell per DCI */
+#define WAKEUP_CONN_ID      0
+#define COMP_EVENT_ID       (1ULL << 32) /* above any conn id */
+#define CONN_REM_BUFS       8   /* imported Client buffers cached per connection */
+#define DEFAULT_POOL_MB     256
+#define URING_EVENT_ID      (2ULL << 32) /* io_uring completions of the file reads */
+/* PAYLOAD_FILE_REQ: uint64_t offset, uint64_t length (0 - up to the end of the file),
+ * both little endian, then the NUL terminated file path relative to the file root */
+#define FILE_REQ_HDR_SIZE   (2 * sizeof(uint64_t))
+#define FILE_PATH_SIZE      (MAX_PACKAGE_SIZE - FILE_REQ_HDR_SIZE)
+/* PAYLOAD_REMOTE_SGL: u32 task flags, then (u64 offset, u64 length) of each segment, little-endian */
+#define REMOTE_SGL_HDR_SIZE sizeof(uint32_t)
+#define MAX_REMOTE_SGES     ((MAX_PACKAGE_SIZE - REMOTE_SGL_HDR_SIZE) / sizeof(struct rdma_remote_sge))
+#define DEFAULT_FILE_CHUNK  (1UL << 20)
+#define FILE_READ_DEPTH     8    /* chunks of a file request read or written at once */
+#define FILE_DIRECT_ALIGN   4096 /* of the O_DIRECT offsets and lengths */
+#define MAX_FIXED_BUFFERS   1024 /* staging slabs registered with io_uring */
+
+/* A parsed request, waiting for a free slot in the send queue */
+struct server_request {
+    uint32_t                    conn_id;
+    int                         seq;
+    uint32_t                    req_id;
+    uint32_t                    flags;
+    int                         use_bin_desc;
+    struct rdma_buffer_desc     bin_desc;
+    char                        desc_str[DESC_STR_SIZE];
+    int                         is_file;
+    uint64_t                    file_offset;
+    uint64_t                    file_length;
+    char                        file_path[FILE_PATH_SIZE];
+    int                         rem_sgl_cnt; /* 0 - the whole buffer */
+    struct rdma_remote_sge      rem_sgl[MAX_REMOTE_SGES];
+};
+
+struct server_worker;
+struct server_conn;
+
+/*
+ * A request served from a file: its chunks are read with io_uring into staging
+ * buffers and each one is RDMA written as soon as its read completes, so reads
+ * and writes of up to FILE_READ_DEPTH chunks overlap
+ */
+struct file_request {
+    struct server_conn         *conn;
+    uint32_t                    req_id;
+    int                         seq;
+    struct rdma_buffer_desc     bin_desc;
+    int                         fd;
+    gdr::MappedFile            *map;        /* written from the mapping, NULL - read with io_uring */
+    uint64_t                    offset;     /* in the file */
+    uint64_t                    length;
+    uint64_t                    issued;     /* bytes whose reads are queued */
+    uint64_t                    posted;     /* bytes whose RDMA write is posted */
+    uint64_t                    written;    /* bytes whose RDMA write is completed */
+    int                         inflight;   /* chunks being read or written */
+    int                         direct;     /* fd is O_DIRECT */
+    int                         failed;
+    std::list<std::unique_ptr<file_request>>::iterator self;
+};
+
+/* Files of the file root opened by a worker, kept open until it exits */
+struct server_file {
+    int                         fd;
+    int                         direct_fd;  /* -1 - the file system has no O_DIRECT (e.g. tmpfs before Linux 6.6) */
+};
+
+/* A request (or a chunk of a file request) posted to the device, with the staging buffer it moves the data through */
+struct server_task {
+    struct server_conn         *conn;
+    uint32_t                    req_id;
+    gdr::StagingBuffer         *staging;    /* NULL - a chunk of a file mapping */
+    struct rdma_buffer         *src_buff;   /* of a file chunk: the staging buffer or the mapping */
+    void                       *src_addr;
+    struct file_request        *freq;       /* NULL - not a file chunk */
+    uint64_t                    chunk_off;  /* in the file request */
+    uint32_t                    chunk_len;
+    std::vector<struct iovec>   iov;        /* -l gather list, valid until the task completes */
+    struct rdma_remote_sge      rem_sgl[MAX_REMOTE_SGES]; /* likewise */
+    struct server_task         *next_free;
+};
+
+/* Per-connection state of a worker event loop */
+struct server_conn {
+    struct server_worker       *worker;
+    int                         fd;
+    uint32_t                    id;
+    /* Receive framing */
+    uint8_t                     rx_buf[RX_BUF_SIZE];
+    size_t                      rx_len;
+    /* Request being assembled from PACKAGE_TYPES packages, preceded by
+     * a PAYLOAD_REQUEST_ID package if the client uses request ids */
+    struct server_request       req;
+    int                         req_pkgs;
+    int                         use_req_ids; /* -1 - not known until the first package */
+    int                         requests;   /* received */
+    int                         completed;  /* RDMA completed, ack queued or sent */
+    int                         inflight;   /* pending or posted to the device */
+    int                         file_reqs;  /* file requests in progress */
+    /* Ack transmission */
+    std::vector<uint8_t>        tx_buf;
+    size_t                      tx_off;
+    int                         epollout;
+    /* Imported Client buffers, a client may alternate between a few of them */
+    struct {
+        struct rdma_remote_buffer  *handle;
+        struct rdma_buffer_desc     desc;
+    }                           rem_bufs[CONN_REM_BUFS];
+    int                         rem_bufs_next;
+    /* Completion slot of a session in the RDMA notify mode: instead of acks the
+     * server writes the number of completed requests into it, after the data */
+    struct rdma_remote_buffer  *notify_buf;
+    int                         closed;
+    std::chrono::system_clock::time_point start;
+};
+
+struct server_worker {
+    int                         id;
+    const struct user_params   *usr_par;
+    std::thread                 thread;
+    struct rdma_device         *rdma_dev;
+    /* Staging buffers of the requests in flight, one per request */
+    std::unique_ptr<gdr::MemProvider> mem;  /* bound to the NUMA node of the NIC, NULL - the default provider */
+    std::unique_ptr<gdr::StagingPool> pool;
+    struct server_task          tasks[MAX_INFLIGHT_TASKS];
+    struct server_task         *free_tasks;
+    /* Event loop */
+    int                         epoll_fd;
+    int                         wakeup_fd;
+    uint32_t                    next_conn_id;
+    std::unordered_map<uint32_t, std::unique_ptr<server_conn>> conns;
+    std::deque<server_request>  pending;
+    std::unique_ptr<gdr::AsyncDevice> async; /* tasks posted to the device */
+    /* File serving: reads into the staging buffers, which are io_uring fixed buffers too */
+    std::unique_ptr<gdr::Uring> uring;
+    int                         uring_fd = -1; /* eventfd of the io_uring completions */
+    std::vector<bool>           fixed_slabs;
+    std::unordered_map<std::string, server_file> files;
+    std::unordered_map<std::string, std::unique_ptr<gdr::MappedFile>> mapped_files;
+    size_t                      max_map_segment;
+    std::list<std::unique_ptr<file_request>> file_reqs;
+    std::deque<server_task *>   file_ready; /* chunks read, waiting for room in the send queues */
+    int                         resetting;
+    /* Completion polling policy: spin, then yield, then sleep on the completion channel */
+    std::chrono::steady_clock::time_point poll_idle_since;
+    int                         cq_armed;
+    unsigned long long          cq_sleeps;
+    /* Connections steered to this worker by the acceptor */
+    std::mutex                  conn_lock;
+    std::deque<int>             conn_queue;
+    std::atomic<int>            active_conns{0};
+    int                         stopping = 0;
+    int                         ret_val = 0;
+    /* Statistics */
+    unsigned long long          iters = 0;
+    double                      busy_seconds = 0;
+    unsigned long long          file_chunks = 0;
+    unsigned long long          mapped_chunks = 0;
+    unsigned long long          file_bytes = 0;
+};
+
 static volatile int keep_running = 1;
 
 void sigint_handler(int dummy)
@@ -82,10 +296,9 @@ void sigint_handler(int dummy)
 }
 
 /****************************************************************************************
- * Open temporary socket connection on the server side, listening to the client.
- * Accepting connection from the client and closing temporary socket.
- * If success, return the accepted socket file descriptor ID
- * Return value: socket fd - success, -1 - error
+ * Open the listening socket on the server side, client connections are accepted
+ * on it by the main thread and steered to the workers.
+ * Return value: listening socket fd - success, -1 - error
  ****************************************************************************************/
 static int open_server_socket(int port)
 {
@@ -97,7 +310,6 @@ static int open_server_socket(int port)
     };
     char   *service;
     int     ret_val;
-    int     sockfd;
     int     tmp_sockfd = -1;
 
     ret_val = asprintf(&service, "%d", port);
@@ -133,15 +345,13 @@ static int open_server_socket(int port)
         return -1;
     }
 
-    listen(tmp_sockfd, 1);
-    sockfd = accept(tmp_sockfd, NULL, 0);
-    close(tmp_sockfd);
-    if (sockfd < 0) {
-        fprintf(stderr, "accept() failed\n");
+    if (listen(tmp_sockfd, SOMAXCONN)) {
+        fprintf(stderr, "listen() failed (errno=%d '%m')\n", errno);
+        close(tmp_sockfd);
         return -1;
-    } 
-    
-    return sockfd;
+    }
+
+    return tmp_sockfd;
 }
 
 static void usage(const char *argv0)
@@ -156,6 +366,29 @@ static void usage(const char *argv0)
     printf("  -s, --size=<size>         size of message to exchange (default 4096)\n");
     printf("  -n, --iters=<iters>       number of exchanges (default 1000)\n");
     printf("  -l, --sg_list-len=<length> number of sge-s to send in sg_list (default 0 - old mode)\n");
+    printf("  -q, --dcis=<num>          number of DCIs in the device DCI pool (default 1)\n");
+    printf("  -w, --workers=<num>       number of worker threads, each with its own RDMA device context (default 1)\n");
+    printf("  -S, --poll-spin=<usec>    busy poll the CQ for <usec> without completions before backing off\n"
+           "                            (default 50, -1 - always busy poll, no completion channel)\n");
+    printf("  -Y, --poll-yield=<usec>   then poll with sched_yield() for <usec> before sleeping on\n"
+           "                            the completion channel (default 200)\n");
+    printf("  -M, --cq-moderation=<count>,<usec> CQ event moderation, if supported (default off)\n");
+    printf("  -T, --stripe=<size>       stripe the tasks larger than <size> over the DCIs, in chunks of about <size>,\n"
+           "                            for the clients without completion slots (default 0 - off)\n");
+    printf("  -G, --signal-period=<wrs> selective signaling, a CQE about every <wrs> WRs of a DCI, which reports\n"
+           "                            the tasks before it as well (default 0 - a CQE per task)\n");
+    printf("  -I, --inline=<size>       RDMA Writes up to <size> bytes carry their data in the WR, the NIC doesn't\n"
+           "                            read the staging buffer (default 0 - the library default, -1 - off)\n");
+    printf("  -H, --mem=<provider>      memory of the staging pool: host (default), huge2m, huge1g, shm, shm-huge2m,\n"
+           "                            numa:<node>, or any of them bound to a NUMA node as <provider>@<node>\n");
+    printf("  -N, --no-numa             don't bind the workers and their staging pools to the NUMA node of the NIC\n");
+    printf("  -m, --pool-size=<MB>      registered staging memory of each worker, a buffer per request in flight\n"
+           "                            (default %d)\n", DEFAULT_POOL_MB);
+    printf("  -F, --file-root=<dir>     serve file requests of the clients from the files under <dir>\n");
+    printf("  -K, --file-chunk=<size>   bytes of a file read, reads are pipelined with the RDMA writes, a multiple\n"
+           "                            of %d (default %lu)\n", FILE_DIRECT_ALIGN, DEFAULT_FILE_CHUNK);
+    printf("  -Z, --file-mmap[=<MB>]    zero copy file requests: the files are mapped and registered, in MRs\n"
+           "                            of up to <MB> (default - the device limit), instead of being read\n");
     printf("  -D, --debug-mask=<mask>   debug bitmask: bit 0 - debug print enable,\n"
            "                                           bit 1 - fast path debug print enable\n");
 }
@@ -167,6 +400,13 @@ static int parse_command_line(int argc, char *argv[], struct user_params *usr_pa
     usr_par->port       = 18515;
     usr_par->size       = 4096;
     usr_par->iters      = 1000;
+    usr_par->num_workers = 1;
+    usr_par->poll_spin_usec  = 50;
+    usr_par->poll_yield_usec = 200;
+    usr_par->pool_mb         = DEFAULT_POOL_MB;
+    usr_par->numa_local      = 1;
+    usr_par->file_chunk      = DEFAULT_FILE_CHUNK;
+    usr_par->file_mmap_mb    = -1;
 
     while (1) {
         int c;
@@ -178,11 +418,25 @@ static int parse_command_line(int argc, char *argv[], struct user_params *usr_pa
             { .name = "size",          .has_arg = 1, .val = 's' },
             { .name = "iters",         .has_arg = 1, .val = 'n' },
             { .name = "sg_list-len",   .has_arg = 1, .val = 'l' },
+            { .name = "dcis",          .has_arg = 1, .val = 'q' },
+            { .name = "workers",       .has_arg = 1, .val = 'w' },
+            { .name = "poll-spin",     .has_arg = 1, .val = 'S' },
+            { .name = "poll-yield",    .has_arg = 1, .val = 'Y' },
+            { .name = "cq-moderation", .has_arg = 1, .val = 'M' },
+            { .name = "stripe",        .has_arg = 1, .val = 'T' },
+            { .name = "signal-period", .has_arg = 1, .val = 'G' },
+            { .name = "inline",        .has_arg = 1, .val = 'I' },
+            { .name = "pool-size",     .has_arg = 1, .val = 'm' },
+            { .name = "mem",           .has_arg = 1, .val = 'H' },
+            { .name = "no-numa",       .has_arg = 0, .val = 'N' },
+            { .name = "file-root",     .has_arg = 1, .val = 'F' },
+            { .name = "file-chunk",    .has_arg = 1, .val = 'K' },
+            { .name = "file-mmap",     .has_arg = 2, .val = 'Z' },
             { .name = "debug-mask",    .has_arg = 1, .val = 'D' },
             { 0 }
         };
 
-        c = getopt_long(argc, argv, "Pa:p:s:n:l:D:",
+        c = getopt_long(argc, argv, "Pa:p:s:n:l:q:w:S:Y:M:T:G:I:m:H:NF:K:Z::D:",
                         long_options, NULL);
         
         if (c == -1)
@@ -216,6 +470,103 @@ static int parse_command_line(int argc, char *argv[], struct user_params *usr_pa
 
         case 'l':
             usr_par->num_sges = strtol(optarg, NULL, 0);
+            if (usr_par->num_sges < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        case 'q':
+            usr_par->num_dcis = strtol(optarg, NULL, 0);
+            break;
+
+        case 'w':
+            usr_par->num_workers = strtol(optarg, NULL, 0);
+            if (usr_par->num_workers < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        case 'S':
+            usr_par->poll_spin_usec = strtol(optarg, NULL, 0);
+            break;
+
+        case 'Y':
+            usr_par->poll_yield_usec = strtol(optarg, NULL, 0);
+            break;
+
+        case 'M':
+            if (sscanf(optarg, "%d,%d", &usr_par->cq_mod_count, &usr_par->cq_mod_period) != 2 ||
+                usr_par->cq_mod_count < 0 || usr_par->cq_mod_count > UINT16_MAX ||
+                usr_par->cq_mod_period < 0 || usr_par->cq_mod_period > UINT16_MAX) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        case 'T':
+            usr_par->stripe_size = strtoul(optarg, NULL, 0);
+            if (usr_par->stripe_size > UINT32_MAX) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        case 'G':
+            usr_par->signal_period = strtol(optarg, NULL, 0);
+            if (usr_par->signal_period < 0 || usr_par->signal_period > UINT16_MAX) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        case 'I':
+            usr_par->max_inline_data = strtol(optarg, NULL, 0);
+            if (usr_par->max_inline_data < -1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        case 'm':
+            usr_par->pool_mb = strtoul(optarg, NULL, 0);
+            break;
+
+        case 'H':
+            try {
+                gdr::set_default_mem_provider(gdr::MemProvider::create(optarg));
+            } catch (const std::invalid_argument& e) {
+                fprintf(stderr, "FAILURE: %s\n", e.what());
+                usage(argv[0]);
+                return 1;
+            }
+            usr_par->mem_spec = optarg;
+            break;
+
+        case 'N':
+            usr_par->numa_local = 0;
+            break;
+
+        case 'F':
+            usr_par->file_root = optarg;
+            break;
+
+        case 'K':
+            usr_par->file_chunk = strtoul(optarg, NULL, 0);
+            if (!usr_par->file_chunk || usr_par->file_chunk % FILE_DIRECT_ALIGN ||
+                usr_par->file_chunk > gdr::StagingPool::MAX_CLASS_SIZE) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        case 'Z':
+            usr_par->file_mmap_mb = optarg ? strtol(optarg, NULL, 0) : 0;
+            if (usr_par->file_mmap_mb < 0) {
+                usage(argv[0]);
+                return 1;
+            }
             break;
 
         case 'D':
@@ -234,188 +585,1537 @@ static int parse_command_line(int argc, char *argv[], struct user_params *usr_pa
         return 1;
     }
 
+    if (usr_par->size > gdr::StagingPool::MAX_CLASS_SIZE) {
+        fprintf(stderr, "FAILURE: size %lu is above the largest staging buffer (%lu)\n",
+                usr_par->size, gdr::StagingPool::MAX_CLASS_SIZE);
+        return 1;
+    }
+    if ((usr_par->pool_mb << 20) < gdr::StagingPool::class_size(usr_par->size)) {
+        fprintf(stderr, "FAILURE: size %lu needs a staging pool of at least %lu bytes\n",
+                usr_par->size, gdr::StagingPool::class_size(usr_par->size));
+        return 1;
+    }
+    if (usr_par->file_mmap_mb >= 0 && !usr_par->file_root) {
+        fprintf(stderr, "FAILURE: -Z maps the files of the file root, set by -F\n");
+        return 1;
+    }
+    if (usr_par->file_root && usr_par->file_mmap_mb < 0 && (usr_par->pool_mb << 20) < gdr::StagingPool::class_size(usr_par->file_chunk)) {
+        fprintf(stderr, "FAILURE: file chunk %lu needs a staging pool of at least %lu bytes\n",
+                usr_par->file_chunk, gdr::StagingPool::class_size(usr_par->file_chunk));
+        return 1;
+    }
+
     return 0;
 }
 
-int main(int argc, char *argv[])
+static int set_nonblocking(int fd)
 {
-    struct rdma_device     *rdma_dev;
-    int                     cnt = 0;
-    struct user_params      usr_par;
-    int                     ret_val = 0;
-    int                     sockfd;
-    struct iovec            buf_iovec[MAX_SGES];
-    auto start = std::chrono::system_clock::now();
+    int flags = fcntl(fd, F_GETFL, 0);
 
-    srand48(getpid() * time(NULL));
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        fprintf(stderr, "FAILURE: fcntl(O_NONBLOCK) failed (errno=%d '%m')\n", errno);
+        return 1;
+    }
+    return 0;
+}
 
-    ret_val = parse_command_line(argc, argv, &usr_par);
-    if (ret_val) {
-        return ret_val;
+/****************************************************************************************
+ * Close the connection socket. The connection state is kept until all its
+ * tasks posted to the device are completed.
+ ****************************************************************************************/
+static void conn_close(struct server_worker *worker, struct server_conn *conn, int failed)
+{
+    if (conn->closed) {
+        return;
     }
+    if (failed) {
+        worker->ret_val = 1;
+    } else {
+        std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - conn->start;
+        std::string label = "worker " + std::to_string(worker->id) + " conn " + std::to_string(conn->id) +
+                            (conn->notify_buf ? " (rdma notify): " : " (tcp ack): ");
 
-    rdma_dev = rdma_open_device_server(&usr_par.hostaddr);
-    if (!rdma_dev) {
-        ret_val = 1;
-        return ret_val;
+        print_run_time(label, elapsed.count(), (unsigned long long)worker->usr_par->size * conn->completed, conn->completed);
     }
-    
-    /* Local memory buffer allocation */
-    /* On the server side, we allocate buffer on CPU and not on GPU */
-    void *buff = malloc(usr_par.size);
-    if (!buff) {
-        ret_val = 1;
-        goto clean_device;
+    worker->iters += conn->completed;
+
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd     = -1;
+    conn->closed = 1;
+    if (conn->notify_buf) {
+        rdma_remote_buffer_release(conn->notify_buf);
+        conn->notify_buf = NULL;
+    }
+    for (int i = 0; i < CONN_REM_BUFS; i++) {
+        if (conn->rem_bufs[i].handle) {
+            rdma_remote_buffer_release(conn->rem_bufs[i].handle);
+            conn->rem_bufs[i].handle = NULL;
+        }
     }
+    worker->active_conns--;
+}
 
-    /* RDMA buffer registration */
-    struct rdma_buffer *rdma_buff;
+static int conn_set_epollout(struct server_worker *worker, struct server_conn *conn, int enable)
+{
+    struct epoll_event ev;
 
-    rdma_buff = rdma_buffer_reg(rdma_dev, buff, usr_par.size);
-    if (!rdma_buff) {
-        ret_val = 1;
-        goto clean_mem_buff;
+    if (conn->epollout == enable) {
+        return 0;
+    }
+    ev.events   = EPOLLIN | (enable ? EPOLLOUT : 0);
+    ev.data.u64 = conn->id;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev)) {
+        fprintf(stderr, "FAILURE: epoll_ctl(MOD) failed for conn %u (errno=%d '%m')\n", conn->id, errno);
+        return 1;
+    }
+    conn->epollout = enable;
+    return 0;
+}
+
+/****************************************************************************************
+ * Send the queued acks, confirming to the client that RDMA read/write has been completed.
+ * Arms EPOLLOUT if the socket buffer is full.
+ * Return value: 0 - success, 1 - error
+ ****************************************************************************************/
+static int conn_flush_acks(struct server_worker *worker, struct server_conn *conn)
+{
+    while (conn->tx_off < conn->tx_buf.size()) {
+        ssize_t w_size = write(conn->fd, conn->tx_buf.data() + conn->tx_off, conn->tx_buf.size() - conn->tx_off);
+        if (w_size < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return conn_set_epollout(worker, conn, 1);
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "FAILURE: Couldn't send ack msg on conn %u (errno=%d '%m')\n", conn->id, errno);
+            return 1;
+        }
+        conn->tx_off += w_size;
     }
+    conn->tx_buf.clear();
+    conn->tx_off = 0;
+    return conn_set_epollout(worker, conn, 0);
+}
 
-    struct sigaction act;
-    act.sa_handler = sigint_handler;
-    sigaction(SIGINT, &act, NULL);
+/* Queue the ack of a completed request: ACK_MSG, or a PAYLOAD_ACK package with its id */
+static void conn_queue_ack(struct server_conn *conn, uint32_t req_id)
+{
+    if (conn->use_req_ids) {
+        uint8_t  pl_type = PAYLOAD_ACK;
+        uint16_t pl_size = sizeof(req_id);
+        uint8_t  package[PACKAGE_HDR_SIZE + sizeof(req_id)];
 
-sock_listen:
-    printf("Listening to remote client...\n");
-    sockfd = open_server_socket(usr_par.port);
-    if (sockfd < 0) {
-        goto clean_rdma_buff;
-    }
-    printf("Connection accepted.\n");
-
-    start = std::chrono::system_clock::now();
- 
-    /****************************************************************************************************
-     * The main loop where we client and server send and receive "iters" number of messages
-     */
-    for (cnt = 0; cnt < usr_par.iters && keep_running; cnt++) {
-
-        int                            r_size;
-        char                           desc_str[sizeof "0102030405060708:01020304:01020304:0102:010203:1:0102030405060708090a0b0c0d0e0f10"];
-        char                           ackmsg[sizeof ACK_MSG];
-        struct rdma_task_attr          task_attr;
-        int                            i;
-        uint32_t                       flags; /* Use enum rdma_task_attr_flags */
-        // payload attrs
-        uint8_t                        pl_type;
-        uint16_t                       pl_size; 
-        //int     expected_comp_events = usr_par.num_sges? (usr_par.num_sges+MAX_SEND_SGE-1)/MAX_SEND_SGE: 1;
-       
-        for (i = 0; i < PACKAGE_TYPES; i++) {
-            r_size = recv(sockfd, &pl_type, sizeof(pl_type), MSG_WAITALL);
-            r_size = recv(sockfd, &pl_size, sizeof(pl_size), MSG_WAITALL);
-            switch (pl_type) {
-                case 0: // RDMA_BUF_DESC
-                    /* Receiving RDMA data (address, size, rkey etc.) from socket as a triger to start RDMA Read/Write operation */
-                    DEBUG_LOG_FAST_PATH("Iteration %d: Waiting to Receive message of size %lu\n", cnt, sizeof desc_str);   
-                    r_size = recv(sockfd, desc_str, pl_size * sizeof(char), MSG_WAITALL);
-                    if (r_size != sizeof desc_str) {
-                        fprintf(stderr, "FAILURE: Couldn't receive RDMA data for iteration %d (errno=%d '%m')\n", cnt, errno);
-                        ret_val = 1;
-                        goto clean_socket;
-                    }
-                    break;
-                case 1: // TASK_ATTRS
-                    /* Receiving rw attr flags */;
-                    int s = pl_size * sizeof(char);
-                    char t[16];
-                    r_size = recv(sockfd, &t, s, MSG_WAITALL);
-                    if (r_size != s) {
-                        fprintf(stderr, "FAILURE: Couldn't receive RDMA data for iteration %d (errno=%d '%m')\n", cnt, errno);
-                        ret_val = 1;
-                        goto clean_socket;
-                    }
-                    sscanf(t, "%08x", &flags);
-                    break;
+        memcpy(package, &pl_type, sizeof(pl_type));
+        memcpy(package + sizeof(pl_type), &pl_size, sizeof(pl_size));
+        memcpy(package + PACKAGE_HDR_SIZE, &req_id, sizeof(req_id));
+        conn->tx_buf.insert(conn->tx_buf.end(), package, package + sizeof package);
+    } else {
+        conn->tx_buf.insert(conn->tx_buf.end(), ACK_MSG, ACK_MSG + sizeof(ACK_MSG));
+    }
+}
+
+/****************************************************************************************
+ * Handle one received package, a request is complete after PACKAGE_TYPES packages
+ * Return value: 0 - success, 1 - error
+ ****************************************************************************************/
+static int conn_handle_package(struct server_worker *worker, struct server_conn *conn,
+                               uint8_t pl_type, const uint8_t *payload, uint16_t pl_size)
+{
+    struct server_request *req = &conn->req;
+
+    if (pl_type == PAYLOAD_NOTIFY_DESC) {
+        struct rdma_buffer_desc notify_desc;
+
+        if (conn->requests || conn->req_pkgs || conn->notify_buf ||
+            rdma_buffer_desc_decode(payload, pl_size, &notify_desc) || notify_desc.size < sizeof(uint64_t)) {
+            fprintf(stderr, "FAILURE: Unexpected notify desc package on conn %u\n", conn->id);
+            return 1;
+        }
+        conn->notify_buf = rdma_remote_buffer_import(worker->rdma_dev, &notify_desc);
+        if (!conn->notify_buf) {
+            return 1;
+        }
+        DEBUG_LOG_FAST_PATH("Conn %u uses RDMA notify completions\n", conn->id);
+        return 0;
+    }
+    if (conn->use_req_ids < 0) {
+        conn->use_req_ids = pl_type == PAYLOAD_REQUEST_ID;
+    }
+    if (pl_type == PAYLOAD_REQUEST_ID) {
+        if (!conn->use_req_ids || conn->req_pkgs || pl_size != sizeof req->req_id) {
+            fprintf(stderr, "FAILURE: Unexpected request id package for request %d of conn %u\n", conn->requests, conn->id);
+            return 1;
+        }
+        memcpy(&req->req_id, payload, sizeof req->req_id);
+        conn->req_pkgs = -1; /* the request packages follow */
+        return 0;
+    }
+    if (conn->use_req_ids && !conn->req_pkgs) {
+        fprintf(stderr, "FAILURE: Missing request id for request %d of conn %u\n", conn->requests, conn->id);
+        return 1;
+    }
+
+    switch (pl_type) {
+        case PAYLOAD_RDMA_BUF_DESC:
+            /* Receiving RDMA data (address, size, rkey etc.) as a triger to start RDMA Read/Write operation */
+            if (pl_size != sizeof req->desc_str) {
+                fprintf(stderr, "FAILURE: Couldn't receive RDMA data for request %d of conn %u\n", conn->requests, conn->id);
+                return 1;
+            }
+            memcpy(req->desc_str, payload, pl_size);
+            req->desc_str[sizeof req->desc_str - 1] = '\0';
+            req->use_bin_desc = 0;
+            DEBUG_LOG_FAST_PATH("Received message \"%s\"\n", req->desc_str);
+            break;
+        case PAYLOAD_TASK_ATTRS: {
+            /* Receiving rw attr flags */
+            char t[16];
+            if (pl_size > sizeof t) {
+                fprintf(stderr, "FAILURE: Couldn't receive task attrs for request %d of conn %u\n", conn->requests, conn->id);
+                return 1;
             }
+            memcpy(t, payload, pl_size);
+            t[sizeof t - 1] = '\0';
+            sscanf(t, "%08x", &req->flags);
+            req->flags &= RDMA_TASK_ATTR_RDMA_READ;
+            req->is_file = 0;
+            req->rem_sgl_cnt = 0;
+            break;
         }
-        
-        DEBUG_LOG_FAST_PATH("Received message \"%s\"\n", desc_str);
-        memset(&task_attr, 0, sizeof task_attr);
-        task_attr.remote_buf_desc_str      = desc_str;
-        task_attr.remote_buf_desc_length   = sizeof desc_str;
-        task_attr.local_buf_rdma           = rdma_buff;
-        task_attr.flags                    = flags;
-        task_attr.wr_id                    = cnt;// * expected_comp_events;
-
-        /* Executing RDMA read */
-        SDEBUG_LOG_FAST_PATH ((char*)buff, "Read iteration N %d", cnt);
-        /* Prepare send sg_list */
-        if (usr_par.num_sges) {
-            if (usr_par.num_sges > MAX_SGES) {
-                fprintf(stderr, "WARN: num_sges %d is too big (max=%d)\n", usr_par.num_sges, MAX_SGES);
-                ret_val = 1;
-                goto clean_socket;
-            }
-	    memset(buf_iovec, 0, sizeof buf_iovec);
-	    task_attr.local_buf_iovcnt = usr_par.num_sges;
-	    task_attr.local_buf_iovec  = buf_iovec;
+        case PAYLOAD_REMOTE_SGL: {
+            /* Scattered over segments of the client buffer, gathered from the staging buffer */
+            uint64_t total_len = 0;
 
-            size_t  portion_size;
-            portion_size = (usr_par.size / usr_par.num_sges) & 0xFFFFFFC0; /* 64 byte aligned */
-            for (i = 0; i < usr_par.num_sges; i++) {
-                buf_iovec[i].iov_base = buff + (i * portion_size);
-                buf_iovec[i].iov_len  = portion_size;
+            if (pl_size <= REMOTE_SGL_HDR_SIZE || (pl_size - REMOTE_SGL_HDR_SIZE) % sizeof(struct rdma_remote_sge)) {
+                fprintf(stderr, "FAILURE: Wrong remote sgl of size %u for request %d of conn %u\n", pl_size, conn->requests, conn->id);
+                return 1;
+            }
+            memcpy(&req->flags, payload, sizeof req->flags);
+            req->flags = le32toh(req->flags) & RDMA_TASK_ATTR_RDMA_READ;
+            req->rem_sgl_cnt = (pl_size - REMOTE_SGL_HDR_SIZE) / sizeof(struct rdma_remote_sge);
+            memcpy(req->rem_sgl, payload + REMOTE_SGL_HDR_SIZE, pl_size - REMOTE_SGL_HDR_SIZE);
+            for (int i = 0; i < req->rem_sgl_cnt; i++) {
+                req->rem_sgl[i].offset = le64toh(req->rem_sgl[i].offset);
+                req->rem_sgl[i].length = le64toh(req->rem_sgl[i].length);
+                total_len += req->rem_sgl[i].length;
+            }
+            if (total_len > worker->usr_par->size) {
+                fprintf(stderr, "FAILURE: remote sgl of %lu bytes is larger than the staging buffer (%lu) for request %d of conn %u\n",
+                        total_len, worker->usr_par->size, conn->requests, conn->id);
+                return 1;
             }
+            req->is_file = 0;
+            break;
         }
-        ret_val = rdma_submit_task(&task_attr);
-        if (ret_val) {
-            goto clean_socket;
-        }
-
-	/* Completion queue polling loop */
-        DEBUG_LOG_FAST_PATH("Polling completion queue\n");
-        struct rdma_completion_event rdma_comp_ev[10];
-        int    reported_ev  = 0;
-        do {
-            reported_ev += rdma_poll_completions(rdma_dev, &rdma_comp_ev[reported_ev], 10/*expected_comp_events-reported_ev*/);
-            //TODO - we can put sleep here
-        } while (reported_ev < 1 && keep_running /*expected_comp_events*/);
-        DEBUG_LOG_FAST_PATH("Finished polling\n");
-
-        for (i = 0; i < reported_ev; ++i) {
-            if (rdma_comp_ev[i].status != (rdma_completion_status)IBV_WC_SUCCESS) {
-                fprintf(stderr, "FAILURE: status \"%s\" (%d) for wr_id %d\n",
-                        ibv_wc_status_str((ibv_wc_status)rdma_comp_ev[i].status),
-                        rdma_comp_ev[i].status, (int) rdma_comp_ev[i].wr_id);
-                ret_val = 1;
-               	if (usr_par.persistent && keep_running) {
-			rdma_reset_device(rdma_dev);
-                }
-		goto clean_socket;
+        case PAYLOAD_FILE_REQ:
+            /* RDMA write of a file range, the file is read by the server */
+            if (!worker->usr_par->file_root || pl_size <= FILE_REQ_HDR_SIZE || payload[pl_size - 1] != '\0') {
+                fprintf(stderr, "FAILURE: %s file request %d of conn %u\n",
+                        worker->usr_par->file_root ? "Wrong" : "Not serving files (no -F), got", conn->requests, conn->id);
+                return 1;
+            }
+            memcpy(&req->file_offset, payload, sizeof req->file_offset);
+            memcpy(&req->file_length, payload + sizeof req->file_offset, sizeof req->file_length);
+            req->file_offset = le64toh(req->file_offset);
+            req->file_length = le64toh(req->file_length);
+            memcpy(req->file_path, payload + FILE_REQ_HDR_SIZE, pl_size - FILE_REQ_HDR_SIZE);
+            req->flags   = 0;
+            req->is_file = 1;
+            req->rem_sgl_cnt = 0;
+            break;
+        case PAYLOAD_RDMA_BUF_DESC_BIN:
+            /* Binary rdma_buffer description, decoded without string parsing */
+            if (rdma_buffer_desc_decode(payload, pl_size, &req->bin_desc)) {
+                fprintf(stderr, "FAILURE: Wrong binary desc of size %u for request %d of conn %u\n", pl_size, conn->requests, conn->id);
+                return 1;
+            }
+            req->use_bin_desc = 1;
+            break;
+    }
+
+    if (conn->req_pkgs < 0) {
+        conn->req_pkgs = 0;
+    }
+    if (++conn->req_pkgs < PACKAGE_TYPES) {
+        return 0;
+    }
+
+    conn->req_pkgs = 0;
+    req->conn_id   = conn->id;
+    req->seq       = conn->requests++;
+    if (!conn->use_req_ids) {
+        req->req_id = req->seq;
+    }
+    conn->inflight++;
+    worker->pending.push_back(*req);
+    return 0;
+}
+
+/****************************************************************************************
+ * Read everything available on the connection and parse the complete packages,
+ * a partial package stays in rx_buf until the rest of it arrives.
+ * Return value: 0 - success, 1 - error or the connection is closed by the client
+ ****************************************************************************************/
+static int conn_read(struct server_worker *worker, struct server_conn *conn)
+{
+    while (1) {
+        ssize_t r_size = recv(conn->fd, conn->rx_buf + conn->rx_len, sizeof conn->rx_buf - conn->rx_len, 0);
+        if (r_size == 0) {
+            DEBUG_LOG_FAST_PATH("Conn %u closed by the client\n", conn->id);
+            return 1;
+        }
+        if (r_size < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
             }
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "FAILURE: recv failed on conn %u (errno=%d '%m')\n", conn->id, errno);
+            worker->ret_val = 1;
+            return 1;
         }
+        conn->rx_len += r_size;
 
-        // Sending ack-message to the client, confirming that RDMA read/write has been completet
-        if (write(sockfd, ACK_MSG, sizeof(ACK_MSG)) != sizeof(ACK_MSG)) {
-            fprintf(stderr, "FAILURE: Couldn't send \"%c\" msg (errno=%d '%m')\n", ACK_MSG, errno);
-            ret_val = 1;
-            goto clean_socket;
+        size_t off = 0;
+        while (conn->rx_len - off >= PACKAGE_HDR_SIZE) {
+            uint8_t  pl_type;
+            uint16_t pl_size;
+
+            memcpy(&pl_type, conn->rx_buf + off, sizeof(pl_type));
+            memcpy(&pl_size, conn->rx_buf + off + sizeof(pl_type), sizeof(pl_size));
+            if (pl_size > MAX_PACKAGE_SIZE) {
+                fprintf(stderr, "FAILURE: package of size %u is too big on conn %u\n", pl_size, conn->id);
+                worker->ret_val = 1;
+                return 1;
+            }
+            if (conn->rx_len - off < PACKAGE_HDR_SIZE + pl_size) {
+                break;
+            }
+            if (conn->requests == worker->usr_par->iters) {
+                fprintf(stderr, "FAILURE: conn %u sent more than %d requests\n", conn->id, worker->usr_par->iters);
+                worker->ret_val = 1;
+                return 1;
+            }
+            if (conn_handle_package(worker, conn, pl_type, conn->rx_buf + off + PACKAGE_HDR_SIZE, pl_size)) {
+                worker->ret_val = 1;
+                return 1;
+            }
+            off += PACKAGE_HDR_SIZE + pl_size;
         }
+        memmove(conn->rx_buf, conn->rx_buf + off, conn->rx_len - off);
+        conn->rx_len -= off;
     }
-    /****************************************************************************************************/
+}
 
-    print_run_time(start, usr_par.size, usr_par.iters);
+/* The imported handle of the Client buffer, NULL - not imported */
+static struct rdma_remote_buffer *conn_find_rem_buff(struct server_conn *conn, const struct rdma_buffer_desc *desc)
+{
+    int i;
 
-clean_socket:
-    close(sockfd);
-    if (usr_par.persistent && keep_running)
-        goto sock_listen;
+    for (i = 0; i < CONN_REM_BUFS; i++) {
+        if (conn->rem_bufs[i].handle && !memcmp(&conn->rem_bufs[i].desc, desc, sizeof *desc)) {
+            return conn->rem_bufs[i].handle;
+        }
+    }
+    return NULL;
+}
 
-clean_rdma_buff:
-    rdma_buffer_dereg(rdma_buff);
+/*
+ * Import the Client buffer once and reuse the handle while its description
+ * doesn't change, the least recently imported entry is replaced on a miss
+ */
+static struct rdma_remote_buffer *conn_get_rem_buff(struct server_worker *worker, struct server_conn *conn,
+                                                    const struct rdma_buffer_desc *desc)
+{
+    struct rdma_remote_buffer *handle = conn_find_rem_buff(conn, desc);
+    int i;
 
-clean_mem_buff:
-    free(buff);
+    if (handle) {
+        return handle;
+    }
 
-clean_device:
-    rdma_close_device(rdma_dev);
+    i = conn->rem_bufs_next;
+    conn->rem_bufs_next = (conn->rem_bufs_next + 1) % CONN_REM_BUFS;
+    if (conn->rem_bufs[i].handle) {
+        rdma_remote_buffer_release(conn->rem_bufs[i].handle);
+    }
+    conn->rem_bufs[i].handle = rdma_remote_buffer_import(worker->rdma_dev, desc);
+    conn->rem_bufs[i].desc   = *desc;
+    return conn->rem_bufs[i].handle;
+}
 
-    return ret_val;
-}
\ No newline at end of file
+/****************************************************************************************
+ * Post the pending requests while there is room in the send queues
+ * Return value: 0 - success, 1 - error
+ ****************************************************************************************/
+static int worker_submit_pending(struct server_worker *worker);
+static void worker_reset_device(struct server_worker *worker);
+
+/* A task of the request failed on the device, so does its connection */
+static void conn_task_failed(struct server_worker *worker, struct server_conn *conn, uint32_t req_id,
+                             rdma_completion_status status)
+{
+    if (!worker->resetting) {
+        fprintf(stderr, "FAILURE: status \"%s\" (%d) for request %u of conn %u\n",
+                ibv_wc_status_str((ibv_wc_status)status), status, req_id, conn->id);
+    }
+    conn_close(worker, conn, 1);
+    if (!worker->resetting && worker->usr_par->persistent && keep_running) {
+        worker_reset_device(worker);
+    }
+}
+
+/* All the data of a request is transferred, ack it unless the client is notified by RDMA */
+static void conn_request_done(struct server_worker *worker, struct server_conn *conn, uint32_t req_id)
+{
+    if (conn->closed) {
+        return;
+    }
+    conn->completed++;
+    if (conn->notify_buf) {
+        /* the client already sees the completion in its notify slot */
+        return;
+    }
+    conn_queue_ack(conn, req_id);
+    if (conn_flush_acks(worker, conn)) {
+        conn_close(worker, conn, 1);
+    }
+}
+
+/* Completion of a request task, ctx is the server_task */
+static void on_task_completion(void *ctx, uint64_t user_data, rdma_completion_status status)
+{
+    struct server_task   *task   = (struct server_task *)ctx;
+    struct server_conn   *conn   = task->conn;
+    struct server_worker *worker = conn->worker;
+    uint32_t              req_id = task->req_id;
+
+    worker->pool->release(task->staging);
+    task->next_free = worker->free_tasks;
+    worker->free_tasks = task;
+
+    conn->inflight--;
+    if (status != (rdma_completion_status)IBV_WC_SUCCESS) {
+        conn_task_failed(worker, conn, req_id, status);
+        return;
+    }
+    conn_request_done(worker, conn, req_id);
+}
+
+/*
+ * A file path of a request must stay under the file root: relative and
+ * without ".." components
+ */
+static int file_path_is_safe(const char *path)
+{
+    const char *comp = path;
+
+    if (!*path || *path == '/') {
+        return 0;
+    }
+    while (comp) {
+        const char *end = strchr(comp, '/');
+        size_t      len = end ? (size_t)(end - comp) : strlen(comp);
+
+        if (len == 2 && !strncmp(comp, "..", 2)) {
+            return 0;
+        }
+        comp = end ? end + 1 : NULL;
+    }
+    return 1;
+}
+
+/****************************************************************************************
+ * Open a file of the file root, once per worker. Besides the buffered fd an O_DIRECT
+ * one is opened if the file system supports it, its reads bypass the page cache.
+ * Return value: the file, NULL - error
+ ****************************************************************************************/
+static struct server_file *worker_open_file(struct server_worker *worker, const char *path)
+{
+    struct server_file  file;
+    std::string         full_path;
+
+    auto it = worker->files.find(path);
+    if (it != worker->files.end()) {
+        return &it->second;
+    }
+    if (!file_path_is_safe(path)) {
+        fprintf(stderr, "FAILURE: file \"%s\" is outside of the file root\n", path);
+        return NULL;
+    }
+    full_path = std::string(worker->usr_par->file_root) + "/" + path;
+    file.fd = open(full_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file.fd < 0) {
+        fprintf(stderr, "FAILURE: Couldn't open \"%s\" (errno=%d '%m')\n", full_path.c_str(), errno);
+        return NULL;
+    }
+    file.direct_fd = open(full_path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    if (file.direct_fd < 0) {
+        DEBUG_LOG_FAST_PATH("No O_DIRECT for \"%s\" (errno=%d '%m'), buffered reads\n", full_path.c_str(), errno);
+    }
+    return &(worker->files[path] = file);
+}
+
+/****************************************************************************************
+ * Map and register a file of the file root, once per worker. The worker waits for
+ * the mapping to be populated, the requests of the file don't wait for the disk then.
+ * Return value: the mapped file, NULL - error
+ ****************************************************************************************/
+static gdr::MappedFile *worker_map_file(struct server_worker *worker, const char *path)
+{
+    auto it = worker->mapped_files.find(path);
+    if (it != worker->mapped_files.end()) {
+        return it->second.get();
+    }
+    if (!file_path_is_safe(path)) {
+        fprintf(stderr, "FAILURE: file \"%s\" is outside of the file root\n", path);
+        return NULL;
+    }
+    try {
+        std::unique_ptr<gdr::MappedFile> map(new gdr::MappedFile(worker->rdma_dev, std::string(worker->usr_par->file_root) + "/" + path,
+                                                                 worker->max_map_segment, std::thread::hardware_concurrency()));
+
+        printf("Worker %d mapped \"%s\": %lu bytes in %zu MRs, populated in %.3f sec, registered in %.3f sec\n",
+               worker->id, path, map->size(), map->segments().size(), map->populate_seconds(), map->reg_seconds());
+        return (worker->mapped_files[path] = std::move(map)).get();
+    } catch (const std::system_error& e) {
+        fprintf(stderr, "FAILURE: %s\n", e.what());
+        return NULL;
+    }
+}
+
+/****************************************************************************************
+ * Start serving a file request: the file range is RDMA written to the client buffer,
+ * it must fit in it. The chunk reads (or the chunks of the mapping) are queued by
+ * worker_issue_file_reads().
+ * Return value: 0 - success, 1 - error
+ ****************************************************************************************/
+static int worker_start_file_request(struct server_worker *worker, struct server_conn *conn,
+                                     const struct server_request *req)
+{
+    struct server_file *file = NULL;
+    gdr::MappedFile    *map  = NULL;
+    uint64_t            file_size;
+    uint64_t            length = req->file_length;
+
+    if (!req->use_bin_desc) {
+        fprintf(stderr, "FAILURE: file request %u of conn %u needs a binary desc\n", req->req_id, conn->id);
+        return 1;
+    }
+    if (worker->usr_par->file_mmap_mb >= 0) {
+        map = worker_map_file(worker, req->file_path);
+        if (!map) {
+            return 1;
+        }
+        file_size = map->size();
+    } else {
+        struct stat st;
+
+        file = worker_open_file(worker, req->file_path);
+        if (!file) {
+            return 1;
+        }
+        if (fstat(file->fd, &st)) {
+            fprintf(stderr, "FAILURE: fstat of \"%s\" failed (errno=%d '%m')\n", req->file_path, errno);
+            return 1;
+        }
+        file_size = st.st_size;
+    }
+    if (!length && req->file_offset < file_size) {
+        length = file_size - req->file_offset;
+    }
+    if (!length || req->file_offset > file_size || length > file_size - req->file_offset || length > req->bin_desc.size) {
+        fprintf(stderr, "FAILURE: range %lu+%lu of \"%s\" (%lu bytes) for a buffer of %lu bytes, request %u of conn %u\n",
+                req->file_offset, req->file_length, req->file_path, file_size, req->bin_desc.size, req->req_id, conn->id);
+        return 1;
+    }
+
+    std::unique_ptr<file_request> freq(new file_request());
+    freq->conn     = conn;
+    freq->req_id   = req->req_id;
+    freq->seq      = req->seq;
+    freq->bin_desc = req->bin_desc;
+    freq->offset   = req->file_offset;
+    freq->length   = length;
+    freq->map      = map;
+    if (file) {
+        /* The chunks are a multiple of FILE_DIRECT_ALIGN, so aligned if the request is */
+        freq->direct = file->direct_fd >= 0 && !(req->file_offset % FILE_DIRECT_ALIGN);
+        freq->fd     = freq->direct ? file->direct_fd : file->fd;
+    }
+    conn->file_reqs++;
+    worker->file_reqs.push_back(std::move(freq));
+    worker->file_reqs.back()->self = std::prev(worker->file_reqs.end());
+    return 0;
+}
+
+/* Release a file request once it has nothing in flight, after its last chunk or a failure */
+static void file_request_put(struct server_worker *worker, struct file_request *freq)
+{
+    if (freq->inflight || (!freq->failed && freq->written < freq->length)) {
+        return;
+    }
+    freq->conn->file_reqs--;
+    freq->conn->inflight--;
+    worker->file_reqs.erase(freq->self);
+}
+
+static void file_chunk_release(struct server_worker *worker, struct server_task *task)
+{
+    struct file_request *freq = task->freq;
+
+    if (task->staging) {
+        worker->pool->release(task->staging);
+    }
+    task->freq = NULL;
+    task->next_free = worker->free_tasks;
+    worker->free_tasks = task;
+    freq->inflight--;
+    file_request_put(worker, freq);
+}
+
+/* Completion of the RDMA write of a file chunk, ctx is the server_task */
+static void on_chunk_completion(void *ctx, uint64_t user_data, rdma_completion_status status)
+{
+    struct server_task   *task   = (struct server_task *)ctx;
+    struct file_request  *freq   = task->freq;
+    struct server_conn   *conn   = task->conn;
+    struct server_worker *worker = conn->worker;
+    uint32_t              req_id = task->req_id;
+
+    if (status != (rdma_completion_status)IBV_WC_SUCCESS) {
+        freq->failed = 1;
+        file_chunk_release(worker, task);
+        conn_task_failed(worker, conn, req_id, status);
+        return;
+    }
+    freq->written += task->chunk_len;
+    if (!freq->failed && freq->written == freq->length) {
+        worker->file_bytes += freq->length;
+        conn_request_done(worker, conn, req_id);
+    }
+    file_chunk_release(worker, task);
+}
+
+/* Completion of a chunk read, the chunk waits in file_ready for its RDMA write */
+static void on_chunk_read(struct server_worker *worker, struct server_task *task, int res)
+{
+    struct file_request *freq = task->freq;
+    struct server_conn  *conn = task->conn;
+
+    if (!freq->failed && !conn->closed && res < (int)task->chunk_len) {
+        fprintf(stderr, "FAILURE: file read of %u bytes at %lu for request %u of conn %u: %s\n",
+                task->chunk_len, freq->offset + task->chunk_off, task->req_id, conn->id,
+                res < 0 ? strerror(-res) : "short read");
+        conn_close(worker, conn, 1);
+    }
+    if (freq->failed || conn->closed) {
+        freq->failed = 1;
+        file_chunk_release(worker, task);
+        return;
+    }
+    worker->file_chunks++;
+    worker->file_ready.push_back(task);
+}
+
+/****************************************************************************************
+ * Post the RDMA writes of the chunks read, in the order of the read completions. The
+ * write posted last for a request carries its notify: the writes of a connection go
+ * through the same DCI, so the notify lands after all the data of the request.
+ ****************************************************************************************/
+static void worker_post_file_chunks(struct server_worker *worker)
+{
+    while (!worker->file_ready.empty()) {
+        struct server_task        *task = worker->file_ready.front();
+        struct file_request       *freq = task->freq;
+        struct server_conn        *conn = task->conn;
+        struct rdma_remote_buffer *rem_buff = NULL;
+        struct rdma_task_attr      task_attr;
+        struct iovec               iov;
+
+        if (!freq->failed && !conn->closed) {
+            /* Looked up per chunk, the handle may be replaced meanwhile by other requests */
+            rem_buff = conn_get_rem_buff(worker, conn, &freq->bin_desc);
+            if (!rem_buff) {
+                conn_close(worker, conn, 1);
+            }
+        }
+        if (!rem_buff) {
+            freq->failed = 1;
+            worker->file_ready.pop_front();
+            file_chunk_release(worker, task);
+            continue;
+        }
+
+        iov.iov_base = task->src_addr;
+        iov.iov_len  = task->chunk_len;
+        memset(&task_attr, 0, sizeof task_attr);
+        task_attr.local_buf_rdma   = task->src_buff;
+        task_attr.local_buf_iovec  = &iov;
+        task_attr.local_buf_iovcnt = 1;
+        if (!conn->notify_buf) {
+            /* Acked once all the chunks completed, their order doesn't matter */
+            task_attr.flags       |= RDMA_TASK_ATTR_STRIPE;
+        } else if (freq->posted + task->chunk_len == freq->length) {
+            task_attr.flags       |= RDMA_TASK_ATTR_NOTIFY;
+            task_attr.notify_buf   = conn->notify_buf;
+            task_attr.notify_value = htole64((uint64_t)freq->seq + 1);
+        }
+
+        int was_idle = !worker->async->in_flight();
+        try {
+            worker->async->submit_callback(task_attr, rem_buff, task->chunk_off, task->chunk_len,
+                                           on_chunk_completion, task, 0);
+        } catch (const std::system_error& e) {
+            if (e.code().value() == EAGAIN && !was_idle) {
+                /* Send queue is full, retry after the next completions */
+                return;
+            }
+            fprintf(stderr, "FAILURE: %s\n", e.what());
+            conn_close(worker, conn, 1);
+            freq->failed = 1;
+            worker->file_ready.pop_front();
+            file_chunk_release(worker, task);
+            continue;
+        }
+        if (was_idle) {
+            worker->poll_idle_since = std::chrono::steady_clock::now();
+        }
+        freq->posted += task->chunk_len;
+        worker->file_ready.pop_front();
+    }
+}
+
+/****************************************************************************************
+ * Queue the reads of the next chunks of the file requests, up to FILE_READ_DEPTH chunks
+ * of a request in flight, while there are free tasks and staging buffers. A staging
+ * buffer is a fixed buffer of the io_uring if its slab could be registered with it.
+ * The chunks of a mapped file need no read, they're ready for the RDMA write at once,
+ * and they end with their segment (MR) of the mapping.
+ ****************************************************************************************/
+static void worker_issue_file_reads(struct server_worker *worker)
+{
+    const struct user_params *usr_par = worker->usr_par;
+    int                       stalled = 0;
+
+    for (auto it = worker->file_reqs.begin(); it != worker->file_reqs.end() && !stalled; ) {
+        struct file_request *freq = (it++)->get();
+
+        if (freq->conn->closed) {
+            freq->failed = 1;
+        }
+        while (!freq->failed && freq->issued < freq->length && freq->inflight < FILE_READ_DEPTH) {
+            struct server_task *task = worker->free_tasks;
+            uint64_t            pos  = freq->offset + freq->issued;
+            uint32_t            len  = std::min<uint64_t>(usr_par->file_chunk, freq->length - freq->issued);
+            uint32_t            read_len = freq->direct ? (len + FILE_DIRECT_ALIGN - 1) & ~(FILE_DIRECT_ALIGN - 1) : len;
+            int                 buf_index;
+
+            if (!task) {
+                stalled = 1;
+                break;
+            }
+            task->conn      = freq->conn;
+            task->req_id    = freq->req_id;
+            task->freq      = freq;
+            task->chunk_off = freq->issued;
+            if (freq->map) {
+                const gdr::MappedFile::Segment& seg = freq->map->segment(pos);
+
+                len = std::min<uint64_t>(len, seg.offset + seg.length - pos);
+                worker->free_tasks = task->next_free;
+                task->staging   = NULL;
+                task->src_buff  = seg.rdma_buff;
+                task->src_addr  = freq->map->addr(pos);
+                task->chunk_len = len;
+                freq->issued   += len;
+                freq->inflight++;
+                worker->mapped_chunks++;
+                worker->file_ready.push_back(task);
+                continue;
+            }
+            try {
+                task->staging = worker->pool->acquire(usr_par->file_chunk);
+            } catch (const std::exception& e) {
+                fprintf(stderr, "FAILURE: %s\n", e.what());
+                task->staging = NULL;
+            }
+            if (!task->staging) {
+                if (worker->pool->stats().in_use_bytes) {
+                    /* Wait for the buffers of the chunks in flight */
+                    stalled = 1;
+                    break;
+                }
+                fprintf(stderr, "FAILURE: no staging buffer for file request %u of conn %u\n", freq->req_id, freq->conn->id);
+                conn_close(worker, freq->conn, 1);
+                freq->failed = 1;
+                break;
+            }
+            buf_index = task->staging->slab_index < worker->fixed_slabs.size() &&
+                        worker->fixed_slabs[task->staging->slab_index] ? (int)task->staging->slab_index : -1;
+            if (!worker->uring->prep_read(freq->fd, task->staging->addr, read_len, pos, buf_index, (uintptr_t)task)) {
+                worker->pool->release(task->staging);
+                stalled = 1;
+                break;
+            }
+            worker->free_tasks = task->next_free;
+            task->src_buff  = task->staging->rdma_buff;
+            task->src_addr  = task->staging->addr;
+            task->chunk_len = len;
+            freq->issued   += len;
+            freq->inflight++;
+        }
+        file_request_put(worker, freq);
+    }
+
+    if (!worker->uring) {
+        return;
+    }
+    try {
+        worker->uring->submit();
+    } catch (const std::system_error& e) {
+        fprintf(stderr, "FAILURE: %s\n", e.what());
+        worker->ret_val = 1;
+        keep_running = 0;
+    }
+}
+
+static void worker_reap_file_reads(struct server_worker *worker)
+{
+    worker->uring->reap([worker](uint64_t user_data, int res) {
+        on_chunk_read(worker, (struct server_task *)(uintptr_t)user_data, res);
+    });
+}
+
+/* Tasks of the requests at the front of the pending queue, posted together */
+struct submit_batch {
+    struct rdma_task_attr       attrs[SUBMIT_BATCH];
+    void                       *tasks[SUBMIT_BATCH];    /* struct server_task */
+    int                         results[SUBMIT_BATCH];
+    int                         num_tasks;
+};
+
+/****************************************************************************************
+ * Post the batched tasks with one doorbell per used DCI. The requests of the posted
+ * tasks leave the pending queue, so do the ones which failed, closing their connection.
+ * A request which doesn't fit in the send queue, and the ones after it, stay at the
+ * front of the queue and their tasks are freed.
+ * Return value: 0 - success, 1 - the send queue is full
+ ****************************************************************************************/
+static int worker_post_batch(struct server_worker *worker, struct submit_batch *batch)
+{
+    int was_idle = !worker->async->in_flight();
+    int full = 0;
+
+    worker->async->submit_callbacks(batch->attrs, batch->num_tasks, on_task_completion, batch->tasks, batch->results);
+    if (was_idle && worker->async->in_flight()) {
+        worker->poll_idle_since = std::chrono::steady_clock::now();
+    }
+    /* The requests which stay pending are the last ones of the batch */
+    for (int i = 0; i < batch->num_tasks; i++) {
+        struct server_task *task    = (struct server_task *)batch->tasks[i];
+        struct server_conn *conn    = task->conn;
+        int                 ret_val = batch->results[i];
+
+        if (ret_val) {
+            worker->pool->release(task->staging);
+            task->next_free = worker->free_tasks;
+            worker->free_tasks = task;
+            if (ret_val == EAGAIN && worker->async->in_flight()) {
+                /* Send queue is full, retry after the next completions */
+                full = 1;
+                continue;
+            }
+            if (ret_val == ECANCELED) {
+                /* Not tried after a failed one */
+                continue;
+            }
+            fprintf(stderr, "FAILURE: request %u of conn %u can't be posted (error=%d '%s')\n",
+                    task->req_id, conn->id, ret_val, strerror(ret_val));
+            conn->inflight--;
+            conn_close(worker, conn, 1);
+        }
+        worker->pending.pop_front();
+    }
+    batch->num_tasks = 0;
+    return full;
+}
+
+/****************************************************************************************
+ * Post the pending requests while there is room in the send queues, SUBMIT_BATCH
+ * requests with one doorbell per DCI. A request which needs the front of the queue
+ * (to be dropped or to wait) first lets the batch before it be posted.
+ * Return value: 0 - success, 1 - error
+ ****************************************************************************************/
+static int worker_submit_pending(struct server_worker *worker)
+{
+    const struct user_params *usr_par = worker->usr_par;
+    struct submit_batch       batch;
+
+    batch.num_tasks = 0;
+    for (;;) {
+        if (worker->pending.size() == (size_t)batch.num_tasks || !worker->free_tasks) {
+            if (!batch.num_tasks || worker_post_batch(worker, &batch)) {
+                return 0;
+            }
+            continue;
+        }
+
+        struct server_request *req  = &worker->pending[batch.num_tasks];
+        struct server_conn    *conn = worker->conns[req->conn_id].get();
+        struct server_task    *task = worker->free_tasks;
+        struct rdma_task_attr *task_attr = &batch.attrs[batch.num_tasks];
+        struct rdma_remote_buffer *rem_buff = NULL;
+
+        if (batch.num_tasks && (conn->closed || req->is_file || (conn->notify_buf && conn->file_reqs))) {
+            if (worker_post_batch(worker, &batch)) {
+                return 0;
+            }
+            continue;
+        }
+        if (conn->closed) {
+            conn->inflight--;
+            worker->pending.pop_front();
+            continue;
+        }
+
+        if (req->is_file) {
+            /* Requests complete in order in the notify mode, the data of a file request
+             * isn't written in one task, so they wait for the file request before them */
+            if (conn->notify_buf && conn->file_reqs) {
+                return 0;
+            }
+            if (worker_start_file_request(worker, conn, req)) {
+                conn->inflight--;
+                conn_close(worker, conn, 1);
+            }
+            worker->pending.pop_front();
+            continue;
+        }
+        if (conn->notify_buf && conn->file_reqs) {
+            return 0;
+        }
+
+        if (req->use_bin_desc) {
+            rem_buff = conn_find_rem_buff(conn, &req->bin_desc);
+            if (!rem_buff && batch.num_tasks) {
+                /* The import may replace the handle of a batched task */
+                if (worker_post_batch(worker, &batch)) {
+                    return 0;
+                }
+                continue;
+            }
+            if (!rem_buff) {
+                rem_buff = conn_get_rem_buff(worker, conn, &req->bin_desc);
+            }
+            if (!rem_buff) {
+                conn->inflight--;
+                worker->pending.pop_front();
+                conn_close(worker, conn, 1);
+                continue;
+            }
+        }
+
+        /* The pool is bounded, a request waits for a staging buffer released by a completion */
+        try {
+            task->staging = worker->pool->acquire(usr_par->size);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "FAILURE: %s\n", e.what());
+            task->staging = NULL;
+        }
+        if (!task->staging && batch.num_tasks) {
+            if (worker_post_batch(worker, &batch)) {
+                return 0;
+            }
+            continue;
+        }
+        if (!task->staging) {
+            if (worker->async->in_flight()) {
+                return 0;
+            }
+            fprintf(stderr, "FAILURE: no staging buffer for request %u of conn %u\n", req->req_id, conn->id);
+            conn->inflight--;
+            worker->pending.pop_front();
+            conn_close(worker, conn, 1);
+            continue;
+        }
+        if (req->use_bin_desc && !req->rem_sgl_cnt && !usr_par->num_sges && req->bin_desc.size > task->staging->size) {
+            worker->pool->release(task->staging);
+            if (batch.num_tasks) {
+                if (worker_post_batch(worker, &batch)) {
+                    return 0;
+                }
+                continue;
+            }
+            /* The task would run past the staging buffer, into the others of its slab */
+            fprintf(stderr, "FAILURE: request %u of conn %u is of %lu bytes, greater than the buffer size %zu\n",
+                    req->req_id, conn->id, (unsigned long)req->bin_desc.size, task->staging->size);
+            conn->inflight--;
+            worker->pending.pop_front();
+            conn_close(worker, conn, 1);
+            continue;
+        }
+        task->conn   = conn;
+        task->req_id = req->req_id;
+
+        memset(task_attr, 0, sizeof *task_attr);
+        task_attr->remote_buf_desc_str     = req->desc_str;
+        task_attr->remote_buf_desc_length  = sizeof req->desc_str;
+        task_attr->remote_buf              = rem_buff;
+        task_attr->local_buf_rdma          = task->staging->rdma_buff;
+        task_attr->flags                   = req->flags;
+        if (conn->notify_buf) {
+            task_attr->flags       |= RDMA_TASK_ATTR_NOTIFY;
+            task_attr->notify_buf   = conn->notify_buf;
+            task_attr->notify_value = htole64((uint64_t)req->seq + 1);
+        } else {
+            /* The ack is sent on the completion of the whole task */
+            task_attr->flags       |= RDMA_TASK_ATTR_STRIPE;
+        }
+        if (req->rem_sgl_cnt) {
+            memcpy(task->rem_sgl, req->rem_sgl, req->rem_sgl_cnt * sizeof *req->rem_sgl);
+            task_attr->remote_sgl     = task->rem_sgl;
+            task_attr->remote_sgl_cnt = req->rem_sgl_cnt;
+        } else if (usr_par->num_sges) {
+            size_t  portion_size;
+            portion_size = (usr_par->size / usr_par->num_sges) & 0xFFFFFFC0; /* 64 byte aligned */
+            for (int i = 0; i < usr_par->num_sges; i++) {
+                task->iov[i].iov_base = (uint8_t *)task->staging->addr + (i * portion_size);
+                task->iov[i].iov_len  = portion_size;
+            }
+            task_attr->local_buf_iovcnt = usr_par->num_sges;
+            task_attr->local_buf_iovec  = task->iov.data();
+        }
+
+        /* Executing RDMA read/write */
+        SDEBUG_LOG_FAST_PATH ((char*)task->staging->addr, "Read iteration N %d", req->seq);
+        worker->free_tasks = task->next_free;
+        batch.tasks[batch.num_tasks++] = task;
+        if (batch.num_tasks == SUBMIT_BATCH && worker_post_batch(worker, &batch)) {
+            return 0;
+        }
+    }
+}
+
+/****************************************************************************************
+ * A device reset flushes the posted tasks without reporting them,
+ * fail every connection which had tasks in flight.
+ ****************************************************************************************/
+static void worker_reset_device(struct server_worker *worker)
+{
+    worker->resetting = 1;
+    rdma_reset_device(worker->rdma_dev);
+    worker->async->fail_pending();
+    for (auto& req : worker->pending) {
+        struct server_conn *conn = worker->conns[req.conn_id].get();
+
+        conn->inflight--;
+        conn_close(worker, conn, 1);
+    }
+    worker->pending.clear();
+    worker->resetting = 0;
+}
+
+static void worker_poll_completions(struct server_worker *worker)
+{
+    if (worker->async->poll()) {
+        worker->poll_idle_since = std::chrono::steady_clock::now();
+    }
+}
+
+/* Take over the connections steered to this worker by the acceptor */
+static void worker_adopt_connections(struct server_worker *worker)
+{
+    uint64_t    wakeups;
+    std::deque<int> fds;
+
+    if (read(worker->wakeup_fd, &wakeups, sizeof wakeups) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "FAILURE: read(eventfd) failed (errno=%d '%m')\n", errno);
+    }
+    {
+        std::lock_guard<std::mutex> lock(worker->conn_lock);
+        fds.swap(worker->conn_queue);
+    }
+
+    for (int sockfd : fds) {
+        std::unique_ptr<server_conn> conn(new server_conn());
+        struct epoll_event ev;
+
+        if (++worker->next_conn_id == WAKEUP_CONN_ID) {
+            ++worker->next_conn_id;
+        }
+        conn->worker = worker;
+        conn->fd    = sockfd;
+        conn->id    = worker->next_conn_id;
+        conn->use_req_ids = -1;
+        conn->start = std::chrono::system_clock::now();
+
+        ev.events   = EPOLLIN;
+        ev.data.u64 = conn->id;
+        if (set_nonblocking(sockfd) || epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, sockfd, &ev)) {
+            fprintf(stderr, "FAILURE: Couldn't add connection %d to the event loop (errno=%d '%m')\n", sockfd, errno);
+            close(sockfd);
+            worker->active_conns--;
+            worker->ret_val = 1;
+            continue;
+        }
+        DEBUG_LOG_FAST_PATH("Worker %d: conn %u on socket %d\n", worker->id, conn->id, sockfd);
+        worker->conns[conn->id] = std::move(conn);
+    }
+}
+
+/****************************************************************************************
+ * Completion polling policy, returns the epoll_wait timeout for the next loop pass.
+ * Without tasks in flight only sockets matter, so block. With tasks in flight busy
+ * poll the CQ for poll_spin_usec since the last completion, then keep polling with
+ * sched_yield() for poll_yield_usec, then arm the CQ and sleep until its completion
+ * event. The pass right after arming still polls, catching the completions which
+ * arrived before the CQ was armed.
+ ****************************************************************************************/
+static int worker_poll_timeout(struct server_worker *worker)
+{
+    const struct user_params *usr_par = worker->usr_par;
+
+    if (!worker->async->in_flight() && worker->pending.empty() && worker->file_ready.empty()) {
+        return -1;
+    }
+    if (usr_par->poll_spin_usec < 0) {
+        return 0;
+    }
+    if (worker->cq_armed) {
+        return -1;
+    }
+
+    std::chrono::duration<double, std::micro> idle = std::chrono::steady_clock::now() - worker->poll_idle_since;
+    if (idle.count() < usr_par->poll_spin_usec) {
+        return 0;
+    }
+    if (idle.count() < usr_par->poll_spin_usec + usr_par->poll_yield_usec) {
+        sched_yield();
+        return 0;
+    }
+    if (!rdma_arm_completions(worker->rdma_dev)) {
+        worker->cq_armed = 1;
+        worker->cq_sleeps++;
+    }
+    return 0;
+}
+
+/****************************************************************************************
+ * Worker thread: owns its rdma_device (PD/CQ/DCIs) and staging pool, and runs
+ * an event loop over the connections steered to it by the acceptor, interleaving
+ * socket I/O, RDMA submissions and completions of all its clients.
+ * While tasks are in flight the loop polls the CQ and does not block on epoll.
+ ****************************************************************************************/
+static void worker_run(struct server_worker *worker)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    /* A core of the NIC's node each, like the completion vector of its CQ */
+    if (worker->usr_par->numa_local) {
+        int ret_val = rdma_device_bind_thread(worker->rdma_dev, worker->id);
+        if (ret_val && ret_val != ENOENT) {
+            fprintf(stderr, "Couldn't bind worker %d to the CPUs of the NIC (errno=%d)\n", worker->id, ret_val);
+        }
+    }
+
+    while (keep_running) {
+        int n, i;
+
+        if (worker->conns.empty()) {
+            std::lock_guard<std::mutex> lock(worker->conn_lock);
+            if (worker->stopping && worker->conn_queue.empty()) {
+                break;
+            }
+        }
+        n = epoll_wait(worker->epoll_fd, events, MAX_EPOLL_EVENTS, worker_poll_timeout(worker));
+        if (n < 0 && errno != EINTR) {
+            fprintf(stderr, "FAILURE: epoll_wait failed (errno=%d '%m')\n", errno);
+            worker->ret_val = 1;
+            break;
+        }
+
+        auto busy_start = std::chrono::system_clock::now();
+        for (i = 0; i < n; i++) {
+            if (events[i].data.u64 == WAKEUP_CONN_ID) {
+                worker_adopt_connections(worker);
+                continue;
+            }
+            if (events[i].data.u64 == URING_EVENT_ID) {
+                uint64_t reads;
+
+                if (read(worker->uring_fd, &reads, sizeof reads) < 0 && errno != EAGAIN) {
+                    fprintf(stderr, "FAILURE: read(eventfd) failed (errno=%d '%m')\n", errno);
+                }
+                continue;
+            }
+            if (events[i].data.u64 == COMP_EVENT_ID) {
+                /* Back to busy polling, the CQ is re-armed when it's idle again */
+                rdma_get_completion_event(worker->rdma_dev);
+                worker->cq_armed = 0;
+                worker->poll_idle_since = std::chrono::steady_clock::now();
+                continue;
+            }
+            auto it = worker->conns.find(events[i].data.u64);
+            if (it == worker->conns.end() || it->second->closed) {
+                continue;
+            }
+            struct server_conn *conn = it->second.get();
+
+            if ((events[i].events & EPOLLOUT) && conn_flush_acks(worker, conn)) {
+                conn_close(worker, conn, 1);
+                continue;
+            }
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && conn_read(worker, conn)) {
+                conn_close(worker, conn, conn->completed != worker->usr_par->iters);
+            }
+        }
+
+        worker_submit_pending(worker);
+        if (worker->usr_par->file_root) {
+            if (worker->uring) {
+                worker_reap_file_reads(worker);
+            }
+            worker_issue_file_reads(worker);
+            worker_post_file_chunks(worker);
+        }
+        if (worker->async->in_flight()) {
+            worker_poll_completions(worker);
+        }
+
+        /* Release the connections which are done */
+        for (auto it = worker->conns.begin(); it != worker->conns.end(); ) {
+            struct server_conn *conn = it->second.get();
+
+            if (!conn->closed && conn->completed == worker->usr_par->iters && conn->tx_buf.empty()) {
+                conn_close(worker, conn, 0);
+            }
+            if (conn->closed && !conn->inflight) {
+                it = worker->conns.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        std::chrono::duration<double> busy = std::chrono::system_clock::now() - busy_start;
+        worker->busy_seconds += busy.count();
+    }
+
+    /* Interrupted, report what the clients got so far */
+    for (auto& it : worker->conns) {
+        conn_close(worker, it.second.get(), 0);
+    }
+    worker->file_ready.clear();
+    worker->file_reqs.clear();
+    worker->conns.clear();
+    worker->pending.clear();
+}
+
+static int worker_init(struct server_worker *worker, const struct user_params *usr_par)
+{
+    struct rdma_device_attr dev_attr;
+    struct rdma_device_caps caps;
+    struct epoll_event      ev;
+
+    worker->usr_par = usr_par;
+
+    memset(&dev_attr, 0, sizeof dev_attr);
+    dev_attr.num_dcis             = usr_par->num_dcis;
+    dev_attr.comp_channel         = usr_par->poll_spin_usec >= 0;
+    dev_attr.cq_moderation_count  = usr_par->cq_mod_count;
+    dev_attr.cq_moderation_period = usr_par->cq_mod_period;
+    dev_attr.stripe_size          = usr_par->stripe_size;
+    dev_attr.signal_period        = usr_par->signal_period;
+    dev_attr.max_inline_data      = usr_par->max_inline_data;
+    dev_attr.comp_vector          = worker->id;
+
+    worker->rdma_dev = rdma_open_device_server_ex((struct sockaddr *)&usr_par->hostaddr, &dev_attr);
+    if (!worker->rdma_dev) {
+        return 1;
+    }
+    if (rdma_device_get_caps(worker->rdma_dev, &caps)) {
+        rdma_close_device(worker->rdma_dev);
+        return 1;
+    }
+
+    /* The staging memory next to the NIC, which DMAs it, unless -H already chose a node */
+    if (usr_par->numa_local && caps.numa_node >= 0) {
+        std::string spec = usr_par->mem_spec ? usr_par->mem_spec : "host";
+
+        if (spec.find('@') == std::string::npos && spec.compare(0, 5, "numa:")) {
+            worker->mem = gdr::MemProvider::create(spec + "@" + std::to_string(caps.numa_node));
+        }
+    }
+    if (!worker->id) {
+        printf("NIC on NUMA node %d (%d local CPUs), %d completion vectors, workers %s\n", caps.numa_node,
+               caps.num_local_cpus, caps.num_comp_vectors, usr_par->numa_local ? "bound to its CPUs" : "not bound");
+    }
+
+    /* Registered staging memory on CPU (not on GPU), each request in flight gets a buffer of it */
+    worker->pool.reset(new gdr::StagingPool(worker->rdma_dev, usr_par->pool_mb << 20, gdr::StagingPool::DEFAULT_SLAB_SIZE,
+                                            worker->mem ? *worker->mem : gdr::default_mem_provider()));
+    try {
+        /* The first slab up front, a provider without enough memory (e.g. no hugepages) fails here */
+        gdr::StagingBuffer *staging = worker->pool->acquire(usr_par->size);
+        if (!staging) {
+            /* e.g. a pool smaller than one 1 GB page */
+            throw std::invalid_argument("staging pool of " + std::to_string(usr_par->pool_mb) + " MB can't hold a page of " +
+                                        (worker->mem ? *worker->mem : gdr::default_mem_provider()).name() + " memory");
+        }
+        worker->pool->release(staging);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "FAILURE: %s\n", e.what());
+        worker->pool.reset();
+        rdma_close_device(worker->rdma_dev);
+        return 1;
+    }
+    worker->free_tasks = NULL;
+    for (int i = MAX_INFLIGHT_TASKS - 1; i >= 0; i--) {
+        worker->tasks[i].iov.resize(usr_par->num_sges);
+        worker->tasks[i].next_free = worker->free_tasks;
+        worker->free_tasks = &worker->tasks[i];
+    }
+
+    worker->async.reset(new gdr::AsyncDevice(worker->rdma_dev, MAX_INFLIGHT_TASKS));
+
+    worker->epoll_fd = epoll_create1(0);
+    if (worker->epoll_fd < 0) {
+        fprintf(stderr, "FAILURE: epoll_create1 failed (errno=%d '%m')\n", errno);
+        goto clean_pool;
+    }
+    worker->wakeup_fd = eventfd(0, EFD_NONBLOCK);
+    if (worker->wakeup_fd < 0) {
+        fprintf(stderr, "FAILURE: eventfd failed (errno=%d '%m')\n", errno);
+        goto clean_epoll;
+    }
+    ev.events   = EPOLLIN;
+    ev.data.u64 = WAKEUP_CONN_ID;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wakeup_fd, &ev)) {
+        fprintf(stderr, "FAILURE: epoll_ctl(ADD) failed (errno=%d '%m')\n", errno);
+        goto clean_eventfd;
+    }
+    if (rdma_get_completion_fd(worker->rdma_dev) >= 0) {
+        ev.events   = EPOLLIN;
+        ev.data.u64 = COMP_EVENT_ID;
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, rdma_get_completion_fd(worker->rdma_dev), &ev)) {
+            fprintf(stderr, "FAILURE: epoll_ctl(ADD) of the completion channel failed (errno=%d '%m')\n", errno);
+            goto clean_eventfd;
+        }
+    }
+    if (usr_par->file_mmap_mb >= 0) {
+        struct rdma_device_caps caps;
+
+        if (rdma_device_get_caps(worker->rdma_dev, &caps)) {
+            goto clean_eventfd;
+        }
+        worker->max_map_segment = caps.max_mr_size;
+        if (usr_par->file_mmap_mb && ((uint64_t)usr_par->file_mmap_mb << 20) < caps.max_mr_size) {
+            worker->max_map_segment = (uint64_t)usr_par->file_mmap_mb << 20;
+        }
+    } else if (usr_par->file_root) {
+        worker->uring_fd = eventfd(0, EFD_NONBLOCK);
+        if (worker->uring_fd < 0) {
+            fprintf(stderr, "FAILURE: eventfd failed (errno=%d '%m')\n", errno);
+            goto clean_eventfd;
+        }
+        try {
+            worker->uring.reset(new gdr::Uring(MAX_INFLIGHT_TASKS, MAX_FIXED_BUFFERS));
+            worker->uring->register_eventfd(worker->uring_fd);
+        } catch (const std::system_error& e) {
+            fprintf(stderr, "FAILURE: %s\n", e.what());
+            goto clean_uring;
+        }
+        /* The staging slabs are the destination of the reads, avoid mapping them per read */
+        worker->pool->set_slab_listener([worker](uint32_t slab_index, void *addr, size_t size) {
+            if (worker->fixed_slabs.size() <= slab_index) {
+                worker->fixed_slabs.resize(slab_index + 1);
+            }
+            worker->fixed_slabs[slab_index] = worker->uring->set_fixed_buffer(slab_index, addr, size);
+        });
+        ev.events   = EPOLLIN;
+        ev.data.u64 = URING_EVENT_ID;
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->uring_fd, &ev)) {
+            fprintf(stderr, "FAILURE: epoll_ctl(ADD) of the io_uring eventfd failed (errno=%d '%m')\n", errno);
+            goto clean_uring;
+        }
+    }
+    return 0;
+
+clean_uring:
+    worker->pool->set_slab_listener(nullptr);
+    worker->uring.reset();
+    close(worker->uring_fd);
+
+clean_eventfd:
+    close(worker->wakeup_fd);
+
+clean_epoll:
+    close(worker->epoll_fd);
+
+clean_pool:
+    worker->async.reset();
+    worker->pool.reset();
+    rdma_close_device(worker->rdma_dev);
+    return 1;
+}
+
+static void worker_destroy(struct server_worker *worker)
+{
+    close(worker->wakeup_fd);
+    close(worker->epoll_fd);
+    worker->async.reset();
+    /* Reads in flight target the staging buffers, the ring goes first */
+    worker->uring.reset();
+    if (worker->uring_fd >= 0) {
+        close(worker->uring_fd);
+    }
+    for (auto& it : worker->files) {
+        close(it.second.fd);
+        if (it.second.direct_fd >= 0) {
+            close(it.second.direct_fd);
+        }
+    }
+    worker->mapped_files.clear();
+    worker->pool.reset();
+    rdma_close_device(worker->rdma_dev);
+}
+
+static void worker_wakeup(struct server_worker *worker)
+{
+    uint64_t one = 1;
+
+    if (write(worker->wakeup_fd, &one, sizeof one) != sizeof one) {
+        fprintf(stderr, "FAILURE: write(eventfd) failed (errno=%d '%m')\n", errno);
+    }
+}
+
+/* Steer a new connection to the worker with the least active connections */
+static void steer_connection(std::vector<std::unique_ptr<server_worker>>& workers, int sockfd)
+{
+    struct server_worker *worker = workers[0].get();
+
+    for (auto& w : workers) {
+        if (w->active_conns < worker->active_conns) {
+            worker = w.get();
+        }
+    }
+    DEBUG_LOG_FAST_PATH("Connection %d steered to worker %d\n", sockfd, worker->id);
+    worker->active_conns++;
+    {
+        std::lock_guard<std::mutex> lock(worker->conn_lock);
+        worker->conn_queue.push_back(sockfd);
+    }
+    worker_wakeup(worker);
+}
+
+int main(int argc, char *argv[])
+{
+    struct user_params      usr_par;
+    int                     ret_val = 0;
+    int                     listen_fd;
+    int                     accepted = 0;
+    std::vector<std::unique_ptr<server_worker>> workers;
+    struct sigaction        act;
+    sigset_t                sigint_set;
+
+    srand48(getpid() * time(NULL));
+
+    ret_val = parse_command_line(argc, argv, &usr_par);
+    if (ret_val) {
+        return ret_val;
+    }
+
+    for (int i = 0; i < usr_par.num_workers; i++) {
+        workers.emplace_back(new server_worker());
+        workers.back()->id = i;
+        if (worker_init(workers.back().get(), &usr_par)) {
+            workers.pop_back();
+            ret_val = 1;
+            goto clean_workers;
+        }
+    }
+
+    memset(&act, 0, sizeof act);
+    act.sa_handler = sigint_handler;
+    sigaction(SIGINT, &act, NULL);
+
+    printf("Listening to remote client...\n");
+    listen_fd = open_server_socket(usr_par.port);
+    if (listen_fd < 0) {
+        ret_val = 1;
+        goto clean_workers;
+    }
+
+    /* SIGINT is handled by the acceptor (main) thread only, it interrupts accept() */
+    sigemptyset(&sigint_set);
+    sigaddset(&sigint_set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigint_set, NULL);
+    for (auto& w : workers) {
+        w->thread = std::thread(worker_run, w.get());
+    }
+    pthread_sigmask(SIG_UNBLOCK, &sigint_set, NULL);
+
+    {
+        auto start = std::chrono::system_clock::now();
+
+        /* Without -P the server exits after each worker has served one client */
+        while (keep_running && (usr_par.persistent || accepted < usr_par.num_workers)) {
+            int sockfd = accept(listen_fd, NULL, 0);
+            if (sockfd < 0) {
+                if (errno != EINTR) {
+                    fprintf(stderr, "accept() failed (errno=%d '%m')\n", errno);
+                    ret_val = 1;
+                    break;
+                }
+                continue;
+            }
+            printf("Connection accepted.\n");
+            steer_connection(workers, sockfd);
+            accepted++;
+        }
+        close(listen_fd);
+
+        for (auto& w : workers) {
+            {
+                std::lock_guard<std::mutex> lock(w->conn_lock);
+                w->stopping = 1;
+            }
+            worker_wakeup(w.get());
+            w->thread.join();
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+        unsigned long long total_iters = 0;
+        for (auto& w : workers) {
+            std::string label = "worker " + std::to_string(w->id) + " total: ";
+            print_run_time(label, w->busy_seconds, (unsigned long long)usr_par.size * w->iters, w->iters);
+            if (w->cq_sleeps) {
+                printf("%s%llu sleeps on the completion channel\n", label.c_str(), w->cq_sleeps);
+            }
+            const gdr::StagingPool::Stats& pool_stats = w->pool->stats();
+            printf("%sstaging pool (%s) %lu of %lu bytes registered in %d slabs (%.3f sec), peak in use %lu bytes, %lu waits for a buffer\n",
+                   label.c_str(), (w->mem ? *w->mem : gdr::default_mem_provider()).name().c_str(), pool_stats.reserved_bytes, pool_stats.max_bytes,
+                   pool_stats.num_slabs, pool_stats.reg_seconds, pool_stats.peak_in_use_bytes, (unsigned long)pool_stats.exhausted);
+            if (w->uring) {
+                printf("%s%llu bytes served from files in %llu chunk reads, %zu of %d slabs are io_uring fixed buffers\n",
+                       label.c_str(), w->file_bytes, w->file_chunks,
+                       (size_t)std::count(w->fixed_slabs.begin(), w->fixed_slabs.end(), true), pool_stats.num_slabs);
+            } else if (usr_par.file_root) {
+                printf("%s%llu bytes served from %zu mapped files in %llu zero copy chunks\n",
+                       label.c_str(), w->file_bytes, w->mapped_files.size(), w->mapped_chunks);
+            }
+            total_iters += w->iters;
+            ret_val |= w->ret_val;
+        }
+        print_run_time("aggregate: ", elapsed.count(), (unsigned long long)usr_par.size * total_iters, total_iters);
+    }
+
+clean_workers:
+    for (auto& w : workers) {
+        worker_destroy(w.get());
+    }
+
+    return ret_val;
+}
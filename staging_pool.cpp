@@ -0,0 +1,147 @@
+#include "staging_pool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+
+namespace gdr {
+
+StagingPool::StagingPool(rdma_device* device, size_t max_bytes, size_t slab_size, MemProvider& provider)
+    : device_(device), provider_(provider), slab_size_(slab_size), stats_() {
+    if (!device_ || max_bytes < MIN_CLASS_SIZE) {
+        throw std::invalid_argument("StagingPool requires a device and at least one buffer of memory");
+    }
+    for (uint32_t i = 0; i < NUM_CLASSES; i++) {
+        free_[i] = nullptr;
+    }
+    stats_.max_bytes = max_bytes;
+}
+
+StagingPool::~StagingPool() {
+    for (Slab* slab : slabs_) {
+        destroy_slab(slab);
+    }
+}
+
+uint32_t StagingPool::size_class(size_t size) {
+    if (size > MAX_CLASS_SIZE) {
+        throw std::invalid_argument("StagingPool: buffer size above the largest size class");
+    }
+    uint32_t cls = 0;
+    while ((MIN_CLASS_SIZE << cls) < size) {
+        cls++;
+    }
+    return cls;
+}
+
+/*
+ * Add a slab to the size class, as large as slab_size_ (at least one buffer)
+ * rounded up to the page size of the provider, or what's left of max_bytes
+ * in whole pages.
+ *
+ * returns: false if not even one buffer fits in max_bytes
+ */
+bool StagingPool::grow(uint32_t size_class) {
+    size_t buf_size = MIN_CLASS_SIZE << size_class;
+    size_t page_size = provider_.page_size();
+    size_t left = stats_.reserved_bytes < stats_.max_bytes ? stats_.max_bytes - stats_.reserved_bytes : 0;
+    size_t slab_bytes = std::max(slab_size_, buf_size);
+
+    slab_bytes = (slab_bytes + page_size - 1) / page_size * page_size;
+    if (slab_bytes > left) {
+        slab_bytes = left / page_size * page_size;
+    }
+    /* Both are powers of two: the buffers fill the pages, or the pages the buffers */
+    size_t count = slab_bytes / buf_size;
+    if (!count) {
+        return false;
+    }
+
+    Slab* slab = new Slab();
+    try {
+        slab->mem = provider_.alloc(count * buf_size);
+    } catch (...) {
+        delete slab;
+        throw;
+    }
+    auto reg_start = std::chrono::steady_clock::now();
+    slab->rdma_buff = rdma_buffer_reg(device_, slab->mem.addr, slab->mem.size);
+    if (!slab->rdma_buff) {
+        provider_.free(slab->mem);
+        delete slab;
+        throw std::system_error(EFAULT, std::generic_category(), "StagingPool: slab registration failed");
+    }
+    std::chrono::duration<double> reg_time = std::chrono::steady_clock::now() - reg_start;
+    stats_.reg_seconds += reg_time.count();
+
+    slab->buffers.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        StagingBuffer& buf = slab->buffers[i];
+
+        buf.rdma_buff = rdma_buffer_view(slab->rdma_buff, i * buf_size, buf_size);
+        if (!buf.rdma_buff) {
+            slab->buffers.resize(i);
+            destroy_slab(slab);
+            throw std::system_error(ENOMEM, std::generic_category(), "StagingPool: buffer view allocation failed");
+        }
+        buf.addr = static_cast<uint8_t*>(slab->mem.addr) + i * buf_size;
+        buf.size = buf_size;
+        buf.size_class = size_class;
+        buf.slab_index = slabs_.size();
+    }
+    for (StagingBuffer& buf : slab->buffers) {
+        buf.next_free = free_[size_class];
+        free_[size_class] = &buf;
+    }
+    slabs_.push_back(slab);
+    stats_.reserved_bytes += slab->mem.size;
+    stats_.num_slabs++;
+    if (slab_listener_) {
+        slab_listener_(slabs_.size() - 1, slab->mem.addr, slab->mem.size);
+    }
+    return true;
+}
+
+void StagingPool::set_slab_listener(SlabListener listener) {
+    slab_listener_ = std::move(listener);
+    if (slab_listener_) {
+        for (size_t i = 0; i < slabs_.size(); i++) {
+            slab_listener_(i, slabs_[i]->mem.addr, slabs_[i]->mem.size);
+        }
+    }
+}
+
+void StagingPool::destroy_slab(Slab* slab) {
+    for (StagingBuffer& buf : slab->buffers) {
+        rdma_buffer_dereg(buf.rdma_buff);
+    }
+    rdma_buffer_dereg(slab->rdma_buff);
+    provider_.free(slab->mem);
+    delete slab;
+}
+
+StagingBuffer* StagingPool::acquire(size_t size) {
+    uint32_t cls = size_class(size);
+
+    if (!free_[cls] && !grow(cls)) {
+        stats_.exhausted++;
+        return nullptr;
+    }
+    StagingBuffer* buf = free_[cls];
+    free_[cls] = buf->next_free;
+
+    stats_.acquires++;
+    stats_.in_use_bytes += buf->size;
+    if (stats_.in_use_bytes > stats_.peak_in_use_bytes) {
+        stats_.peak_in_use_bytes = stats_.in_use_bytes;
+    }
+    return buf;
+}
+
+void StagingPool::release(StagingBuffer* buf) {
+    stats_.in_use_bytes -= buf->size;
+    buf->next_free = free_[buf->size_class];
+    free_[buf->size_class] = buf;
+}
+
+} // namespace gdr
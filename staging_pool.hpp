@@ -0,0 +1,105 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+
+#include "gpu_direct_rdma_access.h"
+#include "mem_provider.hpp"
+
+namespace gdr {
+
+/* A staging buffer of the pool: a view of a registered slab */
+struct StagingBuffer {
+    rdma_buffer*    rdma_buff;  /* shares the MR of its slab */
+    void*           addr;
+    size_t          size;       /* of the size class, at least the acquired size */
+    uint32_t        size_class;
+    uint32_t        slab_index; /* of the slab in the pool, in creation order */
+    StagingBuffer*  next_free;
+};
+
+/*
+ * Pool of registered staging buffers in power of two size classes, from
+ * MIN_CLASS_SIZE to MAX_CLASS_SIZE. The memory of a class is allocated in
+ * slabs, each registered once and carved into buffers which are views sharing
+ * its MR, so acquire/release never register memory. Slabs are allocated on
+ * demand from the memory provider until the pool holds max_bytes, they're kept
+ * until the pool is destroyed. A slab is whole pages of the provider, all of
+ * them carved into buffers, so with large pages (e.g. 1 GB) a slab holds more
+ * buffers than slab_size, and the pool can't grow past max_bytes by rounding.
+ *
+ * Not thread safe: each worker thread owns its pool, so acquire/release are
+ * a free list pop/push without locks or atomics.
+ */
+class StagingPool {
+public:
+    static constexpr size_t MIN_CLASS_SIZE = 4096;
+    static constexpr size_t MAX_CLASS_SIZE = 64UL << 20;
+    static constexpr size_t DEFAULT_SLAB_SIZE = 4UL << 20;
+
+    struct Stats {
+        size_t      max_bytes;
+        size_t      reserved_bytes;     /* allocated and registered slabs */
+        double      reg_seconds;        /* spent registering the slabs */
+        size_t      in_use_bytes;
+        size_t      peak_in_use_bytes;
+        uint64_t    acquires;
+        uint64_t    exhausted;          /* acquires failed at max_bytes */
+        int         num_slabs;
+    };
+
+    StagingPool(rdma_device* device, size_t max_bytes, size_t slab_size = DEFAULT_SLAB_SIZE,
+                MemProvider& provider = default_mem_provider());
+    ~StagingPool();
+    StagingPool(const StagingPool&) = delete;
+    StagingPool& operator=(const StagingPool&) = delete;
+
+    /*
+     * Get a buffer of at least size bytes.
+     *
+     * returns: the buffer, or nullptr if the pool has no free buffer of the class
+     * and can't grow within max_bytes. Throws std::invalid_argument for a size
+     * above MAX_CLASS_SIZE and std::system_error if a slab can't be allocated or registered.
+     */
+    StagingBuffer* acquire(size_t size);
+    void release(StagingBuffer* buf);
+
+    /* The size of the buffers acquire(size) returns */
+    static size_t class_size(size_t size) { return MIN_CLASS_SIZE << size_class(size); }
+
+    const Stats& stats() const { return stats_; }
+
+    /*
+     * Call listener(slab_index, addr, size) for each slab, the existing ones
+     * now and then each new slab once it's registered, e.g. to also register
+     * the slabs with an io_uring as fixed buffers.
+     */
+    using SlabListener = std::function<void(uint32_t slab_index, void* addr, size_t size)>;
+    void set_slab_listener(SlabListener listener);
+
+private:
+    struct Slab {
+        MemRegion       mem;
+        rdma_buffer*    rdma_buff;
+        std::vector<StagingBuffer> buffers;
+    };
+
+    static constexpr uint32_t NUM_CLASSES = 15; /* 4 KB << 14 = 64 MB */
+
+    static uint32_t size_class(size_t size);
+    bool grow(uint32_t size_class);
+    void destroy_slab(Slab* slab);
+
+    rdma_device* device_;
+    MemProvider& provider_;
+    size_t slab_size_;
+    StagingBuffer* free_[NUM_CLASSES];
+    std::vector<Slab*> slabs_;
+    SlabListener slab_listener_;
+    Stats stats_;
+};
+
+} // namespace gdr
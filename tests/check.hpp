@@ -0,0 +1,20 @@
+#pragma once
+/*
+ * Minimal checks of the tests: a failed CHECK prints its location and the
+ * test goes on, check_result() is the exit status of main().
+ */
+#include <cstdio>
+
+static int check_failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            check_failures++; \
+        } \
+    } while (0)
+
+static inline int check_result(const char* test) {
+    printf("%s: %s\n", test, check_failures ? "FAILED" : "OK");
+    return check_failures ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Per task cost of the remote buffer description on the Server: the string
+ * parse (sscanf and wire_gid_to_gid(), as rdma_exec_params_from_desc_str()
+ * does it) against rdma_buffer_desc_decode() of the binary description.
+ * CPU only, the descriptions are made from a device without hardware.
+ *
+ * desc_bench [iterations]
+ */
+#include "gpu_direct_rdma_access.cpp"
+
+#include <chrono>
+
+namespace {
+
+/* Descriptions of as many buffers are parsed in turn, as they'd come from the Clients */
+constexpr int NUM_BUFS = 64;
+
+/* Keeps the parsed fields alive, so the loops aren't optimized out */
+volatile uint64_t sink;
+
+double bench_str(char desc_strs[][BUFF_DESC_STRING_LENGTH], long iterations) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (long i = 0; i < iterations; i++) {
+        const char* desc_str = desc_strs[i % NUM_BUFS];
+        unsigned long long addr, size;
+        unsigned long rkey, dctn;
+        uint16_t lid = 0;
+        int is_global = 0;
+        union ibv_gid gid;
+
+        sscanf(desc_str, "%llx:%llx:%lx:%hx:%lx:%d", &addr, &size, &rkey, &lid, &dctn, &is_global);
+        memset(&gid, 0, sizeof(gid));
+        if (is_global) {
+            wire_gid_to_gid(desc_str + BUFF_DESC_STRING_GID_OFFSET, &gid);
+        }
+        sink = addr ^ size ^ rkey ^ lid ^ dctn ^ gid.global.interface_id;
+    }
+    std::chrono::duration<double, std::nano> time = std::chrono::steady_clock::now() - start;
+    return time.count() / iterations;
+}
+
+double bench_desc(const struct rdma_buffer_desc* wire_descs, long iterations) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (long i = 0; i < iterations; i++) {
+        struct rdma_buffer_desc desc;
+
+        if (rdma_buffer_desc_decode(&wire_descs[i % NUM_BUFS], sizeof desc, &desc)) {
+            return 0;
+        }
+        uint64_t interface_id;
+        memcpy(&interface_id, desc.gid + 8, sizeof(interface_id));
+        sink = desc.addr ^ desc.size ^ desc.rkey ^ desc.lid ^ desc.dctn ^ interface_id;
+    }
+    std::chrono::duration<double, std::nano> time = std::chrono::steady_clock::now() - start;
+    return time.count() / iterations;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : 10000000;
+    struct rdma_device device = {};
+    struct ibv_qp qp = {};
+    struct rdma_buffer buf = {};
+    static char desc_strs[NUM_BUFS][BUFF_DESC_STRING_LENGTH];
+    static struct rdma_buffer_desc wire_descs[NUM_BUFS];
+
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    /* A RoCE buffer, the string carries the GID */
+    qp.qp_num = 0x1234;
+    device.qp = &qp;
+    device.lid = 0x56;
+    device.is_global = 1;
+    for (int i = 0; i < 16; i++) {
+        device.gid.raw[i] = static_cast<uint8_t>(0xf0 + i);
+    }
+    buf.rdma_dev = &device;
+    for (int i = 0; i < NUM_BUFS; i++) {
+        buf.buf_addr = reinterpret_cast<void*>(0x7f1234560000ULL + (static_cast<uint64_t>(i) << 32));
+        buf.buf_size = (5ULL << 30) + i;
+        buf.rkey = 0xabcd + i;
+        if (!rdma_buffer_get_desc_str(&buf, desc_strs[i], sizeof desc_strs[i]) ||
+            rdma_buffer_desc_encode(&buf, &wire_descs[i], sizeof wire_descs[i]) != sizeof wire_descs[i]) {
+            fprintf(stderr, "can't describe the buffer\n");
+            return 1;
+        }
+    }
+
+    double str_ns = bench_str(desc_strs, iterations);
+    double desc_ns = bench_desc(wire_descs, iterations);
+    if (!desc_ns) {
+        fprintf(stderr, "rdma_buffer_desc_decode failed\n");
+        return 1;
+    }
+    printf("%ld iterations\n", iterations);
+    printf("  string (%3zu bytes): sscanf + wire_gid_to_gid  %8.1f ns/desc\n", sizeof desc_strs[0], str_ns);
+    printf("  binary (%3zu bytes): rdma_buffer_desc_decode   %8.1f ns/desc  (%.1fx)\n", sizeof wire_descs[0], desc_ns,
+           str_ns / desc_ns);
+    return 0;
+}
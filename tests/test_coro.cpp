@@ -0,0 +1,169 @@
+/*
+ * gdr::Executor end to end over gdr::SoftDevice: a client and a server handler
+ * talk over a socketpair, the server moves the data with RDMA Writes of the
+ * software stand-in and acks each request.
+ */
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "rdma_coro.hpp"
+#include "check.hpp"
+
+namespace {
+
+constexpr uint32_t BUF_SIZE = 64 * 1024;
+constexpr uint32_t NUM_REQUESTS = 16;
+
+struct Request {
+    uint32_t id;
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct Ack {
+    uint32_t id;
+    int32_t  status;
+};
+
+using Exec = gdr::Executor<gdr::SoftDevice>;
+
+/* Serve the requests until the client closes its end */
+gdr::Task server(Exec& exec, int fd, uint8_t* local, uint8_t* remote) {
+    for (;;) {
+        Request req;
+
+        co_await exec.readable(fd);
+        ssize_t n = recv(fd, &req, sizeof req, MSG_WAITALL);
+        if (n == 0) {
+            break;
+        }
+        if (n != sizeof req) {
+            throw std::runtime_error("server: short request");
+        }
+        rdma_completion_status status = co_await exec.write(remote, req.offset, local + req.offset, req.length);
+        Ack ack = { req.id, static_cast<int32_t>(status) };
+        if (send(fd, &ack, sizeof ack, 0) != sizeof ack) {
+            throw std::runtime_error("server: ack send failed");
+        }
+    }
+    exec.forget_fd(fd);
+}
+
+/* Send the requests one at a time, the acks are recorded in order */
+gdr::Task client(Exec& exec, int fd, std::vector<Ack>& acks) {
+    for (uint32_t i = 0; i < NUM_REQUESTS; i++) {
+        Request req = { i, i * (BUF_SIZE / NUM_REQUESTS), BUF_SIZE / NUM_REQUESTS };
+        Ack ack;
+
+        if (send(fd, &req, sizeof req, 0) != sizeof req) {
+            throw std::runtime_error("client: request send failed");
+        }
+        co_await exec.readable(fd);
+        if (recv(fd, &ack, sizeof ack, MSG_WAITALL) != sizeof ack) {
+            throw std::runtime_error("client: short ack");
+        }
+        acks.push_back(ack);
+    }
+    exec.forget_fd(fd);
+    shutdown(fd, SHUT_WR);
+}
+
+void test_requests(int fail_count) {
+    gdr::SoftDevice device;
+    Exec exec(device);
+    std::vector<uint8_t> local(BUF_SIZE), remote(BUF_SIZE, 0);
+    std::vector<Ack> acks;
+    int fds[2];
+
+    for (size_t i = 0; i < BUF_SIZE; i++) {
+        local[i] = static_cast<uint8_t>(i * 7);
+    }
+    CHECK(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    device.fail_next(fail_count);
+    exec.spawn(server(exec, fds[0], local.data(), remote.data()));
+    exec.spawn(client(exec, fds[1], acks));
+    exec.run();
+
+    CHECK(exec.live_tasks() == 0);
+    CHECK(device.in_flight() == 0);
+    CHECK(acks.size() == NUM_REQUESTS);
+    for (uint32_t i = 0; i < acks.size(); i++) {
+        size_t offset = i * (BUF_SIZE / NUM_REQUESTS);
+        bool failed = static_cast<int>(i) < fail_count;
+
+        CHECK(acks[i].id == i);
+        CHECK(acks[i].status == (failed ? RDMA_STATUS_ERR_LAST : RDMA_STATUS_SUCCESS));
+        /* a failed transfer leaves the remote range untouched */
+        CHECK(!memcmp(remote.data() + offset, failed ? std::vector<uint8_t>(BUF_SIZE / NUM_REQUESTS).data() : local.data() + offset,
+                      BUF_SIZE / NUM_REQUESTS));
+    }
+    close(fds[0]);
+    close(fds[1]);
+}
+
+gdr::Task transfers(Exec& exec, uint8_t* local, uint8_t* remote, int count, bool throw_after, int& done) {
+    for (int i = 0; i < count; i++) {
+        co_await exec.write(remote, i, local + i, 1);
+        done++;
+    }
+    if (throw_after) {
+        throw std::runtime_error("handler failed");
+    }
+}
+
+void test_exception() {
+    gdr::SoftDevice device;
+    Exec exec(device);
+    uint8_t local[4] = { 1, 2, 3, 4 }, remote[4] = {};
+    int failing_done = 0, other_done = 0;
+    bool thrown = false;
+
+    exec.spawn(transfers(exec, local, remote, 1, true, failing_done));
+    exec.spawn(transfers(exec, local, remote, 4, false, other_done));
+    try {
+        exec.run();
+    } catch (const std::runtime_error& e) {
+        thrown = !strcmp(e.what(), "handler failed");
+    }
+    CHECK(thrown);
+    CHECK(failing_done == 1);
+    CHECK(exec.live_tasks() == 1);
+
+    /* The other task was left suspended, run() continues it */
+    exec.run();
+    CHECK(other_done == 4);
+    CHECK(exec.live_tasks() == 0);
+    CHECK(!memcmp(local, remote, sizeof local));
+}
+
+gdr::Task stuck() {
+    co_await std::suspend_always{};
+}
+
+void test_stuck() {
+    gdr::SoftDevice device;
+    Exec exec(device);
+    bool thrown = false;
+
+    exec.spawn(stuck());
+    try {
+        exec.run();
+    } catch (const std::logic_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(exec.live_tasks() == 1); /* destroyed with the executor */
+}
+
+} // namespace
+
+int main() {
+    test_requests(0);
+    test_requests(3);
+    test_exception();
+    test_stuck();
+    return check_result("test_coro");
+}
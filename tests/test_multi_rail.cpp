@@ -0,0 +1,275 @@
+/*
+ * gdr::MultiRail failover over stand-in rails: the library API is replaced by
+ * devices which complete their tasks in order on rdma_poll_completions(),
+ * with a transport error once their rail is broken. No data is moved.
+ */
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <infiniband/verbs.h>
+
+#include "multi_rail.hpp"
+#include "check.hpp"
+
+namespace {
+
+constexpr int NUM_RAILS = 4;
+constexpr size_t BUF_SIZE = 64 << 20;
+
+struct Task {
+    uint64_t    wr_id;
+    size_t      offset;
+    size_t      length;
+};
+
+} // namespace
+
+/* The stand-in library */
+struct rdma_device {
+    int                 rail;
+    bool                broken;
+    int                 submit_error;   /* returned by the submits, EAGAIN for a full send queue */
+    std::vector<Task>   posted;
+    std::vector<Task>   done;
+};
+
+struct rdma_buffer {
+    int rail;
+};
+
+struct rdma_remote_buffer {
+    rdma_device* device;
+};
+
+namespace {
+
+rdma_device* devices[NUM_RAILS];
+int num_devices;
+
+} // namespace
+
+extern "C" {
+
+struct rdma_device* rdma_open_device_server_ex(struct sockaddr*, const struct rdma_device_attr*) {
+    rdma_device* device = new rdma_device();
+
+    device->rail = num_devices;
+    devices[num_devices++] = device;
+    return device;
+}
+
+struct rdma_device* rdma_open_device_client(struct sockaddr*) {
+    return nullptr;
+}
+
+void rdma_close_device(struct rdma_device* device) {
+    delete device;
+}
+
+struct rdma_buffer* rdma_buffer_reg(struct rdma_device* device, void*, size_t) {
+    return new rdma_buffer{ device->rail };
+}
+
+void rdma_buffer_dereg(struct rdma_buffer* rdma_buff) {
+    delete rdma_buff;
+}
+
+int rdma_buffer_desc_encode(struct rdma_buffer*, void* desc, size_t) {
+    struct rdma_buffer_desc wire_desc;
+
+    memset(&wire_desc, 0, sizeof wire_desc);
+    wire_desc.size = BUF_SIZE;
+    memcpy(desc, &wire_desc, sizeof wire_desc);
+    return sizeof wire_desc;
+}
+
+int rdma_buffer_desc_decode(const void* wire_desc, size_t, struct rdma_buffer_desc* desc) {
+    memcpy(desc, wire_desc, sizeof *desc);
+    return 0;
+}
+
+struct rdma_remote_buffer* rdma_remote_buffer_import(struct rdma_device* device, const struct rdma_buffer_desc*) {
+    return new rdma_remote_buffer{ device };
+}
+
+void rdma_remote_buffer_release(struct rdma_remote_buffer* rbuf) {
+    delete rbuf;
+}
+
+int rdma_reset_device(struct rdma_device* device) {
+    device->posted.clear();
+    return 0;
+}
+
+int rdma_submit_task(struct rdma_task_attr*) {
+    return EINVAL;
+}
+
+int rdma_submit_task_handle(struct rdma_task_attr* attr, struct rdma_remote_buffer* rbuf, size_t offset, size_t length) {
+    if (rbuf->device->submit_error) {
+        return rbuf->device->submit_error;
+    }
+    rbuf->device->posted.push_back({ attr->wr_id, offset, length });
+    return 0;
+}
+
+int rdma_submit_tasks(struct rdma_task_attr*, int num_tasks, int* results) {
+    for (int i = 0; i < num_tasks; i++) {
+        results[i] = EINVAL;
+    }
+    return 0;
+}
+
+int rdma_poll_completions(struct rdma_device* device, struct rdma_completion_event* event, uint32_t num_entries) {
+    uint32_t n = 0;
+
+    while (!device->posted.empty() && n < num_entries) {
+        event[n].wr_id = device->posted.front().wr_id;
+        event[n].status = device->broken ? static_cast<rdma_completion_status>(IBV_WC_RETRY_EXC_ERR) : RDMA_STATUS_SUCCESS;
+        if (!device->broken) {
+            device->done.push_back(device->posted.front());
+        }
+        device->posted.erase(device->posted.begin());
+        n++;
+    }
+    return n;
+}
+
+} // extern "C"
+
+namespace {
+
+struct Result {
+    int                     calls;
+    rdma_completion_status  status;
+    uint64_t                user_data;
+};
+
+void on_transfer(void* ctx, uint64_t user_data, rdma_completion_status status) {
+    Result* result = static_cast<Result*>(ctx);
+
+    result->calls++;
+    result->status = status;
+    result->user_data = user_data;
+}
+
+/* The chunks done on the rails cover [0, length) of the transfer once */
+bool covered_once(size_t length) {
+    std::vector<Task> done;
+    size_t offset = 0;
+
+    for (rdma_device* device : devices) {
+        done.insert(done.end(), device->done.begin(), device->done.end());
+        device->done.clear();
+    }
+    std::sort(done.begin(), done.end(), [](const Task& a, const Task& b) { return a.offset < b.offset; });
+    for (const Task& task : done) {
+        if (task.offset != offset) {
+            return false;
+        }
+        offset += task.length;
+    }
+    return offset == length;
+}
+
+void test_failover() {
+    std::vector<sockaddr_storage> addrs(NUM_RAILS);
+    gdr::MultiRail multi_rail(addrs, gdr::MultiRail::Side::SERVER);
+    static char buf[BUF_SIZE];
+    auto local = multi_rail.reg(buf, sizeof buf);
+    std::vector<uint8_t> desc = multi_rail.encode_desc(*local);
+    auto remote = multi_rail.import(desc.data(), desc.size());
+    Result result = {};
+
+    /* A chunk per rail, rail 2 breaks before its chunk completes */
+    multi_rail.submit(*local, 0, *remote, 0, 16 << 20, 0, on_transfer, &result, 1);
+    for (rdma_device* device : devices) {
+        CHECK(device->posted.size() == 1);
+    }
+    devices[2]->broken = true;
+    multi_rail.poll();
+    CHECK(result.calls == 0);
+    CHECK(!multi_rail.rail_up(2) && multi_rail.rails_up() == NUM_RAILS - 1);
+    CHECK(devices[3]->posted.size() == 1); /* the chunk of rail 2, again */
+    while (multi_rail.in_flight()) {
+        multi_rail.poll();
+    }
+    CHECK(result.calls == 1);
+    CHECK(result.status == RDMA_STATUS_SUCCESS && result.user_data == 1);
+    CHECK(covered_once(16 << 20));
+
+    /* The transfers go on over the rails left */
+    multi_rail.submit(*local, 0, *remote, 0, 16 << 20, 0, on_transfer, &result, 2);
+    CHECK(devices[2]->posted.empty());
+    while (multi_rail.in_flight()) {
+        multi_rail.poll();
+    }
+    CHECK(result.calls == 2 && result.status == RDMA_STATUS_SUCCESS);
+    CHECK(covered_once(16 << 20));
+
+    /* Recovered, rail 2 takes chunks again */
+    devices[2]->broken = false;
+    CHECK(multi_rail.recover_rail(2) && multi_rail.rails_up() == NUM_RAILS);
+
+    /* A full send queue: the chunk is posted again once there's room */
+    devices[1]->submit_error = EAGAIN;
+    multi_rail.submit(*local, 0, *remote, 0, 16 << 20, 0, on_transfer, &result, 4);
+    CHECK(devices[1]->posted.empty());
+    devices[1]->submit_error = 0;
+    while (multi_rail.in_flight()) {
+        multi_rail.poll();
+    }
+    CHECK(result.calls == 3 && result.status == RDMA_STATUS_SUCCESS && result.user_data == 4);
+    CHECK(covered_once(16 << 20));
+
+    /* Any other submit error fails the chunk, the transfer is reported once */
+    devices[1]->submit_error = EINVAL;
+    multi_rail.submit(*local, 0, *remote, 0, 16 << 20, 0, on_transfer, &result, 5);
+    while (multi_rail.in_flight()) {
+        multi_rail.poll();
+    }
+    CHECK(result.calls == 4 && result.status != RDMA_STATUS_SUCCESS && result.user_data == 5);
+    CHECK(multi_rail.rails_up() == NUM_RAILS);
+    covered_once(0);
+
+    /* No chunk posted: the submit throws, no callback */
+    bool thrown = false;
+    for (rdma_device* device : devices) {
+        device->submit_error = EINVAL;
+    }
+    try {
+        multi_rail.submit(*local, 0, *remote, 0, 16 << 20, 0, on_transfer, &result, 6);
+    } catch (const std::system_error& e) {
+        thrown = e.code().value() == EINVAL;
+    }
+    CHECK(thrown && !multi_rail.in_flight());
+    multi_rail.poll();
+    CHECK(result.calls == 4);
+    for (rdma_device* device : devices) {
+        device->submit_error = 0;
+    }
+
+    /* Every rail breaks: the transfer fails, reported once */
+    for (rdma_device* device : devices) {
+        device->broken = true;
+    }
+    multi_rail.submit(*local, 0, *remote, 0, 16 << 20, 0, on_transfer, &result, 7);
+    CHECK(devices[2]->posted.size() == 1);
+    while (multi_rail.in_flight()) {
+        multi_rail.poll();
+    }
+    CHECK(result.calls == 5);
+    CHECK(result.status != RDMA_STATUS_SUCCESS && result.user_data == 7);
+    CHECK(multi_rail.rails_up() == 0);
+    for (int i = 0; i < 4; i++) {
+        multi_rail.poll();
+    }
+    CHECK(result.calls == 5);
+}
+
+} // namespace
+
+int main() {
+    test_failover();
+    return check_result("test_multi_rail");
+}
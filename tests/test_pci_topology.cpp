@@ -0,0 +1,144 @@
+/*
+ * gdr::PciTopology over a fake sysfs tree of two sockets: a GPU and NICs
+ * under one PCIe switch, on another root port, on another host bridge of the
+ * socket and on the other socket, and devices of unknown NUMA node.
+ */
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "pci_topology.hpp"
+#include "check.hpp"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+using PathType = gdr::PciTopology::PathType;
+
+constexpr const char* BRIDGE = "0x060400";
+constexpr const char* GPU = "0x030200";
+constexpr const char* NIC = "0x020700";
+
+void write_attr(const fs::path& path, const std::string& value) {
+    std::ofstream(path) << value << "\n";
+}
+
+/* devices/<path> of a PCI device, linked from bus/pci/devices by its BDF */
+void add_device(const fs::path& root, const std::string& path, const char* class_code, int numa_node,
+                double speed_gts, int width, double max_speed_gts, int max_width) {
+    fs::path dir = root / "devices" / path;
+    char speed[32];
+
+    fs::create_directories(dir);
+    write_attr(dir / "class", class_code);
+    write_attr(dir / "vendor", "0x15b3");
+    write_attr(dir / "numa_node", std::to_string(numa_node));
+    snprintf(speed, sizeof speed, "%.1f GT/s PCIe", speed_gts);
+    write_attr(dir / "current_link_speed", speed);
+    write_attr(dir / "current_link_width", std::to_string(width));
+    snprintf(speed, sizeof speed, "%.1f GT/s PCIe", max_speed_gts);
+    write_attr(dir / "max_link_speed", speed);
+    write_attr(dir / "max_link_width", std::to_string(max_width));
+    fs::create_directories(root / "bus/pci/devices");
+    fs::create_symlink(fs::path("../../../devices") / path, root / "bus/pci/devices" / dir.filename());
+}
+
+/* class/infiniband/<name>, with the net device of the PCI device */
+void add_nic(const fs::path& root, const std::string& name, const std::string& path, const std::string& netdev) {
+    fs::path dir = root / "class/infiniband" / name;
+
+    fs::create_directories(dir);
+    fs::create_symlink(root / "devices" / path, dir / "device");
+    fs::create_directories(root / "devices" / path / "net" / netdev);
+}
+
+void make_tree(const fs::path& root) {
+    /* Socket 1: a switch below root port b0:02.0, the GPU and a NIC trained at half speed under it */
+    add_device(root, "pci0000:b0/0000:b0:02.0", BRIDGE, 1, 16.0, 16, 16.0, 16);
+    add_device(root, "pci0000:b0/0000:b0:02.0/0000:b1:00.0", BRIDGE, 1, 16.0, 16, 16.0, 16);
+    add_device(root, "pci0000:b0/0000:b0:02.0/0000:b1:00.0/0000:b2:04.0", BRIDGE, 1, 16.0, 16, 16.0, 16);
+    add_device(root, "pci0000:b0/0000:b0:02.0/0000:b1:00.0/0000:b2:08.0", BRIDGE, 1, 16.0, 16, 16.0, 16);
+    add_device(root, "pci0000:b0/0000:b0:02.0/0000:b1:00.0/0000:b2:04.0/0000:b7:00.0", GPU, 1, 16.0, 16, 16.0, 16);
+    add_device(root, "pci0000:b0/0000:b0:02.0/0000:b1:00.0/0000:b2:08.0/0000:b5:00.0", NIC, 1, 8.0, 16, 16.0, 16);
+    /* a NIC on another root port of the host bridge, another on another host bridge of the socket */
+    add_device(root, "pci0000:b0/0000:b0:03.0", BRIDGE, 1, 16.0, 16, 16.0, 16);
+    add_device(root, "pci0000:b0/0000:b0:03.0/0000:c1:00.0", NIC, 1, 16.0, 16, 16.0, 16);
+    add_device(root, "pci0000:d0/0000:d0:01.0", BRIDGE, 1, 16.0, 16, 16.0, 16);
+    add_device(root, "pci0000:d0/0000:d0:01.0/0000:d1:00.0", NIC, 1, 16.0, 16, 16.0, 16);
+    /* Socket 0 */
+    add_device(root, "pci0000:00/0000:00:01.0", BRIDGE, 0, 16.0, 16, 16.0, 16);
+    add_device(root, "pci0000:00/0000:00:01.0/0000:01:00.0", NIC, 0, 16.0, 16, 16.0, 16);
+    /* Two host bridges of no known node */
+    add_device(root, "pci0000:e0/0000:e0:01.0", BRIDGE, -1, 16.0, 16, 16.0, 16);
+    add_device(root, "pci0000:e0/0000:e0:01.0/0000:e1:00.0", GPU, -1, 16.0, 16, 16.0, 16);
+    add_device(root, "pci0000:f0/0000:f0:01.0", BRIDGE, -1, 16.0, 16, 16.0, 16);
+    add_device(root, "pci0000:f0/0000:f0:01.0/0000:f1:00.0", NIC, -1, 16.0, 16, 16.0, 16);
+
+    add_nic(root, "mlx5_0", "pci0000:b0/0000:b0:02.0/0000:b1:00.0/0000:b2:08.0/0000:b5:00.0", "ens1");
+    add_nic(root, "mlx5_1", "pci0000:b0/0000:b0:03.0/0000:c1:00.0", "ens2");
+    add_nic(root, "mlx5_2", "pci0000:00/0000:00:01.0/0000:01:00.0", "ens3");
+    add_nic(root, "mlx5_3", "pci0000:d0/0000:d0:01.0/0000:d1:00.0", "ens4");
+    add_nic(root, "mlx5_4", "pci0000:f0/0000:f0:01.0/0000:f1:00.0", "ens5");
+}
+
+void test_paths(const fs::path& root) {
+    gdr::PciTopology topology(root.string());
+
+    CHECK(topology.gpus().size() == 2 && topology.gpus()[0] == "0000:b7:00.0");
+    CHECK(topology.nics().size() == 5 && topology.nics()[0].netdevs.size() == 1 && topology.nics()[0].netdevs[0] == "ens1");
+
+    auto nics = topology.nearest_nics("B7:00.0");
+    CHECK(nics.size() == 5);
+    if (nics.size() != 5) {
+        return;
+    }
+    /* up to the switch: the downstream ports and the devices, the NIC link is the bottleneck */
+    CHECK(nics[0].first->name == "mlx5_0" && nics[0].second.type == PathType::SWITCH);
+    CHECK(nics[0].second.hops == 4 && nics[0].second.degraded && nics[0].second.bottleneck == "0000:b5:00.0");
+    CHECK(nics[0].second.bandwidth_gbps > 126 && nics[0].second.bandwidth_gbps < 127);
+    CHECK(nics[1].first->name == "mlx5_1" && nics[1].second.type == PathType::HOST_BRIDGE);
+    CHECK(nics[1].second.hops == 6 && !nics[1].second.degraded);
+    CHECK(nics[2].first->name == "mlx5_3" && nics[2].second.type == PathType::NODE);
+    CHECK(nics[3].second.type == PathType::SYSTEM && nics[4].second.type == PathType::SYSTEM);
+
+    /* A node which isn't known is not taken for the same node */
+    CHECK(topology.path("e1:00.0", "f1:00.0").type == PathType::SYSTEM);
+    CHECK(topology.path("b7:00.0", "f1:00.0").type == PathType::SYSTEM);
+
+    bool thrown = false;
+    try {
+        topology.nearest_nics("ff:00.0");
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+void test_no_tree(const fs::path& root) {
+    bool thrown = false;
+
+    try {
+        gdr::PciTopology topology((root / "none").string());
+    } catch (const std::system_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+} // namespace
+
+int main() {
+    char dir[] = "/tmp/test_pci_topology.XXXXXX";
+
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    make_tree(dir);
+    test_paths(dir);
+    test_no_tree(dir);
+    fs::remove_all(dir);
+    return check_result("test_pci_topology");
+}
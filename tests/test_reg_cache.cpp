@@ -0,0 +1,148 @@
+/*
+ * The registration cache over stand-in MRs: the registration and ibv_dereg_mr()
+ * are replaced by the test, which counts the MRs alive. The library is
+ * included to reach the cache, no RDMA hardware is used.
+ */
+#include "gpu_direct_rdma_access.cpp"
+
+#include "check.hpp"
+
+namespace {
+
+int live_mrs;
+bool fail_reg;
+
+} // namespace
+
+extern "C" {
+
+/* ibv_reg_mr() calls it unless the access flags are known at compile time */
+struct ibv_mr* ibv_reg_mr_iova2(struct ibv_pd* pd, void* addr, size_t length, uint64_t, unsigned int) {
+    if (fail_reg) {
+        return nullptr;
+    }
+    struct ibv_mr* mr = new ibv_mr();
+    mr->pd = pd;
+    mr->addr = addr;
+    mr->length = length;
+    live_mrs++;
+    return mr;
+}
+
+struct ibv_mr* (ibv_reg_mr)(struct ibv_pd* pd, void* addr, size_t length, int access) {
+    return ibv_reg_mr_iova2(pd, addr, length, reinterpret_cast<uintptr_t>(addr), access);
+}
+
+int ibv_dereg_mr(struct ibv_mr* mr) {
+    delete mr;
+    live_mrs--;
+    return 0;
+}
+
+} // extern "C"
+
+namespace {
+
+constexpr uintptr_t BASE = 0x10000000;
+constexpr size_t PAGE = 4096;
+
+void* at(size_t offset) {
+    return reinterpret_cast<void*>(BASE + offset);
+}
+
+struct Fixture {
+    rdma_device device = {};
+
+    Fixture(size_t max_pinned_bytes) {
+        device.pd = reinterpret_cast<ibv_pd*>(0x1000);
+        CHECK(!rdma_reg_cache_enable(&device, max_pinned_bytes));
+    }
+
+    ~Fixture() {
+        reg_cache_destroy(device.reg_cache);
+        CHECK(!live_mrs);
+    }
+
+    rdma_reg_cache* cache() { return device.reg_cache; }
+};
+
+bool covers(const rdma_reg_region* region, size_t offset, size_t length) {
+    return region && region->start == BASE + offset && region->end == BASE + offset + length &&
+           region->mr->addr == at(offset) && region->mr->length == length;
+}
+
+/* A miss next to a cached region registers their union, which replaces it */
+void test_adjacent() {
+    Fixture f(0);
+
+    rdma_reg_region* a = reg_cache_get(&f.device, at(0), PAGE);
+    CHECK(covers(a, 0, PAGE));
+    rdma_reg_region* b = reg_cache_get(&f.device, at(PAGE), PAGE);
+    CHECK(covers(b, 0, 2 * PAGE));
+    /* a is in use, it's no longer cached and goes with its user */
+    CHECK(!a->cached && live_mrs == 2 && f.cache()->pinned_bytes == 3 * PAGE);
+    reg_cache_put(f.cache(), a);
+    CHECK(live_mrs == 1 && f.cache()->num_regions == 1 && f.cache()->pinned_bytes == 2 * PAGE);
+
+    /* Both buffers are served by the union now */
+    CHECK(reg_cache_get(&f.device, at(0), PAGE) == b);
+    CHECK(reg_cache_get(&f.device, at(PAGE / 2), PAGE) == b);
+    CHECK(f.cache()->hits == 2 && f.cache()->misses == 2);
+    reg_cache_put(f.cache(), b);
+    reg_cache_put(f.cache(), b);
+    reg_cache_put(f.cache(), b);
+
+    /* A region far from the others is registered alone */
+    rdma_reg_region* c = reg_cache_get(&f.device, at(16 * PAGE), PAGE);
+    CHECK(covers(c, 16 * PAGE, PAGE) && f.cache()->num_regions == 2);
+    reg_cache_put(f.cache(), c);
+}
+
+/* The idle regions a miss overlaps are deregistered at once */
+void test_overlapping() {
+    Fixture f(0);
+
+    reg_cache_put(f.cache(), reg_cache_get(&f.device, at(0), 2 * PAGE));
+    reg_cache_put(f.cache(), reg_cache_get(&f.device, at(3 * PAGE), PAGE));
+    CHECK(live_mrs == 2);
+
+    rdma_reg_region* region = reg_cache_get(&f.device, at(PAGE), 2 * PAGE);
+    CHECK(covers(region, 0, 4 * PAGE));
+    CHECK(live_mrs == 1 && f.cache()->num_regions == 1 && f.cache()->pinned_bytes == 4 * PAGE);
+    CHECK(f.cache()->lru_head == nullptr);
+    reg_cache_put(f.cache(), region);
+    CHECK(f.cache()->lru_head == region && f.cache()->lru_tail == region);
+}
+
+/* A failed registration leaves the cached regions as they were */
+void test_failure() {
+    Fixture f(4 * PAGE);
+
+    rdma_reg_region* region = reg_cache_get(&f.device, at(0), 2 * PAGE);
+    reg_cache_put(f.cache(), region);
+
+    fail_reg = true;
+    CHECK(!reg_cache_get(&f.device, at(2 * PAGE), PAGE));
+    fail_reg = false;
+    CHECK(reg_cache_get(&f.device, at(0), 2 * PAGE) == region);
+
+    /* The union doesn't fit in the limit while the region is in use */
+    CHECK(!reg_cache_get(&f.device, at(2 * PAGE), 3 * PAGE));
+    CHECK(region->cached && live_mrs == 1);
+    reg_cache_put(f.cache(), region);
+    CHECK(f.cache()->lru_head == region);
+
+    /* Idle, the region is replaced by the union, which fits then */
+    rdma_reg_region* merged = reg_cache_get(&f.device, at(PAGE), 3 * PAGE);
+    CHECK(covers(merged, 0, 4 * PAGE) && live_mrs == 1 && !f.cache()->evictions);
+    reg_cache_put(f.cache(), merged);
+}
+
+} // namespace
+
+int main() {
+    test_adjacent();
+    test_overlapping();
+    test_failure();
+    return check_result("test_reg_cache");
+}
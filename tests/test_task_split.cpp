@@ -0,0 +1,424 @@
+/*
+ * Splitting of the tasks of more than 4 GB into WRs, on a device whose DCIs
+ * are software stand-ins recording the WRs built by rdma_task_build_wrs().
+ * The library is included to reach its internals, no RDMA hardware is used.
+ */
+#include "gpu_direct_rdma_access.cpp"
+
+#include <algorithm>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+constexpr uint64_t GB = 1ULL << 30;
+constexpr int NUM_DCIS = 2;
+constexpr uint32_t LID = 0x12;
+constexpr uint32_t DCTN = 0x3456;
+constexpr uint32_t RKEY = 0x789a;
+
+struct Wr {
+    int         dci;
+    uint64_t    wr_id;
+    unsigned    flags;
+    uint32_t    rkey;
+    uint64_t    remote_addr;
+    uint64_t    length;
+    int         num_sge;
+    uint32_t    dctn;
+};
+
+std::vector<Wr> wrs;
+Wr cur;
+
+/* The stand-in QP, a WR is recorded when its sges are set */
+void wr_rdma_rw(struct ibv_qp_ex* qp, uint32_t rkey, uint64_t remote_addr) {
+    cur = {};
+    cur.dci = DCI_WR_ID_DCI(qp->wr_id);
+    cur.wr_id = qp->wr_id;
+    cur.flags = qp->wr_flags;
+    cur.rkey = rkey;
+    cur.remote_addr = remote_addr;
+}
+
+void wr_set_sge_list(struct ibv_qp_ex*, size_t num_sge, const struct ibv_sge* sg_list) {
+    for (size_t i = 0; i < num_sge; i++) {
+        CHECK(sg_list[i].length);
+        cur.length += sg_list[i].length;
+    }
+    cur.num_sge = static_cast<int>(num_sge);
+}
+
+void wr_set_sge(struct ibv_qp_ex*, uint32_t, uint64_t, uint32_t length) {
+    cur.length = length;
+    cur.num_sge = 1;
+}
+
+void wr_set_dc_addr(struct mlx5dv_qp_ex*, struct ibv_ah*, uint32_t remote_dctn, uint64_t) {
+    cur.dctn = remote_dctn;
+    wrs.push_back(cur);
+}
+
+/* The doorbell of this QP fails, if set */
+struct ibv_qp_ex* failing_qpex;
+
+void wr_start(struct ibv_qp_ex*) {}
+int wr_complete(struct ibv_qp_ex* qp) { return qp == failing_qpex ? EIO : 0; }
+void wr_abort(struct ibv_qp_ex*) {}
+
+struct Fixture {
+    rdma_device     device = {};
+    rdma_dci        dcis[NUM_DCIS] = {};
+    ibv_qp_ex       qpex[NUM_DCIS] = {};
+    mlx5dv_qp_ex    mqpex[NUM_DCIS] = {};
+    ibv_qp          qp = {};
+    ibv_mr          mr = {};
+    ibv_ah*         ah = reinterpret_cast<ibv_ah*>(0x1000);
+    rdma_buffer     local = {};
+    rdma_remote_buffer remote = {};
+
+    Fixture() {
+        device.dcis = dcis;
+        device.num_dcis = NUM_DCIS;
+        device.max_msg_sz = GB;
+        device.max_send_sge = 4;
+        device.ib_port = 1;
+        device.lid = LID;
+        device.qp = &qp;
+        device.stripes = static_cast<rdma_stripe*>(calloc(MAX_STRIPES, sizeof(rdma_stripe)));
+        rdma_reset_stripes(&device);
+        kh_init_inplace(kh_ib_ah, &device.ah_hash);
+        qp.qp_num = DCTN;
+        for (int i = 0; i < NUM_DCIS; i++) {
+            qpex[i].wr_rdma_write = wr_rdma_rw;
+            qpex[i].wr_rdma_read = wr_rdma_rw;
+            qpex[i].wr_set_sge_list = wr_set_sge_list;
+            qpex[i].wr_set_sge = wr_set_sge;
+            qpex[i].wr_start = wr_start;
+            qpex[i].wr_complete = wr_complete;
+            qpex[i].wr_abort = wr_abort;
+            mqpex[i].wr_set_dc_addr = wr_set_dc_addr;
+            dcis[i].qpex = &qpex[i];
+            dcis[i].mqpex = &mqpex[i];
+            dcis[i].index = i;
+            dcis[i].qp_available_wr = SEND_Q_DEPTH;
+        }
+
+        /* The AH of the Client is cached, so it's never created */
+        ibv_ah_attr ah_attr = {};
+        int ret;
+        ah_attr.dlid = LID;
+        ah_attr.port_num = 1;
+        khiter_t iter = kh_put(kh_ib_ah, &device.ah_hash, ah_attr, &ret);
+        kh_value(&device.ah_hash, iter) = ah;
+
+        /* Nothing is accessed at these addresses */
+        mr.lkey = 7;
+        local.buf_addr = reinterpret_cast<void*>(0x100000000ULL);
+        local.buf_size = 64 * GB;
+        local.mr = &mr;
+        local.rkey = RKEY;
+        local.rdma_dev = &device;
+        remote.addr = 0x7000000000ULL;
+        remote.size = 64 * GB;
+        remote.rkey = RKEY;
+        remote.dctn = DCTN;
+        remote.ah = ah;
+        remote.dci = &dcis[0];
+        wrs.clear();
+    }
+
+    ~Fixture() {
+        kh_destroy_inplace(kh_ib_ah, &device.ah_hash);
+        free(device.stripes);
+    }
+
+    /* Complete the recorded WRs, returns the number of reported tasks */
+    int complete_all(uint64_t& wr_id) {
+        rdma_completion_event event;
+        int reported = 0;
+
+        for (const Wr& wr : wrs) {
+            if (wr.flags & IBV_SEND_SIGNALED) {
+                int n = rdma_complete_wr(&device, &dcis[wr.dci], DCI_WR_ID_IDX(wr.wr_id), RDMA_STATUS_SUCCESS, &event);
+                if (n) {
+                    CHECK(event.status == RDMA_STATUS_SUCCESS);
+                    wr_id = event.wr_id;
+                }
+                reported += n;
+            }
+        }
+        for (int i = 0; i < NUM_DCIS; i++) {
+            CHECK(dcis[i].qp_available_wr == SEND_Q_DEPTH);
+        }
+        return reported;
+    }
+};
+
+/* The WRs cover the remote range in order, each within max_msg_sz; returns their total */
+uint64_t check_contiguous(uint64_t remote_addr, uint64_t max_msg_sz) {
+    uint64_t total = 0;
+
+    for (const Wr& wr : wrs) {
+        CHECK(wr.length && wr.length <= max_msg_sz);
+        CHECK(wr.remote_addr == remote_addr + total);
+        CHECK(wr.rkey == RKEY);
+        CHECK(wr.dctn == DCTN);
+        total += wr.length;
+    }
+    return total;
+}
+
+/* Only the last WR of a task is signaled, the task is reported once */
+void check_single_task(Fixture& f, uint64_t wr_id) {
+    uint64_t reported_wr_id = 0;
+
+    CHECK(!wrs.empty());
+    for (size_t i = 0; i < wrs.size(); i++) {
+        CHECK(wrs[i].dci == wrs[0].dci);
+        CHECK(!(wrs[i].flags & IBV_SEND_SIGNALED) == (i + 1 < wrs.size()));
+    }
+    CHECK(f.dcis[wrs[0].dci].qp_available_wr == SEND_Q_DEPTH - static_cast<int>(wrs.size()));
+    CHECK(f.complete_all(reported_wr_id) == 1);
+    CHECK(reported_wr_id == wr_id);
+}
+
+void test_single_buffer() {
+    Fixture f;
+    rdma_task_attr attr = {};
+    uint64_t length = 5 * GB + 123;
+
+    attr.local_buf_rdma = &f.local;
+    attr.wr_id = 1;
+    CHECK(!rdma_submit_task_handle(&attr, &f.remote, 0, length));
+    CHECK(wrs.size() == 6);
+    CHECK(check_contiguous(f.remote.addr, GB) == length);
+    CHECK(wrs.back().length == 123);
+    check_single_task(f, 1);
+}
+
+void test_gather_list() {
+    Fixture f;
+    rdma_task_attr attr = {};
+    /* sges larger than max_msg_sz are split over several WRs */
+    struct iovec iov[3] = {
+        { reinterpret_cast<void*>(0x100000000ULL), 3 * GB },
+        { reinterpret_cast<void*>(0x1c0000000ULL), 1 },
+        { reinterpret_cast<void*>(0x1c0000001ULL), 5 * GB / 2 },
+    };
+    uint64_t length = 3 * GB + 1 + 5 * GB / 2;
+    rdma_exec_params exec_params = {};
+
+    attr.local_buf_rdma = &f.local;
+    attr.local_buf_iovec = iov;
+    attr.local_buf_iovcnt = 3;
+    attr.wr_id = 2;
+
+    rdma_exec_params_set_local(&exec_params, &attr);
+    exec_params.rem_buf_size = length;
+    CHECK(rdma_task_num_wrs(&exec_params) == 6);
+
+    CHECK(!rdma_submit_task_handle(&attr, &f.remote, 0, length));
+    CHECK(wrs.size() == 6);
+    CHECK(check_contiguous(f.remote.addr, GB) == length);
+    /* the 1 byte sge goes with the head of the next one */
+    CHECK(wrs[3].num_sge == 2);
+    check_single_task(f, 2);
+}
+
+void test_desc_str() {
+    Fixture f;
+    rdma_task_attr attr = {};
+    char desc_str[128];
+    char size_field[17];
+
+    f.local.buf_size = 5 * GB + 123;
+    CHECK(rdma_buffer_get_desc_str(&f.local, desc_str, sizeof desc_str) == static_cast<int>(BUFF_DESC_STRING_LENGTH));
+    /* addr:size:..., the size is 16 hex digits */
+    snprintf(size_field, sizeof size_field, "%016llx", static_cast<unsigned long long>(f.local.buf_size));
+    CHECK(!strncmp(desc_str + 17, size_field, 16) && desc_str[33] == ':');
+
+    attr.remote_buf_desc_str = desc_str;
+    attr.remote_buf_desc_length = sizeof desc_str;
+    attr.remote_buf_offset = GB / 2;
+    attr.local_buf_rdma = &f.local;
+    attr.wr_id = 3;
+    CHECK(!rdma_submit_task(&attr));
+    CHECK(check_contiguous(0x100000000ULL + GB / 2, GB) == f.local.buf_size - GB / 2);
+    check_single_task(f, 3);
+}
+
+void test_striped() {
+    Fixture f;
+    rdma_task_attr attr = {};
+    uint64_t reported_wr_id = 0;
+
+    attr.local_buf_rdma = &f.local;
+    attr.flags = RDMA_TASK_ATTR_STRIPE;
+
+    /* 10 chunks of stripe_size, round robin from the DCI of the Client */
+    f.device.stripe_size = 64 << 20;
+    attr.wr_id = 4;
+    CHECK(!rdma_submit_task_handle(&attr, &f.remote, 0, 10 * f.device.stripe_size));
+    CHECK(wrs.size() == 10);
+    CHECK(check_contiguous(f.remote.addr, GB) == 10 * f.device.stripe_size);
+    for (size_t i = 0; i < wrs.size(); i++) {
+        CHECK(wrs[i].length == f.device.stripe_size);
+        CHECK(wrs[i].dci == static_cast<int>(i % NUM_DCIS));
+        CHECK(wrs[i].flags & IBV_SEND_SIGNALED);
+    }
+    CHECK(f.complete_all(reported_wr_id) == 1);
+    CHECK(reported_wr_id == 4);
+
+    /* Beyond MAX_STRIPE_WRS_PER_DCI chunks per DCI the chunks grow, up to max_msg_sz */
+    uint64_t length = 40 * GB + 5;
+    uint64_t num_chunks = (length + GB - 1) / GB;
+    uint64_t chunk_size = (length + num_chunks - 1) / num_chunks;
+
+    wrs.clear();
+    attr.wr_id = 5;
+    CHECK(!rdma_submit_task_handle(&attr, &f.remote, 0, length));
+    CHECK(wrs.size() == num_chunks);
+    CHECK(check_contiguous(f.remote.addr, GB) == length);
+    for (size_t i = 0; i + 1 < wrs.size(); i++) {
+        CHECK(wrs[i].length == chunk_size);
+    }
+    CHECK(f.complete_all(reported_wr_id) == 1);
+    CHECK(reported_wr_id == 5);
+
+    /* A local buffer shorter than the remote range: the stripes end with it */
+    struct iovec iov = { reinterpret_cast<void*>(0x100000000ULL), 3 * f.device.stripe_size };
+
+    wrs.clear();
+    attr.local_buf_iovec = &iov;
+    attr.local_buf_iovcnt = 1;
+    attr.wr_id = 6;
+    CHECK(!rdma_submit_task_handle(&attr, &f.remote, 0, 10 * f.device.stripe_size));
+    CHECK(wrs.size() == 3);
+    CHECK(check_contiguous(f.remote.addr, GB) == iov.iov_len);
+    CHECK(f.complete_all(reported_wr_id) == 1);
+    CHECK(reported_wr_id == 6);
+}
+
+/* Striped and streamed tasks of a batch are posted in order between the others */
+void test_batch() {
+    Fixture f;
+    rdma_remote_buffer remote_dci1 = f.remote;
+    rdma_task_attr attrs[4] = {};
+    /* 4 sges a WR, more WRs than the send queue holds */
+    std::vector<struct iovec> iov(4 * (SEND_Q_DEPTH + 60), { reinterpret_cast<void*>(0x100000000ULL), 1 });
+    int results[4] = { -1, -1, -1, -1 };
+
+    f.device.stripe_size = 64 << 20;
+    remote_dci1.dci = &f.dcis[1];
+    for (int i = 0; i < 4; i++) {
+        attrs[i].local_buf_rdma = &f.local;
+        attrs[i].remote_buf = &f.remote;
+        attrs[i].remote_buf_length = 4096;
+        attrs[i].wr_id = 10 + i;
+    }
+    attrs[1].flags = RDMA_TASK_ATTR_STRIPE;
+    attrs[1].remote_buf_length = 10 * f.device.stripe_size;
+    attrs[2].local_buf_iovec = iov.data();
+    attrs[2].local_buf_iovcnt = static_cast<int>(iov.size());
+    attrs[2].remote_buf_length = iov.size();
+    /* the DCI of the streamed task takes no other task until it's all posted */
+    attrs[3].remote_buf = &remote_dci1;
+
+    CHECK(rdma_submit_tasks(attrs, 4, results) == 4);
+    CHECK(!results[0] && !results[1] && !results[2] && !results[3]);
+    CHECK(wrs.size() > 12);
+    CHECK(wrs[0].dci == 0 && wrs[0].length == 4096);
+    for (size_t i = 1; i <= 10; i++) {
+        CHECK(wrs[i].length == f.device.stripe_size && wrs[i].dci == static_cast<int>((i - 1) % NUM_DCIS));
+    }
+    CHECK(f.dcis[0].stream);
+    for (size_t i = 11; i + 1 < wrs.size(); i++) {
+        CHECK(wrs[i].dci == 0 && wrs[i].remote_addr == f.remote.addr + 4 * (i - 11));
+    }
+    CHECK(wrs.back().dci == 1 && wrs.back().length == 4096 && (wrs.back().flags & IBV_SEND_SIGNALED));
+
+    /* A further task to the streaming DCI ends the batch */
+    CHECK(rdma_submit_tasks(attrs, 2, results) == 0);
+    CHECK(results[0] == EAGAIN && results[1] == ECANCELED);
+    CHECK(rdma_submit_task(&attrs[0]) == EAGAIN);
+}
+
+/* The tasks of a DCI whose doorbell fails are dropped, the others are posted */
+void test_batch_doorbell() {
+    Fixture f;
+    rdma_remote_buffer remote_dci1 = f.remote;
+    rdma_task_attr attrs[3] = {};
+    int results[3];
+    uint64_t reported_wr_id = 0;
+
+    remote_dci1.dci = &f.dcis[1];
+    for (int i = 0; i < 3; i++) {
+        attrs[i].local_buf_rdma = &f.local;
+        attrs[i].remote_buf = i == 1 ? &remote_dci1 : &f.remote;
+        attrs[i].remote_buf_length = 4096;
+        attrs[i].wr_id = 20 + i;
+    }
+    failing_qpex = &f.qpex[0];
+    CHECK(rdma_submit_tasks(attrs, 3, results) == 1);
+    failing_qpex = nullptr;
+    CHECK(results[0] == EIO && !results[1] && results[2] == EIO);
+    CHECK(f.dcis[0].qp_available_wr == SEND_Q_DEPTH && f.dcis[0].app_wr_id_idx == 0);
+
+    /* Only the task of DCI 1 is reported */
+    wrs.erase(std::remove_if(wrs.begin(), wrs.end(), [](const Wr& wr) { return wr.dci == 0; }), wrs.end());
+    CHECK(f.complete_all(reported_wr_id) == 1);
+    CHECK(reported_wr_id == 21);
+}
+
+/* A full send queue is reported as EAGAIN, nothing is posted */
+void test_send_queue_full() {
+    Fixture f;
+    rdma_task_attr attr = {};
+
+    attr.local_buf_rdma = &f.local;
+    f.dcis[0].qp_available_wr = 1;
+    CHECK(rdma_submit_task_handle(&attr, &f.remote, 0, 2 * GB) == EAGAIN);
+    f.device.stripe_size = 64 << 20;
+    attr.flags = RDMA_TASK_ATTR_STRIPE;
+    f.dcis[1].qp_available_wr = 1;
+    CHECK(rdma_submit_task_handle(&attr, &f.remote, 0, 10 * f.device.stripe_size) == EAGAIN);
+    CHECK(wrs.empty());
+    CHECK(f.dcis[0].app_wr_id_idx == 0 && f.dcis[1].app_wr_id_idx == 0);
+}
+
+void test_remote_range() {
+    Fixture f;
+    rdma_task_attr attr = {};
+
+    attr.local_buf_rdma = &f.local;
+    CHECK(rdma_submit_task_handle(&attr, &f.remote, f.remote.size + 1, 0) == EINVAL);
+    CHECK(rdma_submit_task_handle(&attr, &f.remote, GB, f.remote.size - GB + 1) == EINVAL);
+    attr.remote_buf = &f.remote;
+    attr.remote_buf_offset = f.remote.size - 1;
+    attr.remote_buf_length = 2;
+    CHECK(rdma_submit_task(&attr) == EINVAL);
+
+    /* Without a gather list, the local buffer must hold the remote range */
+    f.local.buf_size = GB;
+    CHECK(rdma_submit_task_handle(&attr, &f.remote, 0, GB + 1) == EINVAL);
+    attr.remote_buf_offset = 0;
+    attr.remote_buf_length = GB + 1;
+    CHECK(rdma_submit_tasks(&attr, 1, nullptr) == 0);
+    CHECK(wrs.empty());
+}
+
+} // namespace
+
+int main() {
+    test_single_buffer();
+    test_gather_list();
+    test_desc_str();
+    test_striped();
+    test_batch();
+    test_batch_doorbell();
+    test_send_queue_full();
+    test_remote_range();
+    return check_result("test_task_split");
+}
@@ -0,0 +1,157 @@
+#include "uring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace gdr {
+
+namespace {
+
+int io_uring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int ring_fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+void* map_ring(int ring_fd, size_t size, off_t offset) {
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+    if (ptr == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(), "io_uring ring mmap failed");
+    }
+    return ptr;
+}
+
+} // namespace
+
+Uring::Uring(unsigned entries, unsigned max_fixed_buffers)
+    : max_fixed_buffers_(max_fixed_buffers), fixed_buffers_(false), sq_ring_(nullptr), cq_ring_(nullptr),
+      sqes_(nullptr), to_submit_(0), in_flight_(0) {
+    io_uring_params params;
+
+    memset(&params, 0, sizeof params);
+    ring_fd_ = io_uring_setup(entries, &params);
+    if (ring_fd_ < 0) {
+        throw std::system_error(errno, std::generic_category(), "io_uring_setup failed");
+    }
+
+    try {
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+        sq_ring_ = map_ring(ring_fd_, sq_ring_size_, IORING_OFF_SQ_RING);
+        cq_ring_ = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ring_ : map_ring(ring_fd_, cq_ring_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(map_ring(ring_fd_, sqes_size_, IORING_OFF_SQES));
+    } catch (...) {
+        if (sq_ring_) {
+            munmap(sq_ring_, sq_ring_size_);
+        }
+        if (cq_ring_ && cq_ring_ != sq_ring_) {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        close(ring_fd_);
+        throw;
+    }
+
+    uint8_t* sq = static_cast<uint8_t*>(sq_ring_);
+    uint8_t* cq = static_cast<uint8_t*>(cq_ring_);
+    sq_head_  = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_  = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head_  = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_  = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_  = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_     = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    sq_entries_ = params.sq_entries;
+
+    if (max_fixed_buffers_) {
+        io_uring_rsrc_register reg;
+
+        memset(&reg, 0, sizeof reg);
+        reg.nr = max_fixed_buffers_;
+        reg.flags = IORING_RSRC_REGISTER_SPARSE;
+        fixed_buffers_ = !io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS2, &reg, sizeof reg);
+    }
+}
+
+Uring::~Uring() {
+    munmap(sqes_, sqes_size_);
+    if (cq_ring_ != sq_ring_) {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    munmap(sq_ring_, sq_ring_size_);
+    close(ring_fd_);
+}
+
+void Uring::register_eventfd(int efd) {
+    if (io_uring_register(ring_fd_, IORING_REGISTER_EVENTFD, &efd, 1)) {
+        throw std::system_error(errno, std::generic_category(), "io_uring eventfd registration failed");
+    }
+}
+
+bool Uring::set_fixed_buffer(unsigned index, void* addr, size_t length) {
+    struct iovec iov = { addr, length };
+    io_uring_rsrc_update2 update;
+
+    if (!fixed_buffers_ || index >= max_fixed_buffers_) {
+        return false;
+    }
+    memset(&update, 0, sizeof update);
+    update.offset = index;
+    update.data = reinterpret_cast<uintptr_t>(&iov);
+    update.nr = 1;
+    return io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS_UPDATE, &update, sizeof update) == 1;
+}
+
+bool Uring::prep_read(int fd, void* buf, unsigned length, uint64_t offset, int buf_index, uint64_t user_data) {
+    unsigned tail = *sq_tail_;
+
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        return false;
+    }
+    unsigned index = tail & *sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = buf_index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(buf);
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->buf_index = buf_index >= 0 ? buf_index : 0;
+    sqe->user_data = user_data;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    to_submit_++;
+    return true;
+}
+
+void Uring::submit() {
+    while (to_submit_) {
+        int ret = io_uring_enter(ring_fd_, to_submit_, 0, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "io_uring_enter failed");
+        }
+        to_submit_ -= ret;
+        in_flight_ += ret;
+    }
+}
+
+} // namespace gdr
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <system_error>
+#include <linux/io_uring.h>
+
+namespace gdr {
+
+/*
+ * Minimal io_uring of file reads, on the raw system calls (no liburing).
+ * Reads may target fixed buffers, registered once in a sparse table, which
+ * saves the kernel mapping the user pages on every O_DIRECT read.
+ *
+ * Not thread safe, one ring per worker thread.
+ */
+class Uring {
+public:
+    /* Throws std::system_error if the ring can't be created */
+    Uring(unsigned entries, unsigned max_fixed_buffers);
+    ~Uring();
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    /* Signal efd (an eventfd) on the completions */
+    void register_eventfd(int efd);
+
+    /*
+     * Install [addr, addr + length) as the fixed buffer index.
+     *
+     * returns: false if fixed buffers aren't supported (or index is out of the
+     * table), reads of the buffer then go without it
+     */
+    bool set_fixed_buffer(unsigned index, void* addr, size_t length);
+
+    /*
+     * Queue a read of length bytes at offset of fd into buf, from the fixed
+     * buffer buf_index if it was installed (-1 - not a fixed buffer).
+     *
+     * returns: false if the submission queue is full
+     */
+    bool prep_read(int fd, void* buf, unsigned length, uint64_t offset, int buf_index, uint64_t user_data);
+
+    /* Submit the queued reads, throws std::system_error on failure */
+    void submit();
+
+    /*
+     * Reap the available completions, cb(user_data, res) with res the number
+     * of bytes read or -errno.
+     *
+     * returns: the number of reaped completions
+     */
+    template <typename Callback>
+    unsigned reap(Callback&& cb) {
+        unsigned head = *cq_head_;
+        unsigned reaped = 0;
+
+        while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+            uint64_t user_data = cqe.user_data;
+            int32_t res = cqe.res;
+
+            head++;
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            in_flight_--;
+            reaped++;
+            cb(user_data, res);
+        }
+        return reaped;
+    }
+
+    unsigned in_flight() const { return in_flight_; }
+
+private:
+    int ring_fd_;
+    unsigned max_fixed_buffers_;
+    bool fixed_buffers_;
+    void* sq_ring_;
+    size_t sq_ring_size_;
+    void* cq_ring_;
+    size_t cq_ring_size_;
+    io_uring_sqe* sqes_;
+    size_t sqes_size_;
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned* cq_mask_;
+    io_uring_cqe* cqes_;
+    unsigned sq_entries_;
+    unsigned to_submit_;
+    unsigned in_flight_;
+};
+
+} // namespace gdr
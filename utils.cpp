@@ -35,12 +35,20 @@ bool get_addr(const std::string& dst, sockaddr& addr) {
 void print_run_time(const std::chrono::system_clock::time_point& start, unsigned long size, int iters) {
     auto end = std::chrono::system_clock::now();
     std::chrono::duration<double> elapsed_seconds = end - start;
-    double usec = std::chrono::duration_cast<std::chrono::microseconds>(elapsed_seconds).count();
-    long long bytes = static_cast<long long>(size) * iters;
 
-    std::cout << bytes << " bytes in " << elapsed_seconds.count() << " seconds = " 
+    print_run_time("", elapsed_seconds.count(), static_cast<unsigned long long>(size) * iters, iters);
+}
+
+void print_run_time(const std::string& label, double seconds, unsigned long long bytes, unsigned long long iters) {
+    double usec = seconds * 1e6;
+
+    if (!iters || usec <= 0) {
+        std::cout << label << "no iterations completed\n";
+        return;
+    }
+    std::cout << label << bytes << " bytes in " << seconds << " seconds = " 
               << (bytes * 8. / usec) << " Mbit/sec\n";
-    std::cout << iters << " iters in " << elapsed_seconds.count() << " seconds = " 
+    std::cout << label << iters << " iters in " << seconds << " seconds = " 
               << (usec / iters) << " usec/iter\n";
 }
 
@@ -37,3 +37,9 @@ bool get_addr(const std::string& dst, sockaddr& addr);
  * returns: 0 on success or 1 on error
  */
 void print_run_time(const std::chrono::system_clock::time_point& start, unsigned long size, int iters);
+
+/*
+ * Print throughput and latency of "iters" iterations moving "bytes" bytes
+ * in "seconds", each line prefixed with "label" (e.g. a worker id).
+ */
+void print_run_time(const std::string& label, double seconds, unsigned long long bytes, unsigned long long iters);